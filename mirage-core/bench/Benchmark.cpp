@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sodium.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../engines/encryption/PolymorphicEncryptionEngine.h"
+#include "../utils/corpus/CorpusGenerator.h"
+#include "../utils/crypto/XorTransform.h"
+#include "../utils/math/LatticeNoise.h"
+
+// End-to-end file benchmark that sweeps the engine configuration and reports JSON for regression tracking.
+// Usage: mirage_bench [--sizes 1M,16M] [--profiles random,text,sparse] [--chunks 4K,64K,1M] [--threads 1,0]
+//                     [--security paranoid,balanced,throughput] [--layers none,xor,lattice,all]
+//                     [--modes mapped,pipelined] [--iterations 5] [--dir DIRECTORY] [--output FILE]
+// Every configuration runs in its own child process, so its peak RSS is not inherited from earlier ones.
+// --security picks the rekey interval, padding and noise of a security profile; --layers overrides its stages.
+
+namespace {
+    struct BenchOptions {
+        std::vector<uint64_t> sizes{1 << 20, 16 << 20};
+        std::vector<std::string> profiles{"random"};
+        std::vector<size_t> chunks{4096, 64 * 1024, 1024 * 1024};
+        std::vector<size_t> threads{1, 0};
+        std::vector<std::string> security{"paranoid", "balanced"};
+        std::vector<std::string> layers{"none", "all"};
+        std::vector<std::string> modes{"mapped"};
+        size_t iterations = 5;
+        std::filesystem::path directory = std::filesystem::temp_directory_path();
+        std::string output;
+    };
+
+    struct BenchConfig {
+        uint64_t fileSize;
+        std::string profile;
+        size_t chunkSize;
+        size_t threadCount;
+        std::string security;
+        std::string layers;
+        std::string mode;
+    };
+
+    std::vector<std::string> splitList(const std::string &list) {
+        std::vector<std::string> items;
+        std::stringstream stream(list);
+        for (std::string item; std::getline(stream, item, ',');) {
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+        }
+        if (items.empty()) {
+            throw std::invalid_argument("Empty list: " + list);
+        }
+        return items;
+    }
+
+    // Parses a size with an optional K, M or G suffix.
+    uint64_t parseSize(const std::string &text) {
+        size_t end;
+        const uint64_t value = std::stoull(text, &end);
+        const std::string suffix = text.substr(end);
+        if (suffix.empty()) {
+            return value;
+        }
+        if (suffix == "K") {
+            return value << 10;
+        }
+        if (suffix == "M") {
+            return value << 20;
+        }
+        if (suffix == "G") {
+            return value << 30;
+        }
+        throw std::invalid_argument("Invalid size: " + text);
+    }
+
+    template<typename T>
+    std::vector<T> parseSizes(const std::string &list) {
+        std::vector<T> values;
+        for (const std::string &item: splitList(list)) {
+            values.push_back(static_cast<T>(parseSize(item)));
+        }
+        return values;
+    }
+
+    std::vector<std::string> parseChoices(const std::string &list, const std::vector<std::string> &allowed) {
+        std::vector<std::string> values = splitList(list);
+        for (const std::string &value: values) {
+            if (std::find(allowed.begin(), allowed.end(), value) == allowed.end()) {
+                throw std::invalid_argument("Invalid choice: " + value);
+            }
+        }
+        return values;
+    }
+
+    BenchOptions parseOptions(const int argc, char **argv) {
+        BenchOptions options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string flag = argv[i];
+            if (i + 1 == argc) {
+                throw std::invalid_argument("Missing value for " + flag);
+            }
+            const std::string value = argv[++i];
+            if (flag == "--sizes") {
+                options.sizes = parseSizes<uint64_t>(value);
+            } else if (flag == "--profiles") {
+                options.profiles = parseChoices(value, {"random", "text", "sparse"});
+            } else if (flag == "--chunks") {
+                options.chunks = parseSizes<size_t>(value);
+            } else if (flag == "--threads") {
+                options.threads = parseSizes<size_t>(value);
+            } else if (flag == "--security") {
+                options.security = parseChoices(value, {"paranoid", "balanced", "throughput"});
+            } else if (flag == "--layers") {
+                options.layers = parseChoices(value, {"none", "xor", "lattice", "all"});
+            } else if (flag == "--modes") {
+                options.modes = parseChoices(value, {"mapped", "pipelined"});
+            } else if (flag == "--iterations") {
+                options.iterations = std::max<size_t>(1, std::stoul(value));
+            } else if (flag == "--dir") {
+                options.directory = value;
+            } else if (flag == "--output") {
+                options.output = value;
+            } else {
+                throw std::invalid_argument("Unknown option: " + flag);
+            }
+        }
+        return options;
+    }
+
+    bool sameContents(const std::filesystem::path &first, const std::filesystem::path &second) {
+        std::ifstream a(first, std::ios::binary), b(second, std::ios::binary);
+        std::vector<char> blockA(1 << 20), blockB(1 << 20);
+        while (a && b) {
+            a.read(blockA.data(), static_cast<std::streamsize>(blockA.size()));
+            b.read(blockB.data(), static_cast<std::streamsize>(blockB.size()));
+            if (a.gcount() != b.gcount() || std::memcmp(blockA.data(), blockB.data(), a.gcount()) != 0) {
+                return false;
+            }
+        }
+        return a.eof() && b.eof();
+    }
+
+    // Nearest-rank percentile of sorted samples.
+    double percentile(const std::vector<double> &sorted, const double rank) {
+        const size_t index = static_cast<size_t>(rank / 100.0 * static_cast<double>(sorted.size()) + 0.999999);
+        return sorted[std::clamp<size_t>(index, 1, sorted.size()) - 1];
+    }
+
+    std::string timingJson(std::vector<double> milliseconds, const uint64_t bytes) {
+        std::sort(milliseconds.begin(), milliseconds.end());
+        const double median = percentile(milliseconds, 50);
+        std::ostringstream json;
+        json << "{\"mbPerSecond\": " << static_cast<double>(bytes) / (1024.0 * 1024.0) / (median / 1000.0)
+                << ", \"latencyMs\": {\"p50\": " << median << ", \"p95\": " << percentile(milliseconds, 95)
+                << ", \"p99\": " << percentile(milliseconds, 99) << ", \"max\": " << milliseconds.back() << "}}";
+        return json.str();
+    }
+
+    uint64_t peakRssBytes() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+
+    // Runs one configuration and returns its JSON object.
+    std::string runConfig(const BenchConfig &config, const BenchOptions &options,
+                          const std::filesystem::path &input) {
+        const std::filesystem::path encrypted = input.string() + ".enc";
+        const std::filesystem::path decrypted = input.string() + ".dec";
+
+        engines::encryption::EngineOptions engineOptions;
+        engineOptions.chunkSize = config.chunkSize;
+        engineOptions.threadCount = config.threadCount;
+        engineOptions.profile = engines::encryption::SecurityProfile::fromName(config.security.c_str());
+        engineOptions.profile.xorLayer = config.layers == "xor" || config.layers == "all";
+        engineOptions.profile.latticeNoise = config.layers == "lattice" || config.layers == "all";
+        engineOptions.pipelined = config.mode == "pipelined";
+
+        std::vector<double> encryptTimes, decryptTimes;
+        uint64_t encryptedSize;
+        {
+            const engines::encryption::PolymorphicEncryptionEngine engine(engineOptions);
+            for (size_t i = 0; i < options.iterations; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                engine.encryptFile(input.string(), encrypted.string());
+                auto end = std::chrono::steady_clock::now();
+                encryptTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+                start = std::chrono::steady_clock::now();
+                engine.decryptFile(encrypted.string(), decrypted.string());
+                end = std::chrono::steady_clock::now();
+                decryptTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            }
+            encryptedSize = std::filesystem::file_size(encrypted);
+        }
+
+        if (!sameContents(input, decrypted)) {
+            throw std::runtime_error("Decrypted file differs from the input");
+        }
+        std::filesystem::remove(encrypted);
+        std::filesystem::remove(decrypted);
+
+        std::ostringstream json;
+        json << "{\"fileSize\": " << config.fileSize << ", \"profile\": \"" << config.profile
+                << "\", \"chunkSize\": " << config.chunkSize
+                << ", \"threadCount\": " << config.threadCount << ", \"security\": \"" << config.security
+                << "\", \"rekeyBytes\": " << engineOptions.profile.rekeyBytes << ", \"layers\": \"" << config.layers
+                << "\", \"mode\": \"" << config.mode << "\", \"iterations\": " << options.iterations
+                << ", \"encrypt\": " << timingJson(encryptTimes, config.fileSize)
+                << ", \"decrypt\": " << timingJson(decryptTimes, config.fileSize)
+                << ", \"expansion\": " << static_cast<double>(encryptedSize) / static_cast<double>(
+                    std::max<uint64_t>(config.fileSize, 1))
+                << ", \"peakRssBytes\": " << peakRssBytes() << "}";
+        return json.str();
+    }
+
+    // Runs a configuration in a child process and returns its JSON object, or throws with the child's error.
+    std::string runIsolated(const BenchConfig &config, const BenchOptions &options,
+                            const std::filesystem::path &input) {
+        int channel[2];
+        if (pipe(channel) != 0) {
+            throw std::runtime_error("Failed to create a pipe");
+        }
+        std::cout.flush();
+        const pid_t child = fork();
+        if (child < 0) {
+            throw std::runtime_error("Failed to fork");
+        }
+        if (child == 0) {
+            close(channel[0]);
+            int status = 0;
+            std::string message;
+            try {
+                message = runConfig(config, options, input);
+            } catch (const std::exception &e) {
+                message = e.what();
+                status = 1;
+            }
+            const ssize_t ignored = write(channel[1], message.data(), message.size());
+            static_cast<void>(ignored);
+            close(channel[1]);
+            _exit(status);
+        }
+
+        close(channel[1]);
+        std::string message;
+        char buffer[4096];
+        for (ssize_t length; (length = read(channel[0], buffer, sizeof(buffer))) > 0;) {
+            message.append(buffer, static_cast<size_t>(length));
+        }
+        close(channel[0]);
+        int status;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw std::runtime_error("Configuration failed: " + (message.empty() ? "child crashed" : message));
+        }
+        return message;
+    }
+}
+
+int main(const int argc, char **argv) {
+    if (sodium_init() == -1) {
+        std::cerr << "Error: Failed to initialize libsodium" << std::endl;
+        return 1;
+    }
+
+    try {
+        const BenchOptions options = parseOptions(argc, argv);
+        std::ofstream file;
+        if (!options.output.empty()) {
+            file.open(options.output, std::ios::trunc);
+            if (!file) {
+                throw std::runtime_error("Failed to open output file: " + options.output);
+            }
+        }
+        std::ostream &report = options.output.empty() ? std::cout : file;
+
+        report << "{\n  \"host\": {\"hardwareConcurrency\": " << std::thread::hardware_concurrency()
+                << ", \"xorKernel\": \""
+                << utils::crypto::XorTransform::kernelName(utils::crypto::XorTransform::selectedKernel())
+                << "\", \"latticeKernel\": \"" << utils::math::LatticeNoise::kernelName() << "\"},\n"
+                << "  \"results\": [";
+
+        bool first = true;
+        for (const uint64_t size: options.sizes) {
+            for (const std::string &profile: options.profiles) {
+                const std::filesystem::path input = options.directory / ("mirage_bench_" + std::to_string(getpid()) +
+                                                                          "_" + profile + "_" + std::to_string(size));
+                {
+                    // Generated in the parent and released before forking, so children start single-threaded.
+                    const utils::corpus::CorpusGenerator generator(
+                        utils::corpus::CorpusOptions{.profile = utils::corpus::CorpusGenerator::parseProfile(profile)});
+                    generator.writeFile(input.string(), size);
+                }
+                for (const size_t chunk: options.chunks) {
+                    for (const size_t threads: options.threads) {
+                        for (const std::string &security: options.security) {
+                            for (const std::string &layers: options.layers) {
+                                for (const std::string &mode: options.modes) {
+                                    const BenchConfig config{size, profile, chunk, threads, security, layers, mode};
+                                    report << (first ? "\n    " : ",\n    ") << runIsolated(config, options, input);
+                                    report.flush();
+                                    first = false;
+                                }
+                            }
+                        }
+                    }
+                }
+                std::filesystem::remove(input);
+            }
+        }
+        report << "\n  ]\n}" << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sodium.h>
+#include <string>
+#include <vector>
+
+#include "../engines/encryption/PolymorphicEncryptionEngine.h"
+#include "../utils/corpus/CorpusGenerator.h"
+#include "../utils/crypto/CipherSuite.h"
+#include "../utils/crypto/NoiseGenerator.h"
+#include "../utils/crypto/XorTransform.h"
+#include "../utils/math/LatticeNoise.h"
+#include "../utils/math/LorenzAttractor.h"
+#include "../utils/math/RNG.h"
+
+// Micro-benchmarks for individual hot-path components.
+// Usage: mirage_microbench [suite...]   (runs every suite when none is given)
+// The kernels are checked against their references by tests/KernelTests.cpp, which CTest runs.
+
+namespace {
+    constexpr size_t BENCH_VOLUME = 256 * 1024 * 1024;
+
+    // Runs a kernel until BENCH_VOLUME bytes were processed and returns the throughput in MB/s.
+    double measureThroughput(const size_t bytesPerCall, const std::function<void()> &kernel) {
+        const size_t calls = std::max<size_t>(1, BENCH_VOLUME / bytesPerCall);
+        kernel(); // warm-up
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; ++i) {
+            kernel();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> elapsed = end - start;
+        return static_cast<double>(calls * bytesPerCall) / (1024.0 * 1024.0) / elapsed.count();
+    }
+
+    // Runs an operation a fixed number of times and returns the mean latency in microseconds.
+    double measureLatency(const size_t calls, const std::function<void()> &operation) {
+        operation(); // warm-up
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; ++i) {
+            operation();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const std::chrono::duration<double, std::micro> elapsed = end - start;
+        return elapsed.count() / static_cast<double>(calls);
+    }
+
+    void printResult(const std::string &suite, const std::string &variant, const size_t bytesPerCall,
+                     const double megabytesPerSecond) {
+        std::cout << std::left << std::setw(8) << suite << std::setw(24) << variant << std::right << std::setw(10)
+                << bytesPerCall << " B/call" << std::setw(12) << std::fixed << std::setprecision(1)
+                << megabytesPerSecond << " MB/s" << std::endl;
+    }
+
+    void printLatency(const std::string &suite, const std::string &variant, const double microseconds) {
+        std::cout << std::left << std::setw(8) << suite << std::setw(24) << variant << std::right << std::setw(29)
+                << std::fixed << std::setprecision(2) << microseconds << " us/call" << std::endl;
+    }
+
+    // Mask noise: one randombytes_buf call per chunk versus the seeded ChaCha20 NoiseGenerator.
+    void benchNoise() {
+        for (const size_t noiseSize: {size_t{2048}, size_t{32 * 1024}, size_t{512 * 1024}}) {
+            std::vector<unsigned char> buffer(noiseSize);
+
+            printResult("noise", "randombytes_buf", noiseSize, measureThroughput(noiseSize, [&] {
+                randombytes_buf(buffer.data(), buffer.size());
+            }));
+
+            unsigned char seed[NOISE_SEED_SIZE];
+            utils::crypto::NoiseGenerator::createSeed(seed);
+            utils::crypto::NoiseGenerator generator(seed, 0);
+            printResult("noise", "NoiseGenerator", noiseSize, measureThroughput(noiseSize, [&] {
+                generator.fill(buffer.data(), buffer.size());
+            }));
+            sodium_memzero(seed, sizeof(seed));
+        }
+    }
+
+    // XOR layer: the original per-byte loop versus every kernel the host supports.
+    void benchXor() {
+        unsigned char key[XOR_KEY_SIZE];
+        randombytes_buf(key, sizeof(key));
+        const utils::crypto::XorTransform transform(key);
+
+        for (const size_t length: {size_t{4096}, size_t{64 * 1024}, size_t{4 * 1024 * 1024}}) {
+            std::vector<unsigned char> buffer(length);
+            randombytes_buf(buffer.data(), buffer.size());
+
+            // The loop the engine shipped with, kept here as the baseline.
+            printResult("xor", "scalar modulo", length, measureThroughput(length, [&] {
+                for (size_t i = 0; i < length; ++i) {
+                    buffer[i] ^= key[i % XOR_KEY_SIZE];
+                }
+            }));
+            for (const auto kernel: {utils::crypto::XorKernel::Portable, utils::crypto::XorKernel::Sse2,
+                                     utils::crypto::XorKernel::Avx2, utils::crypto::XorKernel::Avx512,
+                                     utils::crypto::XorKernel::Neon}) {
+                if (utils::crypto::XorTransform::isSupported(kernel)) {
+                    printResult("xor", utils::crypto::XorTransform::kernelName(kernel), length,
+                                measureThroughput(length, [&] {
+                                    transform.applyWith(kernel, buffer.data(), buffer.data(), length);
+                                }));
+                }
+            }
+        }
+        sodium_memzero(key, sizeof(key));
+    }
+
+    // Key generation: the original per-byte reseeding versus RNG::fill and the per-thread pool, and the cost of
+    // constructing an engine (key generation, mlock and the worker pool) for a short job.
+    void benchKeygen() {
+        utils::math::RNG rng;
+        std::array<uint8_t, MASTER_KEY_SIZE> key{};
+
+        // What random<uint8_t>() did for every key byte: mix a seed, reseed a Mersenne Twister, draw once.
+        printLatency("keygen", "per-byte reseed", measureLatency(2000, [&] {
+            for (uint8_t &byte: key) {
+                uint8_t osSeed[32];
+                randombytes_buf(osSeed, sizeof(osSeed));
+                std::array<uint8_t, 32> lorenzEntropy{};
+                utils::math::LorenzAttractor::generateEntropy(lorenzEntropy, 32);
+                std::vector<uint32_t> seed(32);
+                for (size_t i = 0; i < seed.size(); ++i) {
+                    seed[i] = osSeed[i] ^ lorenzEntropy[i];
+                }
+                std::seed_seq sequence(seed.begin(), seed.end());
+                std::mt19937 generator(sequence);
+                std::uniform_int_distribution<unsigned> distribution(0, 255);
+                byte = static_cast<uint8_t>(distribution(generator));
+            }
+        }));
+        printLatency("keygen", "RNG::fill", measureLatency(20000, [&] { rng.fill(key); }));
+        printLatency("keygen", "RNG::fillPooled", measureLatency(20000, [&] { rng.fillPooled(key); }));
+        sodium_memzero(key.data(), key.size());
+
+        engines::encryption::EngineOptions singleThread;
+        singleThread.threadCount = 1;
+        const double singleThreaded = measureLatency(200, [&] {
+            engines::encryption::PolymorphicEncryptionEngine engine(singleThread);
+        });
+        const double defaultThreads = measureLatency(200, [] {
+            engines::encryption::PolymorphicEncryptionEngine engine(engines::encryption::EngineOptions{});
+        });
+        printLatency("keygen", "engine, 1 thread", singleThreaded);
+        printLatency("keygen", "engine, default threads", defaultThreads);
+    }
+
+    // Lorenz entropy: the original scalar loop versus the compile-time table and the batched integrator.
+    void benchLorenz() {
+        // The loop generateEntropy() ran on every seed, kept here as the baseline.
+        const auto scalarEntropy = [](std::array<uint8_t, LORENZ_ENTROPY_SIZE> &buffer, const size_t size) {
+            double x = LORENZ_ENTROPY_START_X;
+            double y = LORENZ_ENTROPY_START_Y;
+            double z = LORENZ_ENTROPY_START_Z;
+            for (size_t i = 0; i < size; ++i) {
+                const double dx = 10.0 * (y - x);
+                const double dy = x * (28.0 - z) - y;
+                const double dz = x * y - 8.0 / 3.0 * z;
+                x += dx * 0.01;
+                y += dy * 0.01;
+                z += dz * 0.01;
+                buffer[i] = static_cast<uint8_t>(std::fmod(std::abs(x + y + z), 256));
+            }
+        };
+
+        std::array<uint8_t, LORENZ_ENTROPY_SIZE> expected{}, actual{};
+        printResult("lorenz", "scalar fmod", expected.size(), measureThroughput(expected.size(), [&] {
+            scalarEntropy(expected, expected.size());
+        }));
+        printResult("lorenz", "compile-time table", actual.size(), measureThroughput(actual.size(), [&] {
+            utils::math::LorenzAttractor::generateEntropy(actual, actual.size());
+        }));
+
+        constexpr size_t steps = 4096;
+        std::vector<utils::math::LorenzState> batch(LORENZ_BATCH_LANES, utils::math::LorenzState{1.01, 1.02, 1.03});
+        std::vector<uint8_t> batchOutput(steps * batch.size());
+        printResult("lorenz", "batched Euler", batchOutput.size(), measureThroughput(batchOutput.size(), [&] {
+            utils::math::LorenzAttractor::integrate(batch, batchOutput, utils::math::LorenzMethod::Euler);
+        }));
+        printResult("lorenz", "batched RK4", batchOutput.size(), measureThroughput(batchOutput.size(), [&] {
+            utils::math::LorenzAttractor::integrate(batch, batchOutput, utils::math::LorenzMethod::RungeKutta4);
+        }));
+    }
+
+    // Lattice noise: the original per-byte distribution versus the keyed keystream stage.
+    void benchLattice() {
+        unsigned char key[LATTICE_NOISE_KEY_SIZE];
+        randombytes_buf(key, sizeof(key));
+        const utils::math::LatticeNoise latticeNoise(key);
+
+        for (const size_t length: {size_t{4096}, size_t{64 * 1024}, size_t{4 * 1024 * 1024}}) {
+            std::vector<uint8_t> buffer(length);
+            randombytes_buf(buffer.data(), buffer.size());
+
+            // The loop the engine shipped with, kept here as the baseline; it reseeded on every call.
+            printResult("lattice", "per-byte distribution", length, measureThroughput(length, [&] {
+                std::default_random_engine generator(std::random_device{}());
+                std::uniform_int_distribution distribution(0, 255);
+                for (size_t i = 0; i < length; ++i) {
+                    buffer[i] = static_cast<uint8_t>((buffer[i] + distribution(generator)) % 256);
+                }
+            }));
+            printResult("lattice", std::string("add, ") + utils::math::LatticeNoise::kernelName(), length,
+                        measureThroughput(length, [&] {
+                            latticeNoise.addLatticeNoise(buffer, buffer, 0);
+                        }));
+            printResult("lattice", std::string("remove, ") + utils::math::LatticeNoise::kernelName(), length,
+                        measureThroughput(length, [&] {
+                            latticeNoise.removeLatticeNoise(buffer, buffer, 0);
+                        }));
+        }
+        sodium_memzero(key, sizeof(key));
+    }
+
+    // Corpus generation: the per-byte random() loop main.cpp used versus one generator stream per profile.
+    void benchCorpus() {
+        std::vector<uint8_t> buffer(CORPUS_BLOCK_SIZE);
+        printResult("corpus", "random() % 256", buffer.size(), measureThroughput(buffer.size(), [&] {
+            for (uint8_t &byte: buffer) {
+                byte = static_cast<uint8_t>(random() % 256);
+            }
+        }));
+        for (const auto profile: {utils::corpus::CorpusProfile::Random, utils::corpus::CorpusProfile::Text,
+                                  utils::corpus::CorpusProfile::Sparse}) {
+            utils::corpus::CorpusOptions options;
+            options.profile = profile;
+            options.threadCount = 1;
+            const utils::corpus::CorpusGenerator generator(options);
+            uint64_t stream = 0;
+            printResult("corpus", utils::corpus::CorpusGenerator::profileName(profile), buffer.size(),
+                        measureThroughput(buffer.size(), [&] { generator.fill(buffer, stream++); }));
+        }
+    }
+
+    // Stream ciphers: every suite available on this CPU sealing messages of the engine's typical chunk sizes.
+    void benchCipher() {
+        unsigned char key[STREAM_KEY_SIZE];
+        randombytes_buf(key, sizeof(key));
+        for (const uint8_t suite: {CIPHER_SUITE_XCHACHA20_POLY1305, CIPHER_SUITE_AES256_GCM}) {
+            if (!utils::crypto::CipherSuite::isAvailable(suite)) {
+                std::cout << "cipher: " << utils::crypto::CipherSuite::name(suite) << " not available" << std::endl;
+                continue;
+            }
+
+            unsigned char header[STREAM_HEADER_SIZE];
+            const unsigned char ad[4] = {1, 2, 3, 4};
+            const auto push = utils::crypto::CipherSuite::createPush(suite, key, header);
+            for (const size_t length: {size_t{4096}, size_t{64 * 1024}, size_t{1024 * 1024}}) {
+                std::vector<uint8_t> buffer(length), output(length + STREAM_ABYTES);
+                randombytes_buf(buffer.data(), buffer.size());
+                printResult("cipher", std::string("push, ") + utils::crypto::CipherSuite::name(suite), length,
+                            measureThroughput(length, [&] {
+                                push->push(output.data(), buffer.data(), length, ad, sizeof(ad), STREAM_TAG_MESSAGE);
+                            }));
+            }
+        }
+        std::cout << "cipher: calibration picks " << utils::crypto::CipherSuite::name(
+            utils::crypto::CipherSuite::fastest()) << std::endl;
+        sodium_memzero(key, sizeof(key));
+    }
+
+    struct Suite {
+        const char *name;
+        void (*run)();
+    };
+
+    constexpr Suite SUITES[] = {
+        {"noise", benchNoise},
+        {"xor", benchXor},
+        {"keygen", benchKeygen},
+        {"lorenz", benchLorenz},
+        {"lattice", benchLattice},
+        {"corpus", benchCorpus},
+        {"cipher", benchCipher},
+    };
+}
+
+int main(const int argc, char **argv) {
+    if (sodium_init() == -1) {
+        std::cerr << "Error: Failed to initialize libsodium" << std::endl;
+        return 1;
+    }
+
+    for (const Suite &suite: SUITES) {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; ++i) {
+            selected = selected || std::strcmp(argv[i], suite.name) == 0;
+        }
+        if (selected) {
+            suite.run();
+        }
+    }
+    return 0;
+}
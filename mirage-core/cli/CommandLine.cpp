@@ -0,0 +1,714 @@
+#include "CommandLine.h"
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sodium.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../engines/encryption/Archive.h"
+#include "../engines/encryption/FileScheduler.h"
+#include "../engines/encryption/PolymorphicEncryptionEngine.h"
+#include "../file/StreamIO.h"
+#include "../utils/crypto/CipherSuite.h"
+#include "../utils/crypto/KeyFile.h"
+#include "../utils/math/RNG.h"
+
+namespace cli {
+    namespace {
+        enum class BatchAction { Encrypt, Decrypt, Verify, Update, Pack, List, Unpack };
+
+        /**
+         * @struct PassphraseSource
+         * @brief Where the passphrase of a sealed key file is read from; never the command line itself.
+         */
+        struct PassphraseSource {
+            std::string file; /**< A file whose first line is the passphrase. */
+            std::string environment; /**< An environment variable holding the passphrase. */
+
+            [[nodiscard]] bool empty() const { return file.empty() && environment.empty(); }
+        };
+
+        struct BatchOptions {
+            BatchAction action = BatchAction::Encrypt;
+            std::string keyFile;
+            PassphraseSource passphrase; /**< Unlocks a sealed key file. */
+            std::vector<std::string> paths;
+            bool recursive = false;
+            bool quiet = false;
+            bool stdio = false;
+            bool stats = false;
+            bool xorLayer = false; /**< Adds the XOR layer to the profile's stages. */
+            bool latticeNoise = false; /**< Adds lattice noise to the profile's stages. */
+            std::string suffix = DEFAULT_ENCRYPTED_SUFFIX;
+            std::string archive; /**< The archive of pack, list and unpack. */
+            std::string into = "."; /**< The directory unpack extracts into. */
+            engines::encryption::EngineOptions engine;
+            engines::encryption::SchedulerOptions scheduler; /**< How many files run at once, and in what budget. */
+        };
+
+        bool isArchiveAction(const BatchAction action) {
+            return action == BatchAction::Pack || action == BatchAction::List || action == BatchAction::Unpack;
+        }
+
+        /**
+         * @brief Handles the passphrase options shared by every command.
+         *
+         * @return True if the argument was a passphrase option.
+         */
+        template<typename Value>
+        bool parsePassphraseOption(const std::string &argument, const Value &value, PassphraseSource &source) {
+            if (argument == "--passphrase-file") {
+                source.file = value();
+            } else if (argument == "--passphrase-env") {
+                source.environment = value();
+            } else {
+                return false;
+            }
+            if (!source.file.empty() && !source.environment.empty()) {
+                throw std::invalid_argument("--passphrase-file and --passphrase-env are exclusive");
+            }
+            return true;
+        }
+
+        /**
+         * @brief Reads a passphrase; the caller erases it with sodium_memzero() once the key is unlocked.
+         */
+        std::string readPassphrase(const PassphraseSource &source) {
+            std::string passphrase;
+            if (!source.environment.empty()) {
+                const char *variable = std::getenv(source.environment.c_str());
+                if (variable == nullptr) {
+                    throw std::runtime_error("Environment variable is not set: " + source.environment);
+                }
+                passphrase = variable;
+            } else if (!source.file.empty()) {
+                std::ifstream file(source.file, std::ios::binary);
+                if (!file) {
+                    throw std::runtime_error("Failed to open passphrase file: " + source.file);
+                }
+                std::getline(file, passphrase);
+                if (!passphrase.empty() && passphrase.back() == '\r') {
+                    passphrase.pop_back();
+                }
+            }
+            return passphrase;
+        }
+
+        /**
+         * @brief Loads the master key of a batch, unlocking a sealed key file with the given passphrase.
+         */
+        utils::crypto::LockedKey loadKey(const std::string &keyFile, const PassphraseSource &source) {
+            std::string passphrase = readPassphrase(source);
+            try {
+                utils::crypto::LockedKey key = utils::crypto::KeyFile::load(keyFile, passphrase);
+                sodium_memzero(passphrase.data(), passphrase.size());
+                return key;
+            } catch (...) {
+                sodium_memzero(passphrase.data(), passphrase.size());
+                throw;
+            }
+        }
+
+        void printUsage() {
+            std::cerr << "Usage:\n"
+                    << "  mirage_core keygen [--passphrase-file FILE|--passphrase-env VAR] KEYFILE\n"
+                    << "  mirage_core unlock --key SEALED (--passphrase-file FILE|--passphrase-env VAR) KEYFILE\n"
+                    << "  mirage_core encrypt|decrypt|verify --key KEYFILE [options] [PATH...]\n"
+                    << "  mirage_core encrypt|decrypt|verify --key KEYFILE [options] --stdio\n"
+                    << "  mirage_core update --key KEYFILE [options] [PATH...]\n"
+                    << "  mirage_core pack --key KEYFILE [options] ARCHIVE [PATH...]\n"
+                    << "  mirage_core list --key KEYFILE ARCHIVE\n"
+                    << "  mirage_core unpack --key KEYFILE [--into DIR] ARCHIVE [MEMBER...]\n\n"
+                    << "Paths may be files, directories with --recursive, or - to read paths from stdin.\n\n"
+                    << "Options:\n"
+                    << "  --passphrase-file F read the passphrase of a sealed key file from the first line of F\n"
+                    << "  --passphrase-env V  read the passphrase of a sealed key file from environment variable V\n"
+                    << "  --stdio             read standard input and write standard output instead of files\n"
+                    << "  -r, --recursive     process the files below directory arguments\n"
+                    << "  --into DIR          directory unpack extracts into (default .)\n"
+                    << "  --suffix SUFFIX     suffix of encrypted files (default " << DEFAULT_ENCRYPTED_SUFFIX << ")\n"
+                    << "  --chunk-size BYTES  plaintext chunk size for encryption\n"
+                    << "  --threads N         segment worker threads; 0 uses every core (default)\n"
+                    << "  --jobs N            files processed at once, largest first; 0 uses every core (default)\n"
+                    << "  --memory-budget B   bytes of input files processed at once (default half the memory)\n"
+                    << "  --max-open-files N  files held open at once (default half the descriptor limit)\n"
+                    << "  --pipelined         use the read/crypt/write pipeline instead of file mappings\n"
+                    << "  --profile NAME      paranoid, balanced (default) or throughput: rekey interval, padding,\n"
+                    << "                      noise and stages of new containers\n"
+                    << "  --xor               add the XOR layer when encrypting, whatever the profile\n"
+                    << "  --lattice           add lattice noise when encrypting, whatever the profile\n"
+                    << "  --huge-pages        back large plaintext buffers with transparent huge pages\n"
+                    << "  --compress          compress chunks that shrink before encrypting them\n"
+                    << "  --updatable         store segment digests so update rewrites only changed segments\n"
+                    << "  --cipher SUITE      xchacha20, aes256gcm or auto, the fastest on this CPU (default)\n"
+                    << "  --stats             print per-stage counters and timings as JSON on stderr\n"
+                    << "  -q, --quiet         print nothing but errors and failures, not even the summary" << std::endl;
+        }
+
+        BatchOptions parseOptions(const int argc, char **argv) {
+            BatchOptions options;
+            const std::string command = argv[1];
+            if (command == "encrypt") {
+                options.action = BatchAction::Encrypt;
+            } else if (command == "decrypt") {
+                options.action = BatchAction::Decrypt;
+            } else if (command == "verify") {
+                options.action = BatchAction::Verify;
+            } else if (command == "update") {
+                options.action = BatchAction::Update;
+                options.engine.updatable = true;
+            } else if (command == "pack") {
+                options.action = BatchAction::Pack;
+            } else if (command == "list") {
+                options.action = BatchAction::List;
+            } else if (command == "unpack") {
+                options.action = BatchAction::Unpack;
+            } else {
+                throw std::invalid_argument("Unknown command: " + command);
+            }
+
+            for (int i = 2; i < argc; ++i) {
+                const std::string argument = argv[i];
+                const auto value = [&]() -> std::string {
+                    if (i + 1 == argc) {
+                        throw std::invalid_argument("Missing value for " + argument);
+                    }
+                    return argv[++i];
+                };
+
+                if (parsePassphraseOption(argument, value, options.passphrase)) {
+                    continue;
+                }
+                if (argument == "--key") {
+                    options.keyFile = value();
+                } else if (argument == "-r" || argument == "--recursive") {
+                    options.recursive = true;
+                } else if (argument == "--stdio") {
+                    options.stdio = true;
+                } else if (argument == "--stats") {
+                    options.stats = true;
+                    options.engine.collectStats = true;
+                } else if (argument == "-q" || argument == "--quiet") {
+                    options.quiet = true;
+                } else if (argument == "--suffix") {
+                    options.suffix = value();
+                } else if (argument == "--into") {
+                    options.into = value();
+                } else if (argument == "--chunk-size") {
+                    options.engine.chunkSize = std::stoul(value());
+                } else if (argument == "--threads") {
+                    options.engine.threadCount = std::stoul(value());
+                } else if (argument == "--jobs") {
+                    options.scheduler.threadCount = std::stoul(value());
+                } else if (argument == "--memory-budget") {
+                    options.scheduler.memoryBudget = std::stoull(value());
+                } else if (argument == "--max-open-files") {
+                    options.scheduler.openFileBudget = std::stoul(value());
+                } else if (argument == "--pipelined") {
+                    options.engine.pipelined = true;
+                } else if (argument == "--profile") {
+                    options.engine.profile = engines::encryption::SecurityProfile::fromName(value().c_str());
+                } else if (argument == "--xor") {
+                    options.xorLayer = true;
+                } else if (argument == "--lattice") {
+                    options.latticeNoise = true;
+                } else if (argument == "--huge-pages") {
+                    options.engine.hugePages = true;
+                } else if (argument == "--compress") {
+                    options.engine.compression = CODEC_LZ;
+                } else if (argument == "--updatable") {
+                    options.engine.updatable = true;
+                } else if (argument == "--cipher") {
+                    options.engine.cipherSuite = utils::crypto::CipherSuite::fromName(value().c_str());
+                } else if (argument.size() > 1 && argument[0] == '-') {
+                    throw std::invalid_argument("Unknown option: " + argument);
+                } else {
+                    options.paths.push_back(argument);
+                }
+            }
+
+            options.engine.profile.xorLayer |= options.xorLayer;
+            options.engine.profile.latticeNoise |= options.latticeNoise;
+
+            if (options.keyFile.empty()) {
+                throw std::invalid_argument("Missing --key");
+            }
+            if (options.suffix.empty()) {
+                throw std::invalid_argument("The suffix must not be empty");
+            }
+            if (options.stdio && !options.paths.empty()) {
+                throw std::invalid_argument("--stdio takes no paths");
+            }
+            if (options.stdio && options.action == BatchAction::Update) {
+                throw std::invalid_argument("update needs files, not --stdio");
+            }
+            if (isArchiveAction(options.action)) {
+                if (options.stdio || options.paths.empty()) {
+                    throw std::invalid_argument(command + " needs an archive path");
+                }
+                options.archive = options.paths.front();
+                options.paths.erase(options.paths.begin());
+            }
+            return options;
+        }
+
+        bool hasSuffix(const std::string &path, const std::string &suffix) {
+            return path.size() > suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+
+        // Expands the arguments into the list of files to process, in argument order.
+        std::vector<std::string> collectFiles(const BatchOptions &options) {
+            std::vector<std::string> arguments;
+            for (const std::string &path: options.paths) {
+                if (path != "-") {
+                    arguments.push_back(path);
+                    continue;
+                }
+                for (std::string line; std::getline(std::cin, line);) {
+                    if (!line.empty()) {
+                        arguments.push_back(line);
+                    }
+                }
+            }
+
+            // Directories contribute the files the command applies to: plaintext for encrypt, containers otherwise.
+            const bool wantEncrypted = options.action == BatchAction::Decrypt || options.action == BatchAction::Verify;
+            std::vector<std::string> files;
+            for (const std::string &argument: arguments) {
+                if (!std::filesystem::is_directory(argument)) {
+                    files.push_back(argument);
+                    continue;
+                }
+                if (!options.recursive) {
+                    throw std::invalid_argument("Directory given without --recursive: " + argument);
+                }
+                for (const auto &entry: std::filesystem::recursive_directory_iterator(argument)) {
+                    if (entry.is_regular_file() && hasSuffix(entry.path().string(), options.suffix) == wantEncrypted) {
+                        files.push_back(entry.path().string());
+                    }
+                }
+            }
+            return files;
+        }
+
+        // Streams standard input through the engine to standard output; verify writes nothing.
+        utils::metrics::OperationStats runStdio(const BatchOptions &options,
+                                                const engines::encryption::PolymorphicEncryptionEngine &engine) {
+            file::FdSource source(STDIN_FILENO);
+            file::FdSink output(STDOUT_FILENO);
+            switch (options.action) {
+                case BatchAction::Encrypt:
+                    return engine.encryptStream(source, output);
+                case BatchAction::Decrypt:
+                    return engine.decryptStream(source, output);
+                case BatchAction::Verify:
+                    return engine.verifyStream(source);
+                default:
+                    break;
+            }
+            return {};
+        }
+
+        /**
+         * @class BatchRunner
+         * @brief Applies one command to many files with a single engine.
+         */
+        class BatchRunner {
+        public:
+            BatchRunner(const BatchOptions &options, const engines::encryption::PolymorphicEncryptionEngine &engine,
+                        std::ostream &report)
+                : options(options), report(report), scheduler(engine, options.scheduler) {
+            }
+
+            // Processes every file, many at a time; reports and swallows failures and returns their number.
+            size_t run(const std::vector<std::string> &files) {
+                std::vector<engines::encryption::FileJob> jobs;
+                jobs.reserve(files.size());
+                size_t failed = 0;
+                for (const std::string &path: files) {
+                    try {
+                        jobs.push_back(plan(path));
+                    } catch (const std::exception &e) {
+                        std::cerr << "FAILED " << path << ": " << e.what() << std::endl;
+                        ++failed;
+                    }
+                }
+
+                scheduler.run(jobs, [&](const size_t index, const engines::encryption::FileJobResult &result) {
+                    const engines::encryption::FileJob &job = jobs[index];
+                    if (!result.succeeded()) {
+                        // A container that failed to update is left as it was before; verify writes nothing.
+                        if (job.operation != engines::encryption::FileOperation::Update &&
+                            job.operation != engines::encryption::FileOperation::Verify) {
+                            std::error_code ignored;
+                            std::filesystem::remove(job.output, ignored);
+                        }
+                        std::cerr << "FAILED " << job.input << ": " << result.errorMessage() << std::endl;
+                        ++failed;
+                        return;
+                    }
+                    bytes += result.bytes;
+                    stats.merge(result.stats);
+                    if (options.quiet) {
+                        return;
+                    }
+                    if (job.operation == engines::encryption::FileOperation::Verify) {
+                        report << "OK " << job.input << '\n';
+                    } else {
+                        report << job.input << " -> " << job.output << '\n';
+                    }
+                });
+                return failed;
+            }
+
+            [[nodiscard]] uint64_t processedBytes() const { return bytes; }
+
+            [[nodiscard]] const utils::metrics::OperationStats &batchStats() const { return stats; }
+
+        private:
+            const BatchOptions &options;
+            std::ostream &report;
+            const engines::encryption::FileScheduler scheduler;
+            uint64_t bytes = 0;
+            utils::metrics::OperationStats stats; /**< Sum of the stats of every file, when enabled. */
+
+            // Turns a path into the job the command makes of it.
+            [[nodiscard]] engines::encryption::FileJob plan(const std::string &path) const {
+                engines::encryption::FileJob job;
+                job.input = path;
+                switch (options.action) {
+                    case BatchAction::Decrypt:
+                        if (!hasSuffix(path, options.suffix)) {
+                            throw std::runtime_error("Name does not end with " + options.suffix);
+                        }
+                        job.output = path.substr(0, path.size() - options.suffix.size());
+                        job.operation = engines::encryption::FileOperation::Decrypt;
+                        break;
+                    case BatchAction::Verify:
+                        job.operation = engines::encryption::FileOperation::Verify;
+                        break;
+                    case BatchAction::Update:
+                        // Containers that do not exist yet are written whole, ready for the next update.
+                        job.output = path + options.suffix;
+                        job.operation = std::filesystem::exists(job.output)
+                                            ? engines::encryption::FileOperation::Update
+                                            : engines::encryption::FileOperation::Encrypt;
+                        break;
+                    default:
+                        job.output = path + options.suffix;
+                        job.operation = engines::encryption::FileOperation::Encrypt;
+                        break;
+                }
+                return job;
+            }
+        };
+
+        // Turns a path into a member name: relative, normalized, with forward slashes and no "..".
+        std::string memberName(const std::string &path) {
+            const std::filesystem::path name = std::filesystem::path(path).lexically_normal().relative_path();
+            for (const std::filesystem::path &part: name) {
+                if (part == "..") {
+                    throw std::runtime_error("Member name leaves the archive root: " + path);
+                }
+            }
+            if (name.empty() || name.filename().empty()) {
+                throw std::runtime_error("Not a member name: " + path);
+            }
+            return name.generic_string();
+        }
+
+        void printSummary(const BatchOptions &options, const size_t succeeded, const size_t total, const uint64_t bytes,
+                          const std::chrono::steady_clock::time_point start) {
+            if (options.quiet) {
+                return;
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr << succeeded << " of " << total << " files, " << std::fixed << std::setprecision(1)
+                    << static_cast<double>(bytes) / (1024.0 * 1024.0) << " MB in " << std::setprecision(3)
+                    << elapsed.count() << " s" << std::endl;
+        }
+
+        // Packs every file into one archive; a failure on any file removes the archive.
+        int runPack(const BatchOptions &options, const engines::encryption::PolymorphicEncryptionEngine &engine,
+                    std::ostream &report, const std::chrono::steady_clock::time_point start) {
+            const std::vector<std::string> files = collectFiles(options);
+            uint64_t bytes = 0;
+            std::string current = options.archive;
+            try {
+                file::FdSink sink(options.archive);
+                engines::encryption::ArchiveWriter writer(engine, sink);
+                for (const std::string &path: files) {
+                    current = path;
+                    file::FdSource source(path);
+                    writer.add(memberName(path), source);
+                    std::error_code ignored;
+                    const uintmax_t size = std::filesystem::file_size(path, ignored);
+                    bytes += ignored ? 0 : size;
+                    if (!options.quiet) {
+                        report << path << " -> " << options.archive << '\n';
+                    }
+                }
+                current = options.archive;
+                writer.finish();
+            } catch (const std::exception &e) {
+                std::error_code ignored;
+                std::filesystem::remove(options.archive, ignored);
+                report.flush();
+                std::cerr << "FAILED " << current << ": " << e.what() << std::endl;
+                return 1;
+            }
+            report.flush();
+            printSummary(options, files.size(), files.size(), bytes, start);
+            return 0;
+        }
+
+        int runList(const BatchOptions &options, const engines::encryption::PolymorphicEncryptionEngine &engine,
+                    std::ostream &report) {
+            const engines::encryption::ArchiveReader reader(engine, options.archive);
+            for (const engines::encryption::ArchiveEntry &entry: reader.members()) {
+                report << entry.size << '\t' << entry.name << '\n';
+            }
+            report.flush();
+            return 0;
+        }
+
+        // Extracts the named members, or all of them; a failed member is reported and skipped.
+        int runUnpack(const BatchOptions &options, const engines::encryption::PolymorphicEncryptionEngine &engine,
+                      std::ostream &report, const std::chrono::steady_clock::time_point start) {
+            const engines::encryption::ArchiveReader reader(engine, options.archive);
+            const auto outputPath = [&](const engines::encryption::ArchiveEntry &entry) {
+                const std::filesystem::path output = std::filesystem::path(options.into) / memberName(entry.name);
+                std::filesystem::create_directories(output.parent_path());
+                return output;
+            };
+
+            // Without names the whole archive is decrypted in one pass.
+            if (options.paths.empty()) {
+                std::filesystem::path output;
+                try {
+                    reader.extractAll([&](const engines::encryption::ArchiveEntry &entry) {
+                        output = outputPath(entry);
+                        if (!options.quiet) {
+                            report << options.archive << ':' << entry.name << " -> " << output.string() << '\n';
+                        }
+                        return std::make_unique<file::FdSink>(output.string());
+                    });
+                } catch (const std::exception &e) {
+                    std::error_code ignored;
+                    if (!output.empty()) {
+                        std::filesystem::remove(output, ignored);
+                    }
+                    report.flush();
+                    std::cerr << "FAILED " << options.archive << ": " << e.what() << std::endl;
+                    return 1;
+                }
+                report.flush();
+                const uint64_t bytes = reader.members().empty()
+                                           ? 0
+                                           : reader.members().back().offset + reader.members().back().size;
+                printSummary(options, reader.members().size(), reader.members().size(), bytes, start);
+                return 0;
+            }
+
+            const std::vector<std::string> &names = options.paths;
+            size_t failed = 0;
+            uint64_t bytes = 0;
+            for (const std::string &name: names) {
+                std::filesystem::path output;
+                try {
+                    const engines::encryption::ArchiveEntry &entry = reader.find(name);
+                    output = outputPath(entry);
+                    file::FdSink sink(output.string());
+                    reader.extract(entry, sink);
+                    bytes += entry.size;
+                } catch (const std::exception &e) {
+                    std::error_code ignored;
+                    if (!output.empty()) {
+                        std::filesystem::remove(output, ignored);
+                    }
+                    std::cerr << "FAILED " << name << ": " << e.what() << std::endl;
+                    ++failed;
+                    continue;
+                }
+                if (!options.quiet) {
+                    report << options.archive << ':' << name << " -> " << output.string() << '\n';
+                }
+            }
+            report.flush();
+            printSummary(options, names.size() - failed, names.size(), bytes, start);
+            return failed == 0 ? 0 : 1;
+        }
+
+        int runArchive(const BatchOptions &options, const std::chrono::steady_clock::time_point start) {
+            const engines::encryption::PolymorphicEncryptionEngine engine(options.engine);
+            switch (options.action) {
+                case BatchAction::Pack:
+                    return runPack(options, engine, std::cout, start);
+                case BatchAction::List:
+                    return runList(options, engine, std::cout);
+                default:
+                    return runUnpack(options, engine, std::cout, start);
+            }
+        }
+
+        /**
+         * @brief Parses the arguments of keygen and unlock: one output key file, a passphrase and for unlock --key.
+         */
+        std::string parseKeyCommand(const int argc, char **argv, std::string *keyFile, PassphraseSource &source) {
+            const std::string command = argv[1];
+            std::string output;
+            for (int i = 2; i < argc; ++i) {
+                const std::string argument = argv[i];
+                const auto value = [&]() -> std::string {
+                    if (i + 1 == argc) {
+                        throw std::invalid_argument("Missing value for " + argument);
+                    }
+                    return argv[++i];
+                };
+
+                if (parsePassphraseOption(argument, value, source)) {
+                    continue;
+                }
+                if (keyFile != nullptr && argument == "--key") {
+                    *keyFile = value();
+                } else if (argument.size() > 1 && argument[0] == '-') {
+                    throw std::invalid_argument("Unknown option: " + argument);
+                } else if (output.empty()) {
+                    output = argument;
+                } else {
+                    throw std::invalid_argument(command + " takes exactly one key file");
+                }
+            }
+            if (output.empty()) {
+                throw std::invalid_argument(command + " takes exactly one key file");
+            }
+            return output;
+        }
+
+        /**
+         * @brief Writes a key, sealed when a passphrase is given.
+         */
+        void writeKey(const std::string &path, const unsigned char *key, const PassphraseSource &source) {
+            if (source.empty()) {
+                utils::crypto::KeyFile::writeRaw(path, key);
+                return;
+            }
+            std::string passphrase = readPassphrase(source);
+            try {
+                utils::crypto::KeyFile::writeSealed(path, key, passphrase);
+            } catch (...) {
+                sodium_memzero(passphrase.data(), passphrase.size());
+                throw;
+            }
+            sodium_memzero(passphrase.data(), passphrase.size());
+        }
+
+        int runKeygen(const int argc, char **argv) {
+            PassphraseSource source;
+            const std::string output = parseKeyCommand(argc, argv, nullptr, source);
+            std::array<uint8_t, MASTER_KEY_SIZE> key{};
+            utils::math::RNG rng;
+            rng.fill(key);
+            try {
+                writeKey(output, key.data(), source);
+            } catch (...) {
+                sodium_memzero(key.data(), key.size());
+                throw;
+            }
+            sodium_memzero(key.data(), key.size());
+            return 0;
+        }
+
+        /**
+         * @brief Unlocks a sealed key file once into a raw session key, so the jobs of a large batch that run as
+         * separate processes each load the key without paying for Argon2id.
+         */
+        int runUnlock(const int argc, char **argv) {
+            std::string keyFile;
+            PassphraseSource source;
+            const std::string output = parseKeyCommand(argc, argv, &keyFile, source);
+            if (keyFile.empty()) {
+                throw std::invalid_argument("Missing --key");
+            }
+            if (source.empty()) {
+                throw std::invalid_argument("unlock needs --passphrase-file or --passphrase-env");
+            }
+            const utils::crypto::LockedKey key = loadKey(keyFile, source);
+            utils::crypto::KeyFile::writeRaw(output, key.data());
+            return 0;
+        }
+    }
+
+    int runCommandLine(const int argc, char **argv) {
+        BatchOptions options;
+        try {
+            if (argc >= 2 && std::string(argv[1]) == "keygen") {
+                return runKeygen(argc, argv);
+            }
+            if (argc >= 2 && std::string(argv[1]) == "unlock") {
+                return runUnlock(argc, argv);
+            }
+            if (argc < 2) {
+                throw std::invalid_argument("Missing command");
+            }
+            options = parseOptions(argc, argv);
+        } catch (const std::invalid_argument &e) {
+            std::cerr << "Error: " << e.what() << "\n\n";
+            printUsage();
+            return 2;
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+
+        try {
+            const auto start = std::chrono::steady_clock::now();
+            const utils::crypto::LockedKey masterKey = loadKey(options.keyFile, options.passphrase);
+            options.engine.masterKey = masterKey.data();
+            if (options.stdio) {
+                const engines::encryption::PolymorphicEncryptionEngine engine(options.engine);
+                const utils::metrics::OperationStats stats = runStdio(options, engine);
+                if (options.stats) {
+                    std::cerr << "stats " << stats.toJson() << std::endl;
+                }
+                return 0;
+            }
+            if (isArchiveAction(options.action)) {
+                return runArchive(options, start);
+            }
+            const std::vector<std::string> files = collectFiles(options);
+
+            size_t failed = 0;
+            uint64_t bytes;
+            utils::metrics::OperationStats stats;
+            {
+                const engines::encryption::PolymorphicEncryptionEngine engine(options.engine);
+                BatchRunner runner(options, engine, std::cout);
+                failed = runner.run(files);
+                std::cout.flush();
+                bytes = runner.processedBytes();
+                stats = runner.batchStats();
+            }
+
+            printSummary(options, files.size() - failed, files.size(), bytes, start);
+            if (options.stats) {
+                std::cerr << "stats " << stats.toJson() << std::endl;
+            }
+            return failed == 0 ? 0 : 1;
+        } catch (const std::invalid_argument &e) {
+            std::cerr << "Error: " << e.what() << "\n\n";
+            printUsage();
+            return 2;
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+} // namespace cli
@@ -0,0 +1,35 @@
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#define DEFAULT_ENCRYPTED_SUFFIX ".mirage"
+
+namespace cli {
+ /**
+  * @brief Runs the non-interactive command line.
+  *
+  * Subcommands:
+  *   keygen KEYFILE                        writes a new random master key
+  *   encrypt|decrypt|verify --key KEYFILE [options] [PATH...]
+  *   encrypt|decrypt|verify --key KEYFILE [options] --stdio
+  *   pack --key KEYFILE [options] ARCHIVE [PATH...]
+  *   list --key KEYFILE ARCHIVE
+  *   unpack --key KEYFILE [--into DIR] ARCHIVE [MEMBER...]
+  *
+  * One engine is created for the whole batch and reused for every file, so per-file cost is the work on the
+  * file itself. Paths may be files, directories (with --recursive) or "-" to read one path per line from
+  * stdin. A failed file is reported and skipped; its partial output is removed. With --stdio the engine streams
+  * standard input to standard output, so it works in a pipeline; a failed decryption exits with status 1 after
+  * its authenticated plaintext was already written, and the consumer must discard it.
+  *
+  * pack writes the files into one encrypted archive, named by their normalized relative paths; list prints
+  * the size and name of every member; unpack extracts the named members, or all of them, below --into and
+  * decrypts only the segments each member overlaps.
+  *
+  * @param argc The argument count passed to main().
+  * @param argv The arguments passed to main().
+  * @return 0 if every file succeeded, 1 if any failed, 2 on a usage error.
+  */
+ int runCommandLine(int argc, char **argv);
+} // namespace cli
+
+#endif // COMMANDLINE_H
@@ -0,0 +1,224 @@
+#include "Archive.h"
+#include "PolymorphicEncryptionEngine.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace engines::encryption {
+    ArchiveWriter::ArchiveWriter(const PolymorphicEncryptionEngine &engine, file::ByteSink &sink)
+        : engine(engine), sink(sink), stream(engine), input(engine.buffers->acquire(engine.streamBlockSize())),
+          position(0), finished(false) {
+        output.resize(std::max(stream.maxUpdateSize(input.size()), stream.maxFinishSize()));
+    }
+
+    void ArchiveWriter::add(const std::string &name, file::ByteSource &source) {
+        ArchiveEntry &entry = beginEntry(name);
+        size_t readLen;
+        do {
+            readLen = source.readFull(input.span());
+            write({input.data(), readLen});
+            entry.size += readLen;
+        } while (readLen == input.size());
+    }
+
+    void ArchiveWriter::add(const std::string &name, const std::span<const unsigned char> data) {
+        ArchiveEntry &entry = beginEntry(name);
+        write(data);
+        entry.size = data.size();
+    }
+
+    void ArchiveWriter::finish() {
+        if (finished) {
+            throw std::logic_error("Archive is already finished");
+        }
+
+        size_t indexSize = sizeof(uint64_t);
+        for (const ArchiveEntry &entry: entries) {
+            indexSize += ARCHIVE_ENTRY_FIXED_SIZE + entry.name.size();
+        }
+        std::vector<unsigned char> index(indexSize + ARCHIVE_FOOTER_SIZE);
+        unsigned char *out = index.data();
+        storeLittleEndian64(out, entries.size());
+        out += sizeof(uint64_t);
+        for (const ArchiveEntry &entry: entries) {
+            storeLittleEndian32(out, static_cast<uint32_t>(entry.name.size()));
+            std::memcpy(out + sizeof(uint32_t), entry.name.data(), entry.name.size());
+            out += sizeof(uint32_t) + entry.name.size();
+            storeLittleEndian64(out, entry.offset);
+            storeLittleEndian64(out + sizeof(uint64_t), entry.size);
+            out += 2 * sizeof(uint64_t);
+        }
+        storeLittleEndian64(out, position);
+        storeLittleEndian64(out + sizeof(uint64_t), indexSize);
+        std::memcpy(out + 2 * sizeof(uint64_t), ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+
+        write(index);
+        output.resize(std::max(output.size(), stream.maxFinishSize()));
+        sink.write({output.data(), stream.finish(output)});
+        finished = true;
+        sodium_memzero(index.data(), index.size());
+    }
+
+    ArchiveEntry &ArchiveWriter::beginEntry(const std::string &name) {
+        if (finished) {
+            throw std::logic_error("Archive is already finished");
+        }
+        if (name.empty() || name.size() > ARCHIVE_MAX_NAME_LENGTH) {
+            throw std::invalid_argument("Invalid archive member name: " + name);
+        }
+        if (!names.insert(name).second) {
+            throw std::invalid_argument("Duplicate archive member: " + name);
+        }
+        entries.push_back({name, position, 0});
+        return entries.back();
+    }
+
+    void ArchiveWriter::write(std::span<const unsigned char> data) {
+        // Blocks are bounded so the output buffer sized in the constructor always suffices.
+        while (!data.empty()) {
+            const std::span<const unsigned char> block = data.first(std::min(data.size(), input.size()));
+            sink.write({output.data(), stream.update(block, output)});
+            position += block.size();
+            data = data.subspan(block.size());
+        }
+    }
+
+    ArchiveReader::ArchiveReader(const PolymorphicEncryptionEngine &engine, const std::string &path)
+        : engine(engine), fileHandler(path),
+          layout(engine.openContainer(fileHandler.fileData, fileHandler.fileSize, fileKey.data())) {
+        readIndex();
+    }
+
+    const ArchiveEntry &ArchiveReader::find(const std::string &name) const {
+        const auto it = byName.find(name);
+        if (it == byName.end()) {
+            throw std::out_of_range("No such archive member: " + name);
+        }
+        return entries[it->second];
+    }
+
+    void ArchiveReader::extract(const ArchiveEntry &entry, file::ByteSink &sink) const {
+        if (entry.size == 0) {
+            return;
+        }
+
+        // Block boundaries fall on segment boundaries, so no segment is decrypted twice.
+        const uint64_t blockLength = blockSize();
+        const utils::memory::SecureBuffer block = engine.buffers->acquire(std::min(blockLength, entry.size));
+        const uint64_t end = entry.offset + entry.size;
+        for (uint64_t position = entry.offset; position < end;) {
+            const uint64_t next = std::min(end, (position / blockLength + 1) * blockLength);
+            const size_t length = next - position;
+            engine.decryptRange(fileHandler, layout, fileKey.data(), position, length, block.data());
+            sink.write({block.data(), length});
+            position = next;
+        }
+    }
+
+    std::vector<unsigned char> ArchiveReader::read(const ArchiveEntry &entry) const {
+        std::vector<unsigned char> contents(entry.size);
+        if (entry.size > 0) {
+            engine.decryptRange(fileHandler, layout, fileKey.data(), entry.offset, entry.size, contents.data());
+        }
+        return contents;
+    }
+
+    void ArchiveReader::extractAll(
+        const std::function<std::unique_ptr<file::ByteSink>(const ArchiveEntry &)> &open) const {
+        size_t member = 0;
+        std::unique_ptr<file::ByteSink> sink;
+        // Empty members own no bytes, so they are opened and closed as soon as they are reached.
+        const auto skipEmpty = [&] {
+            for (; member < entries.size() && entries[member].size == 0; ++member) {
+                open(entries[member]);
+            }
+        };
+
+        skipEmpty();
+        const uint64_t end = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+        const uint64_t blockLength = blockSize();
+        const utils::memory::SecureBuffer block = engine.buffers->acquire(std::min(blockLength, end));
+        for (uint64_t position = 0; position < end;) {
+            const uint64_t next = std::min(end, position + blockLength);
+            engine.decryptRange(fileHandler, layout, fileKey.data(), position, next - position, block.data());
+            for (uint64_t at = position; at < next;) {
+                const ArchiveEntry &entry = entries[member];
+                if (!sink) {
+                    sink = open(entry);
+                }
+                const uint64_t take = std::min(next, entry.offset + entry.size) - at;
+                sink->write({block.data() + (at - position), take});
+                at += take;
+                if (at == entry.offset + entry.size) {
+                    sink.reset();
+                    ++member;
+                    skipEmpty();
+                }
+            }
+            position = next;
+        }
+    }
+
+    void ArchiveReader::readIndex() {
+        const uint64_t plaintextSize = layout.plaintextLength();
+        if (plaintextSize < ARCHIVE_FOOTER_SIZE + sizeof(uint64_t)) {
+            throw std::runtime_error("Container is not an archive");
+        }
+        unsigned char footer[ARCHIVE_FOOTER_SIZE];
+        engine.decryptRange(fileHandler, layout, fileKey.data(), plaintextSize - ARCHIVE_FOOTER_SIZE,
+                            ARCHIVE_FOOTER_SIZE, footer);
+        if (std::memcmp(footer + 2 * sizeof(uint64_t), ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0) {
+            throw std::runtime_error("Container is not an archive");
+        }
+
+        // The index is authenticated like the members, so these checks only reject archives written wrongly.
+        const uint64_t indexOffset = loadLittleEndian64(footer);
+        const uint64_t indexSize = loadLittleEndian64(footer + sizeof(uint64_t));
+        if (indexSize < sizeof(uint64_t) || indexSize > plaintextSize - ARCHIVE_FOOTER_SIZE ||
+            indexOffset != plaintextSize - ARCHIVE_FOOTER_SIZE - indexSize) {
+            throw std::runtime_error("Archive index is malformed");
+        }
+        std::vector<unsigned char> index(indexSize);
+        engine.decryptRange(fileHandler, layout, fileKey.data(), indexOffset, indexSize, index.data());
+
+        const unsigned char *in = index.data();
+        const unsigned char *indexEnd = in + indexSize;
+        const uint64_t count = loadLittleEndian64(in);
+        in += sizeof(uint64_t);
+        if (count > (indexSize - sizeof(uint64_t)) / ARCHIVE_ENTRY_FIXED_SIZE) {
+            throw std::runtime_error("Archive index is malformed");
+        }
+        entries.reserve(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            if (static_cast<size_t>(indexEnd - in) < ARCHIVE_ENTRY_FIXED_SIZE) {
+                throw std::runtime_error("Archive index is malformed");
+            }
+            const uint32_t nameLength = loadLittleEndian32(in);
+            in += sizeof(uint32_t);
+            if (nameLength == 0 || nameLength > ARCHIVE_MAX_NAME_LENGTH ||
+                static_cast<size_t>(indexEnd - in) < nameLength + 2 * sizeof(uint64_t)) {
+                throw std::runtime_error("Archive index is malformed");
+            }
+            ArchiveEntry entry{std::string(reinterpret_cast<const char *>(in), nameLength), 0, 0};
+            in += nameLength;
+            entry.offset = loadLittleEndian64(in);
+            entry.size = loadLittleEndian64(in + sizeof(uint64_t));
+            in += 2 * sizeof(uint64_t);
+            const uint64_t expectedOffset = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+            if (entry.offset != expectedOffset || entry.size > indexOffset - entry.offset ||
+                !byName.emplace(entry.name, entries.size()).second) {
+                throw std::runtime_error("Archive index is malformed");
+            }
+            entries.push_back(std::move(entry));
+        }
+        const uint64_t dataEnd = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+        if (in != indexEnd || dataEnd != indexOffset) {
+            throw std::runtime_error("Archive index is malformed");
+        }
+    }
+
+    uint64_t ArchiveReader::blockSize() const {
+        const uint64_t segmentPlainSize = static_cast<uint64_t>(layout.chunkLength()) * layout.fullSegmentChunkCount();
+        return segmentPlainSize * std::max<uint64_t>(1, engine.streamBlockSize() / segmentPlainSize);
+    }
+} // namespace engines::encryption
@@ -0,0 +1,202 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ContainerFormat.h"
+#include "EncryptionStream.h"
+#include "../../file/FileHandler.h"
+#include "../../file/StreamIO.h"
+
+#define ARCHIVE_MAGIC "MIRAGEAR"
+#define ARCHIVE_MAGIC_SIZE 8
+#define ARCHIVE_FOOTER_SIZE 24
+#define ARCHIVE_ENTRY_FIXED_SIZE 20
+#define ARCHIVE_MAX_NAME_LENGTH 4096
+
+namespace engines::encryption {
+ class PolymorphicEncryptionEngine;
+
+ /**
+  * @struct ArchiveEntry
+  * @brief A member of an archive: its name and where its bytes lie in the archive's plaintext.
+  */
+ struct ArchiveEntry {
+  std::string name; /**< The name the member was added under. */
+  uint64_t offset; /**< Offset of the member in the archive's plaintext. */
+  uint64_t size; /**< Size of the member in bytes. */
+ };
+
+ /**
+  * @class ArchiveWriter
+  * @brief Packs many members into a single segmented container.
+  *
+  * The members are concatenated into one plaintext that is encrypted as it is written, followed by an index
+  * and a fixed-size footer, so the container costs one header, one trailer and one padded final chunk
+  * however many members it holds. The index and the footer are encrypted like the members. Plaintext
+  * layout (little-endian): member data, then the index: entry count (8) and per entry name length (4),
+  * name, offset (8) and size (8); then the footer: index offset (8), index size (8) and the magic "MIRAGEAR".
+  */
+ class ArchiveWriter {
+ public:
+  /**
+   * @brief Constructs a new ArchiveWriter object.
+   *
+   * @param engine The engine to encrypt with; it must outlive the writer.
+   * @param sink The destination of the container.
+   */
+  ArchiveWriter(const PolymorphicEncryptionEngine &engine, file::ByteSink &sink);
+
+  ArchiveWriter(const ArchiveWriter &) = delete;
+
+  ArchiveWriter &operator=(const ArchiveWriter &) = delete;
+
+  /**
+   * @brief Adds a member read from a source until its end.
+   *
+   * Throws std::invalid_argument if the name is empty, longer than ARCHIVE_MAX_NAME_LENGTH or already used.
+   *
+   * @param name The name of the member.
+   * @param source The contents of the member.
+   */
+  void add(const std::string &name, file::ByteSource &source);
+
+  /**
+   * @brief Adds a member held in memory.
+   *
+   * @param name The name of the member.
+   * @param data The contents of the member.
+   */
+  void add(const std::string &name, std::span<const unsigned char> data);
+
+  /**
+   * @brief Writes the index and the footer and seals the container.
+   */
+  void finish();
+
+ private:
+  const PolymorphicEncryptionEngine &engine; /**< The engine encrypting the archive. */
+  file::ByteSink &sink; /**< The destination of the container. */
+  EncryptionStream stream; /**< Encrypts the archive's plaintext. */
+  utils::memory::SecureBuffer input; /**< Block of member data read from a source. */
+  std::vector<unsigned char> output; /**< Container bytes produced from one block. */
+  std::vector<ArchiveEntry> entries; /**< The members added so far. */
+  std::unordered_set<std::string> names; /**< The names used so far. */
+  uint64_t position; /**< Number of plaintext bytes written so far. */
+  bool finished; /**< Whether finish() was called. */
+
+  /**
+   * @brief Checks a member name and records a new entry at the current position.
+   *
+   * @param name The name of the member.
+   * @return The new entry.
+   */
+  ArchiveEntry &beginEntry(const std::string &name);
+
+  /**
+   * @brief Encrypts plaintext block by block and writes the container bytes produced.
+   *
+   * @param data The plaintext.
+   */
+  void write(std::span<const unsigned char> data);
+ };
+
+ /**
+  * @class ArchiveReader
+  * @brief Lists and extracts the members of an archive written by ArchiveWriter.
+  *
+  * The container is mapped once and its trailer authenticated when the reader is opened; the index is then
+  * decrypted from the end of the plaintext. Extracting a member decrypts only the segments it overlaps,
+  * with the random-access path of PolymorphicEncryptionEngine::decryptRange(), so single members come out
+  * of a large archive without decrypting the rest.
+  */
+ class ArchiveReader {
+ public:
+  /**
+   * @brief Constructs a new ArchiveReader object and reads the index.
+   *
+   * Throws if the container does not authenticate or does not hold a well-formed archive.
+   *
+   * @param engine The engine holding the key; it must outlive the reader.
+   * @param path The path to the archive.
+   */
+  ArchiveReader(const PolymorphicEncryptionEngine &engine, const std::string &path);
+
+  /**
+   * @brief Gets the members of the archive.
+   *
+   * @return The members, in the order they were added.
+   */
+  [[nodiscard]] const std::vector<ArchiveEntry> &members() const { return entries; }
+
+  /**
+   * @brief Looks up a member by name.
+   *
+   * Throws std::out_of_range if the archive has no such member.
+   *
+   * @param name The name of the member.
+   * @return The member.
+   */
+  [[nodiscard]] const ArchiveEntry &find(const std::string &name) const;
+
+  /**
+   * @brief Decrypts a member into a sink.
+   *
+   * The member is decrypted in blocks aligned to whole segments, so memory use is bounded by the block size.
+   *
+   * @param entry The member.
+   * @param sink The destination of the member's contents.
+   */
+  void extract(const ArchiveEntry &entry, file::ByteSink &sink) const;
+
+  /**
+   * @brief Decrypts a member into memory.
+   *
+   * @param entry The member.
+   * @return The member's contents.
+   */
+  [[nodiscard]] std::vector<unsigned char> read(const ArchiveEntry &entry) const;
+
+  /**
+   * @brief Decrypts every member in one sequential pass.
+   *
+   * Each segment is decrypted once, however many members it holds, which makes extracting a whole archive
+   * of small members linear in its size.
+   *
+   * @param open Called for every member in order; returns the sink of its contents, which is destroyed once
+   * the member is complete.
+   */
+  void extractAll(const std::function<std::unique_ptr<file::ByteSink>(const ArchiveEntry &)> &open) const;
+
+ private:
+  const PolymorphicEncryptionEngine &engine; /**< The engine holding the key. */
+  file::FileHandler fileHandler; /**< The mapped archive. */
+  utils::crypto::DerivedKey fileKey; /**< The key of the archive's container. */
+  ContainerLayout layout; /**< The authenticated layout of the container. */
+  std::vector<ArchiveEntry> entries; /**< The members, in the order they were added. */
+  std::unordered_map<std::string, size_t> byName; /**< Index of every member in entries by name. */
+
+  /**
+   * @brief Decrypts and parses the footer and the index.
+   *
+   * The members must cover the plaintext in front of the index contiguously, in order.
+   */
+  void readIndex();
+
+  /**
+   * @brief Gets the size of the blocks members are decrypted in.
+   *
+   * @return A multiple of the segment plaintext size, at least the engine's stream block size.
+   */
+  [[nodiscard]] uint64_t blockSize() const;
+ };
+} // namespace engines::encryption
+
+#endif // ARCHIVE_H
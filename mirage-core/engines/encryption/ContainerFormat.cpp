@@ -0,0 +1,392 @@
+#include "ContainerFormat.h"
+#include "PolymorphicEncryptionEngine.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace engines::encryption {
+    namespace {
+        constexpr unsigned char CONTAINER_MAGIC[8] = {'M', 'I', 'R', 'A', 'G', 'E', 'S', 'G'};
+
+        void computeTrailerMac(unsigned char *mac, const unsigned char *commitmentKey, const unsigned char *header,
+                               const uint64_t segmentCount, const uint64_t plaintextSize,
+                               const std::span<const unsigned char> segmentTable) {
+            unsigned char fields[16];
+            storeLittleEndian64(fields, segmentCount);
+            storeLittleEndian64(fields + 8, plaintextSize);
+
+            crypto_generichash_state state;
+            crypto_generichash_init(&state, commitmentKey, crypto_generichash_KEYBYTES, crypto_generichash_BYTES);
+            crypto_generichash_update(&state, header, CONTAINER_HEADER_SIZE);
+            crypto_generichash_update(&state, fields, sizeof(fields));
+            crypto_generichash_update(&state, segmentTable.data(), segmentTable.size());
+            crypto_generichash_final(&state, mac, crypto_generichash_BYTES);
+        }
+    }
+
+    void storeLittleEndian32(unsigned char *out, const uint32_t value) {
+        for (size_t i = 0; i < 4; ++i) {
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+    }
+
+    void storeLittleEndian64(unsigned char *out, const uint64_t value) {
+        for (size_t i = 0; i < 8; ++i) {
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+    }
+
+    uint32_t loadLittleEndian32(const unsigned char *in) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(in[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    uint64_t loadLittleEndian64(const unsigned char *in) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            value |= static_cast<uint64_t>(in[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    void ContainerHeader::serialize(unsigned char *out) const {
+        std::memset(out, 0, CONTAINER_HEADER_SIZE);
+        std::memcpy(out, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+        out[8] = CONTAINER_VERSION;
+        out[9] = flags;
+        out[10] = codec;
+        out[11] = cipherSuite;
+        storeLittleEndian32(out + 12, chunksPerSegment);
+        std::memcpy(out + 16, fileId, FILE_ID_SIZE);
+        storeLittleEndian32(out + 32, chunkSize);
+        storeLittleEndian32(out + 36, noiseSize);
+        storeLittleEndian32(out + 40, rekeyInterval);
+        storeLittleEndian32(out + 44, paddingBlockSize);
+    }
+
+    ContainerHeader ContainerHeader::parse(const unsigned char *in) {
+        if (std::memcmp(in, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0) {
+            throw std::runtime_error("Not a segmented container");
+        }
+        if (in[8] != CONTAINER_VERSION) {
+            throw std::runtime_error("Unsupported container version");
+        }
+
+        // Updates rewrite segments in place, which needs the fixed layout compression gives up.
+        if ((in[9] & ~CONTAINER_KNOWN_FLAGS) != 0 ||
+            (in[9] & (CONTAINER_FLAG_COMPRESSED | CONTAINER_FLAG_UPDATABLE)) ==
+            (CONTAINER_FLAG_COMPRESSED | CONTAINER_FLAG_UPDATABLE)) {
+            throw std::runtime_error("Unsupported container flags");
+        }
+
+        ContainerHeader header;
+        header.flags = in[9];
+        header.codec = in[10];
+        if ((header.flags & CONTAINER_FLAG_COMPRESSED) != 0
+                ? utils::compression::findCodec(header.codec) == nullptr
+                : header.codec != CODEC_NONE) {
+            throw std::runtime_error("Unsupported container codec");
+        }
+        header.cipherSuite = in[11];
+        if (!utils::crypto::CipherSuite::isKnown(header.cipherSuite)) {
+            throw std::runtime_error("Unsupported cipher suite");
+        }
+        header.chunksPerSegment = loadLittleEndian32(in + 12);
+        std::memcpy(header.fileId, in + 16, FILE_ID_SIZE);
+        header.chunkSize = loadLittleEndian32(in + 32);
+        header.noiseSize = loadLittleEndian32(in + 36);
+        header.rekeyInterval = loadLittleEndian32(in + 40);
+        header.paddingBlockSize = loadLittleEndian32(in + 44);
+        if (header.paddingBlockSize == 0) {
+            header.paddingBlockSize = CONTAINER_LEGACY_PADDING_BLOCK_SIZE;
+        }
+        if ((header.paddingBlockSize & (header.paddingBlockSize - 1)) != 0 ||
+            header.chunksPerSegment == 0 || header.chunkSize == 0 || header.chunkSize % header.paddingBlockSize != 0 ||
+            header.chunkSize > RECORD_LENGTH_MASK / 2 || header.noiseSize > RECORD_LENGTH_MASK ||
+            header.rekeyInterval == 0) {
+            throw std::runtime_error("Invalid container geometry");
+        }
+        return header;
+    }
+
+    void ContainerTrailer::seal(const unsigned char *commitmentKey, const unsigned char *header,
+                                const std::span<const unsigned char> segmentTable) {
+        computeTrailerMac(mac, commitmentKey, header, segmentCount, plaintextSize, segmentTable);
+    }
+
+    bool ContainerTrailer::verify(const unsigned char *commitmentKey, const unsigned char *header,
+                                  const std::span<const unsigned char> segmentTable) const {
+        unsigned char expected[crypto_generichash_BYTES];
+        computeTrailerMac(expected, commitmentKey, header, segmentCount, plaintextSize, segmentTable);
+        return sodium_memcmp(expected, mac, sizeof(mac)) == 0;
+    }
+
+    void ContainerTrailer::serialize(unsigned char *out) const {
+        storeLittleEndian64(out, segmentCount);
+        storeLittleEndian64(out + 8, plaintextSize);
+        std::memcpy(out + 16, mac, sizeof(mac));
+    }
+
+    ContainerTrailer ContainerTrailer::parse(const unsigned char *in) {
+        ContainerTrailer trailer;
+        trailer.segmentCount = loadLittleEndian64(in);
+        trailer.plaintextSize = loadLittleEndian64(in + 8);
+        std::memcpy(trailer.mac, in + 16, sizeof(trailer.mac));
+        return trailer;
+    }
+
+    ContainerLayout::ContainerLayout(const ContainerHeader &header, const uint64_t plaintextSize)
+        : chunkSize(header.chunkSize), noiseSize(header.noiseSize), chunksPerSegment(header.chunksPerSegment),
+          rekeyChunks(header.rekeyInterval), paddingBlock(header.paddingBlockSize), plaintextSize(plaintextSize),
+          xorMask((header.flags & CONTAINER_FLAG_XOR_MASK) != 0),
+          latticeNoise((header.flags & CONTAINER_FLAG_LATTICE_NOISE) != 0), suite(header.cipherSuite),
+          compressor((header.flags & CONTAINER_FLAG_COMPRESSED) != 0
+                         ? utils::compression::findCodec(header.codec)
+                         : nullptr),
+          digests((header.flags & CONTAINER_FLAG_UPDATABLE) != 0) {
+        const uint64_t segmentPlainSize = static_cast<uint64_t>(chunkSize) * chunksPerSegment;
+        segments = plaintextSize == 0 ? 1 : (plaintextSize + segmentPlainSize - 1) / segmentPlainSize;
+
+        const uint64_t lastSegmentPlainSize = plaintextSize - (segments - 1) * segmentPlainSize;
+        lastSegmentChunks = lastSegmentPlainSize == 0 ? 1 : (lastSegmentPlainSize + chunkSize - 1) / chunkSize;
+        finalChunkPlainSize = lastSegmentPlainSize - (lastSegmentChunks - 1) * chunkSize;
+    }
+
+    size_t ContainerLayout::chunkLength() const {
+        return chunkSize;
+    }
+
+    size_t ContainerLayout::noiseLength() const {
+        return noiseSize;
+    }
+
+    size_t ContainerLayout::rekeyInterval() const {
+        return rekeyChunks;
+    }
+
+    size_t ContainerLayout::paddingBlockSize() const {
+        return paddingBlock;
+    }
+
+    bool ContainerLayout::xorMasked() const {
+        return xorMask;
+    }
+
+    bool ContainerLayout::latticeNoised() const {
+        return latticeNoise;
+    }
+
+    uint8_t ContainerLayout::cipherSuite() const {
+        return suite;
+    }
+
+    const utils::compression::Codec *ContainerLayout::codec() const {
+        return compressor;
+    }
+
+    bool ContainerLayout::compressed() const {
+        return compressor != nullptr;
+    }
+
+    bool ContainerLayout::updatable() const {
+        return digests;
+    }
+
+    uint64_t ContainerLayout::plaintextLength() const {
+        return plaintextSize;
+    }
+
+    uint64_t ContainerLayout::segmentAt(const uint64_t position) const {
+        return std::min<uint64_t>(position / (static_cast<uint64_t>(chunksPerSegment) * chunkSize), segments - 1);
+    }
+
+    uint64_t ContainerLayout::segmentCount() const {
+        return segments;
+    }
+
+    size_t ContainerLayout::chunkCount(const uint64_t segment) const {
+        return segment + 1 == segments ? lastSegmentChunks : chunksPerSegment;
+    }
+
+    uint64_t ContainerLayout::plainOffset(const uint64_t segment) const {
+        return segment * chunksPerSegment * chunkSize;
+    }
+
+    uint64_t ContainerLayout::plainSize(const uint64_t segment) const {
+        return segment + 1 == segments ? plaintextSize - plainOffset(segment) : chunksPerSegment * chunkSize;
+    }
+
+    uint64_t ContainerLayout::cipherOffset(const uint64_t segment) const {
+        if (!segmentOffsets.empty()) {
+            return segmentOffsets[segment];
+        }
+        return CONTAINER_HEADER_SIZE + segment * fullSegmentCipherSize();
+    }
+
+    uint64_t ContainerLayout::segmentCipherSize(const uint64_t segment) const {
+        const uint64_t end = segment + 1 == segments ? segmentTableOffset() : cipherOffset(segment + 1);
+        return end - cipherOffset(segment);
+    }
+
+    size_t ContainerLayout::chunkPlainSize(const uint64_t segment, const size_t chunk) const {
+        return isFinalChunk(segment, chunk) ? finalChunkPlainSize : chunkSize;
+    }
+
+    size_t ContainerLayout::chunkCipherSize(const uint64_t segment, const size_t chunk) const {
+        if (isFinalChunk(segment, chunk)) {
+            const size_t paddedSize = (finalChunkPlainSize / paddingBlock + 1) * paddingBlock;
+            return paddedSize + STREAM_ABYTES;
+        }
+        return chunkSize + STREAM_ABYTES;
+    }
+
+    uint32_t ContainerLayout::recordFlags(const uint64_t segment, const size_t chunk) const {
+        uint32_t flags = 0;
+        if (chunk + 1 == chunkCount(segment)) {
+            flags |= RECORD_FLAG_SEGMENT_END;
+        }
+        if (segment + 1 == segments) {
+            flags |= RECORD_FLAG_LAST_SEGMENT;
+        }
+        return flags;
+    }
+
+    uint32_t ContainerLayout::recordPrefix(const uint64_t segment, const size_t chunk) const {
+        return recordFlags(segment, chunk) | static_cast<uint32_t>(chunkCipherSize(segment, chunk));
+    }
+
+    uint32_t ContainerLayout::readRecordPrefix(const uint64_t segment, const size_t chunk,
+                                               const unsigned char *record, const uint64_t available) const {
+        if (!compressor) {
+            return recordPrefix(segment, chunk);
+        }
+
+        // The MAC authenticates the descriptor; these checks only keep a forged one within the segment.
+        if (available < RECORD_PREFIX_SIZE) {
+            throw std::runtime_error("Decryption failed");
+        }
+        const uint32_t prefix = loadLittleEndian32(record);
+        const size_t cipherLen = prefix & RECORD_LENGTH_MASK;
+        if ((prefix & ~(RECORD_LENGTH_MASK | RECORD_FLAG_COMPRESSED)) != recordFlags(segment, chunk) ||
+            cipherLen < STREAM_ABYTES || cipherLen > chunkCipherSize(segment, chunk) ||
+            recordSize(prefix) > available) {
+            throw std::runtime_error("Decryption failed");
+        }
+        return prefix;
+    }
+
+    size_t ContainerLayout::recordSize(const uint32_t prefix) const {
+        const size_t cipherLen = prefix & RECORD_LENGTH_MASK;
+        return RECORD_PREFIX_SIZE + cipherLen + recordNoiseSize(cipherLen);
+    }
+
+    size_t ContainerLayout::recordNoiseSize(const size_t cipherLength) const {
+        if (!compressor) {
+            return noiseSize;
+        }
+        // Noise shrinks with the record so that compression saves I/O; full records keep all of it.
+        return std::min<uint64_t>(noiseSize, static_cast<uint64_t>(cipherLength) * noiseSize / chunkSize);
+    }
+
+    uint64_t ContainerLayout::recordOffset(const uint64_t segment, const size_t chunk) const {
+        return cipherOffset(segment) + STREAM_HEADER_SIZE +
+               static_cast<uint64_t>(chunk) *
+               (RECORD_PREFIX_SIZE + chunkSize + STREAM_ABYTES + noiseSize);
+    }
+
+    size_t ContainerLayout::fullSegmentChunkCount() const {
+        return chunksPerSegment;
+    }
+
+    uint64_t ContainerLayout::totalChunkCount() const {
+        return (segments - 1) * chunksPerSegment + lastSegmentChunks;
+    }
+
+    size_t ContainerLayout::maxRecordSize() const {
+        return RECORD_PREFIX_SIZE + chunkSize + paddingBlock + STREAM_ABYTES +
+               noiseSize;
+    }
+
+    uint64_t ContainerLayout::totalSize() const {
+        const uint64_t fullRecordSize = RECORD_PREFIX_SIZE + chunkSize + STREAM_ABYTES +
+                                        noiseSize;
+        const uint64_t lastSegmentSize = STREAM_HEADER_SIZE +
+                                         (lastSegmentChunks - 1) * fullRecordSize + RECORD_PREFIX_SIZE +
+                                         chunkCipherSize(segments - 1, lastSegmentChunks - 1) + noiseSize;
+        if (!segmentOffsets.empty()) {
+            return segmentOffsets.back() + segmentTableSize() + CONTAINER_TRAILER_SIZE;
+        }
+        return cipherOffset(segments - 1) + lastSegmentSize + segmentTableSize() + CONTAINER_TRAILER_SIZE;
+    }
+
+    uint64_t ContainerLayout::segmentTableSize() const {
+        return segments * segmentTableEntrySize();
+    }
+
+    size_t ContainerLayout::segmentTableEntrySize() const {
+        if (compressor) {
+            return SEGMENT_TABLE_ENTRY_SIZE;
+        }
+        return digests ? SEGMENT_DIGEST_ENTRY_SIZE : 0;
+    }
+
+    uint64_t ContainerLayout::segmentTableOffset() const {
+        return totalSize() - CONTAINER_TRAILER_SIZE - segmentTableSize();
+    }
+
+    void ContainerLayout::setSegmentSizes(const std::vector<uint64_t> &sizes) {
+        if (sizes.size() != segments) {
+            throw std::runtime_error("Container size mismatch");
+        }
+        // Every segment holds its stream header and at least the smallest record per chunk.
+        const uint64_t minRecordSize = RECORD_PREFIX_SIZE + STREAM_ABYTES +
+                                       recordNoiseSize(STREAM_ABYTES);
+        segmentOffsets.clear();
+        std::vector<uint64_t> offsets(segments + 1, CONTAINER_HEADER_SIZE);
+        for (uint64_t segment = 0; segment < segments; ++segment) {
+            if (sizes[segment] > segmentCipherSize(segment) ||
+                sizes[segment] < STREAM_HEADER_SIZE + chunkCount(segment) * minRecordSize) {
+                throw std::runtime_error("Container size mismatch");
+            }
+            offsets[segment + 1] = offsets[segment] + sizes[segment];
+        }
+        segmentOffsets = std::move(offsets);
+    }
+
+    void ContainerLayout::parseSegmentTable(const unsigned char *in) {
+        std::vector<uint64_t> sizes(segments);
+        for (uint64_t segment = 0; segment < segments; ++segment) {
+            sizes[segment] = loadLittleEndian64(in + segment * SEGMENT_TABLE_ENTRY_SIZE);
+        }
+        setSegmentSizes(sizes);
+    }
+
+    void ContainerLayout::serializeSegmentTable(unsigned char *out) const {
+        if (!compressor) {
+            return;
+        }
+        for (uint64_t segment = 0; segment < segments; ++segment) {
+            storeLittleEndian64(out + segment * SEGMENT_TABLE_ENTRY_SIZE, segmentCipherSize(segment));
+        }
+    }
+
+    bool ContainerLayout::isFinalChunk(const uint64_t segment, const size_t chunk) const {
+        return segment + 1 == segments && chunk + 1 == lastSegmentChunks;
+    }
+
+    uint64_t ContainerLayout::fullSegmentCipherSize() const {
+        return STREAM_HEADER_SIZE +
+               static_cast<uint64_t>(chunksPerSegment) *
+               (RECORD_PREFIX_SIZE + chunkSize + STREAM_ABYTES + noiseSize);
+    }
+
+    IntegrityError::IntegrityError(const uint64_t segment, const size_t chunk, const uint64_t offset)
+        : std::runtime_error("Chunk " + std::to_string(chunk) + " of segment " + std::to_string(segment) +
+                             " at offset " + std::to_string(offset) + " failed to authenticate"),
+          failedSegment(segment), failedChunk(chunk), failedOffset(offset) {
+    }
+} // namespace engines::encryption
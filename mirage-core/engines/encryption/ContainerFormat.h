@@ -0,0 +1,450 @@
+#ifndef CONTAINERFORMAT_H
+#define CONTAINERFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include <sodium.h>
+#include "../../utils/compression/Codec.h"
+#include "../../utils/crypto/CipherSuite.h"
+#include "../../utils/crypto/KeyDerivation.h"
+
+#define CONTAINER_VERSION 2
+#define CONTAINER_HEADER_SIZE 48
+#define CONTAINER_TRAILER_SIZE 48
+#define CONTAINER_LEGACY_PADDING_BLOCK_SIZE 16
+#define RECORD_PREFIX_SIZE 4
+#define RECORD_FLAG_SEGMENT_END 0x80000000u
+#define RECORD_FLAG_LAST_SEGMENT 0x40000000u
+#define RECORD_FLAG_COMPRESSED 0x20000000u
+#define RECORD_LENGTH_MASK 0x1fffffffu
+#define SEGMENT_TABLE_ENTRY_SIZE 8
+#define SEGMENT_DIGEST_ENTRY_SIZE (STREAM_HEADER_SIZE + crypto_generichash_BYTES)
+#define CONTAINER_FLAG_XOR_MASK 0x01u
+#define CONTAINER_FLAG_LATTICE_NOISE 0x02u
+#define CONTAINER_FLAG_COMPRESSED 0x04u
+#define CONTAINER_FLAG_UPDATABLE 0x08u
+#define CONTAINER_KNOWN_FLAGS (CONTAINER_FLAG_XOR_MASK | CONTAINER_FLAG_LATTICE_NOISE | CONTAINER_FLAG_COMPRESSED | \
+                               CONTAINER_FLAG_UPDATABLE)
+
+namespace engines::encryption {
+ /**
+  * @struct ContainerHeader
+  * @brief The fixed-size header at the start of every segmented container.
+  *
+  * The header records the whole chunk geometry, so a file decrypts with any engine holding the key,
+  * whatever chunk size that engine encrypts with. Layout (little-endian): magic "MIRAGESG" (8),
+  * version (1), flags (1), codec (1), cipher suite (1), chunks per segment (4), file identifier (FILE_ID_SIZE), chunk
+  * size (4), noise size (4), rekey interval in chunks (4), padding block size (4). Containers written before cipher
+  * suites existed hold zero in the suite byte, which is CIPHER_SUITE_XCHACHA20_POLY1305, and containers written
+  * before security profiles hold zero in the padding field, which reads as CONTAINER_LEGACY_PADDING_BLOCK_SIZE.
+  */
+ struct ContainerHeader {
+  uint8_t flags{}; /**< CONTAINER_FLAG_* bits. */
+  uint8_t codec{}; /**< CODEC_* chunk compressor; CODEC_NONE unless CONTAINER_FLAG_COMPRESSED is set. */
+  uint8_t cipherSuite{}; /**< CIPHER_SUITE_* identifier of the stream cipher of every segment. */
+  uint32_t chunksPerSegment{}; /**< Number of chunks in every segment but the last. */
+  unsigned char fileId[FILE_ID_SIZE]{}; /**< Random identifier the file key is derived from. */
+  uint32_t chunkSize{}; /**< Plaintext size of a full chunk. */
+  uint32_t noiseSize{}; /**< Noise bytes appended to every chunk record. */
+  uint32_t rekeyInterval{}; /**< Number of chunks between two rekeys of a segment's stream. */
+  uint32_t paddingBlockSize = CONTAINER_LEGACY_PADDING_BLOCK_SIZE; /**< Block the final chunk is padded to. */
+
+  /**
+   * @brief Serializes the header.
+   *
+   * @param out Output buffer of CONTAINER_HEADER_SIZE bytes.
+   */
+  void serialize(unsigned char *out) const;
+
+  /**
+   * @brief Parses a serialized header.
+   *
+   * Throws if the magic or version does not match, a flag, the codec or the cipher suite is unknown, the flags
+   * combine compression with incremental updates or the geometry is invalid, such as a padding block that is
+   * not a power of two dividing the chunk size.
+   *
+   * @param in Input buffer of CONTAINER_HEADER_SIZE bytes.
+   * @return The parsed header.
+   */
+  static ContainerHeader parse(const unsigned char *in);
+ };
+
+ /**
+  * @struct ContainerTrailer
+  * @brief The fixed-size trailer at the end of every segmented container.
+  *
+  * The trailer commits to the serialized header, the number of segments and the plaintext size with a
+  * keyed BLAKE2b MAC, so dropping whole segments from the end of a file is detected before decryption
+  * starts. Compressed and updatable containers also commit to the segment table in front of the trailer. Layout
+  * (little-endian): segment count (8), plaintext size (8), MAC (crypto_generichash_BYTES).
+  */
+ struct ContainerTrailer {
+  uint64_t segmentCount{}; /**< Number of segments in the container. */
+  uint64_t plaintextSize{}; /**< Size of the original plaintext in bytes. */
+  unsigned char mac[crypto_generichash_BYTES]{}; /**< Commitment over the header and the fields above. */
+
+  /**
+   * @brief Computes the MAC over the header and the trailer fields.
+   *
+   * @param commitmentKey The key derived with utils::crypto::KeyDerivation::deriveCommitmentKey.
+   * @param header The serialized header.
+   * @param segmentTable The serialized segment table; empty unless the container is compressed or updatable.
+   */
+  void seal(const unsigned char *commitmentKey, const unsigned char *header,
+            std::span<const unsigned char> segmentTable);
+
+  /**
+   * @brief Checks the MAC over the header and the trailer fields.
+   *
+   * @param commitmentKey The key derived with utils::crypto::KeyDerivation::deriveCommitmentKey.
+   * @param header The serialized header.
+   * @param segmentTable The serialized segment table; empty unless the container is compressed or updatable.
+   * @return True if the MAC is valid.
+   */
+  [[nodiscard]] bool verify(const unsigned char *commitmentKey, const unsigned char *header,
+                            std::span<const unsigned char> segmentTable) const;
+
+  /**
+   * @brief Serializes the trailer.
+   *
+   * @param out Output buffer of CONTAINER_TRAILER_SIZE bytes.
+   */
+  void serialize(unsigned char *out) const;
+
+  /**
+   * @brief Parses a serialized trailer.
+   *
+   * @param in Input buffer of CONTAINER_TRAILER_SIZE bytes.
+   * @return The parsed trailer.
+   */
+  static ContainerTrailer parse(const unsigned char *in);
+ };
+
+ /**
+  * @class ContainerLayout
+  * @brief Computes where every segment and chunk of a container lives.
+  *
+  * A container holds the plaintext split into segments of chunksPerSegment chunks. Every segment starts
+  * with its own stream header and is followed by its chunk records: a RECORD_PREFIX_SIZE-byte
+  * descriptor, the ciphertext and the mask noise. Only the final chunk of the last segment is padded,
+  * so every offset follows from the geometry and the plaintext size, and segments can be processed
+  * independently. The layout therefore doubles as the chunk index of a container: both inputs are
+  * covered by the trailer MAC, so the position of any byte range is found without reading, or trusting,
+  * anything but the header and the trailer.
+  *
+  * In compressed containers every chunk is compressed before it is encrypted, unless that does not pay,
+  * and its descriptor carries RECORD_FLAG_COMPRESSED when it was. Records then vary in size and their noise
+  * scales with their ciphertext, so the container size of every segment is stored in a segment table of
+  * SEGMENT_TABLE_ENTRY_SIZE-byte entries between the last segment and the trailer, which the trailer MAC
+  * covers. Segment offsets come from the table once setSegmentSizes() or parseSegmentTable() was called;
+  * until then, and for every size that concerns a single record, the layout gives upper bounds, which
+  * writers use as slots that are packed together afterwards. Within a segment, records are found by
+  * walking their descriptors.
+  *
+  * Updatable containers keep the fixed layout and store SEGMENT_DIGEST_ENTRY_SIZE-byte entries in the segment
+  * table instead: every segment's stream header followed by a keyed BLAKE2b digest of its plaintext.
+  * The digests let an update find the segments whose plaintext changed without decrypting anything, and since
+  * the trailer MAC covers the stream headers, a segment rolled back to an earlier version of the file no
+  * longer matches the table.
+  */
+ class ContainerLayout {
+ public:
+  /**
+   * @brief Constructs a new ContainerLayout object.
+   *
+   * @param header The header holding the chunk geometry.
+   * @param plaintextSize The size of the plaintext in bytes.
+   */
+  ContainerLayout(const ContainerHeader &header, uint64_t plaintextSize);
+
+  /**
+   * @brief Gets the plaintext size of a full chunk.
+   */
+  [[nodiscard]] size_t chunkLength() const;
+
+  /**
+   * @brief Gets the number of noise bytes appended to every chunk record.
+   */
+  [[nodiscard]] size_t noiseLength() const;
+
+  /**
+   * @brief Gets the number of chunks between two rekeys of a segment's stream.
+   */
+  [[nodiscard]] size_t rekeyInterval() const;
+
+  /**
+   * @brief Gets the block the final chunk of the container is padded to.
+   */
+  [[nodiscard]] size_t paddingBlockSize() const;
+
+  /**
+   * @brief Tells whether the ciphertext of every record is XORed with the engine's XOR key.
+   */
+  [[nodiscard]] bool xorMasked() const;
+
+  /**
+   * @brief Tells whether the ciphertext of every record carries lattice noise keyed by the file key.
+   */
+  [[nodiscard]] bool latticeNoised() const;
+
+  /**
+   * @brief Gets the CIPHER_SUITE_* identifier of the stream cipher of every segment.
+   */
+  [[nodiscard]] uint8_t cipherSuite() const;
+
+  /**
+   * @brief Gets the codec chunks are compressed with, or nullptr if the container is not compressed.
+   */
+  [[nodiscard]] const utils::compression::Codec *codec() const;
+
+  /**
+   * @brief Tells whether chunks are compressed before they are encrypted.
+   */
+  [[nodiscard]] bool compressed() const;
+
+  /**
+   * @brief Tells whether the segment table holds the stream header and plaintext digest of every segment.
+   */
+  [[nodiscard]] bool updatable() const;
+
+  /**
+   * @brief Gets the size of the plaintext in bytes.
+   */
+  [[nodiscard]] uint64_t plaintextLength() const;
+
+  /**
+   * @brief Gets the index of the segment holding a plaintext position.
+   */
+  [[nodiscard]] uint64_t segmentAt(uint64_t position) const;
+
+  /**
+   * @brief Gets the number of segments.
+   */
+  [[nodiscard]] uint64_t segmentCount() const;
+
+  /**
+   * @brief Gets the number of chunks in a segment.
+   */
+  [[nodiscard]] size_t chunkCount(uint64_t segment) const;
+
+  /**
+   * @brief Gets the offset of a segment's first byte in the plaintext.
+   */
+  [[nodiscard]] uint64_t plainOffset(uint64_t segment) const;
+
+  /**
+   * @brief Gets the plaintext size of a segment.
+   */
+  [[nodiscard]] uint64_t plainSize(uint64_t segment) const;
+
+  /**
+   * @brief Gets the offset of a segment's stream header in the container.
+   */
+  [[nodiscard]] uint64_t cipherOffset(uint64_t segment) const;
+
+  /**
+   * @brief Gets the container size of a segment, from its stream header to the noise of its last record.
+   */
+  [[nodiscard]] uint64_t segmentCipherSize(uint64_t segment) const;
+
+  /**
+   * @brief Gets the plaintext size of a chunk.
+   */
+  [[nodiscard]] size_t chunkPlainSize(uint64_t segment, size_t chunk) const;
+
+  /**
+   * @brief Gets the ciphertext size of a chunk, excluding the record prefix and the noise.
+   *
+   * In compressed containers this is the size of a chunk stored uncompressed, which bounds the others.
+   */
+  [[nodiscard]] size_t chunkCipherSize(uint64_t segment, size_t chunk) const;
+
+  /**
+   * @brief Gets the flags of the descriptor stored in front of a chunk record.
+   */
+  [[nodiscard]] uint32_t recordFlags(uint64_t segment, size_t chunk) const;
+
+  /**
+   * @brief Gets the descriptor stored in front of a chunk record of a container that is not compressed.
+   */
+  [[nodiscard]] uint32_t recordPrefix(uint64_t segment, size_t chunk) const;
+
+  /**
+   * @brief Gets the descriptor a chunk record must carry.
+   *
+   * In compressed containers the descriptor is read from the record and checked against the geometry;
+   * throws if it does not match or the record would overrun the bytes available.
+   *
+   * @param segment The index of the segment.
+   * @param chunk The index of the chunk in the segment.
+   * @param record The record, starting at its descriptor.
+   * @param available The number of container bytes from the record to the end of its segment.
+   * @return The descriptor, which the record's MAC authenticates.
+   */
+  [[nodiscard]] uint32_t readRecordPrefix(uint64_t segment, size_t chunk, const unsigned char *record,
+                                          uint64_t available) const;
+
+  /**
+   * @brief Gets the container size of a record, descriptor and noise included.
+   *
+   * @param prefix The descriptor of the record.
+   */
+  [[nodiscard]] size_t recordSize(uint32_t prefix) const;
+
+  /**
+   * @brief Gets the number of noise bytes behind a record's ciphertext.
+   *
+   * @param cipherLength The ciphertext size of the record.
+   */
+  [[nodiscard]] size_t recordNoiseSize(size_t cipherLength) const;
+
+  /**
+   * @brief Gets the offset of a chunk record in a container that is not compressed.
+   */
+  [[nodiscard]] uint64_t recordOffset(uint64_t segment, size_t chunk) const;
+
+  /**
+   * @brief Gets the number of chunks in every segment but the last.
+   */
+  [[nodiscard]] size_t fullSegmentChunkCount() const;
+
+  /**
+   * @brief Gets the container size of a full segment, from its stream header to its last record.
+   *
+   * In compressed containers this bounds the size of every segment.
+   */
+  [[nodiscard]] uint64_t fullSegmentCipherSize() const;
+
+  /**
+   * @brief Gets the number of chunks in the container.
+   */
+  [[nodiscard]] uint64_t totalChunkCount() const;
+
+  /**
+   * @brief Gets the size of a full chunk record.
+   */
+  [[nodiscard]] size_t maxRecordSize() const;
+
+  /**
+   * @brief Gets the total size of the container, including header, segment table and trailer.
+   */
+  [[nodiscard]] uint64_t totalSize() const;
+
+  /**
+   * @brief Gets the size of the segment table; zero unless the container is compressed or updatable.
+   */
+  [[nodiscard]] uint64_t segmentTableSize() const;
+
+  /**
+   * @brief Gets the size of a segment table entry; zero if the container has no segment table.
+   */
+  [[nodiscard]] size_t segmentTableEntrySize() const;
+
+  /**
+   * @brief Gets the offset of the segment table, which the trailer directly follows.
+   */
+  [[nodiscard]] uint64_t segmentTableOffset() const;
+
+  /**
+   * @brief Sets the container size of every segment of a compressed container.
+   *
+   * Throws if the number of sizes differs from the number of segments or a size exceeds its bound.
+   *
+   * @param sizes The size of every segment.
+   */
+  void setSegmentSizes(const std::vector<uint64_t> &sizes);
+
+  /**
+   * @brief Reads the segment table of a compressed container and sets the segment sizes from it.
+   *
+   * @param in Input buffer of segmentTableSize() bytes.
+   */
+  void parseSegmentTable(const unsigned char *in);
+
+  /**
+   * @brief Serializes the segment table of a compressed container.
+   *
+   * Writes nothing for other containers; the entries of updatable ones come from the segments' encryption.
+   *
+   * @param out Output buffer of segmentTableSize() bytes.
+   */
+  void serializeSegmentTable(unsigned char *out) const;
+
+  /**
+   * @brief Tells whether a chunk is the padded final chunk of the container.
+   */
+  [[nodiscard]] bool isFinalChunk(uint64_t segment, size_t chunk) const;
+
+ private:
+  size_t chunkSize; /**< Plaintext size of a full chunk. */
+  size_t noiseSize; /**< Noise bytes per record. */
+  size_t chunksPerSegment; /**< Chunks in every segment but the last. */
+  size_t rekeyChunks; /**< Chunks between two rekeys. */
+  size_t paddingBlock; /**< Block the final chunk is padded to. */
+  uint64_t plaintextSize; /**< Size of the plaintext. */
+  uint64_t segments; /**< Number of segments. */
+  size_t lastSegmentChunks; /**< Number of chunks in the last segment. */
+  size_t finalChunkPlainSize; /**< Unpadded size of the final chunk. */
+  bool xorMask; /**< Whether record ciphertexts are XOR-masked. */
+  bool latticeNoise; /**< Whether record ciphertexts carry lattice noise. */
+  uint8_t suite; /**< The stream cipher of every segment. */
+  const utils::compression::Codec *compressor; /**< The codec of compressed records, or nullptr. */
+  bool digests; /**< Whether the segment table holds segment digests. */
+  std::vector<uint64_t> segmentOffsets; /**< Offset of every segment and of the table, once the sizes are set. */
+ };
+
+ /**
+  * @class IntegrityError
+  * @brief Thrown when a record of a container whose trailer authenticates does not.
+  *
+  * Records are found from the authenticated layout, so the position is that of the first record of its segment
+  * that failed: its descriptor, MAC, stream tag, padding or compressed payload is not what was written.
+  */
+ class IntegrityError : public std::runtime_error {
+ public:
+  /**
+   * @brief Constructs a new IntegrityError object.
+   *
+   * @param segment The index of the segment.
+   * @param chunk The index of the chunk in the segment; the chunk count for bytes behind the last record.
+   * @param offset The offset of the record in the container.
+   */
+  IntegrityError(uint64_t segment, size_t chunk, uint64_t offset);
+
+  [[nodiscard]] uint64_t segment() const { return failedSegment; }
+
+  [[nodiscard]] size_t chunk() const { return failedChunk; }
+
+  [[nodiscard]] uint64_t offset() const { return failedOffset; }
+
+ private:
+  uint64_t failedSegment; /**< The index of the segment. */
+  size_t failedChunk; /**< The index of the chunk in the segment. */
+  uint64_t failedOffset; /**< The offset of the record in the container. */
+ };
+
+ /**
+  * @brief Writes a 32-bit value in little-endian byte order.
+  */
+ void storeLittleEndian32(unsigned char *out, uint32_t value);
+
+ /**
+  * @brief Writes a 64-bit value in little-endian byte order.
+  */
+ void storeLittleEndian64(unsigned char *out, uint64_t value);
+
+ /**
+  * @brief Reads a 32-bit little-endian value.
+  */
+ [[nodiscard]] uint32_t loadLittleEndian32(const unsigned char *in);
+
+ /**
+  * @brief Reads a 64-bit little-endian value.
+  */
+ [[nodiscard]] uint64_t loadLittleEndian64(const unsigned char *in);
+} // namespace engines::encryption
+
+#endif // CONTAINERFORMAT_H
@@ -0,0 +1,410 @@
+#include "EncryptionStream.h"
+#include "PolymorphicEncryptionEngine.h"
+#include "../../utils/crypto/NoiseGenerator.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace engines::encryption {
+    EncryptionStream::EncryptionStream(const PolymorphicEncryptionEngine &engine)
+        : EncryptionStream(engine, engine.profile) {
+    }
+
+    EncryptionStream::EncryptionStream(const PolymorphicEncryptionEngine &engine, const SecurityProfile &profile)
+        : engine(engine), header(engine.createHeader(profile)), buffered(0), segments(0), started(false),
+          finished(false) {
+        header.serialize(headerBytes);
+        utils::crypto::KeyDerivation::deriveFileKey(fileKey.data(), engine.key, header.fileId);
+        utils::crypto::NoiseGenerator::createSeed(noiseSeed.data());
+        segmentBuffer = engine.buffers->acquire(static_cast<size_t>(header.chunkSize) * header.chunksPerSegment);
+    }
+
+    EncryptionStream::~EncryptionStream() = default;
+
+    size_t EncryptionStream::maxUpdateSize(const size_t inputLength) const {
+        const size_t segmentCipherSize = ContainerLayout(header, 0).fullSegmentCipherSize();
+        return (started ? 0 : CONTAINER_HEADER_SIZE) + (inputLength / segmentBuffer.size() + 1) * segmentCipherSize;
+    }
+
+    size_t EncryptionStream::update(std::span<const unsigned char> input, const std::span<unsigned char> output) {
+        if (finished) {
+            throw std::logic_error("Stream is already finished");
+        }
+        if (output.size() < maxUpdateSize(input.size())) {
+            throw std::invalid_argument("Output buffer is too small");
+        }
+        unsigned char *out = output.data();
+        out += writeHeader(out);
+
+        // A segment is sealed only once data past its end arrives: the last segment is flagged and padded.
+        const size_t segmentSize = segmentBuffer.size();
+        if (buffered > 0) {
+            const size_t taken = std::min(segmentSize - buffered, input.size());
+            std::copy_n(input.data(), taken, segmentBuffer.data() + buffered);
+            buffered += taken;
+            input = input.subspan(taken);
+            if (input.empty()) {
+                return out - output.data();
+            }
+            out += sealSegments(segmentBuffer.data(), 1, out);
+            buffered = 0;
+        }
+
+        if (!input.empty()) {
+            const size_t direct = (input.size() - 1) / segmentSize;
+            out += sealSegments(input.data(), direct, out);
+            input = input.subspan(direct * segmentSize);
+            std::copy_n(input.data(), input.size(), segmentBuffer.data());
+            buffered = input.size();
+        }
+        return out - output.data();
+    }
+
+    size_t EncryptionStream::maxFinishSize() const {
+        const ContainerLayout layout(header, 0);
+        const size_t tableSize = (segments + 1) * layout.segmentTableEntrySize();
+        return (started ? 0 : CONTAINER_HEADER_SIZE) + layout.fullSegmentCipherSize() + header.paddingBlockSize +
+               tableSize + CONTAINER_TRAILER_SIZE;
+    }
+
+    size_t EncryptionStream::finish(const std::span<unsigned char> output) {
+        if (finished) {
+            throw std::logic_error("Stream is already finished");
+        }
+        if (output.size() < maxFinishSize()) {
+            throw std::invalid_argument("Output buffer is too small");
+        }
+        unsigned char *out = output.data();
+        out += writeHeader(out);
+
+        ContainerLayout layout(header, segments * segmentBuffer.size() + buffered);
+        segmentDigests.resize(layout.segmentTableSize());
+        unsigned char *entry = segmentDigests.data() + segments * layout.segmentTableEntrySize();
+        segmentSizes.push_back(engine.encryptSegment(segmentBuffer.data(), out, layout, fileKey.data(),
+                                                     noiseSeed.data(), segments, entry));
+        out += segmentSizes.back();
+        if (layout.compressed()) {
+            layout.setSegmentSizes(segmentSizes);
+        }
+        if (layout.updatable()) {
+            std::copy(segmentDigests.begin(), segmentDigests.end(), out);
+        }
+        engine.sealTrailer(out, layout, headerBytes, fileKey.data());
+        out += layout.segmentTableSize() + CONTAINER_TRAILER_SIZE;
+
+        finished = true;
+        sodium_memzero(segmentBuffer.data(), segmentBuffer.size());
+        return out - output.data();
+    }
+
+    size_t EncryptionStream::writeHeader(unsigned char *out) {
+        if (started) {
+            return 0;
+        }
+        started = true;
+        std::memcpy(out, headerBytes, sizeof(headerBytes));
+        return sizeof(headerBytes);
+    }
+
+    size_t EncryptionStream::sealSegments(const unsigned char *plaintext, const uint64_t count, unsigned char *out) {
+        if (count == 0) {
+            return 0;
+        }
+
+        // Any plaintext size past the end of these segments gives them their non-final layout.
+        const size_t segmentSize = segmentBuffer.size();
+        const ContainerLayout layout(header, (segments + count) * segmentSize + 1);
+        const uint64_t segmentCipherSize = layout.fullSegmentCipherSize();
+        const size_t first = segmentSizes.size();
+        segmentSizes.resize(first + count);
+        segmentDigests.resize((segments + count) * layout.segmentTableEntrySize());
+        engine.forEachSegment(count, [&](const uint64_t index) {
+            segmentSizes[first + index] = engine.encryptSegment(plaintext + index * segmentSize,
+                                                                out + index * segmentCipherSize, layout, fileKey.data(),
+                                                                noiseSeed.data(), segments + index,
+                                                                segmentDigests.data() +
+                                                                (segments + index) * layout.segmentTableEntrySize());
+        });
+        segments += count;
+        // Compressed segments come out shorter than their slots and are moved together.
+        return PolymorphicEncryptionEngine::packSegments(out, segmentCipherSize,
+                                                         {segmentSizes.data() + first, static_cast<size_t>(count)});
+    }
+
+    DecryptionStream::DecryptionStream(const PolymorphicEncryptionEngine &engine)
+        : engine(engine), codec(nullptr), pending(CONTAINER_HEADER_SIZE), pendingLen(0), phase(Phase::Header),
+          afterNoise(Phase::Record), noiseLeft(0), segment(0), chunk(0), untilRekey(0), lastSegment(false), consumed(0),
+          produced(0), segmentStart(CONTAINER_HEADER_SIZE), tableEntrySize(0), tableEntry(0) {
+    }
+
+    DecryptionStream::~DecryptionStream() {
+        sodium_memzero(pending.data(), pending.size());
+    }
+
+    size_t DecryptionStream::maxUpdateSize(const size_t inputLength) const {
+        // A record completed by this input may have been buffered by earlier calls.
+        if (phase == Phase::Header) {
+            return inputLength;
+        }
+        const size_t pendingRecord = header.chunkSize + header.paddingBlockSize;
+        if (!codec) {
+            return inputLength + pendingRecord;
+        }
+        return inputLength / minRecordSize() * header.chunkSize + pendingRecord;
+    }
+
+    size_t DecryptionStream::maxInputSize(const size_t outputLength) const {
+        if (phase == Phase::Header) {
+            return CONTAINER_HEADER_SIZE - pendingLen;
+        }
+        const size_t pendingRecord = header.chunkSize + header.paddingBlockSize;
+        if (outputLength <= pendingRecord) {
+            return 0;
+        }
+        if (!codec) {
+            return outputLength - pendingRecord;
+        }
+        return ((outputLength - pendingRecord) / header.chunkSize + 1) * minRecordSize() - 1;
+    }
+
+    size_t DecryptionStream::update(std::span<const unsigned char> input, const std::span<unsigned char> output) {
+        if (output.size() < maxUpdateSize(input.size())) {
+            throw std::invalid_argument("Output buffer is too small");
+        }
+        unsigned char *out = output.data();
+
+        while (!input.empty()) {
+            switch (phase) {
+                case Phase::Header: {
+                    if (!gather(input, CONTAINER_HEADER_SIZE)) {
+                        break;
+                    }
+                    header = ContainerHeader::parse(pending.data());
+                    std::memcpy(headerBytes, pending.data(), CONTAINER_HEADER_SIZE);
+                    utils::crypto::KeyDerivation::deriveFileKey(fileKey.data(), engine.key, header.fileId);
+                    latticeNoise = PolymorphicEncryptionEngine::createLatticeNoise(
+                        (header.flags & CONTAINER_FLAG_LATTICE_NOISE) != 0, fileKey.data());
+                    codec = ContainerLayout(header, 0).codec();
+                    tableEntrySize = ContainerLayout(header, 0).segmentTableEntrySize();
+                    if (codec) {
+                        unpacked = engine.buffers->acquire(header.chunkSize + header.paddingBlockSize);
+                    }
+                    pending.resize(std::max<size_t>({
+                        CONTAINER_TRAILER_SIZE, SEGMENT_DIGEST_ENTRY_SIZE,
+                        RECORD_PREFIX_SIZE + header.chunkSize + header.paddingBlockSize +
+                        STREAM_ABYTES
+                    }));
+                    phase = Phase::StreamHeader;
+                    // Until now the output bound did not know how far compressed records expand.
+                    const auto room = static_cast<size_t>(output.data() + output.size() - out);
+                    if (codec && room < maxUpdateSize(input.size())) {
+                        throw std::invalid_argument("Output buffer is too small");
+                    }
+                    break;
+                }
+
+                case Phase::StreamHeader: {
+                    if (!gather(input, STREAM_HEADER_SIZE)) {
+                        break;
+                    }
+                    utils::crypto::DerivedKey segmentKey;
+                    utils::crypto::KeyDerivation::deriveSegmentKey(segmentKey.data(), fileKey.data(), segment);
+                    cryptoStateHandler.emplace(header.cipherSuite, segmentKey.data(), pending.data());
+                    if ((header.flags & CONTAINER_FLAG_UPDATABLE) != 0) {
+                        streamHeaders.insert(streamHeaders.end(), pending.data(),
+                                             pending.data() + STREAM_HEADER_SIZE);
+                    }
+                    chunk = 0;
+                    untilRekey = header.rekeyInterval;
+                    phase = Phase::Record;
+                    break;
+                }
+
+                case Phase::Record: {
+                    // Records that lie within the input are decrypted in place; split ones are buffered.
+                    const unsigned char *record;
+                    if (pendingLen == 0 && input.size() >= RECORD_PREFIX_SIZE &&
+                        input.size() >= RECORD_PREFIX_SIZE + (loadLittleEndian32(input.data()) & RECORD_LENGTH_MASK)) {
+                        record = input.data();
+                        const size_t recordLen = RECORD_PREFIX_SIZE + (loadLittleEndian32(record) & RECORD_LENGTH_MASK);
+                        input = input.subspan(recordLen);
+                        consumed += recordLen;
+                    } else {
+                        if (pendingLen < RECORD_PREFIX_SIZE) {
+                            if (!gather(input, RECORD_PREFIX_SIZE)) {
+                                break;
+                            }
+                            // Keep the descriptor and collect the ciphertext behind it.
+                            pendingLen = RECORD_PREFIX_SIZE;
+                        }
+                        const size_t cipherLen = loadLittleEndian32(pending.data()) & RECORD_LENGTH_MASK;
+                        if (cipherLen > pending.size() - RECORD_PREFIX_SIZE) {
+                            throw std::runtime_error("Decryption failed");
+                        }
+                        if (!gather(input, RECORD_PREFIX_SIZE + cipherLen)) {
+                            break;
+                        }
+                        record = pending.data();
+                    }
+                    out += openRecord(record, out);
+                    break;
+                }
+
+                case Phase::Noise: {
+                    const size_t skipped = std::min(noiseLeft, input.size());
+                    input = input.subspan(skipped);
+                    consumed += skipped;
+                    noiseLeft -= skipped;
+                    if (noiseLeft == 0) {
+                        phase = afterNoise;
+                    }
+                    break;
+                }
+
+                case Phase::SegmentTable: {
+                    if (!gather(input, tableEntrySize)) {
+                        break;
+                    }
+                    // The trailer MAC covers the table; the entries must also match the segments that were read.
+                    if (tableEntry == segmentSizes.size()) {
+                        throw std::runtime_error("Container size mismatch");
+                    }
+                    if (codec && loadLittleEndian64(pending.data()) != segmentSizes[tableEntry]) {
+                        throw std::runtime_error("Container size mismatch");
+                    }
+                    if (!codec && std::memcmp(pending.data(),
+                                              streamHeaders.data() +
+                                              tableEntry * STREAM_HEADER_SIZE,
+                                              STREAM_HEADER_SIZE) != 0) {
+                        throw std::runtime_error("Container authentication failed");
+                    }
+                    segmentTable.insert(segmentTable.end(), pending.data(), pending.data() + tableEntrySize);
+                    if (++tableEntry == segmentSizes.size()) {
+                        phase = Phase::Trailer;
+                    }
+                    break;
+                }
+
+                case Phase::Trailer: {
+                    if (!gather(input, CONTAINER_TRAILER_SIZE)) {
+                        break;
+                    }
+                    checkTrailer(pending.data());
+                    phase = Phase::Done;
+                    break;
+                }
+
+                case Phase::Done:
+                    throw std::runtime_error("Unexpected data after the container");
+            }
+        }
+        return out - output.data();
+    }
+
+    void DecryptionStream::finish() {
+        if (phase != Phase::Done) {
+            throw std::runtime_error("Encrypted stream is truncated");
+        }
+        sodium_memzero(pending.data(), pending.size());
+    }
+
+    bool DecryptionStream::gather(std::span<const unsigned char> &input, const size_t need) {
+        const size_t taken = std::min(need - pendingLen, input.size());
+        std::copy_n(input.data(), taken, pending.data() + pendingLen);
+        pendingLen += taken;
+        input = input.subspan(taken);
+        consumed += taken;
+        if (pendingLen < need) {
+            return false;
+        }
+        pendingLen = 0;
+        return true;
+    }
+
+    size_t DecryptionStream::openRecord(const unsigned char *record, unsigned char *out) {
+        const uint32_t prefix = loadLittleEndian32(record);
+        const size_t cipherLen = prefix & RECORD_LENGTH_MASK;
+        const bool segmentEnd = (prefix & RECORD_FLAG_SEGMENT_END) != 0;
+        if (chunk == 0) {
+            lastSegment = (prefix & RECORD_FLAG_LAST_SEGMENT) != 0;
+        }
+
+        // The descriptor is authenticated below; these checks keep it consistent with the header's geometry.
+        const bool finalChunk = segmentEnd && lastSegment;
+        const bool packed = (prefix & RECORD_FLAG_COMPRESSED) != 0;
+        const size_t fullCipherLen = header.chunkSize + STREAM_ABYTES;
+        if (lastSegment != ((prefix & RECORD_FLAG_LAST_SEGMENT) != 0) || (packed && !codec) ||
+            (finalChunk
+                 ? cipherLen > fullCipherLen + header.paddingBlockSize
+                 : codec ? cipherLen > fullCipherLen : cipherLen != fullCipherLen) ||
+            (chunk + 1 == header.chunksPerSegment && !segmentEnd) ||
+            (segmentEnd && !lastSegment && chunk + 1 != header.chunksPerSegment)) {
+            throw std::runtime_error("Decryption failed");
+        }
+
+        // Compressed payloads are decrypted aside and expand into the output.
+        unsigned char *payload = packed ? unpacked.data() : out;
+        const size_t payloadLen = engine.openRecord(*cryptoStateHandler, prefix,
+                                                    (header.flags & CONTAINER_FLAG_XOR_MASK) != 0, latticeNoise.get(),
+                                                    segment * header.chunksPerSegment + chunk, record, payload);
+        const size_t outLen = PolymorphicEncryptionEngine::unpackChunk(codec, prefix,
+                                                                       finalChunk ? header.paddingBlockSize : 0,
+                                                                       payload, payloadLen, out, header.chunkSize);
+        if (finalChunk ? outLen > header.chunkSize : outLen != header.chunkSize) {
+            throw std::runtime_error("Decryption failed");
+        }
+        const size_t noiseSize = ContainerLayout(header, 0).recordNoiseSize(cipherLen);
+        produced += outLen;
+        COUNT_STAT(bytesIn, RECORD_PREFIX_SIZE + cipherLen + noiseSize);
+        COUNT_STAT(bytesOut, outLen);
+
+        if (--untilRekey == 0) {
+            engine.rekey(*cryptoStateHandler);
+            untilRekey = header.rekeyInterval;
+        }
+        if (segmentEnd) {
+            COUNT_STAT(segments, 1);
+            utils::metrics::flushStats();
+        }
+
+        if (segmentEnd) {
+            segmentSizes.push_back(consumed + noiseSize - segmentStart);
+            segmentStart = consumed + noiseSize;
+        }
+        if (finalChunk) {
+            afterNoise = tableEntrySize > 0 ? Phase::SegmentTable : Phase::Trailer;
+        } else if (segmentEnd) {
+            afterNoise = Phase::StreamHeader;
+            ++segment;
+        } else {
+            afterNoise = Phase::Record;
+            ++chunk;
+        }
+        noiseLeft = noiseSize;
+        phase = noiseLeft > 0 ? Phase::Noise : afterNoise;
+        return outLen;
+    }
+
+    size_t DecryptionStream::minRecordSize() const {
+        return ContainerLayout(header, 0).recordSize(STREAM_ABYTES);
+    }
+
+    void DecryptionStream::checkTrailer(const unsigned char *trailerBytes) const {
+        const ContainerTrailer trailer = ContainerTrailer::parse(trailerBytes);
+        ContainerLayout layout(header, produced);
+        if (codec) {
+            layout.setSegmentSizes(segmentSizes);
+        }
+
+        utils::crypto::DerivedKey commitmentKey;
+        utils::crypto::KeyDerivation::deriveCommitmentKey(commitmentKey.data(), fileKey.data());
+        if (!trailer.verify(commitmentKey.data(), headerBytes, segmentTable)) {
+            throw std::runtime_error("Container authentication failed");
+        }
+
+        if (trailer.plaintextSize != produced || trailer.segmentCount != segment + 1 ||
+            layout.segmentCount() != trailer.segmentCount || layout.totalSize() != consumed) {
+            throw std::runtime_error("Container size mismatch");
+        }
+    }
+} // namespace engines::encryption
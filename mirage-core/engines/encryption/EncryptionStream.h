@@ -0,0 +1,265 @@
+#ifndef ENCRYPTIONSTREAM_H
+#define ENCRYPTIONSTREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+#include "ContainerFormat.h"
+#include "SecurityProfile.h"
+#include "../../utils/crypto/CryptoStateHandler.h"
+#include "../../utils/crypto/KeyDerivation.h"
+#include "../../utils/math/LatticeNoise.h"
+#include "../../utils/memory/SecureBufferPool.h"
+
+namespace engines::encryption {
+ class PolymorphicEncryptionEngine;
+
+ /**
+  * @class EncryptionStream
+  * @brief Encrypts data that arrives in pieces into a segmented container.
+  *
+  * The stream produces the same container as PolymorphicEncryptionEngine::encrypt(). The last segment is
+  * flagged and padded differently from the others, so a segment is only sealed once data past its end has
+  * been pushed; up to one segment of plaintext is held in a buffer leased from the engine's pool when the
+  * stream is created. Runs of whole segments pushed at once are encrypted in parallel straight from the
+  * input. Output goes to caller-provided buffers sized with maxUpdateSize() and maxFinishSize(); in compressed
+  * and updatable containers the latter grows with the segment table, so it is checked again before finish().
+  */
+ class EncryptionStream {
+ public:
+  /**
+   * @brief Constructs a new EncryptionStream object.
+   *
+   * @param engine The engine providing the key, the chunk geometry and the workers; it must outlive the stream.
+   */
+  explicit EncryptionStream(const PolymorphicEncryptionEngine &engine);
+
+  /**
+   * @brief Constructs a new EncryptionStream object that writes a container with a given security profile.
+   *
+   * Throws std::invalid_argument if the profile does not fit the engine's chunk size.
+   *
+   * @param engine The engine providing the key, the chunk geometry and the workers; it must outlive the stream.
+   * @param profile The rekey interval, padding, noise and optional stages of the container.
+   */
+  EncryptionStream(const PolymorphicEncryptionEngine &engine, const SecurityProfile &profile);
+
+  /**
+   * @brief Destroys the EncryptionStream object, erasing the buffered plaintext.
+   */
+  ~EncryptionStream();
+
+  EncryptionStream(const EncryptionStream &) = delete;
+
+  EncryptionStream &operator=(const EncryptionStream &) = delete;
+
+  /**
+   * @brief Gets the output buffer size update() needs for an input.
+   *
+   * @param inputLength The length of the input.
+   * @return The largest number of bytes update() may write.
+   */
+  [[nodiscard]] size_t maxUpdateSize(size_t inputLength) const;
+
+  /**
+   * @brief Pushes plaintext into the stream.
+   *
+   * @param input The next piece of plaintext.
+   * @param output The output buffer, at least maxUpdateSize(input.size()) bytes long.
+   * @return The number of container bytes written to output.
+   */
+  size_t update(std::span<const unsigned char> input, std::span<unsigned char> output);
+
+  /**
+   * @brief Gets the output buffer size finish() needs.
+   *
+   * @return The largest number of bytes finish() may write.
+   */
+  [[nodiscard]] size_t maxFinishSize() const;
+
+  /**
+   * @brief Seals the last segment and writes the trailer.
+   *
+   * @param output The output buffer, at least maxFinishSize() bytes long.
+   * @return The number of container bytes written to output.
+   */
+  size_t finish(std::span<unsigned char> output);
+
+ private:
+  const PolymorphicEncryptionEngine &engine; /**< The engine the stream encrypts with. */
+  ContainerHeader header; /**< The header of the container being written. */
+  unsigned char headerBytes[CONTAINER_HEADER_SIZE]{}; /**< The serialized header. */
+  utils::crypto::DerivedKey fileKey; /**< The key of the file. */
+  utils::crypto::DerivedKey noiseSeed; /**< The per-file seed of the mask noise. */
+  utils::memory::SecureBuffer segmentBuffer; /**< Plaintext of the segment not sealed yet. */
+  size_t buffered; /**< Number of bytes in segmentBuffer. */
+  uint64_t segments; /**< Number of segments sealed so far. */
+  std::vector<uint64_t> segmentSizes; /**< Container size of every segment sealed so far. */
+  std::vector<unsigned char> segmentDigests; /**< Segment table entries of an updatable container sealed so far. */
+  bool started; /**< Whether the header was written. */
+  bool finished; /**< Whether finish() was called. */
+
+  /**
+   * @brief Writes the header unless it was written already.
+   *
+   * @param out The output buffer.
+   * @return The number of bytes written.
+   */
+  size_t writeHeader(unsigned char *out);
+
+  /**
+   * @brief Seals full segments that are known not to be the last one.
+   *
+   * @param plaintext The plaintext of the segments.
+   * @param count The number of segments.
+   * @param out The output buffer.
+   * @return The number of bytes written.
+   */
+  size_t sealSegments(const unsigned char *plaintext, uint64_t count, unsigned char *out);
+ };
+
+ /**
+  * @class DecryptionStream
+  * @brief Decrypts a segmented container that arrives in pieces.
+  *
+  * Records are authenticated and decrypted as soon as they are complete, straight from the input when a
+  * record lies within one piece, so at most one record is buffered. Plaintext is released before the
+  * trailer is seen: finish() must be called, and throws if the container was truncated, reordered or not
+  * sealed with the engine's key. Output goes to caller-provided buffers sized with maxUpdateSize().
+  *
+  * Compressed records expand to far more plaintext than they occupy, and how far depends on the geometry in
+  * the container header. Callers with a fixed output buffer therefore cut their input with maxInputSize(),
+  * which hands the header to update() on its own and bounds every later piece by what the buffer holds.
+  */
+ class DecryptionStream {
+ public:
+  /**
+   * @brief Constructs a new DecryptionStream object.
+   *
+   * @param engine The engine providing the key; it must outlive the stream.
+   */
+  explicit DecryptionStream(const PolymorphicEncryptionEngine &engine);
+
+  /**
+   * @brief Destroys the DecryptionStream object, erasing the buffered record.
+   */
+  ~DecryptionStream();
+
+  DecryptionStream(const DecryptionStream &) = delete;
+
+  DecryptionStream &operator=(const DecryptionStream &) = delete;
+
+  /**
+   * @brief Gets the output buffer size update() needs for an input.
+   *
+   * @param inputLength The length of the input.
+   * @return The largest number of bytes update() may write.
+   */
+  [[nodiscard]] size_t maxUpdateSize(size_t inputLength) const;
+
+  /**
+   * @brief Gets the longest input update() accepts with an output buffer of a given size.
+   *
+   * Until the container header is complete this is the rest of the header, which produces no output.
+   *
+   * @param outputLength The size of the output buffer; at least maxUpdateSize(0) + 1.
+   * @return The largest input length whose maxUpdateSize() does not exceed outputLength.
+   */
+  [[nodiscard]] size_t maxInputSize(size_t outputLength) const;
+
+  /**
+   * @brief Pushes container bytes into the stream.
+   *
+   * Throws std::invalid_argument if the output is too small, which for a compressed container pushed together
+   * with its header is only known once the header is parsed.
+   *
+   * @param input The next piece of the container.
+   * @param output The output buffer, at least maxUpdateSize(input.size()) bytes long.
+   * @return The number of plaintext bytes written to output.
+   */
+  size_t update(std::span<const unsigned char> input, std::span<unsigned char> output);
+
+  /**
+   * @brief Checks that the whole container, trailer included, was pushed and authenticated.
+   */
+  void finish();
+
+ private:
+  /**
+   * @enum Phase
+   * @brief The part of the container the stream expects next.
+   */
+  enum class Phase {
+   Header,
+   StreamHeader,
+   Record,
+   Noise,
+   SegmentTable,
+   Trailer,
+   Done
+  };
+
+  const PolymorphicEncryptionEngine &engine; /**< The engine the stream decrypts with. */
+  ContainerHeader header; /**< The header of the container being read. */
+  unsigned char headerBytes[CONTAINER_HEADER_SIZE]{}; /**< The serialized header. */
+  utils::crypto::DerivedKey fileKey; /**< The key of the file. */
+  std::optional<utils::crypto::CryptoStateHandler> cryptoStateHandler; /**< The state of the current segment. */
+  std::unique_ptr<utils::math::LatticeNoise> latticeNoise; /**< The lattice noise stage of the file, or nullptr. */
+  const utils::compression::Codec *codec; /**< The codec of compressed records, or nullptr. */
+  utils::memory::SecureBuffer unpacked; /**< Decrypted payload of a compressed record. */
+  std::vector<unsigned char> pending; /**< A header, trailer or record split across pieces. */
+  size_t pendingLen; /**< Number of bytes in pending. */
+  Phase phase; /**< The part of the container expected next. */
+  Phase afterNoise; /**< The part of the container that follows the current record's noise. */
+  size_t noiseLeft; /**< Noise bytes of the current record still to skip. */
+  uint64_t segment; /**< Index of the current segment. */
+  size_t chunk; /**< Index of the current chunk in its segment. */
+  size_t untilRekey; /**< Records of the current segment still to open before the next rekey. */
+  bool lastSegment; /**< Whether the current segment is flagged as the last one. */
+  uint64_t consumed; /**< Number of container bytes consumed. */
+  uint64_t produced; /**< Number of plaintext bytes produced. */
+  uint64_t segmentStart; /**< Offset of the current segment in the container. */
+  std::vector<uint64_t> segmentSizes; /**< Container size of every segment read so far. */
+  std::vector<unsigned char> streamHeaders; /**< Stream header of every updatable segment read so far. */
+  std::vector<unsigned char> segmentTable; /**< The segment table entries read so far. */
+  size_t tableEntrySize; /**< Size of a segment table entry; zero if the container has none. */
+  size_t tableEntry; /**< Index of the next segment table entry to check. */
+
+  /**
+   * @brief Collects a fixed-size part of the container in pending.
+   *
+   * @param input The remaining input, advanced past the bytes taken.
+   * @param need The size of the part.
+   * @return True once the part is complete.
+   */
+  bool gather(std::span<const unsigned char> &input, size_t need);
+
+  /**
+   * @brief Authenticates and decrypts a complete record.
+   *
+   * @param record The record, starting at its descriptor.
+   * @param out The output buffer.
+   * @return The number of plaintext bytes written.
+   */
+  size_t openRecord(const unsigned char *record, unsigned char *out);
+
+  /**
+   * @brief Gets the size of the smallest record a chunk can be stored in, which bounds how far input expands.
+   *
+   * @return The size in bytes, noise included.
+   */
+  [[nodiscard]] size_t minRecordSize() const;
+
+  /**
+   * @brief Authenticates the trailer against everything consumed so far.
+   *
+   * @param trailerBytes The serialized trailer.
+   */
+  void checkTrailer(const unsigned char *trailerBytes) const;
+ };
+} // namespace engines::encryption
+
+#endif // ENCRYPTIONSTREAM_H
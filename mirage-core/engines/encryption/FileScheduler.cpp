@@ -0,0 +1,122 @@
+#include "FileScheduler.h"
+#include "PolymorphicEncryptionEngine.h"
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "../../utils/concurrency/ResourceBudget.h"
+#include "../../utils/concurrency/WorkStealingPool.h"
+
+namespace engines::encryption {
+    namespace {
+        uint64_t defaultMemoryBudget() {
+            const long pages = sysconf(_SC_PHYS_PAGES);
+            const long pageSize = sysconf(_SC_PAGESIZE);
+            if (pages <= 0 || pageSize <= 0) {
+                return static_cast<uint64_t>(1) << 30;
+            }
+            return static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize) / 2;
+        }
+
+        size_t defaultOpenFileBudget() {
+            rlimit limit{};
+            if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+                return 512;
+            }
+            return std::max<size_t>(SCHEDULER_FILES_PER_JOB, limit.rlim_cur / 2);
+        }
+    }
+
+    std::string FileJobResult::errorMessage() const {
+        if (!error) {
+            return {};
+        }
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception &e) {
+            return e.what();
+        } catch (...) {
+            return "Unknown error";
+        }
+    }
+
+    FileScheduler::FileScheduler(const PolymorphicEncryptionEngine &engine, const SchedulerOptions &options)
+        : engine(engine),
+          threadCount(options.threadCount == 0 ? std::max(1u, std::thread::hardware_concurrency())
+                                               : options.threadCount),
+          memoryLimit(options.memoryBudget == 0 ? defaultMemoryBudget() : options.memoryBudget),
+          fileLimit(options.openFileBudget == 0 ? defaultOpenFileBudget() : options.openFileBudget) {
+        if (fileLimit < SCHEDULER_FILES_PER_JOB) {
+            throw std::invalid_argument("The open file budget must allow at least " +
+                                        std::to_string(SCHEDULER_FILES_PER_JOB) + " files");
+        }
+    }
+
+    std::vector<FileJobResult> FileScheduler::run(const std::vector<FileJob> &jobs,
+                                                  const FileJobCallback &completed) const {
+        std::vector<FileJobResult> results(jobs.size());
+        for (size_t job = 0; job < jobs.size(); ++job) {
+            std::error_code ignored;
+            const uintmax_t size = std::filesystem::file_size(jobs[job].input, ignored);
+            results[job].bytes = ignored ? 0 : size;
+        }
+
+        // Largest first: the task index is the pool's priority.
+        std::vector<size_t> order(jobs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](const size_t a, const size_t b) {
+            return results[a].bytes > results[b].bytes;
+        });
+
+        utils::concurrency::ResourceBudget budget(memoryLimit, fileLimit);
+        utils::concurrency::WorkStealingPool workers(threadCount);
+        std::mutex completedMutex;
+        workers.run(order.size(), [&](const size_t task) {
+            const size_t job = order[task];
+            FileJobResult &result = results[job];
+            try {
+                const utils::concurrency::ResourceBudget::Lease lease =
+                        budget.acquire(result.bytes, SCHEDULER_FILES_PER_JOB);
+                result.stats = execute(jobs[job]);
+            } catch (...) {
+                result.error = std::current_exception();
+            }
+            if (completed) {
+                std::lock_guard lock(completedMutex);
+                completed(job, result);
+            }
+        });
+        return results;
+    }
+
+    size_t FileScheduler::size() const {
+        return threadCount;
+    }
+
+    uint64_t FileScheduler::memoryBudget() const {
+        return memoryLimit;
+    }
+
+    size_t FileScheduler::openFileBudget() const {
+        return fileLimit;
+    }
+
+    utils::metrics::OperationStats FileScheduler::execute(const FileJob &job) const {
+        switch (job.operation) {
+            case FileOperation::Encrypt:
+                return job.profile ? engine.encryptFile(job.input, job.output, *job.profile)
+                                   : engine.encryptFile(job.input, job.output);
+            case FileOperation::Decrypt:
+                return engine.decryptFile(job.input, job.output);
+            case FileOperation::Update:
+                return engine.updateFile(job.input, job.output);
+            case FileOperation::Verify:
+                return engine.verifyFile(job.input);
+        }
+        throw std::invalid_argument("Unknown file operation");
+    }
+} // namespace engines::encryption
@@ -0,0 +1,142 @@
+#ifndef FILESCHEDULER_H
+#define FILESCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+#include "SecurityProfile.h"
+#include "../../utils/metrics/StageStats.h"
+
+#define SCHEDULER_FILES_PER_JOB 2
+
+namespace engines::encryption {
+ class PolymorphicEncryptionEngine;
+
+ /**
+  * @brief The engine call a file job makes.
+  */
+ enum class FileOperation { Encrypt, Decrypt, Update, Verify };
+
+ /**
+  * @struct FileJob
+  * @brief One file of a batch: what to do with it and where to write the result.
+  */
+ struct FileJob {
+  std::string input; /**< The file read: plaintext for Encrypt and Update, a container for Decrypt and Verify. */
+  std::string output; /**< The file written: container for Encrypt and Update, plaintext for Decrypt; not Verify. */
+  FileOperation operation = FileOperation::Encrypt; /**< The engine call applied to the file. */
+  std::optional<SecurityProfile> profile; /**< The profile an Encrypt job writes with instead of the engine's. */
+ };
+
+ /**
+  * @struct FileJobResult
+  * @brief The outcome of one file job.
+  */
+ struct FileJobResult {
+  uint64_t bytes = 0; /**< Size of the input file when the job was scheduled. */
+  utils::metrics::OperationStats stats; /**< Stats of the engine call; all zero unless stats are enabled. */
+  std::exception_ptr error; /**< What the job failed with, or nullptr if it succeeded. */
+
+  [[nodiscard]] bool succeeded() const { return !error; }
+
+  /**
+   * @brief Gets the message of the exception the job failed with.
+   *
+   * @return The message, or an empty string if the job succeeded.
+   */
+  [[nodiscard]] std::string errorMessage() const;
+ };
+
+ /**
+  * @brief Receives the index and the result of every job as it finishes, one call at a time.
+  */
+ using FileJobCallback = std::function<void(size_t, const FileJobResult &)>;
+
+ /**
+  * @struct SchedulerOptions
+  * @brief Runtime configuration of a FileScheduler.
+  */
+ struct SchedulerOptions {
+  size_t threadCount = 0; /**< Files processed at once; zero selects std::thread::hardware_concurrency(). */
+  uint64_t memoryBudget = 0; /**< Bytes running jobs may hold at once; zero selects half the physical memory. */
+  size_t openFileBudget = 0; /**< Files running jobs may hold open at once; zero selects half of RLIMIT_NOFILE. */
+ };
+
+ /**
+  * @class FileScheduler
+  * @brief Runs a batch of file jobs through one engine, many files at a time.
+  *
+  * An engine call parallelizes the segments of one file, which leaves cores idle on batches of small and
+  * medium files: a file of one segment runs on the calling thread alone. The scheduler runs whole files on a
+  * WorkStealingPool instead, largest first, so the small files fill the gaps left by the large ones and the
+  * batch does not end waiting for one large file started last. The segments of large files still spread over
+  * the engine's thread pool, which only ever runs segment tasks, so the two levels cannot deadlock.
+  *
+  * Every job holds a share of a ResourceBudget while it runs: its input size in memory, since mapped files
+  * keep their pages resident, and SCHEDULER_FILES_PER_JOB open files. A job larger than the memory budget
+  * runs alone. A failed job does not stop the batch; its error is returned with its result, and what it
+  * wrote is left for the caller to remove.
+  */
+ class FileScheduler {
+ public:
+  /**
+   * @brief Constructs a new FileScheduler object.
+   *
+   * @param engine The engine the jobs run through; it must outlive the scheduler.
+   * @param options The scheduler configuration.
+   */
+  explicit FileScheduler(const PolymorphicEncryptionEngine &engine, const SchedulerOptions &options = {});
+
+  /**
+   * @brief Runs every job and waits for all of them.
+   *
+   * With a progress callback set on the engine, it is called by concurrent jobs at once and must be thread-safe.
+   *
+   * @param jobs The jobs; jobs must not write a file that another job reads or writes.
+   * @param completed Called as each job finishes, in completion order; may be empty.
+   * @return The result of every job, in the order of the jobs.
+   */
+  std::vector<FileJobResult> run(const std::vector<FileJob> &jobs, const FileJobCallback &completed = {}) const;
+
+  /**
+   * @brief Gets the number of files processed at once.
+   *
+   * @return The number of worker threads.
+   */
+  [[nodiscard]] size_t size() const;
+
+  /**
+   * @brief Gets the memory budget of the running jobs.
+   *
+   * @return The bytes running jobs may hold at once.
+   */
+  [[nodiscard]] uint64_t memoryBudget() const;
+
+  /**
+   * @brief Gets the open file budget of the running jobs.
+   *
+   * @return The files running jobs may hold open at once.
+   */
+  [[nodiscard]] size_t openFileBudget() const;
+
+ private:
+  const PolymorphicEncryptionEngine &engine; /**< The engine the jobs run through. */
+  size_t threadCount; /**< Files processed at once. */
+  uint64_t memoryLimit; /**< Bytes running jobs may hold at once. */
+  size_t fileLimit; /**< Files running jobs may hold open at once. */
+
+  /**
+   * @brief Makes the engine call of one job.
+   *
+   * @param job The job.
+   * @return The stats of the call.
+   */
+  [[nodiscard]] utils::metrics::OperationStats execute(const FileJob &job) const;
+ };
+} // namespace engines::encryption
+
+#endif // FILESCHEDULER_H
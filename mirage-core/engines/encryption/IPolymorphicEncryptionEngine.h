@@ -2,6 +2,7 @@
 #define IPOLYMORPHICENCRYPTIONENGINE_H
 
 #include <cstddef>
+#include <span>
 
 namespace engines::encryption {
  /**
@@ -10,7 +11,8 @@ namespace engines::encryption {
  *
  * The IPolymorphicEncryptionEngine class defines an interface for polymorphic encryption engines.
  * It declares methods for encrypting and decrypting data, ensuring that any derived class
- * implements these essential functionalities.
+ * implements these essential functionalities. Encrypted data is larger than the plaintext, so the
+ * caller sizes the output buffers with encryptedSize() and decryptedSize().
  */
  class IPolymorphicEncryptionEngine {
  public:
@@ -21,27 +23,43 @@ namespace engines::encryption {
    */
   virtual ~IPolymorphicEncryptionEngine() = default;
 
+  /**
+   * @brief Gets the size of the encrypted form of a plaintext.
+   *
+   * @param plaintextSize Size of the data to be encrypted.
+   * @return The largest number of bytes encrypt() writes for that much data.
+   */
+  [[nodiscard]] virtual size_t encryptedSize(size_t plaintextSize) const = 0;
+
+  /**
+   * @brief Gets the size of the plaintext held in encrypted data.
+   *
+   * @param ciphertext The encrypted data.
+   * @return The number of bytes decrypt() writes for that data.
+   */
+  [[nodiscard]] virtual size_t decryptedSize(std::span<const unsigned char> ciphertext) const = 0;
+
   /**
    * @brief Encrypts the provided data.
    *
-   * This method encrypts the data pointed to by the provided pointer. The size of the data
-   * to be encrypted is specified by the data_size parameter.
+   * This method encrypts the data in plaintext into the caller-provided ciphertext buffer.
    *
-   * @param data Pointer to the data to be encrypted.
-   * @param data_size Size of the data to be encrypted.
+   * @param plaintext The data to be encrypted.
+   * @param ciphertext The output buffer, at least encryptedSize(plaintext.size()) bytes long.
+   * @return The number of bytes written to ciphertext.
    */
-  virtual void encrypt(unsigned char *data, size_t data_size) = 0;
+  virtual size_t encrypt(std::span<const unsigned char> plaintext, std::span<unsigned char> ciphertext) const = 0;
 
   /**
    * @brief Decrypts the provided data.
    *
-   * This method decrypts the data pointed to by the provided pointer. The size of the data
-   * to be decrypted is specified by the data_size parameter.
+   * This method decrypts the data in ciphertext into the caller-provided plaintext buffer.
    *
-   * @param data Pointer to the data to be decrypted.
-   * @param data_size Size of the data to be decrypted.
+   * @param ciphertext The data to be decrypted.
+   * @param plaintext The output buffer, at least decryptedSize(ciphertext) bytes long.
+   * @return The number of bytes written to plaintext.
    */
-  virtual void decrypt(unsigned char *data, size_t data_size) = 0;
+  virtual size_t decrypt(std::span<const unsigned char> ciphertext, std::span<unsigned char> plaintext) const = 0;
  };
 }
 
@@ -1,155 +1,1202 @@
 #include "PolymorphicEncryptionEngine.h"
+#include "ContainerFormat.h"
+#include "../../utils/math/LatticeNoise.h"
 #include "../../utils/math/RNG.h"
 #include "../../utils/crypto/CryptoStateHandler.h"
+#include "../../utils/crypto/KeyDerivation.h"
+#include "../../utils/crypto/NoiseGenerator.h"
+#include "../../utils/crypto/XorTransform.h"
+#include "../../file/ChunkPipeline.h"
 #include "../../file/FileHandler.h"
-#include <iostream>
+#include "../../file/StreamIO.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <utility>
 
 namespace engines::encryption {
-    PolymorphicEncryptionEngine::PolymorphicEncryptionEngine(const size_t chunkSize)
-        : chunkSize(chunkSize) {
-        std::cout << "Initializing PolymorphicEncryptionEngine" << std::endl;
+    namespace {
+        unsigned recordStages(const ContainerLayout &layout) {
+            return (layout.xorMasked() ? RECORD_STAGE_XOR : 0) | (layout.latticeNoised() ? RECORD_STAGE_LATTICE : 0) |
+                   (layout.noiseLength() > 0 ? RECORD_STAGE_NOISE : 0);
+        }
+
+        // The options of the (chunkSize, threadCount) constructor; everything else keeps its default.
+        EngineOptions makeOptions(const size_t chunkSize, const size_t threadCount) {
+            EngineOptions options;
+            options.chunkSize = chunkSize;
+            options.threadCount = threadCount;
+            return options;
+        }
+
+        // Calls body.template operator()<Stages>() with Stages equal to stages, a subset of the low bits in Mask.
+        template<unsigned Mask, unsigned Stages = 0, typename Body>
+        decltype(auto) withRecordStages(const unsigned stages, Body &&body) {
+            if constexpr (Stages == Mask) {
+                return body.template operator()<Stages>();
+            } else {
+                if (stages == Stages) {
+                    return body.template operator()<Stages>();
+                }
+                return withRecordStages<Mask, Stages + 1>(stages, std::forward<Body>(body));
+            }
+        }
+    }
+
+    PolymorphicEncryptionEngine::PolymorphicEncryptionEngine(const size_t chunkSize, const size_t threadCount)
+        : PolymorphicEncryptionEngine(makeOptions(chunkSize, threadCount)) {
+    }
+
+    PolymorphicEncryptionEngine::PolymorphicEncryptionEngine(const EngineOptions &options)
+        : chunkSize(0), segmentSize(options.segmentSize), chunksPerSegment(0), pipelined(options.pipelined),
+          pipelineDepth(options.pipelineDepth), profile(options.profile), compression(options.compression),
+          updatable(options.updatable), cipherSuite(options.cipherSuite),
+          collectStats(options.collectStats || options.progress), progress(options.progress) {
+        if (options.chunkSize == 0 || options.chunkSize > RECORD_LENGTH_MASK / 2) {
+            throw std::invalid_argument("Chunk size must be non-zero and fit a record");
+        }
+        profile.validate(options.chunkSize);
+        if (segmentSize == 0) {
+            throw std::invalid_argument("Segment size must be non-zero");
+        }
+        if (compression != CODEC_NONE && utils::compression::findCodec(compression) == nullptr) {
+            throw std::invalid_argument("Unknown compression codec");
+        }
+        if (compression != CODEC_NONE && updatable) {
+            throw std::invalid_argument("Updatable containers cannot be compressed");
+        }
+        if (cipherSuite != CIPHER_SUITE_AUTO && !utils::crypto::CipherSuite::isKnown(cipherSuite)) {
+            throw std::invalid_argument("Unknown cipher suite");
+        }
+        setChunkSize(options.chunkSize);
         if (sodium_init() == -1) {
             throw std::runtime_error("Failed to initialize libsodium");
         }
+        if (cipherSuite == CIPHER_SUITE_AUTO) {
+            cipherSuite = utils::crypto::CipherSuite::fastest();
+        } else if (!utils::crypto::CipherSuite::isAvailable(cipherSuite)) {
+            throw std::runtime_error(std::string(utils::crypto::CipherSuite::name(cipherSuite)) +
+                                     " is not supported by this CPU");
+        }
 
-        generateEncryptionKey();
+        generateEncryptionKey(options.masterKey);
         generateXorKey();
-
-        std::cout << "PolymorphicEncryptionEngine initialized" << std::endl;
+        xorTransform = std::make_unique<utils::crypto::XorTransform>(xor_key);
+        buffers = std::make_unique<utils::memory::SecureBufferPool>(options.bufferPoolLimit, options.hugePages);
+        pool = std::make_unique<utils::concurrency::ThreadPool>(options.threadCount);
+        if (options.autotuneChunkSize) {
+            autotuneChunkSize();
+        }
     }
 
     PolymorphicEncryptionEngine::~PolymorphicEncryptionEngine() {
-        std::cout << "Destroying PolymorphicEncryptionEngine" << std::endl;
+        pool.reset();
         sodium_mprotect_readwrite(key);
-        sodium_memzero(key, crypto_secretstream_xchacha20poly1305_KEYBYTES);
+        sodium_memzero(key, MASTER_KEY_SIZE);
         sodium_free(key);
-        sodium_memzero(xor_key, POLYMORPHIC_KEY_SIZE);
-        std::cout << "PolymorphicEncryptionEngine destroyed" << std::endl;
+        sodium_memzero(xor_key, XOR_KEY_SIZE);
     }
 
-    void PolymorphicEncryptionEngine::encryptFile(const std::string &inputFilename,
-                                                  const std::string &outputFilename) const {
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::encryptFile(const std::string &inputFilename,
+                                                                            const std::string &outputFilename) const {
+        return encryptFile(inputFilename, outputFilename, profile);
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::encryptFile(const std::string &inputFilename,
+                                                                            const std::string &outputFilename,
+                                                                            const SecurityProfile &profile) const {
+        // Compressed segments are packed as they are sealed, which the stream path does in order.
+        if (compression != CODEC_NONE || !file::isMappable(inputFilename) || !file::isMappable(outputFilename)) {
+            file::FdSource source(inputFilename);
+            file::FdSink sink(outputFilename);
+            return encryptStream(source, sink, profile);
+        }
+        const ContainerHeader header = createHeader(profile);
+        utils::metrics::StatsRecorder recorder(collectStats, progress);
+        const utils::metrics::StatsScope scope(&recorder);
         file::FileHandler fileHandler(inputFilename, outputFilename);
-        utils::crypto::CryptoStateHandler cryptoStateHandler(key, fileHandler.outputFile);
 
-        std::vector<unsigned char> bufferIn(chunkSize);
-        std::vector<unsigned char> bufferOut(chunkSize + crypto_secretstream_xchacha20poly1305_ABYTES + chunkSize / 2);
-        std::vector<unsigned char> noiseBuffer(chunkSize / 2);
-        unsigned long long outLen;
-        size_t paddedLen;
-        bool eof = false;
+        unsigned char headerBytes[CONTAINER_HEADER_SIZE];
+        header.serialize(headerBytes);
+
+        utils::crypto::DerivedKey fileKey;
+        utils::crypto::KeyDerivation::deriveFileKey(fileKey.data(), key, header.fileId);
+        utils::crypto::DerivedKey noiseSeed;
+        utils::crypto::NoiseGenerator::createSeed(noiseSeed.data());
+
+        const ContainerLayout layout(header, fileHandler.fileSize);
+        const uint64_t trailerOffset = layout.segmentTableOffset();
+        if (pipelined) {
+            std::vector<unsigned char> trailerBytes(layout.segmentTableSize() + CONTAINER_TRAILER_SIZE);
+            fileHandler.writeAt(headerBytes, sizeof(headerBytes), 0);
+            encryptPipelined(fileHandler, layout, fileKey.data(), noiseSeed.data(), trailerBytes.data());
+            sealTrailer(trailerBytes.data(), layout, headerBytes, fileKey.data());
+            fileHandler.writeAt(trailerBytes.data(), trailerBytes.size(), trailerOffset);
+            return recorder.finish();
+        }
+
+        unsigned char *output = fileHandler.mapOutput(layout.totalSize());
+        std::memcpy(output, headerBytes, sizeof(headerBytes));
+        forEachSegment(layout.segmentCount(), [&](const uint64_t segment) {
+            fileHandler.prefetchInput(layout.plainOffset(segment), layout.plainSize(segment));
+            encryptSegment(fileHandler.fileData + layout.plainOffset(segment), output + layout.cipherOffset(segment),
+                           layout, fileKey.data(), noiseSeed.data(), segment,
+                           output + trailerOffset + segment * layout.segmentTableEntrySize());
+        });
+        sealTrailer(output + trailerOffset, layout, headerBytes, fileKey.data());
+        return recorder.finish();
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::decryptFile(const std::string &inputFilename,
+                                                                            const std::string &outputFilename) const {
+        if (!file::isMappable(inputFilename) || !file::isMappable(outputFilename)) {
+            file::FdSource source(inputFilename);
+            file::FdSink sink(outputFilename);
+            return decryptStream(source, sink);
+        }
+        utils::metrics::StatsRecorder recorder(collectStats, progress);
+        const utils::metrics::StatsScope scope(&recorder);
+        file::FileHandler fileHandler(inputFilename, outputFilename);
+        utils::crypto::DerivedKey fileKey;
+        const ContainerLayout layout = openContainer(fileHandler.fileData, fileHandler.fileSize, fileKey.data());
+        const unsigned char *input = fileHandler.fileData;
+
+        // Records of compressed containers are found by walking their descriptors, which the pipeline cannot.
+        if (pipelined && !layout.compressed()) {
+            fileHandler.resizeOutput(layout.plaintextLength());
+            decryptPipelined(fileHandler, layout, fileKey.data());
+            return recorder.finish();
+        }
+
+        unsigned char *output = fileHandler.mapOutput(layout.plaintextLength());
+        forEachSegment(layout.segmentCount(), [&](const uint64_t segment) {
+            fileHandler.prefetchInput(layout.cipherOffset(segment), layout.segmentCipherSize(segment));
+            decryptSegment(input + layout.cipherOffset(segment), output + layout.plainOffset(segment), layout,
+                           fileKey.data(), segment);
+        });
+        return recorder.finish();
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::verifyFile(const std::string &inputFilename) const {
+        if (!file::isMappable(inputFilename)) {
+            file::FdSource source(inputFilename);
+            return verifyStream(source);
+        }
+        utils::metrics::StatsRecorder recorder(collectStats, progress);
+        const utils::metrics::StatsScope scope(&recorder);
+        const file::FileHandler fileHandler(inputFilename);
+        utils::crypto::DerivedKey fileKey;
+        const ContainerLayout layout = openContainer(fileHandler.fileData, fileHandler.fileSize, fileKey.data());
+
+        // forEachSegment rethrows the failure of the lowest segment, which holds the first failing record.
+        forEachSegment(layout.segmentCount(), [&](const uint64_t segment) {
+            fileHandler.prefetchInput(layout.cipherOffset(segment), layout.segmentCipherSize(segment));
+            verifySegment(fileHandler.fileData, layout, fileKey.data(), segment);
+        });
+        return recorder.finish();
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::updateFile(const std::string &inputFilename,
+                                                                           const std::string &outputFilename) const {
+        // A FIFO would read as an empty plaintext and cut the container down to nothing.
+        if (!file::isMappable(inputFilename) || !file::isMappable(outputFilename)) {
+            throw std::invalid_argument("Incremental updates need regular files");
+        }
+        utils::metrics::StatsRecorder recorder(collectStats, progress);
+        const utils::metrics::StatsScope scope(&recorder);
+
+        // The old segment table is copied out first: resizing the container may cut it off or overwrite it.
+        utils::crypto::DerivedKey fileKey;
+        unsigned char headerBytes[CONTAINER_HEADER_SIZE];
+        uint64_t oldPlaintextSize;
+        std::vector<unsigned char> oldTable;
+        {
+            const file::FileHandler container(outputFilename);
+            const ContainerLayout layout = openContainer(container.fileData, container.fileSize, fileKey.data());
+            if (!layout.updatable()) {
+                throw std::invalid_argument("Container was not written with incremental updates enabled");
+            }
+            std::memcpy(headerBytes, container.fileData, sizeof(headerBytes));
+            oldPlaintextSize = layout.plaintextLength();
+            oldTable.assign(container.fileData + layout.segmentTableOffset(),
+                            container.fileData + layout.segmentTableOffset() + layout.segmentTableSize());
+        }
+
+        // The update is made on a copy that replaces the container only once it is on disk, so a crash, a full
+        // disk or a failed segment leaves the old container as it was.
+        file::ReplacementFile replacement(outputFilename);
+        file::FileHandler fileHandler(inputFilename, replacement.path(), false);
+        const ContainerHeader header = ContainerHeader::parse(headerBytes);
+        const ContainerLayout oldLayout(header, oldPlaintextSize);
+        const ContainerLayout layout(header, fileHandler.fileSize);
+        if (layout.totalSize() < oldLayout.totalSize()) {
+            fileHandler.resizeOutput(layout.totalSize());
+        }
+        unsigned char *output = fileHandler.mapOutput(layout.totalSize());
+        unsigned char *segmentTable = output + layout.segmentTableOffset();
+        utils::crypto::DerivedKey noiseSeed;
+        utils::crypto::NoiseGenerator::createSeed(noiseSeed.data());
 
-        size_t chunkCount = 0;
-        size_t rekeyInterval = PARANOID_MODE ? MIN_REKEY_INTERVAL : MAX_REKEY_INTERVAL;
+        forEachSegment(layout.segmentCount(), [&](const uint64_t segment) {
+            const unsigned char *plaintext = fileHandler.fileData + layout.plainOffset(segment);
+            unsigned char *entry = segmentTable + segment * SEGMENT_DIGEST_ENTRY_SIZE;
+            fileHandler.prefetchInput(layout.plainOffset(segment), layout.plainSize(segment));
 
-        while (!eof) {
-            fileHandler.inputFile.read(reinterpret_cast<char *>(bufferIn.data()), bufferIn.size());
-            const size_t readLen = fileHandler.inputFile.gcount();
-            eof = fileHandler.inputFile.eof();
+            // A segment is kept if its records would come out the same: same plaintext, size and flags.
+            const bool wasLast = segment + 1 == oldLayout.segmentCount();
+            if (segment < oldLayout.segmentCount() && oldLayout.plainSize(segment) == layout.plainSize(segment) &&
+                wasLast == (segment + 1 == layout.segmentCount())) {
+                const unsigned char *oldEntry = oldTable.data() + segment * SEGMENT_DIGEST_ENTRY_SIZE;
+                unsigned char digest[crypto_generichash_BYTES];
+                {
+                    TIME_STAGE(Digest);
+                    crypto_generichash_state state;
+                    beginSegmentDigest(state, fileKey.data(), segment);
+                    crypto_generichash_update(&state, plaintext, layout.plainSize(segment));
+                    crypto_generichash_final(&state, digest, sizeof(digest));
+                }
+                if (sodium_memcmp(digest, oldEntry + STREAM_HEADER_SIZE,
+                                  sizeof(digest)) == 0) {
+                    std::memcpy(entry, oldEntry, SEGMENT_DIGEST_ENTRY_SIZE);
+                    return;
+                }
+            }
+            // A fresh stream header gives the segment fresh nonces; reusing its old state would repeat them.
+            encryptSegment(plaintext, output + layout.cipherOffset(segment), layout, fileKey.data(), noiseSeed.data(),
+                           segment, entry);
+        });
+        sealTrailer(segmentTable, layout, headerBytes, fileKey.data());
+        fileHandler.syncOutput();
+        replacement.commit();
+        return recorder.finish();
+    }
+
+    size_t PolymorphicEncryptionEngine::encryptedSize(const size_t plaintextSize) const {
+        return ContainerLayout(createHeader(profile), plaintextSize).totalSize();
+    }
+
+    size_t PolymorphicEncryptionEngine::decryptedSize(const std::span<const unsigned char> ciphertext) const {
+        if (ciphertext.size() < CONTAINER_HEADER_SIZE + CONTAINER_TRAILER_SIZE) {
+            throw std::runtime_error("Encrypted data is truncated");
+        }
+        return ContainerTrailer::parse(ciphertext.data() + ciphertext.size() - CONTAINER_TRAILER_SIZE).plaintextSize;
+    }
+
+    size_t PolymorphicEncryptionEngine::encrypt(const std::span<const unsigned char> plaintext,
+                                                const std::span<unsigned char> ciphertext) const {
+        const ContainerHeader header = createHeader(profile);
+        ContainerLayout layout(header, plaintext.size());
+        if (ciphertext.size() < layout.totalSize()) {
+            throw std::invalid_argument("Output buffer is too small");
+        }
+        header.serialize(ciphertext.data());
+
+        utils::crypto::DerivedKey fileKey;
+        utils::crypto::KeyDerivation::deriveFileKey(fileKey.data(), key, header.fileId);
+        utils::crypto::DerivedKey noiseSeed;
+        utils::crypto::NoiseGenerator::createSeed(noiseSeed.data());
+
+        std::vector<uint64_t> sizes(layout.segmentCount());
+        unsigned char *segmentTable = ciphertext.data() + layout.segmentTableOffset();
+        forEachSegment(layout.segmentCount(), [&](const uint64_t segment) {
+            sizes[segment] = encryptSegment(plaintext.data() + layout.plainOffset(segment),
+                                            ciphertext.data() + layout.cipherOffset(segment), layout, fileKey.data(),
+                                            noiseSeed.data(), segment,
+                                            segmentTable + segment * layout.segmentTableEntrySize());
+        });
+        if (layout.compressed()) {
+            packSegments(ciphertext.data() + CONTAINER_HEADER_SIZE, layout.fullSegmentCipherSize(), sizes);
+            layout.setSegmentSizes(sizes);
+        }
+        sealTrailer(ciphertext.data() + layout.segmentTableOffset(), layout, ciphertext.data(), fileKey.data());
+        return layout.totalSize();
+    }
 
-            if (eof) {
-                if (sodium_pad(&paddedLen, bufferIn.data(), readLen, PADDING_BLOCK_SIZE, bufferIn.size()) != 0) {
+    size_t PolymorphicEncryptionEngine::decrypt(const std::span<const unsigned char> ciphertext,
+                                                const std::span<unsigned char> plaintext) const {
+        utils::crypto::DerivedKey fileKey;
+        const ContainerLayout layout = openContainer(ciphertext.data(), ciphertext.size(), fileKey.data());
+        if (plaintext.size() < layout.plaintextLength()) {
+            throw std::invalid_argument("Output buffer is too small");
+        }
+
+        try {
+            forEachSegment(layout.segmentCount(), [&](const uint64_t segment) {
+                decryptSegment(ciphertext.data() + layout.cipherOffset(segment),
+                               plaintext.data() + layout.plainOffset(segment), layout, fileKey.data(), segment);
+            });
+        } catch (...) {
+            // Segments before the one that failed were decrypted already.
+            sodium_memzero(plaintext.data(), layout.plaintextLength());
+            throw;
+        }
+        return layout.plaintextLength();
+    }
+
+    EncryptionStream PolymorphicEncryptionEngine::createEncryptionStream() const {
+        return EncryptionStream(*this, profile);
+    }
+
+    DecryptionStream PolymorphicEncryptionEngine::createDecryptionStream() const {
+        return DecryptionStream(*this);
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::encryptStream(file::ByteSource &source,
+                                                                              file::ByteSink &sink) const {
+        return encryptStream(source, sink, profile);
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::encryptStream(file::ByteSource &source,
+                                                                              file::ByteSink &sink,
+                                                                              const SecurityProfile &profile) const {
+        EncryptionStream stream(*this, profile);
+        utils::metrics::StatsRecorder recorder(collectStats, progress);
+        const utils::metrics::StatsScope scope(&recorder);
+        const utils::memory::SecureBuffer input = buffers->acquire(streamBlockSize());
+        // The output is ciphertext, which does not need locked memory.
+        std::vector<unsigned char> output(std::max(stream.maxUpdateSize(input.size()), stream.maxFinishSize()));
+
+        // A short block means the source ended; finish() then seals whatever the stream still holds.
+        size_t readLen;
+        do {
+            readLen = source.readFull(input.span());
+            sink.write({output.data(), stream.update({input.data(), readLen}, output)});
+        } while (readLen == input.size());
+        // The segment table of compressed containers grows with the number of segments.
+        output.resize(std::max(output.size(), stream.maxFinishSize()));
+        sink.write({output.data(), stream.finish(output)});
+        return recorder.finish();
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::decryptStream(file::ByteSource &source,
+                                                                              file::ByteSink &sink) const {
+        utils::metrics::StatsRecorder recorder(collectStats, progress);
+        const utils::metrics::StatsScope scope(&recorder);
+        DecryptionStream stream(*this);
+        std::vector<unsigned char> input(streamBlockSize());
+        utils::memory::SecureBuffer output;
+
+        for (size_t readLen; (readLen = source.readFull(input)) > 0;) {
+            // The header is pushed on its own and tells the stream the geometry the output bound depends on;
+            // compressed records expand, so a block may then go in several pieces.
+            for (std::span<const unsigned char> rest(input.data(), readLen); !rest.empty();) {
+                if (stream.maxUpdateSize(0) + input.size() > output.size()) {
+                    output = buffers->acquire(stream.maxUpdateSize(0) + input.size());
+                }
+                const std::span<const unsigned char> piece = rest.first(
+                    std::min(rest.size(), stream.maxInputSize(output.size())));
+                sink.write({output.data(), stream.update(piece, output.span())});
+                rest = rest.subspan(piece.size());
+            }
+        }
+        stream.finish();
+        return recorder.finish();
+    }
+
+    utils::metrics::OperationStats PolymorphicEncryptionEngine::verifyStream(file::ByteSource &source) const {
+        file::NullSink discarded;
+        return decryptStream(source, discarded);
+    }
+
+    size_t PolymorphicEncryptionEngine::streamBlockSize() const {
+        return std::max<size_t>(DEFAULT_STREAM_BLOCK_SIZE, chunkSize * chunksPerSegment * pool->size());
+    }
+
+    std::vector<unsigned char> PolymorphicEncryptionEngine::decryptRange(const std::string &inputFilename,
+                                                                         const uint64_t offset,
+                                                                         const size_t length) const {
+        const file::FileHandler fileHandler(inputFilename);
+        utils::crypto::DerivedKey fileKey;
+        const ContainerLayout layout = openContainer(fileHandler.fileData, fileHandler.fileSize, fileKey.data());
+        if (offset > layout.plaintextLength() || length > layout.plaintextLength() - offset) {
+            throw std::out_of_range("Range exceeds the plaintext");
+        }
+
+        std::vector<unsigned char> output(length);
+        if (length == 0) {
+            return output;
+        }
+
+        decryptRange(fileHandler, layout, fileKey.data(), offset, length, output.data());
+        return output;
+    }
+
+    void PolymorphicEncryptionEngine::decryptRange(const file::FileHandler &fileHandler, const ContainerLayout &layout,
+                                                   const unsigned char *fileKey, const uint64_t offset,
+                                                   const size_t length, unsigned char *output) const {
+        const uint64_t firstSegment = layout.segmentAt(offset);
+        const uint64_t lastSegment = layout.segmentAt(offset + length - 1);
+        forEachSegment(lastSegment - firstSegment + 1, [&](const uint64_t index) {
+            decryptSegmentRange(fileHandler, layout, fileKey, firstSegment + index, offset, length, output);
+        });
+    }
+
+    void PolymorphicEncryptionEngine::setChunkSize(const size_t size) {
+        chunkSize = size;
+        chunksPerSegment = std::max<size_t>(1, segmentSize / size);
+    }
+
+    void PolymorphicEncryptionEngine::autotuneChunkSize() {
+        std::vector<unsigned char> sample(AUTOTUNE_SAMPLE_SIZE);
+        randombytes_buf(sample.data(), sample.size());
+        utils::crypto::DerivedKey noiseSeed;
+        utils::crypto::NoiseGenerator::createSeed(noiseSeed.data());
+
+        size_t bestChunkSize = chunkSize;
+        double bestSeconds = 0;
+        std::vector<unsigned char> output;
+        for (size_t candidate = AUTOTUNE_MIN_CHUNK_SIZE; candidate <= AUTOTUNE_MAX_CHUNK_SIZE; candidate *= 2) {
+            setChunkSize(candidate);
+            const ContainerHeader header = createHeader(profile);
+            const ContainerLayout layout(header, sample.size());
+            utils::crypto::DerivedKey fileKey;
+            utils::crypto::KeyDerivation::deriveFileKey(fileKey.data(), key, header.fileId);
+            output.resize(layout.totalSize());
+
+            for (size_t round = 0; round < AUTOTUNE_ROUNDS; ++round) {
+                const auto start = std::chrono::steady_clock::now();
+                for (uint64_t segment = 0; segment < layout.segmentCount(); ++segment) {
+                    encryptSegment(sample.data() + layout.plainOffset(segment),
+                                   output.data() + layout.cipherOffset(segment), layout, fileKey.data(),
+                                   noiseSeed.data(), segment,
+                                   output.data() + layout.segmentTableOffset() +
+                                   segment * layout.segmentTableEntrySize());
+                }
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (bestSeconds == 0 || seconds < bestSeconds) {
+                    bestSeconds = seconds;
+                    bestChunkSize = candidate;
+                }
+            }
+        }
+
+        setChunkSize(bestChunkSize);
+    }
+
+    ContainerHeader PolymorphicEncryptionEngine::createHeader(const SecurityProfile &profile) const {
+        profile.validate(chunkSize);
+        ContainerHeader header;
+        header.flags = (profile.xorLayer ? CONTAINER_FLAG_XOR_MASK : 0) |
+                       (profile.latticeNoise ? CONTAINER_FLAG_LATTICE_NOISE : 0) |
+                       (compression != CODEC_NONE ? CONTAINER_FLAG_COMPRESSED : 0) |
+                       (updatable ? CONTAINER_FLAG_UPDATABLE : 0);
+        header.codec = compression;
+        header.cipherSuite = cipherSuite;
+        header.chunksPerSegment = static_cast<uint32_t>(chunksPerSegment);
+        header.chunkSize = static_cast<uint32_t>(chunkSize);
+        header.noiseSize = profile.noiseSize(chunkSize);
+        header.rekeyInterval = profile.rekeyInterval(chunkSize);
+        header.paddingBlockSize = profile.paddingBlockSize;
+        randombytes_buf(header.fileId, FILE_ID_SIZE);
+        return header;
+    }
+
+    size_t PolymorphicEncryptionEngine::encryptSegment(const unsigned char *input, unsigned char *output,
+                                                       const ContainerLayout &layout, const unsigned char *fileKey,
+                                                       const unsigned char *noiseSeed, const uint64_t segment,
+                                                       unsigned char *tableEntry) const {
+        return withRecordStages<RECORD_STAGES_ALL>(recordStages(layout), [&]<unsigned Stages>() {
+            return encryptSegmentWith<Stages>(input, output, layout, fileKey, noiseSeed, segment, tableEntry);
+        });
+    }
+
+    template<unsigned Stages>
+    size_t PolymorphicEncryptionEngine::encryptSegmentWith(const unsigned char *input, unsigned char *output,
+                                                           const ContainerLayout &layout,
+                                                           const unsigned char *fileKey,
+                                                           const unsigned char *noiseSeed, const uint64_t segment,
+                                                           unsigned char *tableEntry) const {
+        utils::crypto::DerivedKey segmentKey;
+        utils::crypto::KeyDerivation::deriveSegmentKey(segmentKey.data(), fileKey, segment);
+        utils::crypto::CryptoStateHandler cryptoStateHandler(layout.cipherSuite(), segmentKey.data());
+        utils::crypto::NoiseGenerator noise(noiseSeed, segment);
+        const auto lattice = createLatticeNoise((Stages & RECORD_STAGE_LATTICE) != 0, fileKey);
+
+        unsigned char *out = output;
+        std::memcpy(out, cryptoStateHandler.getHeader(), STREAM_HEADER_SIZE);
+        out += STREAM_HEADER_SIZE;
+
+        const unsigned char *in = input;
+        utils::memory::SecureBuffer paddedChunk;
+        size_t paddedLen;
+        const size_t chunkCount = layout.chunkCount(segment);
+        const size_t paddingBlock = layout.paddingBlockSize();
+        if (layout.compressed()) {
+            paddedChunk = buffers->acquire(layout.chunkLength() + paddingBlock);
+        }
+        // Counting down spares a division per chunk.
+        size_t untilRekey = layout.rekeyInterval();
+
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            const size_t readLen = layout.chunkPlainSize(segment, chunk);
+            const unsigned char *plaintext = in;
+            paddedLen = readLen;
+
+            // A chunk is kept compressed only when that saves at least an eighth of it.
+            bool packed = false;
+            if (layout.compressed()) {
+                TIME_STAGE(Compress);
+                const size_t packedLen = layout.codec()->compress({in, readLen},
+                                                                  {paddedChunk.data(), readLen - readLen / 8});
+                if (packedLen > 0) {
+                    plaintext = paddedChunk.data();
+                    paddedLen = packedLen;
+                    packed = true;
+                }
+            }
+            if (layout.isFinalChunk(segment, chunk)) {
+                // Only the final chunk needs a private copy: padding is appended in place.
+                if (paddedChunk.size() == 0) {
+                    paddedChunk = buffers->acquire(layout.chunkLength() + paddingBlock);
+                }
+                if (!packed) {
+                    std::copy_n(in, readLen, paddedChunk.data());
+                }
+                if (sodium_pad(&paddedLen, paddedChunk.data(), paddedLen, paddingBlock, paddedChunk.size()) != 0) {
                     throw std::runtime_error("Padding failed");
                 }
-            } else {
-                paddedLen = readLen;
+                plaintext = paddedChunk.data();
             }
 
-            const unsigned char tag = eof ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : 0;
-            crypto_secretstream_xchacha20poly1305_push(&cryptoStateHandler.getState(), bufferOut.data(), &outLen,
-                                                       bufferIn.data(), paddedLen, nullptr, 0, tag);
+            out += sealRecordWith<Stages>(cryptoStateHandler, noise, lattice.get(), layout, segment, chunk, plaintext,
+                                          paddedLen, packed, out);
+            in += readLen;
 
-            generateMaskNoise(noiseBuffer, noiseBuffer.size());
-            for (size_t i = 0; i < noiseBuffer.size(); ++i) {
-                bufferOut[outLen + i] = noiseBuffer[i];
+            if (--untilRekey == 0) {
+                rekey(cryptoStateHandler);
+                untilRekey = layout.rekeyInterval();
             }
+        }
+
+        if (layout.updatable()) {
+            TIME_STAGE(Digest);
+            crypto_generichash_state digest;
+            beginSegmentDigest(digest, fileKey, segment);
+            crypto_generichash_update(&digest, input, in - input);
+            std::memcpy(tableEntry, output, STREAM_HEADER_SIZE);
+            crypto_generichash_final(&digest, tableEntry + STREAM_HEADER_SIZE,
+                                     crypto_generichash_BYTES);
+        }
 
-            fileHandler.outputFile.write(reinterpret_cast<char *>(bufferOut.data()), outLen + noiseBuffer.size());
+        COUNT_STAT(segments, 1);
+        COUNT_STAT(bytesIn, in - input);
+        COUNT_STAT(bytesOut, out - output);
+        return out - output;
+    }
+
+    void PolymorphicEncryptionEngine::decryptSegment(const unsigned char *input, unsigned char *output,
+                                                     const ContainerLayout &layout, const unsigned char *fileKey,
+                                                     const uint64_t segment) const {
+        // The noise is skipped by the layout, so only the layers select an instantiation.
+        withRecordStages<RECORD_STAGE_XOR | RECORD_STAGE_LATTICE>(
+            recordStages(layout) & ~RECORD_STAGE_NOISE, [&]<unsigned Stages>() {
+                decryptSegmentWith<Stages>(input, output, layout, fileKey, segment);
+            });
+    }
+
+    template<unsigned Stages>
+    void PolymorphicEncryptionEngine::decryptSegmentWith(const unsigned char *input, unsigned char *output,
+                                                         const ContainerLayout &layout, const unsigned char *fileKey,
+                                                         const uint64_t segment) const {
+        const unsigned char *in = input;
+        utils::crypto::DerivedKey segmentKey;
+        utils::crypto::KeyDerivation::deriveSegmentKey(segmentKey.data(), fileKey, segment);
+        utils::crypto::CryptoStateHandler cryptoStateHandler(layout.cipherSuite(), segmentKey.data(), in);
+        in += STREAM_HEADER_SIZE;
+        const auto lattice = createLatticeNoise((Stages & RECORD_STAGE_LATTICE) != 0, fileKey);
+
+        unsigned char *out = output;
+        const unsigned char *const segmentEnd = input + layout.segmentCipherSize(segment);
+        utils::memory::SecureBuffer paddedChunk;
+        const size_t chunkCount = layout.chunkCount(segment);
+        size_t untilRekey = layout.rekeyInterval();
+
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            // Padded and compressed chunks do not fit the output mapping as they are, so they are decrypted aside.
+            const bool finalChunk = layout.isFinalChunk(segment, chunk);
+            const size_t plainLen = layout.chunkPlainSize(segment, chunk);
+            try {
+                const uint32_t prefix = layout.readRecordPrefix(segment, chunk, in, segmentEnd - in);
+                const bool aside = finalChunk || (prefix & RECORD_FLAG_COMPRESSED) != 0;
+                if (aside && paddedChunk.size() == 0) {
+                    paddedChunk = buffers->acquire(layout.chunkLength() + layout.paddingBlockSize());
+                }
+                unsigned char *plaintext = aside ? paddedChunk.data() : out;
+                const size_t payloadLen = openRecordWith<Stages>(cryptoStateHandler, prefix, lattice.get(),
+                                                                 segment * layout.fullSegmentChunkCount() + chunk,
+                                                                 in, plaintext);
+                if (unpackChunk(layout.codec(), prefix, finalChunk ? layout.paddingBlockSize() : 0, plaintext,
+                                payloadLen, out, plainLen) != plainLen) {
+                    throw std::runtime_error("Decryption failed");
+                }
+                in += layout.recordSize(prefix);
+            } catch (const std::runtime_error &) {
+                throw IntegrityError(segment, chunk, layout.cipherOffset(segment) + (in - input));
+            }
+            out += plainLen;
 
-            if (++chunkCount % rekeyInterval == 0) {
-                rekey(cryptoStateHandler.getState());
+            if (--untilRekey == 0) {
+                rekey(cryptoStateHandler);
+                untilRekey = layout.rekeyInterval();
             }
         }
+        if (in != segmentEnd) {
+            throw IntegrityError(segment, chunkCount, layout.cipherOffset(segment) + (in - input));
+        }
+
+        COUNT_STAT(segments, 1);
+        COUNT_STAT(bytesIn, in - input);
+        COUNT_STAT(bytesOut, out - output);
     }
 
+    void PolymorphicEncryptionEngine::verifySegment(const unsigned char *input, const ContainerLayout &layout,
+                                                    const unsigned char *fileKey, const uint64_t segment) const {
+        withRecordStages<RECORD_STAGE_XOR | RECORD_STAGE_LATTICE>(
+            recordStages(layout) & ~RECORD_STAGE_NOISE, [&]<unsigned Stages>() {
+                verifySegmentWith<Stages>(input, layout, fileKey, segment);
+            });
+    }
 
-    void PolymorphicEncryptionEngine::decryptFile(const std::string &inputFilename,
-                                                  const std::string &outputFilename) const {
-        file::FileHandler fileHandler(inputFilename, outputFilename);
-        utils::crypto::CryptoStateHandler cryptoStateHandler(key, fileHandler.inputFile);
+    template<unsigned Stages>
+    void PolymorphicEncryptionEngine::verifySegmentWith(const unsigned char *input, const ContainerLayout &layout,
+                                                        const unsigned char *fileKey, const uint64_t segment) const {
+        const uint64_t segmentStart = layout.cipherOffset(segment);
+        const uint64_t segmentEnd = segmentStart + layout.segmentCipherSize(segment);
+        uint64_t position = segmentStart + STREAM_HEADER_SIZE;
+        utils::crypto::DerivedKey segmentKey;
+        utils::crypto::KeyDerivation::deriveSegmentKey(segmentKey.data(), fileKey, segment);
+        utils::crypto::CryptoStateHandler cryptoStateHandler(layout.cipherSuite(), segmentKey.data(),
+                                                             input + segmentStart);
+        const auto lattice = createLatticeNoise((Stages & RECORD_STAGE_LATTICE) != 0, fileKey);
 
-        std::vector<unsigned char> bufferIn(chunkSize + crypto_secretstream_xchacha20poly1305_ABYTES + chunkSize / 2);
-        std::vector<unsigned char> bufferOut(chunkSize + PADDING_BLOCK_SIZE);
-        unsigned long long outLen;
-        size_t unpaddedLen;
-        bool eof = false;
+        // Every chunk is opened over the previous one; the pool erases the buffers when they are released.
+        const utils::memory::SecureBuffer plaintext =
+                buffers->acquire(layout.chunkLength() + layout.paddingBlockSize());
+        utils::memory::SecureBuffer unpacked;
+        if (layout.compressed()) {
+            unpacked = buffers->acquire(layout.chunkLength());
+        }
+        const size_t chunkCount = layout.chunkCount(segment);
+        size_t untilRekey = layout.rekeyInterval();
 
-        size_t chunkCount = 0;
-        size_t rekeyInterval = PARANOID_MODE ? MIN_REKEY_INTERVAL : MAX_REKEY_INTERVAL;
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            try {
+                const uint32_t prefix = layout.readRecordPrefix(segment, chunk, input + position,
+                                                                segmentEnd - position);
+                const size_t payloadLen = openRecordWith<Stages>(cryptoStateHandler, prefix, lattice.get(),
+                                                                 segment * layout.fullSegmentChunkCount() + chunk,
+                                                                 input + position, plaintext.data());
+                unsigned char *chunkData = (prefix & RECORD_FLAG_COMPRESSED) != 0 ? unpacked.data() : plaintext.data();
+                if (unpackChunk(layout.codec(), prefix,
+                                layout.isFinalChunk(segment, chunk) ? layout.paddingBlockSize() : 0, plaintext.data(),
+                                payloadLen, chunkData, layout.chunkLength()) != layout.chunkPlainSize(segment, chunk)) {
+                    throw std::runtime_error("Decryption failed");
+                }
+                position += layout.recordSize(prefix);
+            } catch (const std::runtime_error &) {
+                throw IntegrityError(segment, chunk, position);
+            }
 
-        while (!eof) {
-            fileHandler.inputFile.read(reinterpret_cast<char *>(bufferIn.data()), bufferIn.size());
-            const size_t readLen = fileHandler.inputFile.gcount();
-            eof = fileHandler.inputFile.eof();
+            if (--untilRekey == 0) {
+                rekey(cryptoStateHandler);
+                untilRekey = layout.rekeyInterval();
+            }
+        }
+        if (position != segmentEnd) {
+            throw IntegrityError(segment, chunkCount, position);
+        }
+
+        COUNT_STAT(segments, 1);
+        COUNT_STAT(bytesIn, segmentEnd - segmentStart);
+    }
+
+    void PolymorphicEncryptionEngine::decryptSegmentRange(const file::FileHandler &fileHandler,
+                                                          const ContainerLayout &layout,
+                                                          const unsigned char *fileKey, const uint64_t segment,
+                                                          const uint64_t offset, const size_t length,
+                                                          unsigned char *output) const {
+        const uint64_t segmentStart = layout.plainOffset(segment);
+        const uint64_t begin = std::max(offset, segmentStart);
+        const uint64_t end = std::min(offset + length, segmentStart + layout.plainSize(segment));
+        const size_t lastChunk = (end - 1 - segmentStart) / layout.chunkLength();
 
-            const size_t noiseStart = readLen - chunkSize / 2;
-            std::fill(bufferIn.begin() + noiseStart, bufferIn.end(), 0);
+        // Records of compressed containers are only found by walking them, so their whole segment is prefetched.
+        const uint64_t cipherStart = layout.cipherOffset(segment);
+        const uint64_t segmentEnd = cipherStart + layout.segmentCipherSize(segment);
+        const uint64_t cipherEnd = layout.compressed()
+                                       ? segmentEnd
+                                       : layout.recordOffset(segment, lastChunk) + RECORD_PREFIX_SIZE +
+                                         layout.chunkCipherSize(segment, lastChunk);
+        fileHandler.prefetchInput(cipherStart, cipherEnd - cipherStart);
+        const unsigned char *input = fileHandler.fileData;
+        uint64_t position = cipherStart + STREAM_HEADER_SIZE;
+
+        utils::crypto::DerivedKey segmentKey;
+        utils::crypto::KeyDerivation::deriveSegmentKey(segmentKey.data(), fileKey, segment);
+        utils::crypto::CryptoStateHandler cryptoStateHandler(layout.cipherSuite(), segmentKey.data(),
+                                                             input + cipherStart);
+        const auto lattice = createLatticeNoise(layout.latticeNoised(), fileKey);
+        const utils::memory::SecureBuffer plaintext =
+                buffers->acquire(layout.chunkLength() + layout.paddingBlockSize());
+        utils::memory::SecureBuffer unpacked;
+        if (layout.compressed()) {
+            unpacked = buffers->acquire(layout.chunkLength());
+        }
 
-            if (crypto_secretstream_xchacha20poly1305_pull(&cryptoStateHandler.getState(), bufferOut.data(), &outLen,
-                                                           nullptr, bufferIn.data(), noiseStart, nullptr, 0) != 0) {
+        size_t untilRekey = layout.rekeyInterval();
+
+        for (size_t chunk = 0; chunk <= lastChunk; ++chunk) {
+            const uint32_t prefix = layout.readRecordPrefix(segment, chunk, input + position, segmentEnd - position);
+            const size_t payloadLen = openRecord(cryptoStateHandler, prefix, layout.xorMasked(), lattice.get(),
+                                                 segment * layout.fullSegmentChunkCount() + chunk, input + position,
+                                                 plaintext.data());
+            position += layout.recordSize(prefix);
+            const bool packed = (prefix & RECORD_FLAG_COMPRESSED) != 0;
+            unsigned char *chunkData = packed ? unpacked.data() : plaintext.data();
+            const size_t outLen = unpackChunk(layout.codec(), prefix,
+                                              layout.isFinalChunk(segment, chunk) ? layout.paddingBlockSize() : 0,
+                                              plaintext.data(), payloadLen, chunkData, layout.chunkLength());
+            if (outLen != layout.chunkPlainSize(segment, chunk)) {
                 throw std::runtime_error("Decryption failed");
             }
 
-            if (eof) {
-                if (sodium_unpad(&unpaddedLen, bufferOut.data(), outLen, PADDING_BLOCK_SIZE) != 0) {
+            // Chunks in front of the range only advance the stream.
+            const uint64_t chunkStart = segmentStart + chunk * layout.chunkLength();
+            const uint64_t copyBegin = std::max(begin, chunkStart);
+            const uint64_t copyEnd = std::min(end, chunkStart + outLen);
+            if (copyBegin < copyEnd) {
+                std::copy_n(chunkData + (copyBegin - chunkStart), copyEnd - copyBegin, output + (copyBegin - offset));
+            }
+
+            if (--untilRekey == 0) {
+                rekey(cryptoStateHandler);
+                untilRekey = layout.rekeyInterval();
+            }
+        }
+    }
+
+    uint64_t PolymorphicEncryptionEngine::packSegments(unsigned char *output, const uint64_t slotSize,
+                                                       const std::span<const uint64_t> sizes) {
+        uint64_t packed = 0;
+        for (size_t segment = 0; segment < sizes.size(); ++segment) {
+            if (packed != segment * slotSize) {
+                std::memmove(output + packed, output + segment * slotSize, sizes[segment]);
+            }
+            packed += sizes[segment];
+        }
+        return packed;
+    }
+
+    void PolymorphicEncryptionEngine::beginSegmentDigest(crypto_generichash_state &state, const unsigned char *fileKey,
+                                                         const uint64_t segment) {
+        utils::crypto::DerivedKey digestKey;
+        utils::crypto::KeyDerivation::deriveDigestKey(digestKey.data(), fileKey);
+        unsigned char index[sizeof(uint64_t)];
+        storeLittleEndian64(index, segment);
+        crypto_generichash_init(&state, digestKey.data(), crypto_generichash_KEYBYTES, crypto_generichash_BYTES);
+        crypto_generichash_update(&state, index, sizeof(index));
+    }
+
+    void PolymorphicEncryptionEngine::checkStreamHeaders(const unsigned char *input, const ContainerLayout &layout) {
+        const unsigned char *entry = input + layout.segmentTableOffset();
+        for (uint64_t segment = 0; segment < layout.segmentCount(); ++segment, entry += SEGMENT_DIGEST_ENTRY_SIZE) {
+            if (std::memcmp(input + layout.cipherOffset(segment), entry,
+                            STREAM_HEADER_SIZE) != 0) {
+                throw std::runtime_error("Container authentication failed");
+            }
+        }
+    }
+
+    void PolymorphicEncryptionEngine::sealTrailer(unsigned char *out, const ContainerLayout &layout,
+                                                  const unsigned char *headerBytes,
+                                                  const unsigned char *fileKey) const {
+        const size_t tableSize = layout.segmentTableSize();
+        layout.serializeSegmentTable(out);
+
+        ContainerTrailer trailer;
+        trailer.segmentCount = layout.segmentCount();
+        trailer.plaintextSize = layout.plaintextLength();
+        utils::crypto::DerivedKey commitmentKey;
+        utils::crypto::KeyDerivation::deriveCommitmentKey(commitmentKey.data(), fileKey);
+        trailer.seal(commitmentKey.data(), headerBytes, {out, tableSize});
+        trailer.serialize(out + tableSize);
+    }
+
+    ContainerLayout PolymorphicEncryptionEngine::openContainer(const unsigned char *input, const uint64_t size,
+                                                               unsigned char *fileKey) const {
+        if (size < CONTAINER_HEADER_SIZE + CONTAINER_TRAILER_SIZE) {
+            throw std::runtime_error("Encrypted file is truncated");
+        }
+
+        const ContainerHeader header = ContainerHeader::parse(input);
+        const ContainerTrailer trailer = ContainerTrailer::parse(input + size - CONTAINER_TRAILER_SIZE);
+
+        ContainerLayout layout(header, trailer.plaintextSize);
+        const uint64_t tableSize = layout.segmentTableSize();
+        if (layout.segmentCount() != trailer.segmentCount ||
+            tableSize > size - CONTAINER_HEADER_SIZE - CONTAINER_TRAILER_SIZE) {
+            throw std::runtime_error("Container size mismatch");
+        }
+        const unsigned char *segmentTable = input + size - CONTAINER_TRAILER_SIZE - tableSize;
+
+        utils::crypto::KeyDerivation::deriveFileKey(fileKey, key, header.fileId);
+        utils::crypto::DerivedKey commitmentKey;
+        utils::crypto::KeyDerivation::deriveCommitmentKey(commitmentKey.data(), fileKey);
+        if (!trailer.verify(commitmentKey.data(), input, {segmentTable, tableSize})) {
+            throw std::runtime_error("Container authentication failed");
+        }
+
+        if (layout.compressed()) {
+            layout.parseSegmentTable(segmentTable);
+        }
+        if (layout.totalSize() != size) {
+            throw std::runtime_error("Container size mismatch");
+        }
+        if (layout.updatable()) {
+            checkStreamHeaders(input, layout);
+        }
+        return layout;
+    }
+
+    void PolymorphicEncryptionEngine::encryptPipelined(const file::FileHandler &fileHandler,
+                                                       const ContainerLayout &layout, const unsigned char *fileKey,
+                                                       const unsigned char *noiseSeed,
+                                                       unsigned char *segmentTable) const {
+        const file::ChunkPipeline pipeline(fileHandler, *buffers, layout.chunkLength() + layout.paddingBlockSize(),
+                                           STREAM_HEADER_SIZE + layout.maxRecordSize(),
+                                           pipelineDepth);
+        std::optional<utils::crypto::CryptoStateHandler> cryptoStateHandler;
+        size_t untilRekey = 0;
+        crypto_generichash_state digest;
+        utils::crypto::NoiseGenerator noise(noiseSeed, 0);
+        const auto lattice = createLatticeNoise(layout.latticeNoised(), fileKey);
+
+        pipeline.run(layout.totalChunkCount(), [&](const size_t index) {
+            const uint64_t segment = index / layout.fullSegmentChunkCount();
+            const size_t chunk = index % layout.fullSegmentChunkCount();
+            return file::ChunkPipeline::Transfer{
+                layout.plainOffset(segment) + chunk * layout.chunkLength(), layout.chunkPlainSize(segment, chunk)
+            };
+        }, [&](const size_t index, unsigned char *input, const size_t length, unsigned char *output) {
+            const uint64_t segment = index / layout.fullSegmentChunkCount();
+            const size_t chunk = index % layout.fullSegmentChunkCount();
+            size_t outLen = 0;
+
+            if (chunk == 0) {
+                utils::crypto::DerivedKey segmentKey;
+                utils::crypto::KeyDerivation::deriveSegmentKey(segmentKey.data(), fileKey, segment);
+                cryptoStateHandler.emplace(layout.cipherSuite(), segmentKey.data());
+                untilRekey = layout.rekeyInterval();
+                std::memcpy(output, cryptoStateHandler->getHeader(), STREAM_HEADER_SIZE);
+                outLen = STREAM_HEADER_SIZE;
+                if (layout.updatable()) {
+                    std::memcpy(segmentTable + segment * SEGMENT_DIGEST_ENTRY_SIZE, output,
+                                STREAM_HEADER_SIZE);
+                    beginSegmentDigest(digest, fileKey, segment);
+                }
+            }
+            // The digest covers the plaintext as it is, so the chunk is hashed before it is padded in place.
+            if (layout.updatable()) {
+                TIME_STAGE(Digest);
+                crypto_generichash_update(&digest, input, length);
+                if (chunk + 1 == layout.chunkCount(segment)) {
+                    crypto_generichash_final(&digest, segmentTable + segment * SEGMENT_DIGEST_ENTRY_SIZE +
+                                                      STREAM_HEADER_SIZE,
+                                             crypto_generichash_BYTES);
+                }
+            }
+
+            size_t paddedLen = length;
+            if (layout.isFinalChunk(segment, chunk) &&
+                sodium_pad(&paddedLen, input, length, layout.paddingBlockSize(),
+                           layout.chunkLength() + layout.paddingBlockSize()) != 0) {
+                throw std::runtime_error("Padding failed");
+            }
+            outLen += sealRecord(*cryptoStateHandler, noise, lattice.get(), layout, segment, chunk, input, paddedLen,
+                                 false, output + outLen);
+
+            if (--untilRekey == 0) {
+                rekey(*cryptoStateHandler);
+                untilRekey = layout.rekeyInterval();
+            }
+            COUNT_STAT(bytesIn, length);
+            COUNT_STAT(bytesOut, outLen);
+            if (chunk + 1 == layout.chunkCount(segment)) {
+                COUNT_STAT(segments, 1);
+                utils::metrics::flushStats();
+            }
+            return file::ChunkPipeline::Transfer{
+                chunk == 0 ? layout.cipherOffset(segment) : layout.recordOffset(segment, chunk), outLen
+            };
+        });
+    }
+
+    void PolymorphicEncryptionEngine::decryptPipelined(const file::FileHandler &fileHandler,
+                                                       const ContainerLayout &layout,
+                                                       const unsigned char *fileKey) const {
+        const file::ChunkPipeline pipeline(fileHandler, *buffers,
+                                           STREAM_HEADER_SIZE + layout.maxRecordSize(),
+                                           layout.chunkLength() + layout.paddingBlockSize(), pipelineDepth);
+        std::optional<utils::crypto::CryptoStateHandler> cryptoStateHandler;
+        size_t untilRekey = 0;
+        const auto lattice = createLatticeNoise(layout.latticeNoised(), fileKey);
+
+        pipeline.run(layout.totalChunkCount(), [&](const size_t index) {
+            const uint64_t segment = index / layout.fullSegmentChunkCount();
+            const size_t chunk = index % layout.fullSegmentChunkCount();
+            // The noise is never read; the stream header is read together with the first record.
+            const size_t recordLen = RECORD_PREFIX_SIZE + layout.chunkCipherSize(segment, chunk);
+            return chunk == 0
+                       ? file::ChunkPipeline::Transfer{
+                           layout.cipherOffset(segment), STREAM_HEADER_SIZE + recordLen
+                       }
+                       : file::ChunkPipeline::Transfer{layout.recordOffset(segment, chunk), recordLen};
+        }, [&](const size_t index, unsigned char *input, const size_t length, unsigned char *output) {
+            const uint64_t segment = index / layout.fullSegmentChunkCount();
+            const size_t chunk = index % layout.fullSegmentChunkCount();
+
+            if (chunk == 0) {
+                utils::crypto::DerivedKey segmentKey;
+                utils::crypto::KeyDerivation::deriveSegmentKey(segmentKey.data(), fileKey, segment);
+                cryptoStateHandler.emplace(layout.cipherSuite(), segmentKey.data(), input);
+                untilRekey = layout.rekeyInterval();
+                input += STREAM_HEADER_SIZE;
+            }
+
+            size_t outLen = openRecord(*cryptoStateHandler, layout.recordPrefix(segment, chunk), layout.xorMasked(),
+                                       lattice.get(), index, input, output);
+            if (layout.isFinalChunk(segment, chunk)) {
+                size_t unpaddedLen;
+                if (sodium_unpad(&unpaddedLen, output, outLen, layout.paddingBlockSize()) != 0 ||
+                    unpaddedLen != layout.chunkPlainSize(segment, chunk)) {
                     throw std::runtime_error("Unpadding failed");
                 }
-                fileHandler.outputFile.write(reinterpret_cast<char *>(bufferOut.data()), unpaddedLen);
-            } else {
-                fileHandler.outputFile.write(reinterpret_cast<char *>(bufferOut.data()), outLen);
+                outLen = unpaddedLen;
             }
 
-            if (++chunkCount % rekeyInterval == 0) {
-                rekey(cryptoStateHandler.getState());
+            if (--untilRekey == 0) {
+                rekey(*cryptoStateHandler);
+                untilRekey = layout.rekeyInterval();
             }
+            COUNT_STAT(bytesIn, length);
+            COUNT_STAT(bytesOut, outLen);
+            if (chunk + 1 == layout.chunkCount(segment)) {
+                COUNT_STAT(segments, 1);
+                utils::metrics::flushStats();
+            }
+            return file::ChunkPipeline::Transfer{layout.plainOffset(segment) + chunk * layout.chunkLength(), outLen};
+        });
+    }
+
+    size_t PolymorphicEncryptionEngine::sealRecord(utils::crypto::CryptoStateHandler &cryptoStateHandler,
+                                                   utils::crypto::NoiseGenerator &noise,
+                                                   const utils::math::LatticeNoise *latticeNoise,
+                                                   const ContainerLayout &layout, const uint64_t segment,
+                                                   const size_t chunk, const unsigned char *plaintext,
+                                                   const size_t length, const bool compressed,
+                                                   unsigned char *record) const {
+        return withRecordStages<RECORD_STAGES_ALL>(recordStages(layout), [&]<unsigned Stages>() {
+            return sealRecordWith<Stages>(cryptoStateHandler, noise, latticeNoise, layout, segment, chunk, plaintext,
+                                          length, compressed, record);
+        });
+    }
+
+    template<unsigned Stages>
+    size_t PolymorphicEncryptionEngine::sealRecordWith(utils::crypto::CryptoStateHandler &cryptoStateHandler,
+                                                       utils::crypto::NoiseGenerator &noise,
+                                                       const utils::math::LatticeNoise *latticeNoise,
+                                                       const ContainerLayout &layout, const uint64_t segment,
+                                                       const size_t chunk, const unsigned char *plaintext,
+                                                       const size_t length, const bool compressed,
+                                                       unsigned char *record) const {
+        const uint32_t prefix = layout.recordFlags(segment, chunk) |
+                                static_cast<uint32_t>(length + STREAM_ABYTES) |
+                                (compressed ? RECORD_FLAG_COMPRESSED : 0);
+        size_t outLen;
+
+        COUNT_STAT(chunks, 1);
+        storeLittleEndian32(record, prefix);
+        const unsigned char tag = prefix & RECORD_FLAG_SEGMENT_END ? STREAM_TAG_FINAL : STREAM_TAG_MESSAGE;
+        {
+            TIME_STAGE(Crypto);
+            outLen = cryptoStateHandler.push(record + RECORD_PREFIX_SIZE, plaintext, length, record,
+                                             RECORD_PREFIX_SIZE, tag);
+        }
+        if constexpr ((Stages & (RECORD_STAGE_XOR | RECORD_STAGE_LATTICE)) != 0) {
+            TIME_STAGE(Layers);
+            if constexpr ((Stages & RECORD_STAGE_XOR) != 0) {
+                xorTransform->apply(record + RECORD_PREFIX_SIZE, record + RECORD_PREFIX_SIZE, outLen);
+            }
+            if constexpr ((Stages & RECORD_STAGE_LATTICE) != 0) {
+                const std::span ciphertext(record + RECORD_PREFIX_SIZE, outLen);
+                latticeNoise->addLatticeNoise(ciphertext, ciphertext, segment * layout.fullSegmentChunkCount() + chunk);
+            }
+        }
+
+        if constexpr ((Stages & RECORD_STAGE_NOISE) != 0) {
+            const size_t noiseSize = layout.recordNoiseSize(prefix & RECORD_LENGTH_MASK);
+            TIME_STAGE(Noise);
+            noise.fill(record + RECORD_PREFIX_SIZE + outLen, noiseSize);
+            return RECORD_PREFIX_SIZE + outLen + noiseSize;
+        } else {
+            return RECORD_PREFIX_SIZE + outLen;
         }
     }
 
+    size_t PolymorphicEncryptionEngine::openRecord(utils::crypto::CryptoStateHandler &cryptoStateHandler,
+                                                   const uint32_t prefix, const bool xorMasked,
+                                                   const utils::math::LatticeNoise *latticeNoise,
+                                                   const uint64_t chunkIndex, const unsigned char *record,
+                                                   unsigned char *plaintext) const {
+        const unsigned stages = (xorMasked ? RECORD_STAGE_XOR : 0) | (latticeNoise ? RECORD_STAGE_LATTICE : 0);
+        return withRecordStages<RECORD_STAGE_XOR | RECORD_STAGE_LATTICE>(stages, [&]<unsigned Stages>() {
+            return openRecordWith<Stages>(cryptoStateHandler, prefix, latticeNoise, chunkIndex, record, plaintext);
+        });
+    }
+
+    template<unsigned Stages>
+    size_t PolymorphicEncryptionEngine::openRecordWith(utils::crypto::CryptoStateHandler &cryptoStateHandler,
+                                                       const uint32_t prefix,
+                                                       const utils::math::LatticeNoise *latticeNoise,
+                                                       const uint64_t chunkIndex, const unsigned char *record,
+                                                       unsigned char *plaintext) const {
+        size_t outLen;
+        unsigned char tag;
+
+        if (loadLittleEndian32(record) != prefix) {
+            throw std::runtime_error("Decryption failed");
+        }
+        COUNT_STAT(chunks, 1);
+        const size_t cipherLen = prefix & RECORD_LENGTH_MASK;
+        const unsigned char *ciphertext = record + RECORD_PREFIX_SIZE;
+        if constexpr ((Stages & (RECORD_STAGE_XOR | RECORD_STAGE_LATTICE)) != 0) {
+            TIME_STAGE(Layers);
+            // The input is usually a read-only mapping, so the layers are removed into a per-thread buffer.
+            thread_local std::vector<unsigned char> unmasked;
+            unmasked.resize(std::max(unmasked.size(), cipherLen));
+            if constexpr ((Stages & RECORD_STAGE_LATTICE) != 0) {
+                latticeNoise->removeLatticeNoise({ciphertext, cipherLen}, {unmasked.data(), cipherLen}, chunkIndex);
+                ciphertext = unmasked.data();
+            }
+            if constexpr ((Stages & RECORD_STAGE_XOR) != 0) {
+                xorTransform->apply(ciphertext, unmasked.data(), cipherLen);
+            }
+            ciphertext = unmasked.data();
+        }
+        {
+            TIME_STAGE(Crypto);
+            outLen = cryptoStateHandler.pull(plaintext, tag, ciphertext, cipherLen, record, RECORD_PREFIX_SIZE);
+        }
 
-    void PolymorphicEncryptionEngine::generateEncryptionKey() {
-        key = static_cast<unsigned char *>(sodium_malloc(crypto_secretstream_xchacha20poly1305_KEYBYTES));
+        const bool segmentEnd = (prefix & RECORD_FLAG_SEGMENT_END) != 0;
+        if ((tag == STREAM_TAG_FINAL) != segmentEnd) {
+            throw std::runtime_error("Decryption failed");
+        }
+        return outLen;
+    }
+
+    size_t PolymorphicEncryptionEngine::unpackChunk(const utils::compression::Codec *codec, const uint32_t prefix,
+                                                    const size_t paddingBlock, unsigned char *payload, size_t length,
+                                                    unsigned char *output, const size_t capacity) {
+        if (paddingBlock != 0 && sodium_unpad(&length, payload, length, paddingBlock) != 0) {
+            throw std::runtime_error("Unpadding failed");
+        }
+        if ((prefix & RECORD_FLAG_COMPRESSED) != 0) {
+            TIME_STAGE(Compress);
+            return codec->decompress({payload, length}, {output, capacity});
+        }
+        if (length > capacity) {
+            throw std::runtime_error("Decryption failed");
+        }
+        if (payload != output) {
+            std::copy_n(payload, length, output);
+        }
+        return length;
+    }
+
+    std::unique_ptr<utils::math::LatticeNoise> PolymorphicEncryptionEngine::createLatticeNoise(
+        const bool enabled, const unsigned char *fileKey) {
+        if (!enabled) {
+            return nullptr;
+        }
+        utils::crypto::DerivedKey latticeKey;
+        utils::crypto::KeyDerivation::deriveLatticeKey(latticeKey.data(), fileKey);
+        return std::make_unique<utils::math::LatticeNoise>(latticeKey.data());
+    }
+
+    void PolymorphicEncryptionEngine::forEachSegment(const uint64_t segmentCount,
+                                                     const std::function<void(uint64_t)> &task) const {
+        utils::metrics::StatsRecorder *recorder = utils::metrics::StatsRecorder::current();
+        if (segmentCount == 1 || pool->size() == 1) {
+            for (uint64_t segment = 0; segment < segmentCount; ++segment) {
+                const utils::metrics::StatsScope scope(recorder);
+                task(segment);
+            }
+            return;
+        }
+
+        std::vector<std::future<void> > results;
+        results.reserve(segmentCount);
+        for (uint64_t segment = 0; segment < segmentCount; ++segment) {
+            results.push_back(pool->submit([&task, recorder, segment] {
+                const utils::metrics::StatsScope scope(recorder);
+                task(segment);
+            }));
+        }
+
+        std::exception_ptr failure;
+        for (std::future<void> &result: results) {
+            try {
+                result.get();
+            } catch (...) {
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+            }
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+
+    void PolymorphicEncryptionEngine::generateEncryptionKey(const unsigned char *masterKey) {
+        key = static_cast<unsigned char *>(sodium_malloc(MASTER_KEY_SIZE));
         if (!key) {
             throw std::bad_alloc();
         }
         sodium_mprotect_readwrite(key);
 
-        utils::math::RNG rng;
-        for (size_t i = 0; i < crypto_secretstream_xchacha20poly1305_KEYBYTES; ++i) {
-            key[i] = rng.random<uint8_t>();
+        if (masterKey != nullptr) {
+            std::memcpy(key, masterKey, MASTER_KEY_SIZE);
+        } else {
+            utils::math::RNG rng;
+            rng.fill({key, MASTER_KEY_SIZE});
         }
 
         sodium_mprotect_readonly(key);
     }
 
-    void PolymorphicEncryptionEngine::generateXorKey() {
-        utils::math::RNG rng;
-        for (unsigned char &i: xor_key) {
-            i = rng.random<uint8_t>();
-        }
+    size_t PolymorphicEncryptionEngine::getChunkSize() const {
+        return chunkSize;
     }
 
-    inline void PolymorphicEncryptionEngine::xorBuffer(unsigned char *buffer, const size_t length) const {
-        for (size_t i = 0; i < length; ++i) {
-            buffer[i] ^= xor_key[i % POLYMORPHIC_KEY_SIZE];
-        }
+    uint8_t PolymorphicEncryptionEngine::getCipherSuite() const {
+        return cipherSuite;
     }
 
-    inline void PolymorphicEncryptionEngine::rekey(crypto_secretstream_xchacha20poly1305_state &state) const {
-        crypto_secretstream_xchacha20poly1305_rekey(&state);
+    const SecurityProfile &PolymorphicEncryptionEngine::getProfile() const {
+        return profile;
+    }
+
+    void PolymorphicEncryptionEngine::generateXorKey() {
+        utils::crypto::KeyDerivation::deriveXorKey(xor_key, key);
     }
 
-    void PolymorphicEncryptionEngine::generateMaskNoise(std::vector<unsigned char> &noise, const size_t length) const {
-        noise.resize(length);
-        randombytes_buf(noise.data(), length);
+    void PolymorphicEncryptionEngine::rekey(utils::crypto::CryptoStateHandler &cryptoStateHandler) const {
+        COUNT_STAT(rekeys, 1);
+        TIME_STAGE(Rekey);
+        cryptoStateHandler.rekey();
     }
 } // namespace engines::encryption
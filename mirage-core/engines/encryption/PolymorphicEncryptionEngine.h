@@ -1,110 +1,742 @@
 #ifndef POLYMORPHICENCRYPTIONENGINE_H
 #define POLYMORPHICENCRYPTIONENGINE_H
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
 #include <string>
+#include <vector>
+#include <sodium/crypto_generichash.h>
 #include <sodium/crypto_secretstream_xchacha20poly1305.h>
+#include "EncryptionStream.h"
+#include "IPolymorphicEncryptionEngine.h"
+#include "SecurityProfile.h"
+#include "../../file/ChunkPipeline.h"
+#include "../../utils/compression/Codec.h"
+#include "../../utils/concurrency/ThreadPool.h"
+#include "../../utils/crypto/CipherSuite.h"
+#include "../../utils/crypto/XorTransform.h"
+#include "../../utils/memory/SecureBufferPool.h"
+#include "../../utils/metrics/StageStats.h"
 
-#define PARANOID_MODE true
-#define POLYMORPHIC_KEY_SIZE 16
 #define DEFAULT_CHUNK_SIZE 4096
-#define PADDING_BLOCK_SIZE 16
-#define MIN_REKEY_INTERVAL 100
-#define MAX_REKEY_INTERVAL 1000
+#define DEFAULT_SEGMENT_SIZE (4 * 1024 * 1024)
+#define AUTOTUNE_MIN_CHUNK_SIZE (64 * 1024)
+#define AUTOTUNE_MAX_CHUNK_SIZE (4 * 1024 * 1024)
+#define AUTOTUNE_SAMPLE_SIZE (8 * 1024 * 1024)
+#define AUTOTUNE_ROUNDS 2
+#define MASTER_KEY_SIZE crypto_secretstream_xchacha20poly1305_KEYBYTES
+#define RECORD_STAGE_XOR 0x1u
+#define RECORD_STAGE_LATTICE 0x2u
+#define RECORD_STAGE_NOISE 0x4u
+#define RECORD_STAGES_ALL (RECORD_STAGE_XOR | RECORD_STAGE_LATTICE | RECORD_STAGE_NOISE)
+
+namespace file {
+ class FileHandler;
+ class ByteSource;
+ class ByteSink;
+}
+
+namespace utils::math {
+ class LatticeNoise;
+}
+
+namespace utils::crypto {
+ class CryptoStateHandler;
+ class NoiseGenerator;
+}
 
 namespace engines::encryption {
+ class ContainerLayout;
+ struct ContainerHeader;
+
+ /**
+  * @struct EngineOptions
+  * @brief Runtime configuration of a PolymorphicEncryptionEngine.
+  */
+ struct EngineOptions {
+  size_t chunkSize = DEFAULT_CHUNK_SIZE; /**< Plaintext size of a chunk; a non-zero multiple of the padding block. */
+  size_t segmentSize = DEFAULT_SEGMENT_SIZE; /**< Plaintext size of a segment, rounded down to whole chunks. */
+  size_t threadCount = 0; /**< Segment worker threads; zero selects std::thread::hardware_concurrency(). */
+  bool pipelined = false; /**< Overlap positional reads, crypto and writes instead of using file mappings. */
+  size_t pipelineDepth = DEFAULT_PIPELINE_DEPTH; /**< Chunk buffers in flight per direction in pipelined mode. */
+  SecurityProfile profile; /**< Rekey interval, padding, noise and optional stages of new containers. */
+  bool autotuneChunkSize = false; /**< Replace chunkSize with the fastest size measured on this host. */
+  const unsigned char *masterKey = nullptr; /**< MASTER_KEY_SIZE-byte key to use; nullptr generates a fresh one. */
+  bool collectStats = false; /**< Count and time the hot-path stages of every file and stream call. */
+  utils::metrics::ProgressCallback progress; /**< Called with running stats after every segment; enables stats. */
+  size_t bufferPoolLimit = DEFAULT_BUFFER_POOL_LIMIT; /**< Bytes of idle plaintext buffers kept between calls. */
+  bool hugePages = false; /**< Back large plaintext buffers with transparent huge pages. */
+  uint8_t compression = CODEC_NONE; /**< CODEC_* codec that chunks are compressed with before encryption. */
+  bool updatable = false; /**< Store segment digests so that updateFile() rewrites only changed segments. */
+  uint8_t cipherSuite = CIPHER_SUITE_AUTO; /**< CIPHER_SUITE_* cipher of new containers; AUTO picks the fastest. */
+ };
+
  /**
   * @class PolymorphicEncryptionEngine
   * @brief This class provides methods for encryption and decryption of files using a polymorphic encryption.
   *
   * The PolymorphicEncryptionEngine class uses an encryption module combined with XOR operations
   * to add a layer of polymorphism on top of the encryption. This ensures enhanced security by applying
-  * an additional XOR-based transformation to the encrypted data.
+  * an additional XOR-based transformation to the encrypted data. The rekey interval, the padding, the noise and
+  * the optional XOR and lattice noise stages come from a SecurityProfile, EngineOptions::profile by default or
+  * one passed to encryptFile() and encryptStream() per call; all of it is recorded in the container header, so
+  * decryption follows the file.
+  *
+  * The segment loops are templates over the RECORD_STAGE_* bits of the container, instantiated for every
+  * combination and selected once per segment, so the per-chunk path of a profile holds no test for a stage
+  * it does not run.
+  *
+  * With EngineOptions::collectStats or a progress callback, the file and stream calls count bytes, segments,
+  * chunks and rekeys and time the read, crypto, noise, layer, rekey, compress, digest and write stages on every
+  * thread. The probes cost one thread-local check when stats are off and are removed by building with
+  * INSTRUMENTATION_ENABLED=0.
+  *
+  * With EngineOptions::compression, every chunk is compressed before it is encrypted and stored as it is when
+  * that saves less than an eighth of it; the choice is recorded in the chunk's descriptor, so decryption needs
+  * no option. Compressed records vary in size, so such containers are written by the stream path, which packs
+  * segments as they are sealed, and read through file mappings even in pipelined mode. The record sizes
+  * reveal how well every chunk compresses.
+  *
+  * With EngineOptions::updatable, containers also store a keyed digest of every segment's plaintext, and
+  * updateFile() re-encrypts only the segments of a modified file whose digest changed.
+  *
+  * Buffers that hold plaintext are leased from an engine-wide SecureBufferPool, so they are page-aligned,
+  * locked in memory, zeroed on release and reused by later calls on any thread.
   */
- class PolymorphicEncryptionEngine final {
+ class PolymorphicEncryptionEngine final : public IPolymorphicEncryptionEngine {
  public:
   /**
    * @brief Constructs a new PolymorphicEncryptionEngine object.
    *
    * Initializes the PolymorphicEncryptionEngine, generates the encryption key, and the XOR key.
+   * Files are split into segments of DEFAULT_SEGMENT_SIZE bytes that are encrypted and decrypted
+   * concurrently on an internal thread pool.
+   *
+   * @param chunkSize The plaintext size of a chunk; must be a non-zero multiple of the padding block.
+   * @param threadCount The number of worker threads. Zero selects std::thread::hardware_concurrency().
    */
-  explicit PolymorphicEncryptionEngine(size_t chunkSize = DEFAULT_CHUNK_SIZE);
+  explicit PolymorphicEncryptionEngine(size_t chunkSize = DEFAULT_CHUNK_SIZE, size_t threadCount = 0);
+
+  /**
+   * @brief Constructs a new PolymorphicEncryptionEngine object from a full set of options.
+   *
+   * In pipelined mode the file is processed by a reader, a crypto and a writer stage that overlap disk
+   * I/O with encryption; chunks still go through the segment's stream in order, so the output format is the
+   * same as in the default mode. It suits storage where page faults on a file mapping stall the crypto,
+   * such as spinning disks and network mounts.
+   *
+   * With autotuneChunkSize set, the constructor encrypts an in-memory sample of AUTOTUNE_SAMPLE_SIZE bytes
+   * with every power-of-two chunk size from AUTOTUNE_MIN_CHUNK_SIZE to AUTOTUNE_MAX_CHUNK_SIZE and keeps
+   * the fastest one, which getChunkSize() returns. The chunk geometry is stored in every container header, so
+   * files encrypted with any chunk size decrypt with any engine holding the key.
+   *
+   * @param options The engine configuration.
+   */
+  explicit PolymorphicEncryptionEngine(const EngineOptions &options);
 
   /**
    * @brief Destroys the PolymorphicEncryptionEngine object.
    *
    * Cleans up and securely erases the encryption key and XOR key.
    */
-  ~PolymorphicEncryptionEngine();
+  ~PolymorphicEncryptionEngine() override;
 
   /**
    * @brief Encrypts a file.
    *
    * This method reads the input file, encrypts its contents, applies an XOR operation, and writes the
-   * encrypted data to the output file.
+   * encrypted data to the output file. The output is a segmented container: every segment is encrypted
+   * with its own key derived from the master key, and a trailer commits to the segment count and the
+   * plaintext size, so segments are processed in parallel while truncation and reordering are still
+   * detected. Inputs and outputs that cannot be mapped, such as FIFOs and character devices, go through
+   * encryptStream() instead.
+   *
+   * @param inputFilename The path to the input file.
+   * @param outputFilename The path to the output file.
+   * @return The stats of the call; all zero unless stats are enabled.
+   */
+  utils::metrics::OperationStats encryptFile(const std::string &inputFilename, const std::string &outputFilename) const;
+
+  /**
+   * @brief Encrypts a file with a security profile other than the engine's.
+   *
+   * Throws std::invalid_argument if the profile does not fit the engine's chunk size.
    *
    * @param inputFilename The path to the input file.
    * @param outputFilename The path to the output file.
+   * @param profile The rekey interval, padding, noise and optional stages of the container.
+   * @return The stats of the call; all zero unless stats are enabled.
    */
-  void encryptFile(const std::string &inputFilename, const std::string &outputFilename) const;
+  utils::metrics::OperationStats encryptFile(const std::string &inputFilename, const std::string &outputFilename,
+                                             const SecurityProfile &profile) const;
 
   /**
    * @brief Decrypts a file.
    *
    * This method reads the input file, applies an XOR operation to its contents, decrypts the data, and writes the
-   * decrypted data to the output file.
+   * decrypted data to the output file. Segments are decrypted in parallel; the trailer is authenticated
+   * before any segment is processed. Inputs and outputs that cannot be mapped go through decryptStream(),
+   * which authenticates the trailer last. A record that fails to authenticate throws IntegrityError, except in
+   * pipelined mode and through decryptStream().
    *
    * @param inputFilename The path to the input file.
    * @param outputFilename The path to the output file.
+   * @return The stats of the call; all zero unless stats are enabled.
    */
-  void decryptFile(const std::string &inputFilename, const std::string &outputFilename) const;
+  utils::metrics::OperationStats decryptFile(const std::string &inputFilename, const std::string &outputFilename) const;
+
+  /**
+   * @brief Authenticates a container without writing its plaintext.
+   *
+   * The trailer is authenticated first, then every record of every segment, in parallel. A record is opened
+   * into a locked per-segment scratch buffer of one chunk, which is erased when the segment is done, so no more
+   * than a chunk per segment of plaintext ever exists in memory and nothing is written. Records of one segment are
+   * chained by its stream and checked in order; segments are independent. Padding and compressed payloads are
+   * checked too, so a container that verifies decrypts. Inputs that cannot be mapped go through verifyStream().
+   *
+   * Throws IntegrityError for the first record in file order that fails, and std::runtime_error if the header
+   * or the trailer does not authenticate.
+   *
+   * @param inputFilename The path to the encrypted file.
+   * @return The stats of the call; all zero unless stats are enabled.
+   */
+  utils::metrics::OperationStats verifyFile(const std::string &inputFilename) const;
+
+  /**
+   * @brief Brings an updatable container up to date with a modified version of its plaintext.
+   *
+   * The new plaintext is hashed segment by segment and compared with the digests stored in the container;
+   * only segments whose plaintext changed, and the last segment when the size changed, are encrypted again,
+   * under a fresh stream header, and written over their old records. The segment table and the trailer are
+   * then resealed, so the container authenticates as a whole as before. A segment's chunks are chained by
+   * its stream, so a changed byte costs the rewrite of its segment; a smaller EngineOptions::segmentSize
+   * makes updates finer at the cost of one stream header and table entry per segment.
+   *
+   * The container keeps its header, file key and layers, whatever the engine's options. The update is made on a
+   * copy next to it, see file::ReplacementFile, which is synced and renamed over the container when complete, so
+   * a crash or a failure leaves either the old or the new container. On file systems that share extents, such
+   * as Btrfs and XFS, the copy costs no data writes; elsewhere it rewrites the whole container once and needs
+   * room for a second copy. Both files must be regular files; throws std::invalid_argument if the container was
+   * not written with EngineOptions::updatable.
+   *
+   * @param inputFilename The path to the new plaintext.
+   * @param outputFilename The path to the container to update.
+   * @return The stats of the call, counting re-encrypted segments only; all zero unless stats are enabled.
+   */
+  utils::metrics::OperationStats updateFile(const std::string &inputFilename, const std::string &outputFilename) const;
+
+  /**
+   * @brief Encrypts everything a source yields until its end into a sink.
+   *
+   * The plaintext size is not needed in advance: the source is read in blocks of whole segments, which are
+   * encrypted in parallel, and the segment still buffered when the source ends is sealed as the last one.
+   * Memory use is bounded by the block size, whatever the length of the input.
+   *
+   * @param source The plaintext, such as a pipe on standard input.
+   * @param sink The destination of the container.
+   * @return The stats of the call; all zero unless stats are enabled.
+   */
+  utils::metrics::OperationStats encryptStream(file::ByteSource &source, file::ByteSink &sink) const;
+
+  /**
+   * @brief Encrypts everything a source yields into a sink with a security profile other than the engine's.
+   *
+   * @param source The plaintext.
+   * @param sink The destination of the container.
+   * @param profile The rekey interval, padding, noise and optional stages of the container.
+   * @return The stats of the call; all zero unless stats are enabled.
+   */
+  utils::metrics::OperationStats encryptStream(file::ByteSource &source, file::ByteSink &sink,
+                                               const SecurityProfile &profile) const;
+
+  /**
+   * @brief Decrypts a container read from a source into a sink.
+   *
+   * Plaintext is written as soon as its records are authenticated, before the trailer is read; the method
+   * throws at the end if the container was truncated, reordered or not sealed with the engine's key, and the
+   * consumer must then discard what was written.
+   *
+   * @param source The container, such as a pipe on standard input.
+   * @param sink The destination of the plaintext.
+   * @return The stats of the call; all zero unless stats are enabled.
+   */
+  utils::metrics::OperationStats decryptStream(file::ByteSource &source, file::ByteSink &sink) const;
+
+  /**
+   * @brief Authenticates a container read from a source without writing its plaintext.
+   *
+   * Works like decryptStream() with a sink that drops the plaintext; throws if the container does not
+   * authenticate.
+   *
+   * @param source The container, such as a pipe on standard input.
+   * @return The stats of the call; all zero unless stats are enabled.
+   */
+  utils::metrics::OperationStats verifyStream(file::ByteSource &source) const;
+
+  /**
+   * @brief Decrypts a byte range of an encrypted file.
+   *
+   * The container layout locates the segments covering the range, and only those are read and decrypted,
+   * in parallel. Every chunk that is read is authenticated, and the geometry the offsets are computed from
+   * is authenticated by the trailer first. A segment is a single stream, so the chunks in front of the range
+   * within its first segment are decrypted too; a smaller EngineOptions::segmentSize bounds that work at
+   * the cost of one stream header per segment.
+   *
+   * @param inputFilename The path to the encrypted file.
+   * @param offset The offset of the range in the plaintext.
+   * @param length The length of the range.
+   * @return The plaintext of the range.
+   */
+  [[nodiscard]] std::vector<unsigned char> decryptRange(const std::string &inputFilename, uint64_t offset,
+                                                        size_t length) const;
+
+  /**
+   * @brief Gets the size of the container that encrypting a plaintext produces.
+   *
+   * @param plaintextSize The size of the plaintext in bytes.
+   * @return The exact size of the container in bytes, or an upper bound when compression is enabled.
+   */
+  [[nodiscard]] size_t encryptedSize(size_t plaintextSize) const override;
+
+  /**
+   * @brief Gets the plaintext size recorded in a container.
+   *
+   * The size is read from the trailer without authenticating it; decrypt() authenticates it.
+   *
+   * @param ciphertext The container.
+   * @return The size of the plaintext in bytes.
+   */
+  [[nodiscard]] size_t decryptedSize(std::span<const unsigned char> ciphertext) const override;
+
+  /**
+   * @brief Encrypts a buffer into a container in memory.
+   *
+   * The container has the same format as the files written by encryptFile(), and its segments are encrypted
+   * in parallel.
+   *
+   * @param plaintext The data to encrypt.
+   * @param ciphertext The output buffer, at least encryptedSize(plaintext.size()) bytes long.
+   * @return The number of bytes written to ciphertext.
+   */
+  size_t encrypt(std::span<const unsigned char> plaintext, std::span<unsigned char> ciphertext) const override;
+
+  /**
+   * @brief Decrypts a container held in memory.
+   *
+   * The header, the segment table and the trailer are authenticated first. Segments are then decrypted in
+   * parallel, each written to plaintext as its records authenticate. If a record fails to authenticate, the
+   * output is erased before its IntegrityError propagates, so no plaintext of a tampered container is left behind.
+   *
+   * @param ciphertext The container.
+   * @param plaintext The output buffer, at least decryptedSize(ciphertext) bytes long.
+   * @return The number of bytes written to plaintext.
+   */
+  size_t decrypt(std::span<const unsigned char> ciphertext, std::span<unsigned char> plaintext) const override;
+
+  /**
+   * @brief Creates a stream that encrypts data pushed to it in pieces.
+   *
+   * The stream refers to this engine, which must outlive it.
+   *
+   * @return The stream.
+   */
+  [[nodiscard]] EncryptionStream createEncryptionStream() const;
+
+  /**
+   * @brief Creates a stream that decrypts a container pushed to it in pieces.
+   *
+   * The stream refers to this engine, which must outlive it.
+   *
+   * @return The stream.
+   */
+  [[nodiscard]] DecryptionStream createDecryptionStream() const;
+
+  /**
+   * @brief Gets the chunk size new containers are encrypted with.
+   *
+   * @return The plaintext size of a chunk, as configured or as picked by the autotuner.
+   */
+  [[nodiscard]] size_t getChunkSize() const;
+
+  /**
+   * @brief Gets the cipher suite new containers are encrypted with.
+   *
+   * @return The CIPHER_SUITE_* identifier, as configured or as picked by the calibration.
+   */
+  [[nodiscard]] uint8_t getCipherSuite() const;
+
+  /**
+   * @brief Gets the security profile new containers are encrypted with unless a call passes another.
+   *
+   * @return The profile.
+   */
+  [[nodiscard]] const SecurityProfile &getProfile() const;
 
  private:
-  unsigned char xor_key[POLYMORPHIC_KEY_SIZE]{}; /**< XOR key used for additional polymorphic encryption. */
+  friend class EncryptionStream;
+  friend class DecryptionStream;
+  friend class ArchiveWriter;
+  friend class ArchiveReader;
+
+  unsigned char xor_key[XOR_KEY_SIZE]{}; /**< XOR key used for additional polymorphic encryption. */
   unsigned char *key{}; /**< Encryption key used for the primary encryption method. */
-  size_t chunkSize; /**< Size of the chunks used for encryption and decryption. */
+  size_t chunkSize; /**< Size of the chunks used for encryption. */
+  size_t segmentSize; /**< Requested plaintext size of a segment. */
+  size_t chunksPerSegment; /**< Number of chunks per independently encrypted segment. */
+  bool pipelined; /**< Whether files are processed by the read/crypt/write pipeline. */
+  size_t pipelineDepth; /**< Chunk buffers in flight per direction in pipelined mode. */
+  SecurityProfile profile; /**< Security profile of new containers unless a call passes another. */
+  uint8_t compression; /**< CODEC_* identifier of the codec new containers are compressed with. */
+  bool updatable; /**< Whether new containers store segment digests for updateFile(). */
+  uint8_t cipherSuite; /**< CIPHER_SUITE_* stream cipher of new containers, resolved from CIPHER_SUITE_AUTO. */
+  bool collectStats; /**< Whether file and stream calls collect stats. */
+  utils::metrics::ProgressCallback progress; /**< Progress callback of file and stream calls, or empty. */
+  std::unique_ptr<utils::crypto::XorTransform> xorTransform; /**< Vectorized XOR with xor_key. */
+  std::unique_ptr<utils::memory::SecureBufferPool> buffers; /**< Locked buffers for plaintext, shared by all calls. */
+  std::unique_ptr<utils::concurrency::ThreadPool> pool; /**< Workers processing segments in parallel. */
 
   /**
    * @brief Generates the XOR key.
    *
-   * Generates a random XOR key using the custom RNG.
+   * Derives the XOR key from the encryption key, so any engine holding the key removes the XOR layer.
    */
   void generateXorKey();
 
   /**
    * @brief Generates the encryption key.
    *
-   * Allocates and initializes the encryption key using the custom RNG.
+   * Allocates the encryption key and copies the given master key into it, or fills it using the custom RNG.
+   *
+   * @param masterKey The MASTER_KEY_SIZE-byte key to use, or nullptr.
    */
-  void generateEncryptionKey();
+  void generateEncryptionKey(const unsigned char *masterKey);
 
   /**
-   * @brief Applies an XOR operation to a buffer.
+   * @brief Gets the size of the blocks encryptStream() and decryptStream() read.
    *
-   * This method applies an XOR operation to the given buffer using the XOR key.
-   *
-   * @param buffer The buffer to be XORed.
-   * @param length The length of the buffer.
+   * @return At least DEFAULT_STREAM_BLOCK_SIZE, and one segment per worker so blocks are encrypted in parallel.
    */
-  void xorBuffer(unsigned char *buffer, size_t length) const;
+  [[nodiscard]] size_t streamBlockSize() const;
 
   /**
    * @brief Rekeys the encryption state.
    *
    * Updates the encryption state with a new key.
    *
-   * @param state The current encryption state.
+   * @param cryptoStateHandler The stream of the current segment.
    */
-  void rekey(crypto_secretstream_xchacha20poly1305_state &state) const;
+  void rekey(utils::crypto::CryptoStateHandler &cryptoStateHandler) const;
 
   /**
-  * @brief Generates a mask noise.
-  *
-  * Generates a random noise mask of the specified length using the randombytes_buf function.
-  *
-  * @param noise The noise buffer to be generated.
-  * @param length The length of the noise buffer.
-  */
-  void generateMaskNoise(std::vector<unsigned char> &noise, size_t length) const;
+   * @brief Sets the chunk size and the geometry that depends on it.
+   *
+   * @param size The plaintext size of a chunk.
+   */
+  void setChunkSize(size_t size);
+
+  /**
+   * @brief Picks the chunk size with the highest encryption throughput on this host.
+   *
+   * Every candidate is timed AUTOTUNE_ROUNDS times on one thread and the best round counts, so the
+   * result reflects the per-chunk MAC, noise and record overhead rather than scheduling noise.
+   */
+  void autotuneChunkSize();
+
+  /**
+   * @brief Builds the header of a new container with the engine's chunk geometry and a fresh file identifier.
+   *
+   * Throws std::invalid_argument if the profile does not fit the chunk size.
+   *
+   * @param profile The security profile of the container.
+   * @return The header.
+   */
+  [[nodiscard]] ContainerHeader createHeader(const SecurityProfile &profile) const;
+
+  /**
+   * @brief Encrypts one segment of a file.
+   *
+   * Reads the plaintext straight from the input mapping and writes the records straight into the output
+   * mapping; only the padded final chunk is copied. In compressed containers the segment may come out shorter
+   * than its slot in the layout. In updatable containers the segment's stream header and plaintext digest are
+   * written to its segment table entry.
+   *
+   * @param input The plaintext of the segment.
+   * @param output The container bytes of the segment, starting at its stream header.
+   * @param layout The layout of the container being written.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @param noiseSeed The per-file seed of the mask noise.
+   * @param segment The index of the segment.
+   * @param tableEntry The segment's entry in the segment table; only written in updatable containers.
+   * @return The number of container bytes written.
+   */
+  size_t encryptSegment(const unsigned char *input, unsigned char *output, const ContainerLayout &layout,
+                        const unsigned char *fileKey, const unsigned char *noiseSeed, uint64_t segment,
+                        unsigned char *tableEntry) const;
+
+  /**
+   * @brief Encrypts one segment of a file with the record stages of its container fixed at compile time.
+   *
+   * @tparam Stages The RECORD_STAGE_* bits of the container.
+   * @see encryptSegment()
+   */
+  template<unsigned Stages>
+  size_t encryptSegmentWith(const unsigned char *input, unsigned char *output, const ContainerLayout &layout,
+                            const unsigned char *fileKey, const unsigned char *noiseSeed, uint64_t segment,
+                            unsigned char *tableEntry) const;
+
+  /**
+   * @brief Starts the keyed digest of a segment's plaintext, bound to the segment's position in the file.
+   *
+   * @param state The state to initialize; the plaintext is hashed into it with crypto_generichash_update.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @param segment The index of the segment.
+   */
+  static void beginSegmentDigest(crypto_generichash_state &state, const unsigned char *fileKey, uint64_t segment);
+
+  /**
+   * @brief Checks the stream headers of an updatable container against its authenticated segment table.
+   *
+   * @param input The whole container.
+   * @param layout The layout of the container, whose trailer is authenticated.
+   */
+  static void checkStreamHeaders(const unsigned char *input, const ContainerLayout &layout);
+
+  /**
+   * @brief Decrypts one segment of a file.
+   *
+   * Authenticates and decrypts the records straight from the input mapping into the output mapping.
+   *
+   * @param input The container bytes of the segment, starting at its stream header.
+   * @param output The plaintext of the segment.
+   * @param layout The layout of the container being read.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @param segment The index of the segment.
+   */
+  void decryptSegment(const unsigned char *input, unsigned char *output, const ContainerLayout &layout,
+                      const unsigned char *fileKey, uint64_t segment) const;
+
+  /**
+   * @brief Decrypts one segment of a file with the record stages of its container fixed at compile time.
+   *
+   * @tparam Stages The RECORD_STAGE_XOR and RECORD_STAGE_LATTICE bits of the container.
+   * @see decryptSegment()
+   */
+  template<unsigned Stages>
+  void decryptSegmentWith(const unsigned char *input, unsigned char *output, const ContainerLayout &layout,
+                          const unsigned char *fileKey, uint64_t segment) const;
+
+  /**
+   * @brief Authenticates one segment of a file without writing its plaintext.
+   *
+   * Throws IntegrityError for the first record of the segment that fails.
+   *
+   * @param input The whole container.
+   * @param layout The authenticated layout of the container.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @param segment The index of the segment.
+   */
+  void verifySegment(const unsigned char *input, const ContainerLayout &layout, const unsigned char *fileKey,
+                     uint64_t segment) const;
+
+  /**
+   * @brief Authenticates one segment of a file with the record stages of its container fixed at compile time.
+   *
+   * @tparam Stages The RECORD_STAGE_XOR and RECORD_STAGE_LATTICE bits of the container.
+   * @see verifySegment()
+   */
+  template<unsigned Stages>
+  void verifySegmentWith(const unsigned char *input, const ContainerLayout &layout, const unsigned char *fileKey,
+                         uint64_t segment) const;
+
+  /**
+   * @brief Decrypts a plaintext range of an opened container, one task per segment it overlaps.
+   *
+   * @param fileHandler The open container.
+   * @param layout The authenticated layout of the container.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @param offset The offset of the range in the plaintext.
+   * @param length The length of the range; non-zero.
+   * @param output The plaintext of the range.
+   */
+  void decryptRange(const file::FileHandler &fileHandler, const ContainerLayout &layout,
+                    const unsigned char *fileKey, uint64_t offset, size_t length, unsigned char *output) const;
+
+  /**
+   * @brief Decrypts the part of a segment that overlaps a plaintext range.
+   *
+   * @param fileHandler The open container.
+   * @param layout The layout of the container being read.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @param segment The index of the segment.
+   * @param offset The offset of the range in the plaintext.
+   * @param length The length of the range.
+   * @param output The plaintext of the whole range.
+   */
+  void decryptSegmentRange(const file::FileHandler &fileHandler, const ContainerLayout &layout,
+                           const unsigned char *fileKey, uint64_t segment, uint64_t offset, size_t length,
+                           unsigned char *output) const;
+
+  /**
+   * @brief Packs segments written into the slots of a compressed container's layout against each other.
+   *
+   * @param output The container bytes of the first segment's slot.
+   * @param slotSize The distance between two slots.
+   * @param sizes The number of bytes written into every slot.
+   * @return The size of the packed segments.
+   */
+  static uint64_t packSegments(unsigned char *output, uint64_t slotSize, std::span<const uint64_t> sizes);
+
+  /**
+   * @brief Writes the segment table, if any, and the trailer that commits to a container's header, segment
+   * count, plaintext size and segment table.
+   *
+   * The digest entries of updatable containers must already be in place at the start of out.
+   *
+   * @param out Output buffer of segmentTableSize() + CONTAINER_TRAILER_SIZE bytes.
+   * @param layout The layout of the container.
+   * @param headerBytes The serialized header.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   */
+  void sealTrailer(unsigned char *out, const ContainerLayout &layout, const unsigned char *headerBytes,
+                   const unsigned char *fileKey) const;
+
+  /**
+   * @brief Parses and authenticates the header and the trailer of a container.
+   *
+   * Throws if the container is truncated, was not sealed with this engine's key, or its size does not match
+   * the geometry recorded in the header.
+   *
+   * @param input The whole container.
+   * @param size The size of the container in bytes.
+   * @param fileKey Output buffer for the key of the file.
+   * @return The layout of the container.
+   */
+  [[nodiscard]] ContainerLayout openContainer(const unsigned char *input, uint64_t size, unsigned char *fileKey) const;
+
+  /**
+   * @brief Encrypts a file with overlapping read, crypto and write stages.
+   *
+   * @param fileHandler The open input and output files.
+   * @param layout The layout of the container being written.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @param noiseSeed The per-file seed of the mask noise.
+   * @param segmentTable Output buffer for the segment table of updatable containers.
+   */
+  void encryptPipelined(const file::FileHandler &fileHandler, const ContainerLayout &layout,
+                        const unsigned char *fileKey, const unsigned char *noiseSeed,
+                        unsigned char *segmentTable) const;
+
+  /**
+   * @brief Decrypts a file with overlapping read, crypto and write stages.
+   *
+   * @param fileHandler The open input and output files.
+   * @param layout The layout of the container being read.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   */
+  void decryptPipelined(const file::FileHandler &fileHandler, const ContainerLayout &layout,
+                        const unsigned char *fileKey) const;
+
+  /**
+   * @brief Encrypts a chunk into a record: descriptor, ciphertext and mask noise.
+   *
+   * @param cryptoStateHandler The state of the segment's stream.
+   * @param noise The source of the mask noise.
+   * @param latticeNoise The lattice noise stage of the file, or nullptr.
+   * @param layout The layout of the container being written.
+   * @param segment The index of the segment.
+   * @param chunk The index of the chunk in the segment.
+   * @param plaintext The (compressed, padded) chunk.
+   * @param length The length of the chunk.
+   * @param compressed Whether the chunk was compressed, which the descriptor records.
+   * @param record The output buffer.
+   * @return The number of bytes written to record.
+   */
+  size_t sealRecord(utils::crypto::CryptoStateHandler &cryptoStateHandler, utils::crypto::NoiseGenerator &noise,
+                    const utils::math::LatticeNoise *latticeNoise, const ContainerLayout &layout,
+                    uint64_t segment, size_t chunk, const unsigned char *plaintext, size_t length, bool compressed,
+                    unsigned char *record) const;
+
+  /**
+   * @brief Encrypts a chunk into a record with the record stages of the container fixed at compile time.
+   *
+   * @tparam Stages The RECORD_STAGE_* bits of the container.
+   * @see sealRecord()
+   */
+  template<unsigned Stages>
+  size_t sealRecordWith(utils::crypto::CryptoStateHandler &cryptoStateHandler, utils::crypto::NoiseGenerator &noise,
+                        const utils::math::LatticeNoise *latticeNoise, const ContainerLayout &layout,
+                        uint64_t segment, size_t chunk, const unsigned char *plaintext, size_t length,
+                        bool compressed, unsigned char *record) const;
+
+  /**
+   * @brief Authenticates and decrypts a record.
+   *
+   * Throws if the descriptor, the MAC or the stream tag does not match what the layout expects.
+   *
+   * @param cryptoStateHandler The state of the segment's stream.
+   * @param prefix The descriptor expected for this record, authenticated as associated data.
+   * @param xorMasked Whether the ciphertext carries the XOR layer.
+   * @param latticeNoise The lattice noise stage of the file, or nullptr.
+   * @param chunkIndex The index of the chunk in the file, which selects its lattice noise stream.
+   * @param record The record, starting at its descriptor.
+   * @param plaintext The output buffer.
+   * @return The length of the (padded, compressed) plaintext.
+   */
+  size_t openRecord(utils::crypto::CryptoStateHandler &cryptoStateHandler, uint32_t prefix, bool xorMasked,
+                    const utils::math::LatticeNoise *latticeNoise, uint64_t chunkIndex, const unsigned char *record,
+                    unsigned char *plaintext) const;
+
+  /**
+   * @brief Authenticates and decrypts a record with the record stages of the container fixed at compile time.
+   *
+   * @tparam Stages The RECORD_STAGE_XOR and RECORD_STAGE_LATTICE bits of the container.
+   * @see openRecord()
+   */
+  template<unsigned Stages>
+  size_t openRecordWith(utils::crypto::CryptoStateHandler &cryptoStateHandler, uint32_t prefix,
+                        const utils::math::LatticeNoise *latticeNoise, uint64_t chunkIndex,
+                        const unsigned char *record, unsigned char *plaintext) const;
+
+  /**
+   * @brief Turns the decrypted payload of a record back into the chunk.
+   *
+   * Removes the padding of the final chunk and decompresses the payload of records flagged as compressed.
+   * Throws if either is malformed or the chunk does not fit the output.
+   *
+   * @param codec The codec of the container, or nullptr.
+   * @param prefix The descriptor of the record.
+   * @param paddingBlock The block the final chunk is padded to if the record holds it, otherwise zero.
+   * @param payload The decrypted payload; may be the output itself unless the record is compressed.
+   * @param length The length of the payload.
+   * @param output The destination of the chunk.
+   * @param capacity The size of the output.
+   * @return The length of the chunk.
+   */
+  static size_t unpackChunk(const utils::compression::Codec *codec, uint32_t prefix, size_t paddingBlock,
+                            unsigned char *payload, size_t length, unsigned char *output, size_t capacity);
+
+  /**
+   * @brief Creates the lattice noise stage of a file.
+   *
+   * @param enabled Whether the container carries lattice noise.
+   * @param fileKey The key of the file, derived from the master key and the file identifier.
+   * @return The stage keyed for the file, or nullptr when it is disabled.
+   */
+  [[nodiscard]] static std::unique_ptr<utils::math::LatticeNoise> createLatticeNoise(bool enabled,
+                                                                                     const unsigned char *fileKey);
+
+  /**
+   * @brief Runs a task for every segment, in parallel when the pool has more than one worker.
+   *
+   * Waits for every task before rethrowing the first exception, so tasks never outlive the caller's state.
+   * Every task reports its stats to the caller's recorder when it finishes.
+   *
+   * @param segmentCount The number of segments.
+   * @param task The task to run for each segment index.
+   */
+  void forEachSegment(uint64_t segmentCount, const std::function<void(uint64_t)> &task) const;
  };
 } // namespace engines::encryption
 
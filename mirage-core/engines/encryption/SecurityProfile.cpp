@@ -0,0 +1,74 @@
+#include "SecurityProfile.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace engines::encryption {
+    SecurityProfile SecurityProfile::forLevel(const SecurityLevel level) {
+        switch (level) {
+            case SecurityLevel::Paranoid:
+                return {
+                    level, PARANOID_REKEY_BYTES, PARANOID_PADDING_BLOCK_SIZE, PARANOID_NOISE_PERCENT, true, true
+                };
+            case SecurityLevel::Balanced:
+                return {
+                    level, BALANCED_REKEY_BYTES, BALANCED_PADDING_BLOCK_SIZE, BALANCED_NOISE_PERCENT, false, false
+                };
+            case SecurityLevel::Throughput:
+                return {
+                    level, THROUGHPUT_REKEY_BYTES, THROUGHPUT_PADDING_BLOCK_SIZE, THROUGHPUT_NOISE_PERCENT, false,
+                    false
+                };
+        }
+        throw std::invalid_argument("Unknown security profile");
+    }
+
+    SecurityProfile SecurityProfile::fromName(const char *name) {
+        for (const SecurityLevel level: {SecurityLevel::Paranoid, SecurityLevel::Balanced, SecurityLevel::Throughput}) {
+            if (std::strcmp(name, SecurityProfile::name(level)) == 0) {
+                return forLevel(level);
+            }
+        }
+        throw std::invalid_argument(std::string("Unknown security profile: ") + name);
+    }
+
+    const char *SecurityProfile::name(const SecurityLevel level) {
+        switch (level) {
+            case SecurityLevel::Paranoid:
+                return "paranoid";
+            case SecurityLevel::Balanced:
+                return "balanced";
+            case SecurityLevel::Throughput:
+                return "throughput";
+        }
+        return "unknown";
+    }
+
+    void SecurityProfile::validate(const size_t chunkSize) const {
+        if (paddingBlockSize < PROFILE_MIN_PADDING_BLOCK_SIZE || paddingBlockSize > PROFILE_MAX_PADDING_BLOCK_SIZE ||
+            (paddingBlockSize & (paddingBlockSize - 1)) != 0 || chunkSize % paddingBlockSize != 0) {
+            throw std::invalid_argument("The padding block must be a power of two from " +
+                                        std::to_string(PROFILE_MIN_PADDING_BLOCK_SIZE) + " to " +
+                                        std::to_string(PROFILE_MAX_PADDING_BLOCK_SIZE) +
+                                        " bytes that divides the chunk size");
+        }
+        if (noisePercent > PROFILE_MAX_NOISE_PERCENT) {
+            throw std::invalid_argument("Noise must not exceed " + std::to_string(PROFILE_MAX_NOISE_PERCENT) +
+                                        " percent of the chunk size");
+        }
+        if (rekeyBytes == 0) {
+            throw std::invalid_argument("Rekey interval must be non-zero");
+        }
+    }
+
+    uint32_t SecurityProfile::rekeyInterval(const size_t chunkSize) const {
+        return static_cast<uint32_t>(std::clamp<uint64_t>(rekeyBytes / chunkSize, 1,
+                                                          std::numeric_limits<uint32_t>::max()));
+    }
+
+    uint32_t SecurityProfile::noiseSize(const size_t chunkSize) const {
+        return static_cast<uint32_t>(static_cast<uint64_t>(chunkSize) * noisePercent / 100);
+    }
+} // namespace engines::encryption
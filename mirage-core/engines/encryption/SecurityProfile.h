@@ -0,0 +1,103 @@
+#ifndef SECURITYPROFILE_H
+#define SECURITYPROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define PARANOID_REKEY_BYTES (256 * 1024)
+#define PARANOID_PADDING_BLOCK_SIZE 256
+#define PARANOID_NOISE_PERCENT 100
+#define BALANCED_REKEY_BYTES (1024 * 1024)
+#define BALANCED_PADDING_BLOCK_SIZE 16
+#define BALANCED_NOISE_PERCENT 50
+#define THROUGHPUT_REKEY_BYTES (64 * 1024 * 1024)
+#define THROUGHPUT_PADDING_BLOCK_SIZE 16
+#define THROUGHPUT_NOISE_PERCENT 0
+#define PROFILE_MIN_PADDING_BLOCK_SIZE 16
+#define PROFILE_MAX_PADDING_BLOCK_SIZE 4096
+#define PROFILE_MAX_NOISE_PERCENT 100
+
+namespace engines::encryption {
+ /**
+  * @brief The named security profiles.
+  */
+ enum class SecurityLevel { Paranoid, Balanced, Throughput };
+
+ /**
+  * @struct SecurityProfile
+  * @brief The trade-off between hiding and speed a container is written with.
+  *
+  * A profile sets how much plaintext a segment's stream seals between rekeys, the block the final chunk is
+  * padded to, the noise appended to every record as a share of the chunk size and the optional XOR and lattice
+  * noise stages. All of it is recorded in the container header, so decryption follows the file whatever profile
+  * the decrypting engine has, and one engine writes containers of any profile.
+  *
+  * Paranoid rekeys every PARANOID_REKEY_BYTES, pads to PARANOID_PADDING_BLOCK_SIZE bytes, doubles every record
+  * with noise and runs both stages. Balanced, the default, rekeys every BALANCED_REKEY_BYTES and adds half a
+  * chunk of noise. Throughput rekeys only every THROUGHPUT_REKEY_BYTES, which segments of the default size never
+  * reach, and writes no noise. The fields may also be set one by one.
+  */
+ struct SecurityProfile {
+  SecurityLevel level = SecurityLevel::Balanced; /**< The profile the fields started from. */
+  uint64_t rekeyBytes = BALANCED_REKEY_BYTES; /**< Plaintext bytes a stream seals between two rekeys. */
+  uint32_t paddingBlockSize = BALANCED_PADDING_BLOCK_SIZE; /**< Power of two the final chunk is padded to. */
+  uint32_t noisePercent = BALANCED_NOISE_PERCENT; /**< Noise bytes per record, in percent of the chunk size. */
+  bool xorLayer = false; /**< XOR the ciphertext of every record with the engine's XOR key. */
+  bool latticeNoise = false; /**< Add per-file keyed lattice noise to the ciphertext of every record. */
+
+  /**
+   * @brief Gets the settings of a named profile.
+   *
+   * @param level The profile.
+   * @return The profile's settings.
+   */
+  [[nodiscard]] static SecurityProfile forLevel(SecurityLevel level);
+
+  /**
+   * @brief Finds a profile by name.
+   *
+   * Throws std::invalid_argument if no profile has the name.
+   *
+   * @param name "paranoid", "balanced" or "throughput".
+   * @return The profile's settings.
+   */
+  [[nodiscard]] static SecurityProfile fromName(const char *name);
+
+  /**
+   * @brief Gets the name of a profile.
+   *
+   * @param level The profile.
+   * @return The name, such as "balanced".
+   */
+  [[nodiscard]] static const char *name(SecurityLevel level);
+
+  /**
+   * @brief Checks that the profile can be used with a chunk size.
+   *
+   * Throws std::invalid_argument if the padding block is not a power of two from PROFILE_MIN_PADDING_BLOCK_SIZE
+   * to PROFILE_MAX_PADDING_BLOCK_SIZE dividing the chunk size, the noise exceeds PROFILE_MAX_NOISE_PERCENT or
+   * the rekey interval is zero.
+   *
+   * @param chunkSize The plaintext size of a chunk.
+   */
+  void validate(size_t chunkSize) const;
+
+  /**
+   * @brief Gets the number of chunks between two rekeys.
+   *
+   * @param chunkSize The plaintext size of a chunk.
+   * @return rekeyBytes in whole chunks; at least one.
+   */
+  [[nodiscard]] uint32_t rekeyInterval(size_t chunkSize) const;
+
+  /**
+   * @brief Gets the number of noise bytes appended to a full chunk's record.
+   *
+   * @param chunkSize The plaintext size of a chunk.
+   * @return The noise size in bytes.
+   */
+  [[nodiscard]] uint32_t noiseSize(size_t chunkSize) const;
+ };
+} // namespace engines::encryption
+
+#endif // SECURITYPROFILE_H
@@ -0,0 +1,125 @@
+#include "ChunkPipeline.h"
+#include "FileHandler.h"
+#include "../utils/concurrency/SpscRing.h"
+#include "../utils/memory/SecureBufferPool.h"
+#include "../utils/metrics/StageStats.h"
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace file {
+    namespace {
+        struct FilledInput {
+            size_t slot;
+            size_t length;
+        };
+
+        struct PendingWrite {
+            size_t slot;
+            ChunkPipeline::Transfer target;
+        };
+    }
+
+    ChunkPipeline::ChunkPipeline(const FileHandler &fileHandler, utils::memory::SecureBufferPool &buffers,
+                                 const size_t inputCapacity, const size_t outputCapacity, const size_t depth)
+        : fileHandler(fileHandler), buffers(buffers), inputCapacity(inputCapacity), outputCapacity(outputCapacity),
+          depth(depth == 0 ? 1 : depth) {
+    }
+
+    void ChunkPipeline::run(const size_t count, const ReadPlan &readPlan, const Process &process) const {
+        // Slot i of a direction starts at i * capacity; both blocks are erased when they are released.
+        const utils::memory::SecureBuffer inputSlots = buffers.acquire(depth * inputCapacity);
+        const utils::memory::SecureBuffer outputSlots = buffers.acquire(depth * outputCapacity);
+        auto inputAt = [&](const size_t slot) { return inputSlots.data() + slot * inputCapacity; };
+        auto outputAt = [&](const size_t slot) { return outputSlots.data() + slot * outputCapacity; };
+
+        utils::concurrency::SpscRing<size_t> freeInputs(depth);
+        utils::concurrency::SpscRing<FilledInput> filledInputs(depth);
+        utils::concurrency::SpscRing<size_t> freeOutputs(depth);
+        utils::concurrency::SpscRing<PendingWrite> pendingWrites(depth);
+        for (size_t slot = 0; slot < depth; ++slot) {
+            freeInputs.tryPush(slot);
+            freeOutputs.tryPush(slot);
+        }
+
+        std::mutex failureMutex;
+        std::exception_ptr failure;
+        auto fail = [&] {
+            {
+                std::lock_guard lock(failureMutex);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+            }
+            freeInputs.close();
+            filledInputs.close();
+            freeOutputs.close();
+            pendingWrites.close();
+        };
+
+        // The stage threads report to the caller's recorder, in batches so progress stays current.
+        utils::metrics::StatsRecorder *recorder = utils::metrics::StatsRecorder::current();
+        std::thread reader([&] {
+            const utils::metrics::StatsScope scope(recorder);
+            try {
+                for (size_t index = 0; index < count; ++index) {
+                    size_t slot;
+                    if (!freeInputs.pop(slot)) {
+                        return;
+                    }
+                    const Transfer source = readPlan(index);
+                    fileHandler.readAt(inputAt(slot), source.length, source.offset);
+                    if (!filledInputs.push({slot, source.length})) {
+                        return;
+                    }
+                    if ((index + 1) % STATS_FLUSH_INTERVAL == 0) {
+                        utils::metrics::flushStats();
+                    }
+                }
+            } catch (...) {
+                fail();
+            }
+        });
+
+        std::thread writer([&] {
+            const utils::metrics::StatsScope scope(recorder);
+            try {
+                PendingWrite write{};
+                for (size_t written = 1; pendingWrites.pop(write); ++written) {
+                    fileHandler.writeAt(outputAt(write.slot), write.target.length, write.target.offset);
+                    freeOutputs.push(write.slot);
+                    if (written % STATS_FLUSH_INTERVAL == 0) {
+                        utils::metrics::flushStats();
+                    }
+                }
+            } catch (...) {
+                fail();
+            }
+        });
+
+        try {
+            for (size_t index = 0; index < count; ++index) {
+                FilledInput input{};
+                size_t outputSlot;
+                if (!filledInputs.pop(input) || !freeOutputs.pop(outputSlot)) {
+                    break;
+                }
+                const Transfer target = process(index, inputAt(input.slot), input.length, outputAt(outputSlot));
+                freeInputs.push(input.slot);
+                if (!pendingWrites.push({outputSlot, target})) {
+                    break;
+                }
+            }
+        } catch (...) {
+            fail();
+        }
+
+        pendingWrites.close();
+        reader.join();
+        writer.join();
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+} // namespace file
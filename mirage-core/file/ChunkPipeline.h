@@ -0,0 +1,84 @@
+#ifndef CHUNKPIPELINE_H
+#define CHUNKPIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#define DEFAULT_PIPELINE_DEPTH 8
+
+namespace utils::memory {
+    class SecureBufferPool;
+}
+
+namespace file {
+    class FileHandler;
+
+    /**
+     * @class ChunkPipeline
+     * @brief Overlaps reading, processing and writing of a sequence of chunks.
+     *
+     * A reader thread fills input slots with positional reads, the calling thread transforms them in order
+     * into output slots, and a writer thread stores the results with positional writes. The stages hand
+     * reusable slot buffers to each other through bounded lock-free rings, so the disk and the CPU work at
+     * the same time while the transformation still sees every chunk in sequence. The slots of a run are
+     * leased from a SecureBufferPool, one block per direction.
+     */
+    class ChunkPipeline {
+    public:
+        /**
+         * @struct Transfer
+         * @brief A byte range of a file.
+         */
+        struct Transfer {
+            uint64_t offset; /**< Offset of the range in the file. */
+            size_t length; /**< Length of the range. */
+        };
+
+        /**
+         * @brief Returns the input range of the chunk with the given index.
+         */
+        using ReadPlan = std::function<Transfer(size_t index)>;
+
+        /**
+         * @brief Transforms an input slot into an output slot and returns where the output goes.
+         *
+         * Called on the calling thread, in index order. The input slot is writable.
+         */
+        using Process = std::function<Transfer(size_t index, unsigned char *input, size_t length,
+                                               unsigned char *output)>;
+
+        /**
+         * @brief Constructs a new ChunkPipeline object.
+         *
+         * @param fileHandler The open input and output files.
+         * @param buffers The pool the slots are leased from.
+         * @param inputCapacity The size of every input slot.
+         * @param outputCapacity The size of every output slot.
+         * @param depth The number of slots in flight per direction.
+         */
+        ChunkPipeline(const FileHandler &fileHandler, utils::memory::SecureBufferPool &buffers, size_t inputCapacity,
+                      size_t outputCapacity, size_t depth = DEFAULT_PIPELINE_DEPTH);
+
+        /**
+         * @brief Runs the pipeline over a number of chunks.
+         *
+         * Returns after every output was written. If any stage throws, the other stages are stopped and the
+         * first exception is rethrown.
+         *
+         * @param count The number of chunks.
+         * @param readPlan Gives the input range of every chunk.
+         * @param process Transforms every chunk.
+         */
+        void run(size_t count, const ReadPlan &readPlan, const Process &process) const;
+
+    private:
+        const FileHandler &fileHandler; /**< The open input and output files. */
+        utils::memory::SecureBufferPool &buffers; /**< The pool the slots are leased from. */
+        size_t inputCapacity; /**< Size of an input slot. */
+        size_t outputCapacity; /**< Size of an output slot. */
+        size_t depth; /**< Number of slots per direction. */
+    };
+} // namespace file
+
+#endif // CHUNKPIPELINE_H
@@ -1,19 +1,58 @@
 #include "FileHandler.h"
+#include "../utils/metrics/StageStats.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <stdexcept>
-#include <iostream>
+#include <vector>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 namespace file {
-    FileHandler::FileHandler(const std::string &inputFilename, const std::string &outputFilename)
-        : inputFile(inputFilename, std::ios::binary), outputFile(outputFilename, std::ios::binary), inputFd(-1),
-          fileSize(0), fileData(nullptr) {
-        if (!inputFile.is_open() || !outputFile.is_open()) {
-            throw std::runtime_error("Failed to open file streams");
+    namespace {
+        // Copies size bytes from the start of input to output, in the kernel where it can.
+        bool copyData(const int input, const int output, off_t size) {
+            bool kernelCopy = true;
+            std::vector<unsigned char> buffer;
+            while (size > 0) {
+                ssize_t count;
+                if (kernelCopy) {
+                    count = copy_file_range(input, nullptr, output, nullptr, static_cast<size_t>(size), 0);
+                    if (count == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                        kernelCopy = false;
+                        buffer.resize(1024 * 1024);
+                        continue;
+                    }
+                } else {
+                    count = read(input, buffer.data(), std::min<size_t>(buffer.size(), static_cast<size_t>(size)));
+                    for (ssize_t done = 0; count > 0 && done < count;) {
+                        const ssize_t written = write(output, buffer.data() + done, count - done);
+                        if (written == -1 && errno == EINTR) {
+                            continue;
+                        }
+                        if (written <= 0) {
+                            return false;
+                        }
+                        done += written;
+                    }
+                }
+                if (count == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    return false;
+                }
+                size -= count;
+            }
+            return true;
         }
+    }
 
+    FileHandler::FileHandler(const std::string &inputFilename)
+        : inputFd(-1), outputFd(-1), fileSize(0), fileData(nullptr), outputSize(0), outputData(nullptr) {
         inputFd = open(inputFilename.c_str(), O_RDONLY);
         if (inputFd == -1) {
             throw std::runtime_error("Failed to open input file descriptor");
@@ -26,21 +65,185 @@ namespace file {
         }
         fileSize = sb.st_size;
 
-        fileData = static_cast<const unsigned char *>(mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, inputFd, 0));
-        if (fileData == MAP_FAILED) {
-            close(inputFd);
-            throw std::runtime_error("Failed to map file to memory");
+        if (fileSize > 0) {
+            void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, inputFd, 0);
+            if (mapping == MAP_FAILED) {
+                close(inputFd);
+                throw std::runtime_error("Failed to map file to memory");
+            }
+            madvise(mapping, fileSize, MADV_SEQUENTIAL);
+            fileData = static_cast<const unsigned char *>(mapping);
+        }
+    }
+
+    FileHandler::FileHandler(const std::string &inputFilename, const std::string &outputFilename,
+                             const bool truncateOutput)
+        : FileHandler(inputFilename) {
+        // The delegated constructor has completed, so the destructor releases the input if this throws.
+        outputFd = open(outputFilename.c_str(), O_RDWR | O_CREAT | (truncateOutput ? O_TRUNC : 0), 0644);
+        if (outputFd == -1) {
+            throw std::runtime_error("Failed to open output file descriptor");
         }
     }
 
     FileHandler::~FileHandler() {
-        if (inputFile.is_open()) inputFile.close();
-        if (outputFile.is_open()) outputFile.close();
         if (fileData != nullptr) {
             munmap(const_cast<unsigned char *>(fileData), fileSize);
         }
+        if (outputData != nullptr) {
+            munmap(outputData, outputSize);
+        }
         if (inputFd != -1) {
             close(inputFd);
         }
+        if (outputFd != -1) {
+            close(outputFd);
+        }
+    }
+
+    unsigned char *FileHandler::mapOutput(const size_t size) {
+        if (outputData != nullptr) {
+            throw std::logic_error("Output file is already mapped");
+        }
+        if (size == 0) {
+            return nullptr;
+        }
+        TIME_STAGE(Write);
+
+        const int error = posix_fallocate(outputFd, 0, static_cast<off_t>(size));
+        if (error == EINVAL || error == EOPNOTSUPP) {
+            if (ftruncate(outputFd, static_cast<off_t>(size)) == -1) {
+                throw std::runtime_error("Failed to resize output file");
+            }
+        } else if (error != 0) {
+            throw std::runtime_error("Failed to allocate output file");
+        }
+
+        void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, outputFd, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("Failed to map output file to memory");
+        }
+        madvise(mapping, size, MADV_SEQUENTIAL);
+
+        outputData = static_cast<unsigned char *>(mapping);
+        outputSize = size;
+        return outputData;
+    }
+
+    void FileHandler::prefetchInput(const uint64_t offset, const size_t length) const {
+        if (fileData == nullptr || length == 0) {
+            return;
+        }
+        const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        const uint64_t begin = offset & ~(pageSize - 1);
+        madvise(const_cast<unsigned char *>(fileData) + begin, offset + length - begin, MADV_WILLNEED);
+    }
+
+    void FileHandler::readAt(unsigned char *buffer, size_t length, uint64_t offset) const {
+        TIME_STAGE(Read);
+        while (length > 0) {
+            const ssize_t readLen = pread(inputFd, buffer, length, static_cast<off_t>(offset));
+            if (readLen == -1 && errno == EINTR) {
+                continue;
+            }
+            if (readLen <= 0) {
+                throw std::runtime_error("Failed to read input file");
+            }
+            buffer += readLen;
+            length -= readLen;
+            offset += readLen;
+        }
+    }
+
+    void FileHandler::writeAt(const unsigned char *buffer, size_t length, uint64_t offset) const {
+        TIME_STAGE(Write);
+        while (length > 0) {
+            const ssize_t written = pwrite(outputFd, buffer, length, static_cast<off_t>(offset));
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw std::runtime_error("Failed to write output file");
+            }
+            buffer += written;
+            length -= written;
+            offset += written;
+        }
+    }
+
+    void FileHandler::resizeOutput(const uint64_t size) const {
+        if (ftruncate(outputFd, static_cast<off_t>(size)) == -1) {
+            throw std::runtime_error("Failed to resize output file");
+        }
+    }
+
+    void FileHandler::syncOutput() const {
+        TIME_STAGE(Write);
+        if (outputData != nullptr && msync(outputData, outputSize, MS_SYNC) == -1) {
+            throw std::runtime_error("Failed to flush output file");
+        }
+        if (fsync(outputFd) == -1) {
+            throw std::runtime_error("Failed to flush output file");
+        }
+    }
+
+    ReplacementFile::ReplacementFile(const std::string &target) : target(target), committed(false) {
+        const int input = open(target.c_str(), O_RDONLY);
+        if (input == -1) {
+            throw std::runtime_error("Failed to open file: " + target);
+        }
+        struct stat sb{};
+        if (fstat(input, &sb) == -1) {
+            close(input);
+            throw std::runtime_error("Failed to get file size");
+        }
+
+        std::vector<char> name(target.begin(), target.end());
+        const std::string suffix = ".XXXXXX";
+        name.insert(name.end(), suffix.begin(), suffix.end());
+        name.push_back('\0');
+        const int output = mkstemp(name.data());
+        if (output == -1) {
+            close(input);
+            throw std::runtime_error("Failed to create a copy of " + target);
+        }
+        staging = name.data();
+
+        const bool copied = fchmod(output, sb.st_mode & 07777) == 0 && copyData(input, output, sb.st_size);
+        close(input);
+        if (close(output) == -1 || !copied) {
+            unlink(staging.c_str());
+            throw std::runtime_error("Failed to create a copy of " + target);
+        }
+    }
+
+    ReplacementFile::~ReplacementFile() {
+        if (!committed) {
+            unlink(staging.c_str());
+        }
+    }
+
+    void ReplacementFile::commit() {
+        const int fd = open(staging.c_str(), O_RDONLY);
+        if (fd == -1 || fsync(fd) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            throw std::runtime_error("Failed to flush " + staging);
+        }
+        close(fd);
+        if (rename(staging.c_str(), target.c_str()) == -1) {
+            throw std::runtime_error("Failed to replace " + target);
+        }
+        committed = true;
+
+        // The rename itself is durable once the directory is synced.
+        const size_t slash = target.rfind('/');
+        const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : target.substr(0, slash);
+        const int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (directoryFd != -1) {
+            fsync(directoryFd);
+            close(directoryFd);
+        }
     }
 }
@@ -1,7 +1,9 @@
 #ifndef FILEHANDLER_H
 #define FILEHANDLER_H
 
-#include <fstream>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 
 namespace file {
     /**
@@ -10,26 +12,40 @@ namespace file {
      *
      * The FileHandler class encapsulates the opening and closing of input and output files, ensuring
      * that files are properly managed and closed when no longer needed. It provides a simple interface
-     * for file operations within an RAII context.
+     * for file operations within an RAII context. The input is mapped read-only into memory and the
+     * output can be pre-sized and mapped writable, so the engine reads and writes chunks in place.
      */
     class FileHandler {
     public:
-        std::ifstream inputFile; /**< Input file stream for reading data. */
-        std::ofstream outputFile; /**< Output file stream for writing data. */
         int inputFd; /**< File descriptor for the input file. */
+        int outputFd; /**< File descriptor for the output file, or -1 if the handler only reads. */
         size_t fileSize; /**< Size of the input file. */
         const unsigned char *fileData; /**< Memory-mapped data of the input file. */
+        size_t outputSize; /**< Size of the mapped output file. */
+        unsigned char *outputData; /**< Memory-mapped data of the output file, once mapOutput() was called. */
+
+        /**
+         * @brief Constructs a new FileHandler object for reading only.
+         *
+         * Opens and maps the specified input file; no output file is opened. Throws an exception if the file
+         * cannot be opened.
+         *
+         * @param inputFilename The path to the input file.
+         */
+        explicit FileHandler(const std::string &inputFilename);
 
         /**
          * @brief Constructs a new FileHandler object.
          *
          * Opens the specified input and output files. Throws an exception if the files cannot be opened.
-         * Also maps the input file into memory for efficient reading.
+         * Also maps the input file into memory for efficient reading and advises the kernel that it will
+         * be read sequentially.
          *
          * @param inputFilename The path to the input file.
          * @param outputFilename The path to the output file.
+         * @param truncateOutput Whether to empty the output file; false keeps an existing one to update in place.
          */
-        FileHandler(const std::string &inputFilename, const std::string &outputFilename);
+        FileHandler(const std::string &inputFilename, const std::string &outputFilename, bool truncateOutput = true);
 
         /**
          * @brief Destroys the FileHandler object.
@@ -37,6 +53,112 @@ namespace file {
          * Ensures that the input and output files are properly closed and unmapped.
          */
         ~FileHandler();
+
+        FileHandler(const FileHandler &) = delete;
+
+        FileHandler &operator=(const FileHandler &) = delete;
+
+        /**
+         * @brief Sizes the output file and maps it into memory.
+         *
+         * The blocks are reserved up front, so running out of disk space is reported here as an exception
+         * instead of a SIGBUS while the mapping is written.
+         *
+         * @param size The final size of the output file in bytes.
+         * @return A pointer to the writable mapping, or nullptr if size is zero.
+         */
+        unsigned char *mapOutput(size_t size);
+
+        /**
+         * @brief Asks the kernel to start reading a range of the input mapping ahead of use.
+         *
+         * @param offset The offset of the range in the input file.
+         * @param length The length of the range.
+         */
+        void prefetchInput(uint64_t offset, size_t length) const;
+
+        /**
+         * @brief Reads from the input file at a given offset.
+         *
+         * Positional reads bypass the input mapping; they are used by the pipelined mode, where a dedicated
+         * reader thread keeps the storage busy. Throws an exception if fewer than length bytes could be read.
+         *
+         * @param buffer The destination buffer.
+         * @param length The number of bytes to read.
+         * @param offset The offset in the input file.
+         */
+        void readAt(unsigned char *buffer, size_t length, uint64_t offset) const;
+
+        /**
+         * @brief Writes to the output file at a given offset.
+         *
+         * Positional writes bypass the output mapping; they are used by the pipelined mode, where a dedicated
+         * writer thread keeps the storage busy. Throws an exception if the data could not be written completely.
+         *
+         * @param buffer The source buffer.
+         * @param length The number of bytes to write.
+         * @param offset The offset in the output file.
+         */
+        void writeAt(const unsigned char *buffer, size_t length, uint64_t offset) const;
+
+        /**
+         * @brief Sets the size of the output file without mapping it.
+         *
+         * @param size The new size of the output file in bytes.
+         */
+        void resizeOutput(uint64_t size) const;
+
+        /**
+         * @brief Flushes the output mapping and the output file to stable storage.
+         *
+         * Throws an exception if the data could not be written back, such as when the disk is full.
+         */
+        void syncOutput() const;
+    };
+
+    /**
+     * @class ReplacementFile
+     * @brief A private copy of a file that atomically takes the file's place once it is committed.
+     *
+     * The copy is created in the same directory, so rename() can swap it in, with the permissions of the original.
+     * Its data is copied with copy_file_range(), which shares the extents instead where the file system supports
+     * it. commit() flushes the copy to disk, renames it over the original and syncs the directory; a copy that was
+     * not committed is removed by the destructor, and the original is left as it was.
+     */
+    class ReplacementFile {
+    public:
+        /**
+         * @brief Copies a regular file to a uniquely named file next to it.
+         *
+         * @param target The path of the file to replace.
+         */
+        explicit ReplacementFile(const std::string &target);
+
+        /**
+         * @brief Removes the copy unless it was committed.
+         */
+        ~ReplacementFile();
+
+        ReplacementFile(const ReplacementFile &) = delete;
+
+        ReplacementFile &operator=(const ReplacementFile &) = delete;
+
+        /**
+         * @brief Returns the path of the copy, to be opened and modified by the caller.
+         */
+        [[nodiscard]] const std::string &path() const { return staging; }
+
+        /**
+         * @brief Syncs the copy and renames it over the original.
+         *
+         * Data written through a mapping must already be flushed, see FileHandler::syncOutput().
+         */
+        void commit();
+
+    private:
+        std::string target; /**< The file to replace. */
+        std::string staging; /**< The copy. */
+        bool committed; /**< Whether the copy has replaced the target. */
     };
 } // namespace file
 
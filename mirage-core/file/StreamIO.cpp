@@ -0,0 +1,88 @@
+#include "StreamIO.h"
+#include "../utils/metrics/StageStats.h"
+#include <cerrno>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace file {
+    size_t ByteSource::readFull(const std::span<unsigned char> buffer) {
+        size_t total = 0;
+        while (total < buffer.size()) {
+            const size_t readLen = read(buffer.subspan(total));
+            if (readLen == 0) {
+                break;
+            }
+            total += readLen;
+        }
+        return total;
+    }
+
+    FdSource::FdSource(const int fd) : fd(fd), owned(false) {
+    }
+
+    FdSource::FdSource(const std::string &path) : fd(open(path.c_str(), O_RDONLY)), owned(true) {
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open input file descriptor");
+        }
+    }
+
+    FdSource::~FdSource() {
+        if (owned) {
+            close(fd);
+        }
+    }
+
+    size_t FdSource::read(const std::span<unsigned char> buffer) {
+        TIME_STAGE(Read);
+        while (true) {
+            const ssize_t readLen = ::read(fd, buffer.data(), buffer.size());
+            if (readLen == -1 && errno == EINTR) {
+                continue;
+            }
+            if (readLen < 0) {
+                throw std::runtime_error("Failed to read input stream");
+            }
+            return static_cast<size_t>(readLen);
+        }
+    }
+
+    FdSink::FdSink(const int fd) : fd(fd), owned(false) {
+    }
+
+    FdSink::FdSink(const std::string &path) : fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+                                              owned(true) {
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open output file descriptor");
+        }
+    }
+
+    FdSink::~FdSink() {
+        if (owned) {
+            close(fd);
+        }
+    }
+
+    void FdSink::write(std::span<const unsigned char> buffer) {
+        TIME_STAGE(Write);
+        while (!buffer.empty()) {
+            const ssize_t written = ::write(fd, buffer.data(), buffer.size());
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw std::runtime_error("Failed to write output stream");
+            }
+            buffer = buffer.subspan(static_cast<size_t>(written));
+        }
+    }
+
+    bool isMappable(const std::string &path) {
+        struct stat sb{};
+        if (stat(path.c_str(), &sb) == -1) {
+            return errno == ENOENT;
+        }
+        return S_ISREG(sb.st_mode);
+    }
+} // namespace file
@@ -0,0 +1,149 @@
+#ifndef STREAMIO_H
+#define STREAMIO_H
+
+#include <cstddef>
+#include <span>
+#include <string>
+
+#define DEFAULT_STREAM_BLOCK_SIZE (4 * 1024 * 1024)
+
+namespace file {
+    /**
+     * @class ByteSource
+     * @brief A sequential source of bytes whose length need not be known in advance.
+     */
+    class ByteSource {
+    public:
+        virtual ~ByteSource() = default;
+
+        /**
+         * @brief Reads the next bytes of the source.
+         *
+         * May return fewer bytes than requested before the end of the source, as a pipe does.
+         *
+         * @param buffer The destination buffer.
+         * @return The number of bytes read; zero only at the end of the source.
+         */
+        virtual size_t read(std::span<unsigned char> buffer) = 0;
+
+        /**
+         * @brief Reads until a buffer is full or the source ends.
+         *
+         * @param buffer The destination buffer.
+         * @return The number of bytes read; less than buffer.size() only at the end of the source.
+         */
+        size_t readFull(std::span<unsigned char> buffer);
+    };
+
+    /**
+     * @class ByteSink
+     * @brief A sequential destination of bytes.
+     */
+    class ByteSink {
+    public:
+        virtual ~ByteSink() = default;
+
+        /**
+         * @brief Writes bytes to the sink completely or throws.
+         *
+         * @param buffer The bytes to write.
+         */
+        virtual void write(std::span<const unsigned char> buffer) = 0;
+    };
+
+    /**
+     * @class FdSource
+     * @brief Reads from a file descriptor: a file, a pipe, a socket or a terminal.
+     */
+    class FdSource final : public ByteSource {
+    public:
+        /**
+         * @brief Constructs a new FdSource object over an open descriptor, which it does not close.
+         *
+         * @param fd The file descriptor, such as STDIN_FILENO.
+         */
+        explicit FdSource(int fd);
+
+        /**
+         * @brief Constructs a new FdSource object that opens and owns a path.
+         *
+         * Throws an exception if the path cannot be opened.
+         *
+         * @param path The path to read, which may name a FIFO or a device.
+         */
+        explicit FdSource(const std::string &path);
+
+        /**
+         * @brief Destroys the FdSource object, closing the descriptor if it owns it.
+         */
+        ~FdSource() override;
+
+        FdSource(const FdSource &) = delete;
+
+        FdSource &operator=(const FdSource &) = delete;
+
+        size_t read(std::span<unsigned char> buffer) override;
+
+    private:
+        int fd; /**< The descriptor read from. */
+        bool owned; /**< Whether the descriptor is closed by the destructor. */
+    };
+
+    /**
+     * @class FdSink
+     * @brief Writes to a file descriptor: a file, a pipe, a socket or a terminal.
+     */
+    class FdSink final : public ByteSink {
+    public:
+        /**
+         * @brief Constructs a new FdSink object over an open descriptor, which it does not close.
+         *
+         * @param fd The file descriptor, such as STDOUT_FILENO.
+         */
+        explicit FdSink(int fd);
+
+        /**
+         * @brief Constructs a new FdSink object that creates or truncates and owns a path.
+         *
+         * Throws an exception if the path cannot be opened.
+         *
+         * @param path The path to write, which may name a FIFO or a device.
+         */
+        explicit FdSink(const std::string &path);
+
+        /**
+         * @brief Destroys the FdSink object, closing the descriptor if it owns it.
+         */
+        ~FdSink() override;
+
+        FdSink(const FdSink &) = delete;
+
+        FdSink &operator=(const FdSink &) = delete;
+
+        void write(std::span<const unsigned char> buffer) override;
+
+    private:
+        int fd; /**< The descriptor written to. */
+        bool owned; /**< Whether the descriptor is closed by the destructor. */
+    };
+
+    /**
+     * @class NullSink
+     * @brief Drops everything written to it.
+     */
+    class NullSink final : public ByteSink {
+    public:
+        void write(std::span<const unsigned char>) override {
+        }
+    };
+
+    /**
+     * @brief Checks whether FileHandler can map a path.
+     *
+     * @param path The path to check.
+     * @return True if the path is a regular file or does not exist yet; false for pipes, sockets and devices.
+     */
+    bool isMappable(const std::string &path);
+} // namespace file
+
+#endif // STREAMIO_H
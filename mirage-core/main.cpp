@@ -1,35 +1,21 @@
-#include <fstream>
 #include <iostream>
 #include <sodium.h>
 #include <string>
-#include <vector>
-#include <ctime>
 #include <chrono>
 #include <iomanip>
 #include <sstream>
 
+#include "cli/CommandLine.h"
 #include "engines/encryption/PolymorphicEncryptionEngine.h"
+#include "utils/corpus/CorpusGenerator.h"
 
 
 // Function to generate a test file with a random message
 void generateTestFile(const std::string &filename) {
-    std::ofstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open file for writing: " + filename);
-    }
-
     // Write random data to the file
     constexpr size_t fileSize = 200 * 1024 * 1024; // 200 MB
-    std::string message;
-    message.reserve(fileSize);
-    srandom(std::time(nullptr));
-    for (size_t i = 0; i < fileSize; ++i) {
-        message.push_back(random() % 256);
-    }
-
-    if (!file.write(message.c_str(), message.size())) {
-        throw std::runtime_error("Failed to write data to file: " + filename);
-    }
+    const utils::corpus::CorpusGenerator generator;
+    generator.writeFile(filename, fileSize);
 }
 
 void displayMenu() {
@@ -51,7 +37,12 @@ std::string formatDuration(const double milliseconds) {
     return ss.str();
 }
 
-int main() {
+int main(int argc, char **argv) {
+    // Any argument selects the non-interactive command line; without arguments the demo menu runs.
+    if (argc > 1) {
+        return cli::runCommandLine(argc, argv);
+    }
+
     try {
         const std::string filename = "test.ini";
         const std::string encryptedFilename = "encrypted_test.ini";
@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <initializer_list>
+#include <iostream>
+#include <optional>
+#include <sodium.h>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../cli/CommandLine.h"
+#include "../engines/encryption/Archive.h"
+#include "../engines/encryption/ContainerFormat.h"
+#include "../engines/encryption/FileScheduler.h"
+#include "../engines/encryption/PolymorphicEncryptionEngine.h"
+#include "../engines/encryption/SecurityProfile.h"
+#include "../file/StreamIO.h"
+#include "../utils/concurrency/ResourceBudget.h"
+#include "../utils/concurrency/WorkStealingPool.h"
+#include "../utils/crypto/KeyFile.h"
+#include "TestSupport.h"
+
+// Checks the engine and the code around it end to end, on temporary files.
+// Usage: mirage_engine_tests [suite...]   (runs every suite when none is given)
+
+#define TEST_CHUNK_SIZE 1024
+#define TEST_SEGMENT_SIZE (4 * TEST_CHUNK_SIZE)
+
+namespace {
+    using engines::encryption::ContainerHeader;
+    using engines::encryption::ContainerLayout;
+    using engines::encryption::EngineOptions;
+    using engines::encryption::FileOperation;
+    using engines::encryption::PolymorphicEncryptionEngine;
+    using engines::encryption::SecurityLevel;
+    using engines::encryption::SecurityProfile;
+
+    // Segments of four small chunks, so a few kilobytes hold several segments and a partial last one.
+    EngineOptions smallSegments() {
+        EngineOptions options;
+        options.chunkSize = TEST_CHUNK_SIZE;
+        options.segmentSize = TEST_SEGMENT_SIZE;
+        options.threadCount = 2;
+        return options;
+    }
+
+    std::vector<unsigned char> encryptBytes(const PolymorphicEncryptionEngine &engine,
+                                            const std::vector<unsigned char> &plaintext) {
+        std::vector<unsigned char> ciphertext(engine.encryptedSize(plaintext.size()));
+        ciphertext.resize(engine.encrypt(plaintext, ciphertext));
+        return ciphertext;
+    }
+
+    std::vector<unsigned char> decryptBytes(const PolymorphicEncryptionEngine &engine,
+                                            const std::vector<unsigned char> &ciphertext) {
+        std::vector<unsigned char> plaintext(engine.decryptedSize(ciphertext));
+        plaintext.resize(engine.decrypt(ciphertext, plaintext));
+        return plaintext;
+    }
+
+    // Yields a buffer in pieces of at most a given size, as a pipe does.
+    class MemorySource final : public file::ByteSource {
+    public:
+        MemorySource(const std::vector<unsigned char> &bytes, const size_t piece) : bytes(bytes), piece(piece) {
+        }
+
+        size_t read(const std::span<unsigned char> buffer) override {
+            const size_t count = std::min({buffer.size(), bytes.size() - position, piece});
+            std::copy_n(bytes.begin() + static_cast<std::ptrdiff_t>(position), count, buffer.begin());
+            position += count;
+            return count;
+        }
+
+    private:
+        const std::vector<unsigned char> &bytes; /**< The bytes to yield. */
+        size_t piece; /**< The most bytes a read returns. */
+        size_t position = 0; /**< The bytes yielded so far. */
+    };
+
+    // Collects everything written to it.
+    class MemorySink final : public file::ByteSink {
+    public:
+        std::vector<unsigned char> bytes; /**< The bytes written so far. */
+
+        void write(const std::span<const unsigned char> buffer) override {
+            bytes.insert(bytes.end(), buffer.begin(), buffer.end());
+        }
+    };
+
+    // Every input size round-trips; a flipped byte, a truncated trailer and reordered segments are rejected.
+    bool testEngine() {
+        const PolymorphicEncryptionEngine engine(smallSegments());
+        for (const size_t size: {0, 1, TEST_CHUNK_SIZE - 1, TEST_SEGMENT_SIZE, TEST_SEGMENT_SIZE + 1,
+                                 5 * TEST_SEGMENT_SIZE + 300}) {
+            const std::vector<unsigned char> plaintext = tests::randomBytes(size);
+            CHECK(decryptBytes(engine, encryptBytes(engine, plaintext)) == plaintext);
+        }
+
+        const tests::TempDirectory directory;
+        const std::vector<unsigned char> plaintext = tests::randomBytes(3 * TEST_SEGMENT_SIZE + 300);
+        tests::writeFile(directory.path("plain"), plaintext);
+        engine.encryptFile(directory.path("plain"), directory.path("sealed"));
+        engine.decryptFile(directory.path("sealed"), directory.path("opened"));
+        CHECK(tests::readFile(directory.path("opened")) == plaintext);
+
+        const std::vector<unsigned char> container = tests::readFile(directory.path("sealed"));
+        const ContainerLayout layout(ContainerHeader::parse(container.data()), plaintext.size());
+        std::vector<unsigned char> damaged = container;
+        damaged[layout.recordOffset(1, 2) + RECORD_PREFIX_SIZE + 8] ^= 1;
+        tests::writeFile(directory.path("damaged"), damaged);
+        const std::string failure = "Chunk 2 of segment 1 at offset " + std::to_string(layout.recordOffset(1, 2)) +
+                                    " failed to authenticate";
+        CHECK(tests::throwsWith([&] { engine.decryptFile(directory.path("damaged"), directory.path("opened")); },
+                                failure));
+        CHECK(tests::throwsWith([&] { decryptBytes(engine, damaged); }, failure));
+
+        damaged.assign(container.begin(), container.end() - CONTAINER_TRAILER_SIZE / 2);
+        tests::writeFile(directory.path("damaged"), damaged);
+        CHECK(tests::throwsWith([&] { engine.decryptFile(directory.path("damaged"), directory.path("opened")); },
+                                "Container size mismatch"));
+
+        // Segments are the same size, so swapping the first two keeps every offset valid.
+        damaged = container;
+        std::memcpy(damaged.data() + layout.cipherOffset(0), container.data() + layout.cipherOffset(1),
+                    layout.segmentCipherSize(1));
+        std::memcpy(damaged.data() + layout.cipherOffset(1), container.data() + layout.cipherOffset(0),
+                    layout.segmentCipherSize(0));
+        CHECK(tests::throwsWith([&] { decryptBytes(engine, damaged); }, "failed to authenticate"));
+        return true;
+    }
+
+    // Ranges starting and ending inside chunks and crossing segment and rekey boundaries match a full decrypt.
+    bool testRange() {
+        EngineOptions options = smallSegments();
+        options.profile.rekeyBytes = 2 * TEST_CHUNK_SIZE;
+        const PolymorphicEncryptionEngine engine(options);
+        const tests::TempDirectory directory;
+        const std::vector<unsigned char> plaintext = tests::randomBytes(3 * TEST_SEGMENT_SIZE + 300);
+        tests::writeFile(directory.path("plain"), plaintext);
+        engine.encryptFile(directory.path("plain"), directory.path("sealed"));
+        engine.decryptFile(directory.path("sealed"), directory.path("opened"));
+        const std::vector<unsigned char> full = tests::readFile(directory.path("opened"));
+        CHECK(full == plaintext);
+
+        for (const size_t offset: {0, 1, TEST_CHUNK_SIZE - 7, 2 * TEST_CHUNK_SIZE - 5, TEST_SEGMENT_SIZE - 3,
+                                   TEST_SEGMENT_SIZE, 2 * TEST_SEGMENT_SIZE + 11, 3 * TEST_SEGMENT_SIZE + 299}) {
+            for (const size_t length: {0, 1, 10, TEST_CHUNK_SIZE + 13, TEST_SEGMENT_SIZE + 9, 3 * TEST_SEGMENT_SIZE}) {
+                const size_t clamped = std::min(length, full.size() - offset);
+                const std::vector<unsigned char> expected(full.begin() + offset, full.begin() + offset + clamped);
+                if (engine.decryptRange(directory.path("sealed"), offset, clamped) != expected) {
+                    std::cerr << "Error: range " << offset << "+" << clamped << " differs from a full decrypt"
+                            << std::endl;
+                    return false;
+                }
+            }
+        }
+        CHECK(engine.decryptRange(directory.path("sealed"), full.size(), 0).empty());
+        CHECK(tests::throwsWith([&] { (void) engine.decryptRange(directory.path("sealed"), full.size() - 1, 2); },
+                                "Range exceeds the plaintext"));
+        return true;
+    }
+
+    // The span calls read and write the containers of the file calls, and a failed decrypt leaves only zeros.
+    bool testSpan() {
+        const PolymorphicEncryptionEngine engine(smallSegments());
+        const tests::TempDirectory directory;
+        const std::vector<unsigned char> plaintext = tests::randomBytes(3 * TEST_SEGMENT_SIZE + 300);
+        tests::writeFile(directory.path("sealed"), encryptBytes(engine, plaintext));
+        engine.decryptFile(directory.path("sealed"), directory.path("opened"));
+        CHECK(tests::readFile(directory.path("opened")) == plaintext);
+
+        tests::writeFile(directory.path("plain"), plaintext);
+        engine.encryptFile(directory.path("plain"), directory.path("sealed"));
+        const std::vector<unsigned char> container = tests::readFile(directory.path("sealed"));
+        CHECK(container.size() == engine.encryptedSize(plaintext.size()));
+        CHECK(engine.decryptedSize(container) == plaintext.size());
+        CHECK(decryptBytes(engine, container) == plaintext);
+
+        std::vector<unsigned char> output(container.size() - 1);
+        CHECK(tests::throwsWith([&] { engine.encrypt(plaintext, output); }, "Output buffer is too small"));
+        output.resize(plaintext.size() - 1);
+        CHECK(tests::throwsWith([&] { engine.decrypt(container, output); }, "Output buffer is too small"));
+
+        // The last segment fails after the others were decrypted, and they are erased again.
+        const ContainerLayout layout(ContainerHeader::parse(container.data()), plaintext.size());
+        std::vector<unsigned char> damaged = container;
+        damaged[layout.recordOffset(layout.segmentCount() - 1, 0) + RECORD_PREFIX_SIZE + 8] ^= 1;
+        output.assign(plaintext.size(), 0xaa);
+        CHECK(tests::throwsWith([&] { engine.decrypt(damaged, output); }, "failed to authenticate"));
+        CHECK(std::all_of(output.begin(), output.end(), [](const unsigned char byte) { return byte == 0; }));
+        return true;
+    }
+
+    // The stream calls write containers the span calls read and the other way round, in pieces of any size.
+    bool testStream() {
+        const PolymorphicEncryptionEngine engine(smallSegments());
+        for (const size_t size: {0, 1, TEST_SEGMENT_SIZE, 3 * TEST_SEGMENT_SIZE + 300}) {
+            const std::vector<unsigned char> plaintext = tests::randomBytes(size);
+            for (const size_t piece: {37, 4096, TEST_SEGMENT_SIZE * 8}) {
+                MemorySource plainSource(plaintext, piece);
+                MemorySink sealed;
+                engine.encryptStream(plainSource, sealed);
+                CHECK(decryptBytes(engine, sealed.bytes) == plaintext);
+
+                const std::vector<unsigned char> container = encryptBytes(engine, plaintext);
+                MemorySource sealedSource(container, piece);
+                MemorySink opened;
+                engine.decryptStream(sealedSource, opened);
+                CHECK(opened.bytes == plaintext);
+                MemorySource verifiedSource(container, piece);
+                engine.verifyStream(verifiedSource);
+            }
+        }
+
+        const std::vector<unsigned char> plaintext = tests::randomBytes(3 * TEST_SEGMENT_SIZE + 300);
+        std::vector<unsigned char> damaged = encryptBytes(engine, plaintext);
+        const ContainerLayout layout(ContainerHeader::parse(damaged.data()), plaintext.size());
+        damaged[layout.recordOffset(1, 2) + RECORD_PREFIX_SIZE + 8] ^= 1;
+        MemorySource sealedSource(damaged, 4096);
+        MemorySink opened;
+        CHECK(tests::throwsWith([&] { engine.decryptStream(sealedSource, opened); }, "Decryption failed"));
+        MemorySource verifiedSource(damaged, 4096);
+        CHECK(tests::throwsWith([&] { engine.verifyStream(verifiedSource); }, "Decryption failed"));
+        return true;
+    }
+
+    // Runs the command line the way the mirage_core executable does.
+    int runCommandLine(std::vector<std::string> arguments) {
+        arguments.insert(arguments.begin(), "mirage_core");
+        std::vector<char *> argv;
+        for (std::string &argument: arguments) {
+            argv.push_back(argument.data());
+        }
+        argv.push_back(nullptr);
+        return cli::runCommandLine(static_cast<int>(arguments.size()), argv.data());
+    }
+
+    // Members round-trip through pack, list and unpack; duplicate names and names that leave the root are refused.
+    bool testArchive() {
+        const tests::TempDirectory directory;
+        const tests::WorkingDirectory workingDirectory(directory.path("."));
+        CHECK(runCommandLine({"keygen", "key"}) == 0);
+        const utils::crypto::LockedKey key = utils::crypto::KeyFile::load("key");
+        EngineOptions options;
+        options.masterKey = key.data();
+        const PolymorphicEncryptionEngine engine(options);
+
+        const std::vector<unsigned char> first = tests::randomBytes(3 * DEFAULT_SEGMENT_SIZE / 2);
+        const std::vector<unsigned char> second = tests::randomBytes(5000);
+        std::filesystem::create_directory("sub");
+        tests::writeFile("first", first);
+        tests::writeFile("empty", {});
+        tests::writeFile("sub/second", second);
+        CHECK(runCommandLine({"pack", "--key", "key", "-q", "archive", "first", "empty", "sub/second"}) == 0);
+        CHECK(runCommandLine({"list", "--key", "key", "archive"}) == 0);
+
+        const engines::encryption::ArchiveReader reader(engine, "archive");
+        CHECK(reader.members().size() == 3);
+        CHECK(reader.read(reader.find("first")) == first);
+        CHECK(reader.read(reader.find("empty")).empty());
+        CHECK(reader.read(reader.find("sub/second")) == second);
+        CHECK(tests::throwsWith([&] { (void) reader.find("missing"); }, "No such archive member"));
+
+        CHECK(runCommandLine({"unpack", "--key", "key", "-q", "--into", "all", "archive"}) == 0);
+        CHECK(tests::readFile("all/first") == first);
+        CHECK(tests::readFile("all/empty").empty());
+        CHECK(tests::readFile("all/sub/second") == second);
+        CHECK(runCommandLine({"unpack", "--key", "key", "-q", "--into", "one", "archive", "sub/second"}) == 0);
+        CHECK(tests::readFile("one/sub/second") == second);
+        CHECK(!std::filesystem::exists("one/first"));
+
+        // "./first" names the same member as "first", so the archive is refused and removed.
+        CHECK(runCommandLine({"pack", "--key", "key", "-q", "twice", "first", "./first"}) == 1);
+        CHECK(!std::filesystem::exists("twice"));
+        {
+            file::FdSink sink("duplicate");
+            engines::encryption::ArchiveWriter writer(engine, sink);
+            writer.add("member", first);
+            CHECK(tests::throwsWith([&] { writer.add("member", second); }, "Duplicate archive member"));
+        }
+
+        // The writer stores any name; unpack must not follow one out of the directory it extracts into.
+        {
+            file::FdSink sink("escaping");
+            engines::encryption::ArchiveWriter writer(engine, sink);
+            writer.add("../escaped", second);
+            writer.finish();
+        }
+        CHECK(runCommandLine({"unpack", "--key", "key", "-q", "--into", "inside", "escaping"}) == 1);
+        CHECK(!std::filesystem::exists("escaped"));
+        return true;
+    }
+
+    // Tells whether a segment's ciphertext is the same in two versions of an uncompressed container.
+    bool sameSegment(const std::vector<unsigned char> &before, const std::vector<unsigned char> &after,
+                     const ContainerLayout &layout, const uint64_t segment) {
+        const uint64_t begin = layout.cipherOffset(segment);
+        const uint64_t end = begin + layout.segmentCipherSize(segment);
+        return end <= before.size() && end <= after.size() &&
+               std::equal(before.begin() + begin, before.begin() + end, after.begin() + begin);
+    }
+
+    // Updates rewrite only the segments that changed, and a failed update leaves the container as it was.
+    bool testUpdate() {
+        EngineOptions options = smallSegments();
+        options.updatable = true;
+        const PolymorphicEncryptionEngine engine(options);
+        const tests::TempDirectory directory;
+        const std::string plain = directory.path("plain"), sealed = directory.path("sealed");
+        std::vector<unsigned char> plaintext = tests::randomBytes(3 * TEST_SEGMENT_SIZE + 300);
+        tests::writeFile(plain, plaintext);
+        engine.encryptFile(plain, sealed);
+
+        // Applies a modification and checks that the container decrypts to it; returns the old container.
+        const auto update = [&](const std::vector<unsigned char> &modified) {
+            const std::vector<unsigned char> before = tests::readFile(sealed);
+            tests::writeFile(plain, modified);
+            engine.updateFile(plain, sealed);
+            engine.decryptFile(sealed, directory.path("opened"));
+            plaintext = modified;
+            return before;
+        };
+
+        std::vector<unsigned char> before = update(plaintext);
+        std::vector<unsigned char> after = tests::readFile(sealed);
+        ContainerLayout layout(ContainerHeader::parse(before.data()), plaintext.size());
+        CHECK(tests::readFile(directory.path("opened")) == plaintext);
+        for (uint64_t segment = 0; segment < layout.segmentCount(); ++segment) {
+            CHECK(sameSegment(before, after, layout, segment));
+        }
+
+        std::vector<unsigned char> modified = plaintext;
+        modified[TEST_SEGMENT_SIZE + 5] ^= 1;
+        before = update(modified);
+        after = tests::readFile(sealed);
+        CHECK(tests::readFile(directory.path("opened")) == plaintext);
+        CHECK(sameSegment(before, after, layout, 0));
+        CHECK(!sameSegment(before, after, layout, 1));
+        CHECK(sameSegment(before, after, layout, 2));
+        CHECK(sameSegment(before, after, layout, 3));
+
+        // Growing rewrites the old partial last segment; the full segments in front of it are kept.
+        modified = plaintext;
+        const std::vector<unsigned char> tail = tests::randomBytes(TEST_SEGMENT_SIZE);
+        modified.insert(modified.end(), tail.begin(), tail.end());
+        before = update(modified);
+        after = tests::readFile(sealed);
+        CHECK(tests::readFile(directory.path("opened")) == plaintext);
+        for (uint64_t segment = 0; segment < 3; ++segment) {
+            CHECK(sameSegment(before, after, layout, segment));
+        }
+        CHECK(!sameSegment(before, after, layout, 3));
+
+        // Shrinking rewrites the segment that becomes the last one.
+        layout = ContainerLayout(ContainerHeader::parse(after.data()), plaintext.size());
+        modified.resize(2 * TEST_SEGMENT_SIZE + 100);
+        before = update(modified);
+        after = tests::readFile(sealed);
+        CHECK(tests::readFile(directory.path("opened")) == plaintext);
+        CHECK(sameSegment(before, after, layout, 0));
+        CHECK(sameSegment(before, after, layout, 1));
+        CHECK(!sameSegment(before, after, layout, 2));
+
+        // The update fails after the copy of the container was made; the copy is removed, the container kept.
+        before = tests::readFile(sealed);
+        CHECK(tests::throwsWith([&] { engine.updateFile(directory.path("missing"), sealed); }, "Failed to open"));
+        CHECK(tests::readFile(sealed) == before);
+        size_t files = 0;
+        for ([[maybe_unused]] const auto &entry: std::filesystem::directory_iterator(directory.path("."))) {
+            ++files;
+        }
+        CHECK(files == 3);
+        engine.decryptFile(sealed, directory.path("opened"));
+        CHECK(tests::readFile(directory.path("opened")) == plaintext);
+        return true;
+    }
+
+    // Raw and sealed key files load, and wrong passphrases, out-of-range limits and overwrites are refused.
+    bool testKeyFile() {
+        using utils::crypto::KeyFile;
+        const tests::TempDirectory directory;
+        const std::string raw = directory.path("raw"), sealed = directory.path("sealed");
+        const std::vector<unsigned char> key = tests::randomBytes(KEY_FILE_KEY_SIZE);
+        const std::vector<unsigned char> other = tests::randomBytes(KEY_FILE_KEY_SIZE);
+        constexpr utils::crypto::KdfLimits fast{crypto_pwhash_OPSLIMIT_MIN, crypto_pwhash_MEMLIMIT_MIN};
+
+        KeyFile::writeRaw(raw, key.data());
+        CHECK(!KeyFile::isSealed(raw));
+        CHECK(std::memcmp(KeyFile::load(raw).data(), key.data(), KEY_FILE_KEY_SIZE) == 0);
+        CHECK((std::filesystem::status(raw).permissions() & std::filesystem::perms::all) ==
+              (std::filesystem::perms::owner_read | std::filesystem::perms::owner_write));
+        CHECK(tests::throwsWith([&] { (void) KeyFile::load(raw, "passphrase"); }, "not sealed"));
+
+        KeyFile::writeSealed(sealed, key.data(), "passphrase", fast);
+        CHECK(KeyFile::isSealed(sealed));
+        CHECK(std::memcmp(KeyFile::load(sealed, "passphrase").data(), key.data(), KEY_FILE_KEY_SIZE) == 0);
+        CHECK(tests::throwsWith([&] { (void) KeyFile::load(sealed, "passphrasf"); }, "Wrong passphrase"));
+        CHECK(tests::throwsWith([&] { (void) KeyFile::load(sealed); }, "needs a passphrase"));
+
+        // The limits are checked before the file is created, and again when a file is loaded.
+        CHECK(tests::throwsWith([&] {
+            KeyFile::writeSealed(directory.path("costly"), key.data(), "passphrase",
+                                 {crypto_pwhash_OPSLIMIT_MIN, KEY_FILE_MAX_MEMLIMIT + 1});
+        }, "out of range"));
+        CHECK(tests::throwsWith([&] {
+            KeyFile::writeSealed(directory.path("costly"), key.data(), "passphrase", {0, crypto_pwhash_MEMLIMIT_MIN});
+        }, "out of range"));
+        CHECK(!std::filesystem::exists(directory.path("costly")));
+        std::vector<unsigned char> costly = tests::readFile(sealed);
+        for (size_t i = 16; i < 24; ++i) {
+            costly[i] = 0xff;
+        }
+        tests::writeFile(directory.path("costly"), costly);
+        CHECK(tests::throwsWith([&] { (void) KeyFile::load(directory.path("costly"), "passphrase"); }, "malformed"));
+
+        CHECK(tests::throwsWith([&] { KeyFile::writeRaw(raw, other.data()); }, "Refusing to overwrite"));
+        CHECK(tests::throwsWith([&] { KeyFile::writeSealed(sealed, other.data(), "passphrase", fast); },
+                                "Refusing to overwrite"));
+        CHECK(std::memcmp(KeyFile::load(raw).data(), key.data(), KEY_FILE_KEY_SIZE) == 0);
+        CHECK(std::memcmp(KeyFile::load(sealed, "passphrase").data(), key.data(), KEY_FILE_KEY_SIZE) == 0);
+        return true;
+    }
+
+    // Every task of the pool runs once, a lease holds its share until it is released, and a batch under a
+    // budget smaller than its largest file completes with every error reported against its own file.
+    bool testScheduler() {
+        utils::concurrency::WorkStealingPool pool(4);
+        for (const size_t taskCount: {0, 1, 1000}) {
+            std::vector<std::atomic<int>> runs(taskCount);
+            pool.run(taskCount, [&](const size_t task) { runs[task].fetch_add(1); });
+            CHECK(std::all_of(runs.begin(), runs.end(), [](const std::atomic<int> &count) { return count == 1; }));
+        }
+
+        utils::concurrency::ResourceBudget budget(100, 2);
+        std::optional<utils::concurrency::ResourceBudget::Lease> held(budget.acquire(60, 1));
+        std::atomic<bool> acquired = false;
+        std::thread waiter([&] {
+            // More than the whole budget: it waits until nothing else is held, then runs alone.
+            const utils::concurrency::ResourceBudget::Lease large = budget.acquire(1000, 1);
+            acquired = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const bool waited = !acquired;
+        held.reset();
+        waiter.join();
+        CHECK(waited);
+        CHECK(acquired);
+
+        const PolymorphicEncryptionEngine engine(smallSegments());
+        const tests::TempDirectory directory;
+        std::vector<std::vector<unsigned char>> plaintexts;
+        std::vector<engines::encryption::FileJob> jobs;
+        for (size_t file = 0; file < 8; ++file) {
+            plaintexts.push_back(tests::randomBytes(file == 5 ? 10 * TEST_SEGMENT_SIZE + 1 : file * 3000));
+            const std::string name = std::to_string(file);
+            tests::writeFile(directory.path(name), plaintexts.back());
+            jobs.push_back({directory.path(name), directory.path(name + ".sealed"), FileOperation::Encrypt, {}});
+        }
+        jobs.push_back({directory.path("missing"), directory.path("missing.sealed"), FileOperation::Encrypt, {}});
+
+        const engines::encryption::FileScheduler scheduler(engine, {3, 4 * TEST_SEGMENT_SIZE, 4});
+        std::vector<int> completions(jobs.size());
+        std::vector<engines::encryption::FileJobResult> results =
+                scheduler.run(jobs, [&](const size_t job, const engines::encryption::FileJobResult &) {
+                    ++completions[job];
+                });
+        CHECK(std::all_of(completions.begin(), completions.end(), [](const int count) { return count == 1; }));
+        for (size_t file = 0; file < plaintexts.size(); ++file) {
+            CHECK(results[file].succeeded());
+            CHECK(results[file].bytes == plaintexts[file].size());
+        }
+        CHECK(!results.back().succeeded());
+        CHECK(results.back().errorMessage().find("Failed to open") != std::string::npos);
+
+        // One damaged container fails on its own; the others decrypt.
+        std::vector<unsigned char> damaged = tests::readFile(directory.path("5.sealed"));
+        const ContainerLayout layout(ContainerHeader::parse(damaged.data()), plaintexts[5].size());
+        damaged[layout.recordOffset(7, 1) + RECORD_PREFIX_SIZE + 8] ^= 1;
+        tests::writeFile(directory.path("5.sealed"), damaged);
+        jobs.pop_back();
+        for (engines::encryption::FileJob &job: jobs) {
+            job.input = job.output;
+            job.output = job.input + ".opened";
+            job.operation = FileOperation::Decrypt;
+        }
+        results = scheduler.run(jobs);
+        for (size_t file = 0; file < plaintexts.size(); ++file) {
+            if (file == 5) {
+                CHECK(results[file].errorMessage().find("Chunk 1 of segment 7") != std::string::npos);
+            } else {
+                CHECK(results[file].succeeded());
+                CHECK(tests::readFile(jobs[file].output) == plaintexts[file]);
+            }
+        }
+        return true;
+    }
+
+    // Every profile's rekey interval, padding, noise and stages are written to the header, and decryption
+    // follows the header whatever the decrypting engine's own profile is.
+    bool testProfile() {
+        unsigned char key[MASTER_KEY_SIZE];
+        randombytes_buf(key, sizeof(key));
+        EngineOptions options = smallSegments();
+        options.masterKey = key;
+        const PolymorphicEncryptionEngine engine(options);
+        options.profile = SecurityProfile::forLevel(SecurityLevel::Throughput);
+        const PolymorphicEncryptionEngine other(options);
+        sodium_memzero(key, sizeof(key));
+        CHECK(engine.getProfile().level == SecurityLevel::Balanced);
+
+        const tests::TempDirectory directory;
+        const std::vector<unsigned char> plaintext = tests::randomBytes(3 * TEST_SEGMENT_SIZE + 300);
+        tests::writeFile(directory.path("plain"), plaintext);
+        for (const SecurityLevel level: {SecurityLevel::Paranoid, SecurityLevel::Balanced, SecurityLevel::Throughput}) {
+            const SecurityProfile profile = SecurityProfile::forLevel(level);
+            engine.encryptFile(directory.path("plain"), directory.path("sealed"), profile);
+            const ContainerHeader header = ContainerHeader::parse(tests::readFile(directory.path("sealed")).data());
+            CHECK(header.rekeyInterval == profile.rekeyInterval(TEST_CHUNK_SIZE));
+            CHECK(header.paddingBlockSize == profile.paddingBlockSize);
+            CHECK(header.noiseSize == profile.noiseSize(TEST_CHUNK_SIZE));
+            CHECK(((header.flags & CONTAINER_FLAG_XOR_MASK) != 0) == profile.xorLayer);
+            CHECK(((header.flags & CONTAINER_FLAG_LATTICE_NOISE) != 0) == profile.latticeNoise);
+
+            other.decryptFile(directory.path("sealed"), directory.path("opened"));
+            CHECK(tests::readFile(directory.path("opened")) == plaintext);
+            other.verifyFile(directory.path("sealed"));
+        }
+
+        // Without a profile argument the engine's own profile is written.
+        engine.encryptFile(directory.path("plain"), directory.path("sealed"));
+        const ContainerHeader header = ContainerHeader::parse(tests::readFile(directory.path("sealed")).data());
+        CHECK(header.rekeyInterval == BALANCED_REKEY_BYTES / TEST_CHUNK_SIZE);
+        CHECK(header.paddingBlockSize == BALANCED_PADDING_BLOCK_SIZE);
+        CHECK(header.noiseSize == TEST_CHUNK_SIZE * BALANCED_NOISE_PERCENT / 100);
+        return true;
+    }
+
+    // Verification names the segment, the chunk and the container offset of the first record that fails.
+    bool testVerify() {
+        const PolymorphicEncryptionEngine engine(smallSegments());
+        const tests::TempDirectory directory;
+        const std::vector<unsigned char> plaintext = tests::randomBytes(3 * TEST_SEGMENT_SIZE + 300);
+        tests::writeFile(directory.path("plain"), plaintext);
+        engine.encryptFile(directory.path("plain"), directory.path("sealed"));
+        engine.verifyFile(directory.path("sealed"));
+
+        const std::vector<unsigned char> container = tests::readFile(directory.path("sealed"));
+        const ContainerLayout layout(ContainerHeader::parse(container.data()), plaintext.size());
+        const std::pair<uint64_t, size_t> records[] = {{0, 0}, {1, 3}, {3, 0}};
+        for (const auto &[segment, chunk]: records) {
+            std::vector<unsigned char> damaged = container;
+            damaged[layout.recordOffset(segment, chunk) + RECORD_PREFIX_SIZE + 8] ^= 1;
+
+            // The record two segments on is damaged too; the first in file order is reported.
+            if (segment + 2 < layout.segmentCount()) {
+                damaged[layout.recordOffset(segment + 2, 0) + RECORD_PREFIX_SIZE + 8] ^= 1;
+            }
+            tests::writeFile(directory.path("damaged"), damaged);
+            try {
+                engine.verifyFile(directory.path("damaged"));
+                std::cerr << "Error: a damaged record of segment " << segment << " verified" << std::endl;
+                return false;
+            } catch (const engines::encryption::IntegrityError &e) {
+                CHECK(e.segment() == segment);
+                CHECK(e.chunk() == chunk);
+                CHECK(e.offset() == layout.recordOffset(segment, chunk));
+            }
+        }
+        return true;
+    }
+
+    constexpr tests::Suite SUITES[] = {
+        {"engine", testEngine},
+        {"range", testRange},
+        {"span", testSpan},
+        {"stream", testStream},
+        {"archive", testArchive},
+        {"update", testUpdate},
+        {"keyfile", testKeyFile},
+        {"scheduler", testScheduler},
+        {"profile", testProfile},
+        {"verify", testVerify},
+    };
+}
+
+int main(const int argc, char **argv) {
+    return tests::runSuites(argc, argv, SUITES);
+}
@@ -0,0 +1,275 @@
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <sodium.h>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "../utils/compression/Codec.h"
+#include "../utils/corpus/CorpusGenerator.h"
+#include "../utils/crypto/CipherSuite.h"
+#include "../utils/crypto/XorTransform.h"
+#include "../utils/math/LatticeNoise.h"
+#include "../utils/math/LorenzAttractor.h"
+#include "TestSupport.h"
+
+// Checks the hot-path kernels against their references.
+// Usage: mirage_kernel_tests [suite...]   (runs every suite when none is given)
+
+namespace {
+    // Every kernel the host supports must match the scalar reference for all tail lengths and misaligned buffers.
+    bool testXor() {
+        unsigned char key[XOR_KEY_SIZE];
+        randombytes_buf(key, sizeof(key));
+        const utils::crypto::XorTransform transform(key);
+        sodium_memzero(key, sizeof(key));
+
+        std::vector<unsigned char> input(4096 + 64), expected(input.size()), actual(input.size());
+        randombytes_buf(input.data(), input.size());
+        for (const auto kernel: {utils::crypto::XorKernel::Portable, utils::crypto::XorKernel::Sse2,
+                                 utils::crypto::XorKernel::Avx2, utils::crypto::XorKernel::Avx512,
+                                 utils::crypto::XorKernel::Neon}) {
+            if (!utils::crypto::XorTransform::isSupported(kernel)) {
+                continue;
+            }
+            for (size_t misalignment = 0; misalignment < 64; misalignment += 7) {
+                for (size_t length = 0; length <= 4096 - 64; length += length < 300 ? 1 : 397) {
+                    transform.applyScalar(input.data() + misalignment, expected.data(), length);
+                    transform.applyWith(kernel, input.data() + misalignment, actual.data() + misalignment, length);
+                    if (std::memcmp(expected.data(), actual.data() + misalignment, length) != 0) {
+                        std::cerr << "Error: XOR kernel " << utils::crypto::XorTransform::kernelName(kernel)
+                                << " differs from the scalar reference at length " << length << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // The compile-time table must equal the loop generateEntropy() used to run, and every batched trajectory must
+    // follow the single-trajectory steps, including a partial last batch.
+    bool testLorenz() {
+        std::array<uint8_t, LORENZ_ENTROPY_SIZE> expected{}, actual{};
+        double x = LORENZ_ENTROPY_START_X;
+        double y = LORENZ_ENTROPY_START_Y;
+        double z = LORENZ_ENTROPY_START_Z;
+        for (uint8_t &byte: expected) {
+            const double dx = 10.0 * (y - x);
+            const double dy = x * (28.0 - z) - y;
+            const double dz = x * y - 8.0 / 3.0 * z;
+            x += dx * 0.01;
+            y += dy * 0.01;
+            z += dz * 0.01;
+            byte = static_cast<uint8_t>(std::fmod(std::abs(x + y + z), 256));
+        }
+        utils::math::LorenzAttractor::generateEntropy(actual, actual.size());
+        if (expected != actual) {
+            std::cerr << "Error: the Lorenz entropy table differs from the scalar reference" << std::endl;
+            return false;
+        }
+
+        constexpr size_t steps = 4096;
+        std::vector<utils::math::LorenzState> starts;
+        for (size_t i = 0; i < LORENZ_BATCH_LANES + 3; ++i) {
+            starts.push_back({1.0 + 0.001 * static_cast<double>(i), 1.0, 1.0 + 0.002 * static_cast<double>(i)});
+        }
+        std::vector<uint8_t> output(steps * starts.size());
+        for (const auto method: {utils::math::LorenzMethod::Euler, utils::math::LorenzMethod::RungeKutta4}) {
+            utils::math::LorenzAttractor::integrate(starts, output, method);
+            for (size_t i = 0; i < starts.size(); ++i) {
+                const auto reference = utils::math::LorenzAttractor::trajectory<steps>(starts[i], method);
+                for (size_t s = 0; s < steps; ++s) {
+                    if (output[s * starts.size() + i] != reference[s]) {
+                        std::cerr << "Error: batched Lorenz trajectory " << i << " differs at step " << s << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // The noise must be the keystream of the stream identifier added modulo 256, and removal must undo it, for
+    // every length around the vector and batch widths and for misaligned buffers.
+    bool testLattice() {
+        unsigned char key[LATTICE_NOISE_KEY_SIZE];
+        randombytes_buf(key, sizeof(key));
+        const utils::math::LatticeNoise latticeNoise(key);
+
+        std::vector<uint8_t> input(3 * LATTICE_NOISE_BATCH_SIZE + 64), noisy(input.size()), restored(input.size());
+        std::vector<uint8_t> keystream(input.size());
+        randombytes_buf(input.data(), input.size());
+        bool passed = true;
+        for (size_t length = 0; passed && length + 64 <= input.size(); length += length < 300 ? 1 : 1021) {
+            const size_t misalignment = length % 61;
+            const uint64_t streamId = length * 0x9e3779b97f4a7c15ull;
+            const std::span source(input.data() + misalignment, length);
+            latticeNoise.addLatticeNoise(source, {noisy.data(), length}, streamId);
+            latticeNoise.removeLatticeNoise({noisy.data(), length}, {restored.data() + misalignment, length},
+                                            streamId);
+
+            unsigned char nonce[crypto_stream_chacha20_ietf_NONCEBYTES]{};
+            for (size_t i = 0; i < 8; ++i) {
+                nonce[i] = static_cast<unsigned char>(streamId >> (8 * i));
+            }
+            crypto_stream_chacha20_ietf(keystream.data(), length, nonce, key);
+            for (size_t i = 0; i < length; ++i) {
+                if (noisy[i] != static_cast<uint8_t>(source[i] + keystream[i])) {
+                    std::cerr << "Error: lattice noise differs from the keystream at length " << length << std::endl;
+                    passed = false;
+                    break;
+                }
+            }
+            if (passed && std::memcmp(restored.data() + misalignment, source.data(), length) != 0) {
+                std::cerr << "Error: lattice noise does not round-trip at length " << length << std::endl;
+                passed = false;
+            }
+        }
+        sodium_memzero(key, sizeof(key));
+        return passed;
+    }
+
+    // A corpus stream must be the same every time it is generated.
+    bool testCorpus() {
+        std::vector<uint8_t> buffer(CORPUS_BLOCK_SIZE), again(buffer.size());
+        for (const auto profile: {utils::corpus::CorpusProfile::Random, utils::corpus::CorpusProfile::Text,
+                                  utils::corpus::CorpusProfile::Sparse}) {
+            utils::corpus::CorpusOptions options;
+            options.profile = profile;
+            options.threadCount = 1;
+            const utils::corpus::CorpusGenerator generator(options);
+            generator.fill(buffer, 7);
+            generator.fill(again, 7);
+            if (buffer != again) {
+                std::cerr << "Error: corpus stream is not reproducible for profile "
+                        << utils::corpus::CorpusGenerator::profileName(profile) << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Every suite available on this CPU must round-trip across a rekey and reject a flipped bit.
+    bool testCipher() {
+        unsigned char key[STREAM_KEY_SIZE];
+        randombytes_buf(key, sizeof(key));
+        bool passed = true;
+        for (const uint8_t suite: {CIPHER_SUITE_XCHACHA20_POLY1305, CIPHER_SUITE_AES256_GCM}) {
+            if (!utils::crypto::CipherSuite::isAvailable(suite)) {
+                continue;
+            }
+
+            unsigned char header[STREAM_HEADER_SIZE];
+            const unsigned char ad[4] = {1, 2, 3, 4};
+            std::vector<uint8_t> message(1000), sealed(message.size() + STREAM_ABYTES), opened(message.size());
+            randombytes_buf(message.data(), message.size());
+            const auto push = utils::crypto::CipherSuite::createPush(suite, key, header);
+            push->push(sealed.data(), message.data(), message.size(), ad, sizeof(ad), STREAM_TAG_MESSAGE);
+            push->rekey();
+            std::vector<uint8_t> last(sealed.size());
+            push->push(last.data(), message.data(), message.size(), ad, sizeof(ad), STREAM_TAG_FINAL);
+
+            unsigned char tag;
+            const auto pull = utils::crypto::CipherSuite::createPull(suite, key, header);
+            const bool first = pull->pull(opened.data(), tag, sealed.data(), sealed.size(), ad, sizeof(ad)) &&
+                               tag == STREAM_TAG_MESSAGE && opened == message;
+            pull->rekey();
+            last[last.size() / 2] ^= 1;
+            const auto tampered = utils::crypto::CipherSuite::createPull(suite, key, header);
+            const bool rejected = !tampered->pull(opened.data(), tag, last.data(), last.size(), ad, sizeof(ad));
+            last[last.size() / 2] ^= 1;
+            const bool second = pull->pull(opened.data(), tag, last.data(), last.size(), ad, sizeof(ad)) &&
+                                tag == STREAM_TAG_FINAL && opened == message;
+            if (!first || !second || !rejected) {
+                std::cerr << "Error: " << utils::crypto::CipherSuite::name(suite) << " does not round-trip"
+                        << std::endl;
+                passed = false;
+            }
+        }
+        sodium_memzero(key, sizeof(key));
+        return passed;
+    }
+
+    // LZ must round-trip random, repetitive and incompressible blocks, give up on an output that is too small and
+    // reject truncated and malformed blocks without writing past its output.
+    bool testCodec() {
+        const utils::compression::Codec *codec = utils::compression::findCodec(CODEC_LZ);
+        CHECK(codec != nullptr);
+        CHECK(codec == utils::compression::findCodec("lz"));
+
+        std::vector<std::vector<unsigned char>> blocks;
+        blocks.emplace_back();
+        blocks.push_back(tests::randomBytes(4096));
+        blocks.emplace_back(4096, 0);
+        for (const size_t size: {5, 13, 100, 4096, 65536 + 300}) {
+            std::vector<unsigned char> block(size);
+            const std::vector<unsigned char> alphabet = tests::randomBytes(8);
+            for (size_t i = 0; i < size; ++i) {
+                block[i] = i % 97 < 50 ? static_cast<unsigned char>(i % 7) : alphabet[i * 31 % 8];
+            }
+            blocks.push_back(block);
+        }
+
+        for (const std::vector<unsigned char> &block: blocks) {
+            std::vector<unsigned char> compressed(block.size() + block.size() / 255 + 16);
+            compressed.resize(codec->compress(block, compressed));
+            CHECK(!compressed.empty());
+            std::vector<unsigned char> output(block.size());
+            CHECK(codec->decompress(compressed, output) == block.size());
+            CHECK(output == block);
+
+            // A block that does not shrink is abandoned when the output only holds a smaller one.
+            if (compressed.size() > 1) {
+                std::vector<unsigned char> small(compressed.size() - 1);
+                CHECK(codec->compress(block, small) == 0);
+            }
+            if (!block.empty()) {
+                output.resize(block.size() - 1);
+                CHECK(tests::throwsWith([&] { (void) codec->decompress(compressed, output); }, "Malformed"));
+            }
+
+            // A truncated block either fails or decodes to a shorter plaintext, which the engine rejects.
+            output.resize(block.size());
+            for (size_t length = 0; length < compressed.size(); length += 1 + length / 16) {
+                try {
+                    CHECK(codec->decompress({compressed.data(), length}, output) < block.size());
+                } catch (const std::runtime_error &) {
+                }
+            }
+        }
+
+        // Literals past the end of the block, a zero offset and an offset in front of the output.
+        const std::vector<std::vector<unsigned char>> malformed = {
+            {0xf0}, {0x30, 'a'}, {0x10, 'a', 0, 0}, {0x10, 'a', 2, 0}
+        };
+        std::vector<unsigned char> output(64);
+        for (const std::vector<unsigned char> &block: malformed) {
+            CHECK(tests::throwsWith([&] { (void) codec->decompress(block, output); }, "Malformed"));
+        }
+        for (size_t trial = 0; trial < 1000; ++trial) {
+            const std::vector<unsigned char> garbage = tests::randomBytes(1 + trial % 64);
+            try {
+                CHECK(codec->decompress(garbage, output) <= output.size());
+            } catch (const std::runtime_error &) {
+            }
+        }
+        return true;
+    }
+
+    constexpr tests::Suite SUITES[] = {
+        {"xor", testXor},
+        {"lorenz", testLorenz},
+        {"lattice", testLattice},
+        {"corpus", testCorpus},
+        {"cipher", testCipher},
+        {"codec", testCodec},
+    };
+}
+
+int main(const int argc, char **argv) {
+    return tests::runSuites(argc, argv, SUITES);
+}
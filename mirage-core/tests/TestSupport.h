@@ -0,0 +1,180 @@
+#ifndef TESTSUPPORT_H
+#define TESTSUPPORT_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sodium.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Fails the enclosing check function, naming the condition and where it is, if the condition is false.
+ */
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << "Error: " << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+            return false; \
+        } \
+    } while (false)
+
+namespace tests {
+    /**
+     * @struct Suite
+     * @brief A named group of checks that CTest runs as one test.
+     */
+    struct Suite {
+        const char *name;
+        bool (*run)(); /**< Returns false if a check failed. */
+    };
+
+    /**
+     * @class TempDirectory
+     * @brief A fresh directory under the system's temporary directory, removed with its contents.
+     */
+    class TempDirectory {
+    public:
+        TempDirectory() {
+            std::string pattern = (std::filesystem::temp_directory_path() / "mirage-tests-XXXXXX").string();
+            if (mkdtemp(pattern.data()) == nullptr) {
+                throw std::runtime_error("Failed to create a temporary directory");
+            }
+            root = pattern;
+        }
+
+        TempDirectory(const TempDirectory &) = delete;
+
+        TempDirectory &operator=(const TempDirectory &) = delete;
+
+        ~TempDirectory() {
+            std::error_code ignored;
+            std::filesystem::remove_all(root, ignored);
+        }
+
+        /**
+         * @brief Gets the path of a file in the directory.
+         */
+        [[nodiscard]] std::string path(const std::string &name) const {
+            return (root / name).string();
+        }
+
+    private:
+        std::filesystem::path root; /**< The directory. */
+    };
+
+    /**
+     * @class WorkingDirectory
+     * @brief Makes a directory the working directory until the end of the scope.
+     */
+    class WorkingDirectory {
+    public:
+        explicit WorkingDirectory(const std::string &path) : previous(std::filesystem::current_path()) {
+            std::filesystem::current_path(path);
+        }
+
+        WorkingDirectory(const WorkingDirectory &) = delete;
+
+        WorkingDirectory &operator=(const WorkingDirectory &) = delete;
+
+        ~WorkingDirectory() {
+            std::error_code ignored;
+            std::filesystem::current_path(previous, ignored);
+        }
+
+    private:
+        std::filesystem::path previous; /**< The working directory to return to. */
+    };
+
+    /**
+     * @brief Gets random bytes.
+     */
+    inline std::vector<unsigned char> randomBytes(const size_t size) {
+        std::vector<unsigned char> bytes(size);
+        randombytes_buf(bytes.data(), bytes.size());
+        return bytes;
+    }
+
+    /**
+     * @brief Reads a whole file.
+     */
+    inline std::vector<unsigned char> readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+
+    /**
+     * @brief Replaces the contents of a file.
+     */
+    inline void writeFile(const std::string &path, const std::vector<unsigned char> &bytes) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!out) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+    }
+
+    /**
+     * @brief Tells whether a call throws an exception whose message contains the given text.
+     *
+     * An exception with another message is printed, so a failing check shows what was thrown instead.
+     */
+    template<typename Function>
+    bool throwsWith(Function &&function, const std::string &message) {
+        try {
+            function();
+        } catch (const std::exception &e) {
+            if (std::string(e.what()).find(message) != std::string::npos) {
+                return true;
+            }
+            std::cerr << "Unexpected error: " << e.what() << std::endl;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Runs the suites named on the command line, or every suite when none is named.
+     *
+     * @param argc The argument count of main().
+     * @param argv The arguments of main(); every argument after the program name selects a suite.
+     * @param suites The suites of the test executable.
+     * @return Zero if every suite that ran passed, one otherwise.
+     */
+    template<size_t N>
+    int runSuites(const int argc, char **argv, const Suite (&suites)[N]) {
+        if (sodium_init() == -1) {
+            std::cerr << "Error: Failed to initialize libsodium" << std::endl;
+            return 1;
+        }
+
+        int status = 0;
+        for (const Suite &suite: suites) {
+            bool selected = argc == 1;
+            for (int i = 1; i < argc; ++i) {
+                selected = selected || std::strcmp(argv[i], suite.name) == 0;
+            }
+            if (selected) {
+                bool passed;
+                try {
+                    passed = suite.run();
+                } catch (const std::exception &e) {
+                    std::cerr << suite.name << ": " << e.what() << std::endl;
+                    passed = false;
+                }
+                std::cout << (passed ? "PASS " : "FAIL ") << suite.name << std::endl;
+                status |= passed ? 0 : 1;
+            }
+        }
+        return status;
+    }
+} // namespace tests
+
+#endif // TESTSUPPORT_H
@@ -0,0 +1,25 @@
+#include "Codec.h"
+#include "LzCodec.h"
+#include <cstring>
+
+namespace utils::compression {
+    namespace {
+        const LzCodec lzCodec;
+    }
+
+    const Codec *findCodec(const uint8_t id) {
+        switch (id) {
+            case CODEC_LZ:
+                return &lzCodec;
+            default:
+                return nullptr;
+        }
+    }
+
+    const Codec *findCodec(const char *name) {
+        if (std::strcmp(name, lzCodec.name()) == 0) {
+            return &lzCodec;
+        }
+        return nullptr;
+    }
+} // namespace utils::compression
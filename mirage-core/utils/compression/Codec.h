@@ -0,0 +1,80 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#define CODEC_NONE 0
+#define CODEC_LZ 1
+
+namespace utils::compression {
+ /**
+  * @class Codec
+  * @brief A block compressor applied to chunks before they are encrypted.
+  *
+  * Codecs are stateless and shared between threads. Every chunk is compressed on its own, so chunks
+  * decompress independently and in any order.
+  */
+ class Codec {
+ public:
+  virtual ~Codec() = default;
+
+  /**
+   * @brief Gets the identifier recorded in container headers.
+   *
+   * @return A non-zero CODEC_* value.
+   */
+  [[nodiscard]] virtual uint8_t id() const = 0;
+
+  /**
+   * @brief Gets the name of the codec as it appears in reports and options.
+   *
+   * @return The lower-case name.
+   */
+  [[nodiscard]] virtual const char *name() const = 0;
+
+  /**
+   * @brief Compresses a block into a buffer of limited size.
+   *
+   * The output limit doubles as the incompressibility test: a block that does not shrink below it is
+   * abandoned early and stored as it is.
+   *
+   * @param input The block.
+   * @param output The destination; its size is the largest acceptable compressed size.
+   * @return The compressed size, or zero if the result does not fit output.
+   */
+  [[nodiscard]] virtual size_t compress(std::span<const unsigned char> input,
+                                        std::span<unsigned char> output) const = 0;
+
+  /**
+   * @brief Decompresses a block.
+   *
+   * Throws std::runtime_error if the input is malformed or decompresses to more than output holds.
+   *
+   * @param input The compressed block.
+   * @param output The destination.
+   * @return The decompressed size.
+   */
+  [[nodiscard]] virtual size_t decompress(std::span<const unsigned char> input,
+                                          std::span<unsigned char> output) const = 0;
+ };
+
+ /**
+  * @brief Finds a codec by the identifier recorded in a container header.
+  *
+  * @param id The CODEC_* identifier.
+  * @return The codec, or nullptr for CODEC_NONE and unknown identifiers.
+  */
+ const Codec *findCodec(uint8_t id);
+
+ /**
+  * @brief Finds a codec by name.
+  *
+  * @param name The name, such as "lz".
+  * @return The codec, or nullptr if there is none of that name.
+  */
+ const Codec *findCodec(const char *name);
+} // namespace utils::compression
+
+#endif // CODEC_H
@@ -0,0 +1,187 @@
+#include "LzCodec.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace utils::compression {
+    namespace {
+        uint32_t read32(const unsigned char *in) {
+            uint32_t value;
+            std::memcpy(&value, in, sizeof(value));
+            return value;
+        }
+
+        uint32_t hashSequence(const uint32_t sequence) {
+            return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        }
+
+        // Lengths past a nibble continue as a run of 255s and a final byte below 255.
+        bool writeLength(unsigned char *&out, const unsigned char *end, size_t length) {
+            for (; length >= 255; length -= 255) {
+                if (out == end) {
+                    return false;
+                }
+                *out++ = 255;
+            }
+            if (out == end) {
+                return false;
+            }
+            *out++ = static_cast<unsigned char>(length);
+            return true;
+        }
+
+        size_t readLength(const unsigned char *&in, const unsigned char *end, size_t length) {
+            unsigned char byte;
+            do {
+                if (in == end) {
+                    throw std::runtime_error("Malformed compressed block");
+                }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+            return length;
+        }
+
+        // Writes literals followed by a match; a zero match length marks the last sequence.
+        bool writeSequence(unsigned char *&out, const unsigned char *end, const unsigned char *literals,
+                           const size_t literalLength, const size_t offset, const size_t matchLength) {
+            if (out == end) {
+                return false;
+            }
+            unsigned char *token = out++;
+            const size_t matchCode = matchLength == 0 ? 0 : matchLength - LZ_MIN_MATCH;
+            *token = static_cast<unsigned char>(std::min<size_t>(literalLength, 15) << 4 |
+                                                std::min<size_t>(matchCode, 15));
+            if (literalLength >= 15 && !writeLength(out, end, literalLength - 15)) {
+                return false;
+            }
+            if (static_cast<size_t>(end - out) < literalLength) {
+                return false;
+            }
+            // An empty block has no literals to copy and may pass a null pointer for them.
+            if (literalLength > 0) {
+                std::memcpy(out, literals, literalLength);
+                out += literalLength;
+            }
+            if (matchLength == 0) {
+                return true;
+            }
+
+            if (end - out < 2) {
+                return false;
+            }
+            out[0] = static_cast<unsigned char>(offset);
+            out[1] = static_cast<unsigned char>(offset >> 8);
+            out += 2;
+            return matchCode < 15 || writeLength(out, end, matchCode - 15);
+        }
+    }
+
+    size_t LzCodec::compress(const std::span<const unsigned char> input, const std::span<unsigned char> output) const {
+        const unsigned char *const base = input.data();
+        const unsigned char *const inputEnd = base + input.size();
+        unsigned char *out = output.data();
+        const unsigned char *const outputEnd = out + output.size();
+        const unsigned char *anchor = base;
+
+        // Matches start LZ_MATCH_GUARD bytes before the end and stop LZ_LAST_LITERALS before it.
+        if (input.size() > LZ_MATCH_GUARD) {
+            uint32_t table[1 << LZ_HASH_BITS] = {};
+            const unsigned char *const searchLimit = inputEnd - LZ_MATCH_GUARD;
+            const unsigned char *const matchLimit = inputEnd - LZ_LAST_LITERALS;
+            const unsigned char *in = base + 1;
+            size_t misses = 0;
+
+            while (in < searchLimit) {
+                const uint32_t sequence = read32(in);
+                const uint32_t hash = hashSequence(sequence);
+                const unsigned char *reference = base + table[hash];
+                table[hash] = static_cast<uint32_t>(in - base);
+                if (in - reference > LZ_MAX_OFFSET || read32(reference) != sequence) {
+                    in += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                    continue;
+                }
+                misses = 0;
+
+                while (in > anchor && reference > base && in[-1] == reference[-1]) {
+                    --in;
+                    --reference;
+                }
+                const unsigned char *matchEnd = in + LZ_MIN_MATCH;
+                for (const unsigned char *next = reference + LZ_MIN_MATCH;
+                     matchEnd < matchLimit && *matchEnd == *next; ++matchEnd, ++next) {
+                }
+                if (!writeSequence(out, outputEnd, anchor, in - anchor, in - reference, matchEnd - in)) {
+                    return 0;
+                }
+                in = matchEnd;
+                anchor = in;
+                if (in < searchLimit) {
+                    table[hashSequence(read32(in - 2))] = static_cast<uint32_t>(in - 2 - base);
+                }
+            }
+        }
+
+        if (!writeSequence(out, outputEnd, anchor, inputEnd - anchor, 0, 0)) {
+            return 0;
+        }
+        return out - output.data();
+    }
+
+    size_t LzCodec::decompress(const std::span<const unsigned char> input,
+                               const std::span<unsigned char> output) const {
+        const unsigned char *in = input.data();
+        const unsigned char *const inputEnd = in + input.size();
+        unsigned char *out = output.data();
+        const unsigned char *const outputEnd = out + output.size();
+
+        while (true) {
+            if (in == inputEnd) {
+                throw std::runtime_error("Malformed compressed block");
+            }
+            const unsigned char token = *in++;
+            size_t literalLength = token >> 4;
+            if (literalLength == 15) {
+                literalLength = readLength(in, inputEnd, literalLength);
+            }
+            if (static_cast<size_t>(inputEnd - in) < literalLength ||
+                static_cast<size_t>(outputEnd - out) < literalLength) {
+                throw std::runtime_error("Malformed compressed block");
+            }
+            if (literalLength > 0) {
+                std::memcpy(out, in, literalLength);
+                in += literalLength;
+                out += literalLength;
+            }
+            if (in == inputEnd) {
+                break;
+            }
+
+            if (inputEnd - in < 2) {
+                throw std::runtime_error("Malformed compressed block");
+            }
+            const size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+            in += 2;
+            size_t matchLength = (token & 15) + LZ_MIN_MATCH;
+            if ((token & 15) == 15) {
+                matchLength = readLength(in, inputEnd, matchLength);
+            }
+            if (offset == 0 || offset > static_cast<size_t>(out - output.data()) ||
+                static_cast<size_t>(outputEnd - out) < matchLength) {
+                throw std::runtime_error("Malformed compressed block");
+            }
+
+            // Overlapping matches repeat the bytes just written, so they are copied forwards one at a time.
+            const unsigned char *match = out - offset;
+            if (offset >= matchLength) {
+                std::memcpy(out, match, matchLength);
+                out += matchLength;
+            } else {
+                for (const unsigned char *end = out + matchLength; out < end;) {
+                    *out++ = *match++;
+                }
+            }
+        }
+        return out - output.data();
+    }
+} // namespace utils::compression
@@ -0,0 +1,36 @@
+#ifndef LZCODEC_H
+#define LZCODEC_H
+
+#include "Codec.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_GUARD 12
+#define LZ_SKIP_TRIGGER 6
+
+namespace utils::compression {
+ /**
+  * @class LzCodec
+  * @brief A byte-oriented LZ77 codec in the style of LZ4, tuned for speed over ratio.
+  *
+  * Matches are found with a single-probe hash table of 4-byte sequences over a 64 KiB window. A block is
+  * a series of sequences: a token holding a literal count and a match length in its two nibbles, extra
+  * length bytes for either when the nibble is 15, the literals, and a 2-byte little-endian match offset;
+  * the last sequence has literals only. Where no match is found the search steps further with every miss,
+  * so incompressible data costs little more than a pass over it before the output limit gives up.
+  */
+ class LzCodec final : public Codec {
+ public:
+  [[nodiscard]] uint8_t id() const override { return CODEC_LZ; }
+
+  [[nodiscard]] const char *name() const override { return "lz"; }
+
+  [[nodiscard]] size_t compress(std::span<const unsigned char> input, std::span<unsigned char> output) const override;
+
+  [[nodiscard]] size_t decompress(std::span<const unsigned char> input, std::span<unsigned char> output) const override;
+ };
+} // namespace utils::compression
+
+#endif // LZCODEC_H
@@ -0,0 +1,48 @@
+#include "ResourceBudget.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace utils::concurrency {
+    ResourceBudget::Lease::Lease(ResourceBudget *budget, const uint64_t memory, const size_t files)
+        : budget(budget), memory(memory), files(files) {
+    }
+
+    ResourceBudget::Lease::Lease(Lease &&other) noexcept
+        : budget(other.budget), memory(other.memory), files(other.files) {
+        other.budget = nullptr;
+    }
+
+    ResourceBudget::Lease::~Lease() {
+        if (budget != nullptr) {
+            budget->release(memory, files);
+        }
+    }
+
+    ResourceBudget::ResourceBudget(const uint64_t memoryLimit, const size_t fileLimit)
+        : memoryLimit(memoryLimit), fileLimit(fileLimit) {
+        if (memoryLimit == 0 || fileLimit == 0) {
+            throw std::invalid_argument("Resource limits must be positive");
+        }
+    }
+
+    ResourceBudget::Lease ResourceBudget::acquire(uint64_t memory, size_t files) {
+        memory = std::min(memory, memoryLimit);
+        files = std::min(files, fileLimit);
+        std::unique_lock lock(mutex);
+        released.wait(lock, [&] {
+            return memoryUsed + memory <= memoryLimit && filesUsed + files <= fileLimit;
+        });
+        memoryUsed += memory;
+        filesUsed += files;
+        return {this, memory, files};
+    }
+
+    void ResourceBudget::release(const uint64_t memory, const size_t files) {
+        {
+            std::lock_guard lock(mutex);
+            memoryUsed -= memory;
+            filesUsed -= files;
+        }
+        released.notify_all();
+    }
+} // namespace utils::concurrency
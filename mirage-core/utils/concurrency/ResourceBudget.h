@@ -0,0 +1,86 @@
+#ifndef RESOURCEBUDGET_H
+#define RESOURCEBUDGET_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace utils::concurrency {
+ /**
+  * @class ResourceBudget
+  * @brief A counting limit on the memory and open files that concurrent jobs hold at once.
+  *
+  * A job acquires its share before it starts and releases it when it finishes; acquire() blocks while the
+  * share does not fit next to the jobs already running. A share larger than a limit is clamped to it, so an
+  * oversized job still runs, alone, instead of waiting forever.
+  */
+ class ResourceBudget {
+ public:
+  /**
+   * @class Lease
+   * @brief A share of the budget, released when the lease is destroyed.
+   */
+  class Lease {
+  public:
+   Lease(const Lease &) = delete;
+
+   Lease &operator=(const Lease &) = delete;
+
+   Lease(Lease &&other) noexcept;
+
+   /**
+    * @brief Destroys the Lease object, returning its share to the budget.
+    */
+   ~Lease();
+
+  private:
+   friend class ResourceBudget;
+
+   ResourceBudget *budget; /**< The budget the share came from; nullptr once moved from. */
+   uint64_t memory; /**< Bytes of memory held. */
+   size_t files; /**< Open files held. */
+
+   Lease(ResourceBudget *budget, uint64_t memory, size_t files);
+  };
+
+  /**
+   * @brief Constructs a new ResourceBudget object.
+   *
+   * @param memoryLimit The bytes of memory jobs may hold at once.
+   * @param fileLimit The files jobs may hold open at once.
+   */
+  ResourceBudget(uint64_t memoryLimit, size_t fileLimit);
+
+  ResourceBudget(const ResourceBudget &) = delete;
+
+  ResourceBudget &operator=(const ResourceBudget &) = delete;
+
+  /**
+   * @brief Waits until a share fits in the budget and takes it.
+   *
+   * @param memory The bytes of memory the job holds.
+   * @param files The files the job holds open.
+   * @return The lease of the share.
+   */
+  [[nodiscard]] Lease acquire(uint64_t memory, size_t files);
+
+ private:
+  std::mutex mutex; /**< Guards the amounts in use. */
+  std::condition_variable released; /**< Signals waiting jobs when a lease is returned. */
+  uint64_t memoryLimit; /**< The bytes of memory jobs may hold at once. */
+  size_t fileLimit; /**< The files jobs may hold open at once. */
+  uint64_t memoryUsed = 0; /**< The bytes of memory held by running jobs. */
+  size_t filesUsed = 0; /**< The files held open by running jobs. */
+
+  /**
+   * @brief Returns a share to the budget.
+   *
+   * @param memory The bytes of memory returned.
+   * @param files The open files returned.
+   */
+  void release(uint64_t memory, size_t files);
+ };
+} // namespace utils::concurrency
+
+#endif // RESOURCEBUDGET_H
@@ -0,0 +1,138 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace utils::concurrency {
+ /**
+  * @class SpscRing
+  * @brief A bounded lock-free ring buffer for exactly one producer and one consumer thread.
+  *
+  * Producer and consumer only touch their own index and read the other one, so tryPush() and tryPop() are
+  * wait-free. The blocking push() and pop() park on a futex-backed event counter instead of spinning, which
+  * keeps an I/O stage that waits on the disk from burning a core. close() wakes both sides for shutdown.
+  *
+  * @tparam T The element type; must be cheap to copy, e.g. a slot index.
+  */
+ template<typename T>
+ class SpscRing {
+ public:
+  /**
+   * @brief Constructs a new SpscRing object.
+   *
+   * @param capacity The minimum number of elements the ring holds; rounded up to a power of two.
+   */
+  explicit SpscRing(const size_t capacity)
+   : elements(std::bit_ceil(capacity < 2 ? size_t{2} : capacity)), mask(elements.size() - 1) {
+  }
+
+  SpscRing(const SpscRing &) = delete;
+
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  /**
+   * @brief Appends an element if the ring is not full. Producer side only.
+   *
+   * @param value The element to append.
+   * @return True if the element was appended.
+   */
+  bool tryPush(const T &value) {
+   const uint64_t t = tail.load(std::memory_order_relaxed);
+   if (t - head.load(std::memory_order_acquire) == elements.size()) {
+    return false;
+   }
+   elements[t & mask] = value;
+   tail.store(t + 1, std::memory_order_release);
+   signal();
+   return true;
+  }
+
+  /**
+   * @brief Removes the oldest element if the ring is not empty. Consumer side only.
+   *
+   * @param value Receives the removed element.
+   * @return True if an element was removed.
+   */
+  bool tryPop(T &value) {
+   const uint64_t h = head.load(std::memory_order_relaxed);
+   if (h == tail.load(std::memory_order_acquire)) {
+    return false;
+   }
+   value = elements[h & mask];
+   head.store(h + 1, std::memory_order_release);
+   signal();
+   return true;
+  }
+
+  /**
+   * @brief Appends an element, waiting while the ring is full. Producer side only.
+   *
+   * @param value The element to append.
+   * @return False if the ring was closed before the element could be appended.
+   */
+  bool push(const T &value) {
+   for (;;) {
+    const uint32_t seen = events.load(std::memory_order_acquire);
+    if (closed.load(std::memory_order_acquire)) {
+     return false;
+    }
+    if (tryPush(value)) {
+     return true;
+    }
+    events.wait(seen, std::memory_order_acquire);
+   }
+  }
+
+  /**
+   * @brief Removes the oldest element, waiting while the ring is empty. Consumer side only.
+   *
+   * Elements pushed before close() are still delivered.
+   *
+   * @param value Receives the removed element.
+   * @return False if the ring is empty and closed.
+   */
+  bool pop(T &value) {
+   for (;;) {
+    const uint32_t seen = events.load(std::memory_order_acquire);
+    if (tryPop(value)) {
+     return true;
+    }
+    if (closed.load(std::memory_order_acquire)) {
+     return false;
+    }
+    events.wait(seen, std::memory_order_acquire);
+   }
+  }
+
+  /**
+   * @brief Closes the ring and wakes both sides.
+   */
+  void close() {
+   closed.store(true, std::memory_order_release);
+   signal();
+  }
+
+ private:
+  std::vector<T> elements; /**< The ring storage; its size is a power of two. */
+  const size_t mask; /**< Maps a position to an index in elements. */
+  alignas(64) std::atomic<uint64_t> head{0}; /**< Position of the next element to pop, written by the consumer. */
+  alignas(64) std::atomic<uint64_t> tail{0}; /**< Position of the next element to push, written by the producer. */
+  alignas(64) std::atomic<uint32_t> events{0}; /**< Bumped on every state change so waiters can park on it. */
+  std::atomic<bool> closed{false}; /**< Set by close(). */
+
+  /**
+   * @brief Publishes a state change to parked waiters.
+   */
+  void signal() {
+   events.fetch_add(1, std::memory_order_acq_rel);
+   events.notify_all();
+  }
+ };
+} // namespace utils::concurrency
+
+#endif // SPSCRING_H
@@ -0,0 +1,83 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace utils::concurrency {
+ /**
+  * @class ThreadPool
+  * @brief A fixed-size pool of worker threads consuming a shared task queue.
+  *
+  * The ThreadPool class starts a fixed number of worker threads on construction and joins them on
+  * destruction. Tasks are submitted as callables and their results (or exceptions) are delivered
+  * through a std::future.
+  */
+ class ThreadPool {
+ public:
+  /**
+   * @brief Constructs a new ThreadPool object.
+   *
+   * @param threadCount The number of worker threads. Zero selects std::thread::hardware_concurrency().
+   */
+  explicit ThreadPool(size_t threadCount = 0);
+
+  /**
+   * @brief Destroys the ThreadPool object.
+   *
+   * Drains the pending tasks and joins all worker threads.
+   */
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /**
+   * @brief Submits a task to the pool.
+   *
+   * @tparam F The callable type.
+   * @param task The callable to execute on a worker thread.
+   * @return A future holding the result of the task, or the exception it threw.
+   */
+  template<typename F>
+  auto submit(F &&task) -> std::future<std::invoke_result_t<F> > {
+   using R = std::invoke_result_t<F>;
+   auto packaged = std::make_shared<std::packaged_task<R()> >(std::forward<F>(task));
+   std::future<R> result = packaged->get_future();
+   {
+    std::lock_guard lock(mutex);
+    tasks.emplace([packaged] { (*packaged)(); });
+   }
+   condition.notify_one();
+   return result;
+  }
+
+  /**
+   * @brief Gets the number of worker threads.
+   *
+   * @return The number of worker threads.
+   */
+  [[nodiscard]] size_t size() const;
+
+ private:
+  std::vector<std::thread> workers; /**< The worker threads. */
+  std::queue<std::function<void()> > tasks; /**< Pending tasks in submission order. */
+  std::mutex mutex; /**< Guards the task queue and the stopping flag. */
+  std::condition_variable condition; /**< Signals workers when tasks arrive or the pool stops. */
+  bool stopping = false; /**< Set when the pool is being destroyed. */
+
+  /**
+   * @brief The main loop executed by every worker thread.
+   */
+  void workerLoop();
+ };
+} // namespace utils::concurrency
+
+#endif // THREADPOOL_H
@@ -0,0 +1,95 @@
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <thread>
+
+namespace utils::concurrency {
+    WorkStealingPool::WorkStealingPool(const size_t threadCount)
+        : threadCount(threadCount == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threadCount) {
+    }
+
+    void WorkStealingPool::run(const size_t taskCount, const std::function<void(size_t)> &task) {
+        const size_t workerCount = std::min(threadCount, taskCount);
+        if (workerCount == 0) {
+            return;
+        }
+
+        queues.clear();
+        for (size_t worker = 0; worker < workerCount; ++worker) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (size_t index = 0; index < taskCount; ++index) {
+            queues[index % workerCount]->tasks.push_back(index);
+        }
+
+        std::mutex failureMutex;
+        std::exception_ptr failure;
+        const auto work = [&](const size_t worker) {
+            for (size_t index; next(worker, index);) {
+                try {
+                    task(index);
+                } catch (...) {
+                    std::lock_guard lock(failureMutex);
+                    if (!failure) {
+                        failure = std::current_exception();
+                    }
+                }
+            }
+        };
+
+        // The calling thread works as the first worker instead of idling until the others finish.
+        std::vector<std::thread> workers;
+        workers.reserve(workerCount - 1);
+        for (size_t worker = 1; worker < workerCount; ++worker) {
+            workers.emplace_back(work, worker);
+        }
+        work(0);
+        for (std::thread &worker: workers) {
+            worker.join();
+        }
+        queues.clear();
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    size_t WorkStealingPool::size() const {
+        return threadCount;
+    }
+
+    bool WorkStealingPool::next(const size_t worker, size_t &task) {
+        {
+            WorkerQueue &own = *queues[worker];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        // Tasks are never added during a run, so a victim found empty stays empty and one sweep suffices.
+        // The thief takes the most urgent task left rather than the least, since the tail is what it shortens.
+        for (;;) {
+            WorkerQueue *victim = nullptr;
+            size_t lowest = std::numeric_limits<size_t>::max();
+            for (const std::unique_ptr<WorkerQueue> &queue: queues) {
+                std::lock_guard lock(queue->mutex);
+                if (!queue->tasks.empty() && queue->tasks.front() < lowest) {
+                    lowest = queue->tasks.front();
+                    victim = queue.get();
+                }
+            }
+            if (victim == nullptr) {
+                return false;
+            }
+            std::lock_guard lock(victim->mutex);
+            if (!victim->tasks.empty()) {
+                task = victim->tasks.front();
+                victim->tasks.pop_front();
+                return true;
+            }
+        }
+    }
+} // namespace utils::concurrency
@@ -0,0 +1,80 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace utils::concurrency {
+ /**
+  * @class WorkStealingPool
+  * @brief Runs a batch of independent, coarse tasks on worker threads that steal from each other when idle.
+  *
+  * Tasks are identified by their index and dealt round-robin onto one deque per worker, so index order is
+  * priority order: each worker starts with the lowest index it was dealt, and a worker whose deque runs dry
+  * steals the lowest index left on any other deque. Callers that sort their tasks longest first therefore
+  * get longest-processing-time-first scheduling, which keeps the tail of a batch short, while workers only
+  * contend on a lock when they steal.
+  *
+  * Unlike ThreadPool, which serves short-lived segment tasks for the whole life of an engine, the workers
+  * exist for the duration of one run(), so tasks may themselves wait on a ThreadPool without deadlocking.
+  */
+ class WorkStealingPool {
+ public:
+  /**
+   * @brief Constructs a new WorkStealingPool object.
+   *
+   * @param threadCount The number of worker threads. Zero selects std::thread::hardware_concurrency().
+   */
+  explicit WorkStealingPool(size_t threadCount = 0);
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  /**
+   * @brief Runs a task for every index and waits for all of them.
+   *
+   * A task that throws does not stop the others; the first exception is rethrown once every task finished.
+   * Calls to run() on the same pool must not overlap.
+   *
+   * @param taskCount The number of tasks.
+   * @param task The task to run for each index, on any worker thread.
+   */
+  void run(size_t taskCount, const std::function<void(size_t)> &task);
+
+  /**
+   * @brief Gets the number of worker threads.
+   *
+   * @return The number of worker threads a large enough batch runs on.
+   */
+  [[nodiscard]] size_t size() const;
+
+ private:
+  /**
+   * @struct WorkerQueue
+   * @brief The tasks dealt to one worker, in priority order.
+   */
+  struct WorkerQueue {
+   std::mutex mutex; /**< Guards the tasks; taken by the owner and by thieves. */
+   std::deque<size_t> tasks; /**< Indices of the pending tasks, lowest first. */
+  };
+
+  size_t threadCount; /**< The number of worker threads. */
+  std::vector<std::unique_ptr<WorkerQueue> > queues; /**< One queue per worker thread of the current run. */
+
+  /**
+   * @brief Takes the next task of a worker, from its own queue or stolen from another.
+   *
+   * @param worker The index of the worker.
+   * @param task Set to the index of the task taken.
+   * @return False once every queue is empty.
+   */
+  bool next(size_t worker, size_t &task);
+ };
+} // namespace utils::concurrency
+
+#endif // WORKSTEALINGPOOL_H
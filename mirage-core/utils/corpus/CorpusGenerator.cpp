@@ -0,0 +1,267 @@
+#include "CorpusGenerator.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <future>
+#include <sodium.h>
+#include <stdexcept>
+#include <string_view>
+#include <unistd.h>
+
+namespace utils::corpus {
+    namespace {
+        constexpr size_t PAGE_SIZE = 4096;
+
+        constexpr std::string_view WORDS[64] = {
+            "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on",
+            "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they",
+            "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if", "more", "when",
+            "will", "would", "who", "so", "no", "request", "error", "value", "server", "file", "time", "data",
+            "user", "system", "version", "status", "update", "result", "process", "network"
+        };
+
+        /**
+         * @class Xoshiro256
+         * @brief The xoshiro256** generator, seeded through SplitMix64 from a seed and a stream index.
+         */
+        class Xoshiro256 {
+        public:
+            Xoshiro256(const uint64_t seed, const uint64_t stream) {
+                uint64_t x = seed ^ stream * 0x9e3779b97f4a7c15ull;
+                for (uint64_t &word: state) {
+                    x += 0x9e3779b97f4a7c15ull;
+                    uint64_t z = x;
+                    z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9ull;
+                    z = (z ^ z >> 27) * 0x94d049bb133111ebull;
+                    word = z ^ z >> 31;
+                }
+            }
+
+            uint64_t next() {
+                const uint64_t result = std::rotl(state[1] * 5, 7) * 9;
+                const uint64_t t = state[1] << 17;
+                state[2] ^= state[0];
+                state[3] ^= state[1];
+                state[1] ^= state[2];
+                state[0] ^= state[3];
+                state[2] ^= t;
+                state[3] = std::rotl(state[3], 45);
+                return result;
+            }
+
+            void fill(std::span<uint8_t> buffer) {
+                size_t offset = 0;
+                for (; offset + sizeof(uint64_t) <= buffer.size(); offset += sizeof(uint64_t)) {
+                    const uint64_t word = next();
+                    std::memcpy(buffer.data() + offset, &word, sizeof(word));
+                }
+                const uint64_t word = next();
+                std::memcpy(buffer.data() + offset, &word, buffer.size() - offset);
+            }
+
+        private:
+            uint64_t state[4]{};
+        };
+
+        void fillText(Xoshiro256 &rng, const std::span<uint8_t> buffer) {
+            size_t offset = 0;
+            size_t lineLength = 0;
+            while (offset < buffer.size()) {
+                const uint64_t r = rng.next();
+                // The smaller of two uniform indices favours the common words at the front of the vocabulary.
+                const std::string_view word = WORDS[std::min(r & 63, r >> 6 & 63)];
+                const size_t length = std::min(word.size(), buffer.size() - offset);
+                std::memcpy(buffer.data() + offset, word.data(), length);
+                offset += length;
+                lineLength += length + 1;
+                if (offset < buffer.size()) {
+                    const bool lineEnd = lineLength > 60 + (r >> 12 & 31);
+                    buffer[offset++] = lineEnd ? '\n' : ' ';
+                    lineLength = lineEnd ? 0 : lineLength;
+                }
+            }
+        }
+
+        void fillSparse(Xoshiro256 &rng, const std::span<uint8_t> buffer) {
+            for (size_t page = 0; page < buffer.size(); page += PAGE_SIZE) {
+                const std::span<uint8_t> bytes = buffer.subspan(page, std::min(PAGE_SIZE, buffer.size() - page));
+                const uint64_t r = rng.next();
+                if ((r & 7) == 0) {
+                    rng.fill(bytes);
+                    continue;
+                }
+                std::fill(bytes.begin(), bytes.end(), 0);
+                if ((r >> 3 & 3) == 0 && bytes.size() > 64) {
+                    const size_t recordOffset = (r >> 8) % (bytes.size() - 64);
+                    rng.fill(bytes.subspan(recordOffset, 16 + (r >> 32) % 48));
+                }
+            }
+        }
+
+        void writeAll(const int fd, const uint8_t *buffer, size_t length, uint64_t offset) {
+            while (length > 0) {
+                const ssize_t written = pwrite(fd, buffer, length, static_cast<off_t>(offset));
+                if (written == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    throw std::runtime_error("Failed to write corpus file");
+                }
+                buffer += written;
+                length -= written;
+                offset += written;
+            }
+        }
+
+        int createFile(const std::string &path) {
+            const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) {
+                throw std::runtime_error("Failed to create corpus file: " + path);
+            }
+            return fd;
+        }
+
+        // Waits for every task before rethrowing the first exception.
+        void waitAll(std::vector<std::future<void> > &results) {
+            std::exception_ptr failure;
+            for (std::future<void> &result: results) {
+                try {
+                    result.get();
+                } catch (...) {
+                    if (!failure) {
+                        failure = std::current_exception();
+                    }
+                }
+            }
+            if (failure) {
+                std::rethrow_exception(failure);
+            }
+        }
+    }
+
+    CorpusGenerator::CorpusGenerator(const CorpusOptions &options)
+        : profile(options.profile), seed(options.seed),
+          pool(std::make_unique<concurrency::ThreadPool>(options.threadCount)) {
+        while (seed == 0) {
+            randombytes_buf(&seed, sizeof(seed));
+        }
+    }
+
+    void CorpusGenerator::fill(const std::span<uint8_t> buffer, const uint64_t stream) const {
+        Xoshiro256 rng(seed, stream);
+        switch (profile) {
+            case CorpusProfile::Random:
+                rng.fill(buffer);
+                break;
+            case CorpusProfile::Text:
+                fillText(rng, buffer);
+                break;
+            case CorpusProfile::Sparse:
+                fillSparse(rng, buffer);
+                break;
+        }
+    }
+
+    void CorpusGenerator::writeFile(const std::string &path, const uint64_t size) const {
+        const int fd = createFile(path);
+        std::vector<std::future<void> > results;
+        for (uint64_t offset = 0; offset < size; offset += CORPUS_BLOCK_SIZE) {
+            results.push_back(pool->submit([this, fd, offset, size] {
+                thread_local std::vector<uint8_t> block(CORPUS_BLOCK_SIZE);
+                const std::span bytes(block.data(), std::min<uint64_t>(CORPUS_BLOCK_SIZE, size - offset));
+                fill(bytes, offset / CORPUS_BLOCK_SIZE);
+                writeAll(fd, bytes.data(), bytes.size(), offset);
+            }));
+        }
+
+        try {
+            waitAll(results);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        if (close(fd) != 0) {
+            throw std::runtime_error("Failed to close corpus file: " + path);
+        }
+    }
+
+    std::vector<std::string> CorpusGenerator::writeTree(const std::string &directory, const size_t fileCount,
+                                                        const uint64_t minSize, const uint64_t maxSize) const {
+        if (minSize == 0 || minSize > maxSize) {
+            throw std::invalid_argument("File sizes must satisfy 0 < minSize <= maxSize");
+        }
+
+        // Sizes come from a stream of their own, so they do not depend on the content profile.
+        Xoshiro256 sizes(seed, ~uint64_t{0});
+        std::vector<std::string> paths(fileCount);
+        std::vector<uint64_t> fileSizes(fileCount);
+        const double logMin = std::log(static_cast<double>(minSize));
+        const double logMax = std::log(static_cast<double>(maxSize));
+        for (size_t index = 0; index < fileCount; ++index) {
+            const double unit = static_cast<double>(sizes.next() >> 11) * 0x1.0p-53;
+            fileSizes[index] = std::clamp(static_cast<uint64_t>(std::exp(logMin + unit * (logMax - logMin))),
+                                          minSize, maxSize);
+
+            char name[64];
+            std::snprintf(name, sizeof(name), "d%04zu/f%06zu.bin", index / CORPUS_FILES_PER_DIRECTORY, index);
+            paths[index] = (std::filesystem::path(directory) / name).string();
+        }
+
+        std::vector<std::future<void> > results;
+        for (size_t first = 0; first < fileCount; first += CORPUS_FILES_PER_DIRECTORY) {
+            std::filesystem::create_directories(std::filesystem::path(paths[first]).parent_path());
+            results.push_back(pool->submit([this, &paths, &fileSizes, first, fileCount] {
+                thread_local std::vector<uint8_t> block(CORPUS_BLOCK_SIZE);
+                const size_t last = std::min<size_t>(first + CORPUS_FILES_PER_DIRECTORY, fileCount);
+                for (size_t index = first; index < last; ++index) {
+                    const int fd = createFile(paths[index]);
+                    try {
+                        for (uint64_t offset = 0; offset < fileSizes[index]; offset += CORPUS_BLOCK_SIZE) {
+                            const std::span bytes(block.data(),
+                                                  std::min<uint64_t>(CORPUS_BLOCK_SIZE, fileSizes[index] - offset));
+                            fill(bytes, static_cast<uint64_t>(index + 1) << 32 | offset / CORPUS_BLOCK_SIZE);
+                            writeAll(fd, bytes.data(), bytes.size(), offset);
+                        }
+                    } catch (...) {
+                        close(fd);
+                        throw;
+                    }
+                    close(fd);
+                }
+            }));
+        }
+        waitAll(results);
+        return paths;
+    }
+
+    uint64_t CorpusGenerator::getSeed() const {
+        return seed;
+    }
+
+    CorpusProfile CorpusGenerator::parseProfile(const std::string &name) {
+        for (const CorpusProfile profile: {CorpusProfile::Random, CorpusProfile::Text, CorpusProfile::Sparse}) {
+            if (name == profileName(profile)) {
+                return profile;
+            }
+        }
+        throw std::invalid_argument("Unknown corpus profile: " + name);
+    }
+
+    const char *CorpusGenerator::profileName(const CorpusProfile profile) {
+        switch (profile) {
+            case CorpusProfile::Random:
+                return "random";
+            case CorpusProfile::Text:
+                return "text";
+            case CorpusProfile::Sparse:
+                return "sparse";
+        }
+        return "unknown";
+    }
+} // namespace utils::corpus
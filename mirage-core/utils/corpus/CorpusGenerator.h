@@ -0,0 +1,106 @@
+#ifndef CORPUSGENERATOR_H
+#define CORPUSGENERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include "../concurrency/ThreadPool.h"
+
+#define CORPUS_BLOCK_SIZE (4 * 1024 * 1024)
+#define CORPUS_FILES_PER_DIRECTORY 64
+
+namespace utils::corpus {
+ /**
+  * @enum CorpusProfile
+  * @brief The kinds of content a CorpusGenerator produces.
+  */
+ enum class CorpusProfile {
+  Random, /**< Uniform bytes; incompressible. */
+  Text, /**< Lines of skewed English words; compresses like prose or logs. */
+  Sparse /**< Mostly zero pages with occasional random pages and short records, like disk images. */
+ };
+
+ /**
+  * @struct CorpusOptions
+  * @brief Configuration of a CorpusGenerator.
+  */
+ struct CorpusOptions {
+  CorpusProfile profile = CorpusProfile::Random; /**< The content profile. */
+  uint64_t seed = 0; /**< Seed of the content; zero draws one from the OS RNG. */
+  size_t threadCount = 0; /**< Generator threads; zero selects std::thread::hardware_concurrency(). */
+ };
+
+ /**
+  * @class CorpusGenerator
+  * @brief Writes synthetic benchmark inputs of any size without holding them in memory.
+  *
+  * Content is produced in blocks of CORPUS_BLOCK_SIZE bytes by a xoshiro256** generator seeded from the
+  * corpus seed and the block's stream, so blocks are generated on all worker threads and written with
+  * positional writes in any order, and the same seed always yields the same corpus.
+  */
+ class CorpusGenerator {
+ public:
+  /**
+   * @brief Constructs a new CorpusGenerator object.
+   *
+   * @param options The generator configuration.
+   */
+  explicit CorpusGenerator(const CorpusOptions &options = {});
+
+  /**
+   * @brief Fills a buffer with the content of one stream.
+   *
+   * @param buffer The buffer to fill.
+   * @param stream Selects an independent stream of the seed.
+   */
+  void fill(std::span<uint8_t> buffer, uint64_t stream) const;
+
+  /**
+   * @brief Writes a file of the given size.
+   *
+   * @param path The path of the file; an existing file is replaced.
+   * @param size The size of the file in bytes.
+   */
+  void writeFile(const std::string &path, uint64_t size) const;
+
+  /**
+   * @brief Writes a tree of many small files.
+   *
+   * File sizes are log-uniform between minSize and maxSize; files are spread over subdirectories of
+   * CORPUS_FILES_PER_DIRECTORY entries.
+   *
+   * @param directory The root of the tree; created if missing.
+   * @param fileCount The number of files.
+   * @param minSize The smallest file size in bytes.
+   * @param maxSize The largest file size in bytes.
+   * @return The paths of the files written.
+   */
+  std::vector<std::string> writeTree(const std::string &directory, size_t fileCount, uint64_t minSize,
+                                     uint64_t maxSize) const;
+
+  /**
+   * @brief Gets the seed of the corpus.
+   */
+  [[nodiscard]] uint64_t getSeed() const;
+
+  /**
+   * @brief Parses a profile name: "random", "text" or "sparse".
+   */
+  [[nodiscard]] static CorpusProfile parseProfile(const std::string &name);
+
+  /**
+   * @brief Gets the name of a profile.
+   */
+  [[nodiscard]] static const char *profileName(CorpusProfile profile);
+
+ private:
+  CorpusProfile profile; /**< The content profile. */
+  uint64_t seed; /**< The seed of the corpus. */
+  std::unique_ptr<concurrency::ThreadPool> pool; /**< Workers generating and writing blocks. */
+ };
+} // namespace utils::corpus
+
+#endif // CORPUSGENERATOR_H
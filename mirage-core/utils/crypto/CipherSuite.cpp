@@ -0,0 +1,245 @@
+#include "CipherSuite.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace utils::crypto {
+    namespace {
+        /**
+         * @class XChaCha20Poly1305Stream
+         * @brief A stream of libsodium's crypto_secretstream_xchacha20poly1305.
+         */
+        class XChaCha20Poly1305Stream final : public StreamCipher {
+        public:
+            XChaCha20Poly1305Stream() = default;
+
+            ~XChaCha20Poly1305Stream() override { sodium_memzero(&state, sizeof(state)); }
+
+            void initPush(const unsigned char *key, unsigned char *header) {
+                if (crypto_secretstream_xchacha20poly1305_init_push(&state, header, key) != 0) {
+                    throw std::runtime_error("Failed to initialize encryption stream");
+                }
+            }
+
+            void initPull(const unsigned char *key, const unsigned char *header) {
+                if (crypto_secretstream_xchacha20poly1305_init_pull(&state, header, key) != 0) {
+                    throw std::runtime_error("Failed to initialize decryption stream");
+                }
+            }
+
+            void push(unsigned char *ciphertext, const unsigned char *message, const size_t length,
+                      const unsigned char *ad, const size_t adLength, const unsigned char tag) override {
+                crypto_secretstream_xchacha20poly1305_push(&state, ciphertext, nullptr, message, length, ad, adLength,
+                                                           tag);
+            }
+
+            bool pull(unsigned char *message, unsigned char &tag, const unsigned char *ciphertext, const size_t length,
+                      const unsigned char *ad, const size_t adLength) override {
+                return crypto_secretstream_xchacha20poly1305_pull(&state, message, nullptr, &tag, ciphertext, length,
+                                                                  ad, adLength) == 0;
+            }
+
+            void rekey() override {
+                crypto_secretstream_xchacha20poly1305_rekey(&state);
+            }
+
+        private:
+            crypto_secretstream_xchacha20poly1305_state state{}; /**< The secretstream state. */
+        };
+
+        /**
+         * @class Aes256GcmStream
+         * @brief A stream of AES-256-GCM messages under a per-stream key, with counter nonces.
+         */
+        class Aes256GcmStream final : public StreamCipher {
+        public:
+            Aes256GcmStream(const unsigned char *key, const unsigned char *header) {
+                crypto_generichash(streamKey, sizeof(streamKey), header, STREAM_HEADER_SIZE, key, STREAM_KEY_SIZE);
+                expandKey();
+            }
+
+            ~Aes256GcmStream() override {
+                sodium_memzero(&state, sizeof(state));
+                sodium_memzero(streamKey, sizeof(streamKey));
+            }
+
+            void push(unsigned char *ciphertext, const unsigned char *message, const size_t length,
+                      const unsigned char *ad, const size_t adLength, const unsigned char tag) override {
+                unsigned char nonce[crypto_aead_aes256gcm_NPUBBYTES];
+                nextNonce(nonce, tag);
+                ciphertext[0] = tag;
+                crypto_aead_aes256gcm_encrypt_detached_afternm(ciphertext + 1, ciphertext + 1 + length, nullptr,
+                                                               message, length, ad, adLength, nullptr, nonce, &state);
+            }
+
+            bool pull(unsigned char *message, unsigned char &tag, const unsigned char *ciphertext, const size_t length,
+                      const unsigned char *ad, const size_t adLength) override {
+                if (length < STREAM_ABYTES) {
+                    return false;
+                }
+                // A tag changed in transit changes the nonce, so the message fails to authenticate.
+                tag = ciphertext[0];
+                unsigned char nonce[crypto_aead_aes256gcm_NPUBBYTES];
+                nextNonce(nonce, tag);
+                const size_t messageLength = length - STREAM_ABYTES;
+                return crypto_aead_aes256gcm_decrypt_detached_afternm(message, nullptr, ciphertext + 1, messageLength,
+                                                                      ciphertext + 1 + messageLength, ad, adLength,
+                                                                      nonce, &state) == 0;
+            }
+
+            void rekey() override {
+                unsigned char counterBytes[sizeof(uint64_t)];
+                for (size_t i = 0; i < sizeof(counterBytes); ++i) {
+                    counterBytes[i] = static_cast<unsigned char>(counter >> (8 * i));
+                }
+                unsigned char nextKey[crypto_aead_aes256gcm_KEYBYTES];
+                crypto_generichash(nextKey, sizeof(nextKey), counterBytes, sizeof(counterBytes), streamKey,
+                                   sizeof(streamKey));
+                std::memcpy(streamKey, nextKey, sizeof(streamKey));
+                sodium_memzero(nextKey, sizeof(nextKey));
+                counter = 0;
+                expandKey();
+            }
+
+        private:
+            crypto_aead_aes256gcm_state state{}; /**< The expanded AES key and GHASH tables. */
+            unsigned char streamKey[crypto_aead_aes256gcm_KEYBYTES]{}; /**< The current key of the stream. */
+            uint64_t counter = 0; /**< Messages sealed or opened under the current key. */
+
+            void expandKey() {
+                if (crypto_aead_aes256gcm_beforenm(&state, streamKey) != 0) {
+                    throw std::runtime_error("Failed to initialize AES-256-GCM stream");
+                }
+            }
+
+            // Nonce layout: message counter (8, little-endian), tag (1), zero (3).
+            void nextNonce(unsigned char *nonce, const unsigned char tag) {
+                std::memset(nonce, 0, crypto_aead_aes256gcm_NPUBBYTES);
+                for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+                    nonce[i] = static_cast<unsigned char>(counter >> (8 * i));
+                }
+                nonce[sizeof(uint64_t)] = tag;
+                ++counter;
+            }
+        };
+
+        static_assert(1 + crypto_aead_aes256gcm_ABYTES == STREAM_ABYTES,
+                      "AES-256-GCM messages must grow like secretstream messages");
+        static_assert(crypto_aead_aes256gcm_KEYBYTES == STREAM_KEY_SIZE, "Suites must share the key size");
+
+        void requireAvailable(const uint8_t suite) {
+            if (!CipherSuite::isKnown(suite)) {
+                throw std::runtime_error("Unsupported cipher suite");
+            }
+            if (!CipherSuite::isAvailable(suite)) {
+                throw std::runtime_error(std::string(CipherSuite::name(suite)) + " is not supported by this CPU");
+            }
+        }
+
+        // Seals the calibration sample once and returns the time it took.
+        std::chrono::steady_clock::duration timeSuite(const uint8_t suite, const std::vector<unsigned char> &sample,
+                                                      std::vector<unsigned char> &sealed) {
+            unsigned char key[STREAM_KEY_SIZE];
+            unsigned char header[STREAM_HEADER_SIZE];
+            randombytes_buf(key, sizeof(key));
+            const auto start = std::chrono::steady_clock::now();
+            const std::unique_ptr<StreamCipher> stream = CipherSuite::createPush(suite, key, header);
+            for (size_t offset = 0; offset < sample.size(); offset += CIPHER_CALIBRATION_MESSAGE_SIZE) {
+                stream->push(sealed.data(), sample.data() + offset, CIPHER_CALIBRATION_MESSAGE_SIZE, nullptr, 0,
+                             STREAM_TAG_MESSAGE);
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            sodium_memzero(key, sizeof(key));
+            return elapsed;
+        }
+    }
+
+    bool CipherSuite::isKnown(const uint8_t suite) {
+        return suite == CIPHER_SUITE_XCHACHA20_POLY1305 || suite == CIPHER_SUITE_AES256_GCM;
+    }
+
+    bool CipherSuite::isAvailable(const uint8_t suite) {
+        switch (suite) {
+            case CIPHER_SUITE_XCHACHA20_POLY1305:
+                return true;
+            case CIPHER_SUITE_AES256_GCM:
+                return sodium_init() >= 0 && crypto_aead_aes256gcm_is_available() == 1;
+            default:
+                return false;
+        }
+    }
+
+    const char *CipherSuite::name(const uint8_t suite) {
+        switch (suite) {
+            case CIPHER_SUITE_XCHACHA20_POLY1305:
+                return "xchacha20";
+            case CIPHER_SUITE_AES256_GCM:
+                return "aes256gcm";
+            case CIPHER_SUITE_AUTO:
+                return "auto";
+            default:
+                return "unknown";
+        }
+    }
+
+    uint8_t CipherSuite::fromName(const char *name) {
+        for (const uint8_t suite: {CIPHER_SUITE_XCHACHA20_POLY1305, CIPHER_SUITE_AES256_GCM, CIPHER_SUITE_AUTO}) {
+            if (std::strcmp(name, CipherSuite::name(suite)) == 0) {
+                return suite;
+            }
+        }
+        throw std::invalid_argument(std::string("Unknown cipher suite: ") + name);
+    }
+
+    uint8_t CipherSuite::fastest() {
+        static const uint8_t suite = [] {
+            if (!isAvailable(CIPHER_SUITE_AES256_GCM)) {
+                return static_cast<uint8_t>(CIPHER_SUITE_XCHACHA20_POLY1305);
+            }
+            std::vector<unsigned char> sample(CIPHER_CALIBRATION_SIZE);
+            std::vector<unsigned char> sealed(CIPHER_CALIBRATION_MESSAGE_SIZE + STREAM_ABYTES);
+            randombytes_buf(sample.data(), sample.size());
+
+            // The best of two rounds each, so a preemption during one round does not decide.
+            uint8_t best = CIPHER_SUITE_XCHACHA20_POLY1305;
+            auto bestTime = std::chrono::steady_clock::duration::max();
+            for (int round = 0; round < 2; ++round) {
+                for (const uint8_t candidate: {CIPHER_SUITE_XCHACHA20_POLY1305, CIPHER_SUITE_AES256_GCM}) {
+                    const auto elapsed = timeSuite(candidate, sample, sealed);
+                    if (elapsed < bestTime) {
+                        bestTime = elapsed;
+                        best = candidate;
+                    }
+                }
+            }
+            return best;
+        }();
+        return suite;
+    }
+
+    std::unique_ptr<StreamCipher> CipherSuite::createPush(const uint8_t suite, const unsigned char *key,
+                                                          unsigned char *header) {
+        requireAvailable(suite);
+        if (suite == CIPHER_SUITE_AES256_GCM) {
+            randombytes_buf(header, STREAM_HEADER_SIZE);
+            return std::make_unique<Aes256GcmStream>(key, header);
+        }
+        auto stream = std::make_unique<XChaCha20Poly1305Stream>();
+        stream->initPush(key, header);
+        return stream;
+    }
+
+    std::unique_ptr<StreamCipher> CipherSuite::createPull(const uint8_t suite, const unsigned char *key,
+                                                          const unsigned char *header) {
+        requireAvailable(suite);
+        if (suite == CIPHER_SUITE_AES256_GCM) {
+            return std::make_unique<Aes256GcmStream>(key, header);
+        }
+        auto stream = std::make_unique<XChaCha20Poly1305Stream>();
+        stream->initPull(key, header);
+        return stream;
+    }
+} // namespace utils::crypto
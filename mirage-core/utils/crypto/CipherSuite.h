@@ -0,0 +1,158 @@
+#ifndef CIPHERSUITE_H
+#define CIPHERSUITE_H
+
+#include <sodium.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#define CIPHER_SUITE_XCHACHA20_POLY1305 0
+#define CIPHER_SUITE_AES256_GCM 1
+#define CIPHER_SUITE_AUTO 0xff
+#define STREAM_KEY_SIZE crypto_secretstream_xchacha20poly1305_KEYBYTES
+#define STREAM_HEADER_SIZE crypto_secretstream_xchacha20poly1305_HEADERBYTES
+#define STREAM_ABYTES crypto_secretstream_xchacha20poly1305_ABYTES
+#define STREAM_TAG_MESSAGE crypto_secretstream_xchacha20poly1305_TAG_MESSAGE
+#define STREAM_TAG_FINAL crypto_secretstream_xchacha20poly1305_TAG_FINAL
+#define CIPHER_CALIBRATION_SIZE (1024 * 1024)
+#define CIPHER_CALIBRATION_MESSAGE_SIZE (64 * 1024)
+
+namespace utils::crypto {
+ /**
+  * @class StreamCipher
+  * @brief This class provides an interface for the authenticated stream of one segment.
+  *
+  * A stream seals a sequence of messages under one key, so that messages can be neither modified, dropped nor
+  * reordered, and tags every message with STREAM_TAG_MESSAGE or STREAM_TAG_FINAL. Every cipher suite writes
+  * a STREAM_HEADER_SIZE-byte header and adds STREAM_ABYTES bytes to every message, so the container layout
+  * does not depend on the suite.
+  */
+ class StreamCipher {
+ public:
+  /**
+   * @brief Virtual destructor for the interface.
+   *
+   * Implementations erase their key material.
+   */
+  virtual ~StreamCipher() = default;
+
+  /**
+   * @brief Seals the next message of the stream.
+   *
+   * @param ciphertext Output buffer of length + STREAM_ABYTES bytes.
+   * @param message The message.
+   * @param length The length of the message.
+   * @param ad Additional data authenticated with the message.
+   * @param adLength The length of the additional data.
+   * @param tag STREAM_TAG_MESSAGE, or STREAM_TAG_FINAL for the last message.
+   */
+  virtual void push(unsigned char *ciphertext, const unsigned char *message, size_t length, const unsigned char *ad,
+                    size_t adLength, unsigned char tag) = 0;
+
+  /**
+   * @brief Opens the next message of the stream.
+   *
+   * @param message Output buffer of length - STREAM_ABYTES bytes.
+   * @param tag Set to the tag the message was sealed with.
+   * @param ciphertext The sealed message.
+   * @param length The length of the sealed message, at least STREAM_ABYTES.
+   * @param ad Additional data authenticated with the message.
+   * @param adLength The length of the additional data.
+   * @return False if the message does not authenticate.
+   */
+  [[nodiscard]] virtual bool pull(unsigned char *message, unsigned char &tag, const unsigned char *ciphertext,
+                                  size_t length, const unsigned char *ad, size_t adLength) = 0;
+
+  /**
+   * @brief Replaces the key of the stream with one derived from it, so earlier messages cannot be recovered
+   * from the current state.
+   */
+  virtual void rekey() = 0;
+ };
+
+ /**
+  * @class CipherSuite
+  * @brief This class enumerates the stream ciphers containers can be encrypted with.
+  *
+  * CIPHER_SUITE_XCHACHA20_POLY1305 is libsodium's secretstream and runs everywhere. CIPHER_SUITE_AES256_GCM
+  * seals every message with libsodium's AES-256-GCM, which needs AES-NI and PCLMUL or the ARM crypto
+  * extensions, and is much faster per byte where they are present. Its header is random; the stream key is a
+  * keyed BLAKE2b hash of it, and every message uses the next nonce of a counter, with the tag in the nonce.
+  * The tag is also stored in front of the ciphertext, so a message costs one byte and the GCM tag, as in
+  * secretstream. Rekeying hashes the key with the counter and restarts the counter.
+  */
+ class CipherSuite {
+ public:
+  /**
+   * @brief Tells whether a suite identifier is known to this build.
+   *
+   * @param suite A CIPHER_SUITE_* identifier.
+   * @return True for every identifier but CIPHER_SUITE_AUTO and unknown ones.
+   */
+  [[nodiscard]] static bool isKnown(uint8_t suite);
+
+  /**
+   * @brief Tells whether a suite runs on this CPU.
+   *
+   * @param suite A CIPHER_SUITE_* identifier.
+   * @return True if streams of the suite can be created.
+   */
+  [[nodiscard]] static bool isAvailable(uint8_t suite);
+
+  /**
+   * @brief Gets the name of a suite.
+   *
+   * @param suite A CIPHER_SUITE_* identifier.
+   * @return The name, such as "aes256gcm", or "unknown".
+   */
+  [[nodiscard]] static const char *name(uint8_t suite);
+
+  /**
+   * @brief Finds a suite by name.
+   *
+   * Throws std::invalid_argument if no suite has the name.
+   *
+   * @param name "xchacha20", "aes256gcm" or "auto".
+   * @return The CIPHER_SUITE_* identifier.
+   */
+  [[nodiscard]] static uint8_t fromName(const char *name);
+
+  /**
+   * @brief Gets the fastest suite available on this CPU.
+   *
+   * The first call seals CIPHER_CALIBRATION_SIZE bytes in messages of CIPHER_CALIBRATION_MESSAGE_SIZE bytes with
+   * every available suite and keeps the fastest; later calls return the result of the first.
+   *
+   * @return The CIPHER_SUITE_* identifier.
+   */
+  [[nodiscard]] static uint8_t fastest();
+
+  /**
+   * @brief Starts a stream for encryption.
+   *
+   * Throws std::runtime_error if the suite is not available.
+   *
+   * @param suite A CIPHER_SUITE_* identifier.
+   * @param key The STREAM_KEY_SIZE-byte key.
+   * @param header Output buffer of STREAM_HEADER_SIZE bytes, filled with the header to store.
+   * @return The stream.
+   */
+  [[nodiscard]] static std::unique_ptr<StreamCipher> createPush(uint8_t suite, const unsigned char *key,
+                                                                unsigned char *header);
+
+  /**
+   * @brief Starts a stream for decryption.
+   *
+   * Throws std::runtime_error if the suite is not available.
+   *
+   * @param suite A CIPHER_SUITE_* identifier.
+   * @param key The STREAM_KEY_SIZE-byte key.
+   * @param header The STREAM_HEADER_SIZE-byte header read in front of the stream.
+   * @return The stream.
+   */
+  [[nodiscard]] static std::unique_ptr<StreamCipher> createPull(uint8_t suite, const unsigned char *key,
+                                                                const unsigned char *header);
+ };
+} // namespace utils::crypto
+
+#endif // CIPHERSUITE_H
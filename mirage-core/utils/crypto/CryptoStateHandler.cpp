@@ -1,39 +1,43 @@
 #include "CryptoStateHandler.h"
 #include <sodium/utils.h>
+#include <cstring>
+#include <stdexcept>
 
 namespace utils::crypto {
-    CryptoStateHandler::CryptoStateHandler(const unsigned char *key, std::ofstream &outputFile) {
-        if (crypto_secretstream_xchacha20poly1305_init_push(&state, header, key) != 0) {
-            throw std::runtime_error("Failed to initialize encryption stream");
-        }
-        outputFile.write(reinterpret_cast<char *>(header), sizeof(header));
+    CryptoStateHandler::CryptoStateHandler(const uint8_t suite, const unsigned char *key)
+        : stream(CipherSuite::createPush(suite, key, header)) {
     }
 
-    CryptoStateHandler::CryptoStateHandler(const unsigned char *key, std::ifstream &inputFile) {
-        inputFile.read(reinterpret_cast<char *>(header), sizeof(header));
-        if (crypto_secretstream_xchacha20poly1305_init_pull(&state, header, key) != 0) {
-            throw std::runtime_error("Failed to initialize decryption stream");
-        }
+    CryptoStateHandler::CryptoStateHandler(const uint8_t suite, const unsigned char *key,
+                                           const unsigned char *streamHeader) {
+        std::memcpy(header, streamHeader, sizeof(header));
+        stream = CipherSuite::createPull(suite, key, header);
     }
 
     CryptoStateHandler::~CryptoStateHandler() {
-        sodium_memzero(&state, sizeof(state));
+        stream.reset();
         sodium_memzero(header, sizeof(header));
     }
 
-    crypto_secretstream_xchacha20poly1305_state &CryptoStateHandler::getState() {
-        return state;
+    size_t CryptoStateHandler::push(unsigned char *ciphertext, const unsigned char *message, const size_t length,
+                                    const unsigned char *ad, const size_t adLength, const unsigned char tag) {
+        stream->push(ciphertext, message, length, ad, adLength, tag);
+        return length + STREAM_ABYTES;
     }
 
-    unsigned char *CryptoStateHandler::getHeader() {
-        return header;
+    size_t CryptoStateHandler::pull(unsigned char *message, unsigned char &tag, const unsigned char *ciphertext,
+                                    const size_t length, const unsigned char *ad, const size_t adLength) {
+        if (length < STREAM_ABYTES || !stream->pull(message, tag, ciphertext, length, ad, adLength)) {
+            throw std::runtime_error("Decryption failed");
+        }
+        return length - STREAM_ABYTES;
     }
 
-    void CryptoStateHandler::setState(const crypto_secretstream_xchacha20poly1305_state &newState) {
-        std::memcpy(&state, &newState, sizeof(state));
+    void CryptoStateHandler::rekey() {
+        stream->rekey();
     }
 
-    void CryptoStateHandler::setHeader(const unsigned char *newHeader) {
-        std::memcpy(header, newHeader, sizeof(header));
+    unsigned char *CryptoStateHandler::getHeader() {
+        return header;
     }
 } // namespace utils::crypto
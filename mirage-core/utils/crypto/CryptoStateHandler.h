@@ -2,7 +2,10 @@
 #define CRYPTOSTATEHANDLER_H
 
 #include <sodium.h>
-#include <fstream>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "CipherSuite.h"
 
 namespace utils::crypto {
  /**
@@ -11,29 +14,32 @@ namespace utils::crypto {
   *
   * The CryptoStateHandler class encapsulates the initialization and handling of the cryptographic state
   * used for encryption and decryption operations. It ensures the state is correctly initialized and
-  * provides a clean interface for managing the state.
+  * provides a clean interface for managing the state. The state belongs to the StreamCipher of the
+  * container's cipher suite, so the engine's loops are the same for every suite.
   */
  class CryptoStateHandler {
  public:
   /**
    * @brief Constructs a new CryptoStateHandler for encryption.
    *
-   * Initializes the cryptographic state for encryption and writes the header to the output file.
+   * Initializes the cryptographic state for encryption. The generated header is available through getHeader()
+   * and must be stored in front of the ciphertext.
    *
+   * @param suite The CIPHER_SUITE_* identifier of the stream cipher.
    * @param key The encryption key.
-   * @param outputFile The output file stream to write the header to.
    */
-  CryptoStateHandler(const unsigned char *key, std::ofstream &outputFile);
+  CryptoStateHandler(uint8_t suite, const unsigned char *key);
 
   /**
    * @brief Constructs a new CryptoStateHandler for decryption.
    *
-   * Initializes the cryptographic state for decryption by reading the header from the input file.
+   * Initializes the cryptographic state for decryption from a header that has already been read.
    *
+   * @param suite The CIPHER_SUITE_* identifier of the stream cipher.
    * @param key The encryption key.
-   * @param inputFile The input file stream to read the header from.
+   * @param header The STREAM_HEADER_SIZE-byte stream header.
    */
-  CryptoStateHandler(const unsigned char *key, std::ifstream &inputFile);
+  CryptoStateHandler(uint8_t suite, const unsigned char *key, const unsigned char *header);
 
   /**
    * @brief Destroys the CryptoStateHandler object.
@@ -43,37 +49,50 @@ namespace utils::crypto {
   ~CryptoStateHandler();
 
   /**
-   * @brief Gets the cryptographic state.
+   * @brief Seals the next message of the stream.
    *
-   * @return The current cryptographic state.
+   * @param ciphertext Output buffer of length + STREAM_ABYTES bytes.
+   * @param message The message.
+   * @param length The length of the message.
+   * @param ad Additional data authenticated with the message.
+   * @param adLength The length of the additional data.
+   * @param tag STREAM_TAG_MESSAGE, or STREAM_TAG_FINAL for the last message.
+   * @return The length of the sealed message.
    */
-  [[nodiscard]] crypto_secretstream_xchacha20poly1305_state &getState();
+  size_t push(unsigned char *ciphertext, const unsigned char *message, size_t length, const unsigned char *ad,
+              size_t adLength, unsigned char tag);
 
   /**
-   * @brief Gets the header.
+   * @brief Opens the next message of the stream.
    *
-   * @return The current header.
+   * Throws if the message does not authenticate.
+   *
+   * @param message Output buffer of length - STREAM_ABYTES bytes.
+   * @param tag Set to the tag the message was sealed with.
+   * @param ciphertext The sealed message.
+   * @param length The length of the sealed message.
+   * @param ad Additional data authenticated with the message.
+   * @param adLength The length of the additional data.
+   * @return The length of the message.
    */
-  [[nodiscard]] unsigned char *getHeader();
+  size_t pull(unsigned char *message, unsigned char &tag, const unsigned char *ciphertext, size_t length,
+              const unsigned char *ad, size_t adLength);
 
   /**
-   * @brief Sets the cryptographic state.
-   *
-   * @param newState The new cryptographic state.
+   * @brief Rekeys the stream.
    */
-  void setState(const crypto_secretstream_xchacha20poly1305_state &newState);
+  void rekey();
 
   /**
-   * @brief Sets the header.
+   * @brief Gets the header.
    *
-   * @param newHeader The new header.
+   * @return The current header.
    */
-  void setHeader(const unsigned char *newHeader);
+  [[nodiscard]] unsigned char *getHeader();
 
  private:
-  crypto_secretstream_xchacha20poly1305_state state{}; /**< The cryptographic state used for encryption/decryption. */
-  unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES]{};
-  /**< The header for the cryptographic stream. */
+  unsigned char header[STREAM_HEADER_SIZE]{}; /**< The header for the cryptographic stream; initialized first. */
+  std::unique_ptr<StreamCipher> stream; /**< The stream cipher of the suite, holding the cryptographic state. */
  };
 } // namespace utils::crypto
 
@@ -0,0 +1,46 @@
+#include "KeyDerivation.h"
+#include "XorTransform.h"
+#include "../math/LatticeNoise.h"
+#include <stdexcept>
+
+namespace utils::crypto {
+    void KeyDerivation::deriveFileKey(unsigned char *fileKey, const unsigned char *masterKey,
+                                      const unsigned char *fileId) {
+        if (crypto_generichash(fileKey, crypto_kdf_KEYBYTES, fileId, FILE_ID_SIZE, masterKey,
+                               crypto_secretstream_xchacha20poly1305_KEYBYTES) != 0) {
+            throw std::runtime_error("Failed to derive file key");
+        }
+    }
+
+    void KeyDerivation::deriveSegmentKey(unsigned char *segmentKey, const unsigned char *fileKey,
+                                         const uint64_t segmentIndex) {
+        if (crypto_kdf_derive_from_key(segmentKey, crypto_secretstream_xchacha20poly1305_KEYBYTES, segmentIndex,
+                                       "MIRSEGMT", fileKey) != 0) {
+            throw std::runtime_error("Failed to derive segment key");
+        }
+    }
+
+    void KeyDerivation::deriveCommitmentKey(unsigned char *commitmentKey, const unsigned char *fileKey) {
+        if (crypto_kdf_derive_from_key(commitmentKey, crypto_generichash_KEYBYTES, 0, "MIRCOMMT", fileKey) != 0) {
+            throw std::runtime_error("Failed to derive commitment key");
+        }
+    }
+
+    void KeyDerivation::deriveLatticeKey(unsigned char *latticeKey, const unsigned char *fileKey) {
+        if (crypto_kdf_derive_from_key(latticeKey, LATTICE_NOISE_KEY_SIZE, 0, "MIRLATTC", fileKey) != 0) {
+            throw std::runtime_error("Failed to derive lattice noise key");
+        }
+    }
+
+    void KeyDerivation::deriveDigestKey(unsigned char *digestKey, const unsigned char *fileKey) {
+        if (crypto_kdf_derive_from_key(digestKey, crypto_generichash_KEYBYTES, 0, "MIRDIGST", fileKey) != 0) {
+            throw std::runtime_error("Failed to derive digest key");
+        }
+    }
+
+    void KeyDerivation::deriveXorKey(unsigned char *xorKey, const unsigned char *masterKey) {
+        if (crypto_kdf_derive_from_key(xorKey, XOR_KEY_SIZE, 0, "MIRXORKY", masterKey) != 0) {
+            throw std::runtime_error("Failed to derive XOR key");
+        }
+    }
+} // namespace utils::crypto
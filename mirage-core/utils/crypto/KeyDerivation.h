@@ -0,0 +1,108 @@
+#ifndef KEYDERIVATION_H
+#define KEYDERIVATION_H
+
+#include <sodium.h>
+#include <cstdint>
+
+#define FILE_ID_SIZE 16
+
+namespace utils::crypto {
+ /**
+  * @class KeyDerivation
+  * @brief This class derives the per-file and per-segment keys from the engine master key.
+  *
+  * Every encrypted file carries a random file identifier. The master key and the identifier are
+  * combined into a file key, from which independent segment keys and a commitment key are derived
+  * with crypto_kdf. Binding the segment index into its key means a segment moved to another position
+  * or spliced in from another file fails authentication.
+  */
+ class KeyDerivation {
+ public:
+  /**
+   * @brief Derives the file key for a given file identifier.
+   *
+   * @param fileKey Output buffer of crypto_kdf_KEYBYTES bytes.
+   * @param masterKey The engine master key.
+   * @param fileId The FILE_ID_SIZE-byte file identifier stored in the file header.
+   */
+  static void deriveFileKey(unsigned char *fileKey, const unsigned char *masterKey, const unsigned char *fileId);
+
+  /**
+   * @brief Derives the secretstream key of a segment.
+   *
+   * @param segmentKey Output buffer of crypto_secretstream_xchacha20poly1305_KEYBYTES bytes.
+   * @param fileKey The file key.
+   * @param segmentIndex The zero-based position of the segment in the file.
+   */
+  static void deriveSegmentKey(unsigned char *segmentKey, const unsigned char *fileKey, uint64_t segmentIndex);
+
+  /**
+   * @brief Derives the key used to authenticate the file trailer.
+   *
+   * @param commitmentKey Output buffer of crypto_generichash_KEYBYTES bytes.
+   * @param fileKey The file key.
+   */
+  static void deriveCommitmentKey(unsigned char *commitmentKey, const unsigned char *fileKey);
+
+  /**
+   * @brief Derives the key of the lattice noise stage.
+   *
+   * @param latticeKey Output buffer of LATTICE_NOISE_KEY_SIZE bytes.
+   * @param fileKey The file key.
+   */
+  static void deriveLatticeKey(unsigned char *latticeKey, const unsigned char *fileKey);
+
+  /**
+   * @brief Derives the key of the segment digests that incremental updates compare plaintext with.
+   *
+   * @param digestKey Output buffer of crypto_generichash_KEYBYTES bytes.
+   * @param fileKey The file key.
+   */
+  static void deriveDigestKey(unsigned char *digestKey, const unsigned char *fileKey);
+
+  /**
+   * @brief Derives the engine's XOR key.
+   *
+   * @param xorKey Output buffer of XOR_KEY_SIZE bytes.
+   * @param masterKey The engine master key.
+   */
+  static void deriveXorKey(unsigned char *xorKey, const unsigned char *masterKey);
+ };
+
+ /**
+  * @class DerivedKey
+  * @brief A fixed-size key buffer that is securely erased when it goes out of scope.
+  */
+ class DerivedKey {
+ public:
+  DerivedKey() = default;
+
+  DerivedKey(const DerivedKey &) = delete;
+
+  DerivedKey &operator=(const DerivedKey &) = delete;
+
+  /**
+   * @brief Destroys the DerivedKey object, erasing the key material.
+   */
+  ~DerivedKey() { sodium_memzero(bytes, sizeof(bytes)); }
+
+  /**
+   * @brief Gets the key bytes.
+   *
+   * @return A pointer to the crypto_kdf_KEYBYTES key bytes.
+   */
+  [[nodiscard]] unsigned char *data() { return bytes; }
+
+  /**
+   * @brief Gets the key bytes.
+   *
+   * @return A pointer to the crypto_kdf_KEYBYTES key bytes.
+   */
+  [[nodiscard]] const unsigned char *data() const { return bytes; }
+
+ private:
+  unsigned char bytes[crypto_kdf_KEYBYTES]{}; /**< The key material. */
+ };
+} // namespace utils::crypto
+
+#endif // KEYDERIVATION_H
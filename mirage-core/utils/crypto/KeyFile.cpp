@@ -0,0 +1,223 @@
+#include "KeyFile.h"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace utils::crypto {
+    namespace {
+        void storeLittleEndian(unsigned char *out, const uint64_t value, const size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                out[i] = static_cast<unsigned char>(value >> (8 * i));
+            }
+        }
+
+        uint64_t loadLittleEndian(const unsigned char *in, const size_t size) {
+            uint64_t value = 0;
+            for (size_t i = 0; i < size; ++i) {
+                value |= static_cast<uint64_t>(in[i]) << (8 * i);
+            }
+            return value;
+        }
+
+        /**
+         * @brief Allocates guarded memory, initializing libsodium first since keys may be loaded before any engine
+         * exists.
+         */
+        unsigned char *allocateSecure(const size_t size) {
+            if (sodium_init() < 0) {
+                throw std::runtime_error("libsodium initialization failed");
+            }
+            auto *bytes = static_cast<unsigned char *>(sodium_malloc(size));
+            if (!bytes) {
+                throw std::bad_alloc();
+            }
+            return bytes;
+        }
+
+        /**
+         * @class SealingKey
+         * @brief The key stretched from a passphrase, in locked memory that is erased on destruction.
+         */
+        class SealingKey {
+        public:
+            SealingKey() : bytes(allocateSecure(crypto_aead_xchacha20poly1305_ietf_KEYBYTES)) {
+            }
+
+            ~SealingKey() { sodium_free(bytes); }
+
+            SealingKey(const SealingKey &) = delete;
+
+            SealingKey &operator=(const SealingKey &) = delete;
+
+            [[nodiscard]] unsigned char *data() const { return bytes; }
+
+        private:
+            unsigned char *bytes;
+        };
+    }
+
+    LockedKey::LockedKey() : bytes(allocateSecure(KEY_FILE_KEY_SIZE)) {
+        sodium_memzero(bytes, KEY_FILE_KEY_SIZE);
+    }
+
+    LockedKey::~LockedKey() {
+        // sodium_free() erases the allocation; it only needs to be writable again.
+        if (bytes != nullptr) {
+            sodium_mprotect_readwrite(bytes);
+            sodium_free(bytes);
+        }
+    }
+
+    LockedKey::LockedKey(LockedKey &&other) noexcept : bytes(other.bytes) {
+        other.bytes = nullptr;
+    }
+
+    LockedKey &LockedKey::operator=(LockedKey &&other) noexcept {
+        if (this != &other) {
+            if (bytes != nullptr) {
+                sodium_mprotect_readwrite(bytes);
+                sodium_free(bytes);
+            }
+            bytes = other.bytes;
+            other.bytes = nullptr;
+        }
+        return *this;
+    }
+
+    LockedKey KeyFile::load(const std::string &path, const std::string_view passphrase) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Failed to open key file: " + path);
+        }
+        std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        LockedKey key;
+
+        if (contents.size() == KEY_FILE_KEY_SIZE) {
+            if (!passphrase.empty()) {
+                sodium_memzero(contents.data(), contents.size());
+                throw std::invalid_argument("Key file is not sealed with a passphrase: " + path);
+            }
+            std::memcpy(key.bytes, contents.data(), KEY_FILE_KEY_SIZE);
+            sodium_memzero(contents.data(), contents.size());
+            sodium_mprotect_readonly(key.bytes);
+            return key;
+        }
+
+        if (contents.size() != SEALED_KEY_FILE_SIZE ||
+            std::memcmp(contents.data(), KEY_FILE_MAGIC, KEY_FILE_MAGIC_SIZE) != 0) {
+            throw std::runtime_error("Key file must hold exactly " + std::to_string(KEY_FILE_KEY_SIZE) +
+                                     " bytes or a sealed key: " + path);
+        }
+        if (contents[KEY_FILE_MAGIC_SIZE] != KEY_FILE_VERSION) {
+            throw std::runtime_error("Unsupported key file version: " + path);
+        }
+        if (passphrase.empty()) {
+            throw std::invalid_argument("Key file is sealed and needs a passphrase: " + path);
+        }
+
+        // The limits are authenticated only after the stretch, so they are bounded before it runs.
+        const unsigned char *header = contents.data();
+        KdfLimits limits;
+        limits.opslimit = loadLittleEndian(header + 12, 4);
+        limits.memlimit = loadLittleEndian(header + 16, 8);
+        if (limits.opslimit < crypto_pwhash_OPSLIMIT_MIN || limits.opslimit > crypto_pwhash_OPSLIMIT_SENSITIVE ||
+            limits.memlimit < crypto_pwhash_MEMLIMIT_MIN || limits.memlimit > KEY_FILE_MAX_MEMLIMIT) {
+            throw std::runtime_error("Key file is malformed: " + path);
+        }
+
+        const SealingKey sealingKey;
+        stretch(sealingKey.data(), passphrase, header + 24, limits);
+        const unsigned char *nonce = header + KEY_FILE_HEADER_SIZE;
+        const unsigned char *sealed = nonce + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt_detached(key.bytes, nullptr, sealed, KEY_FILE_KEY_SIZE,
+                                                                sealed + KEY_FILE_KEY_SIZE, header,
+                                                                KEY_FILE_HEADER_SIZE, nonce,
+                                                                sealingKey.data()) != 0) {
+            throw std::runtime_error("Wrong passphrase or corrupted key file: " + path);
+        }
+        sodium_mprotect_readonly(key.bytes);
+        return key;
+    }
+
+    bool KeyFile::isSealed(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        char magic[KEY_FILE_MAGIC_SIZE];
+        return file.read(magic, sizeof(magic)) && std::memcmp(magic, KEY_FILE_MAGIC, KEY_FILE_MAGIC_SIZE) == 0;
+    }
+
+    void KeyFile::writeRaw(const std::string &path, const unsigned char *key) {
+        writeExclusive(path, key, KEY_FILE_KEY_SIZE);
+    }
+
+    void KeyFile::writeSealed(const std::string &path, const unsigned char *key, const std::string_view passphrase,
+                              const KdfLimits &limits) {
+        if (passphrase.empty()) {
+            throw std::invalid_argument("The passphrase must not be empty");
+        }
+        if (limits.opslimit < crypto_pwhash_OPSLIMIT_MIN || limits.opslimit > crypto_pwhash_OPSLIMIT_SENSITIVE ||
+            limits.memlimit < crypto_pwhash_MEMLIMIT_MIN || limits.memlimit > KEY_FILE_MAX_MEMLIMIT) {
+            throw std::invalid_argument("Key derivation limits are out of range");
+        }
+
+        unsigned char contents[SEALED_KEY_FILE_SIZE]{};
+        std::memcpy(contents, KEY_FILE_MAGIC, KEY_FILE_MAGIC_SIZE);
+        contents[KEY_FILE_MAGIC_SIZE] = KEY_FILE_VERSION;
+        storeLittleEndian(contents + 12, limits.opslimit, 4);
+        storeLittleEndian(contents + 16, limits.memlimit, 8);
+        randombytes_buf(contents + 24, crypto_pwhash_SALTBYTES);
+        unsigned char *nonce = contents + KEY_FILE_HEADER_SIZE;
+        randombytes_buf(nonce, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
+
+        const SealingKey sealingKey;
+        stretch(sealingKey.data(), passphrase, contents + 24, limits);
+        unsigned char *sealed = nonce + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+        crypto_aead_xchacha20poly1305_ietf_encrypt_detached(sealed, sealed + KEY_FILE_KEY_SIZE, nullptr, key,
+                                                            KEY_FILE_KEY_SIZE, contents, KEY_FILE_HEADER_SIZE,
+                                                            nullptr, nonce, sealingKey.data());
+        writeExclusive(path, contents, sizeof(contents));
+    }
+
+    void KeyFile::stretch(unsigned char *sealingKey, const std::string_view passphrase, const unsigned char *salt,
+                          const KdfLimits &limits) {
+        if (crypto_pwhash(sealingKey, crypto_aead_xchacha20poly1305_ietf_KEYBYTES, passphrase.data(),
+                          passphrase.size(), salt, limits.opslimit, limits.memlimit,
+                          crypto_pwhash_ALG_ARGON2ID13) != 0) {
+            throw std::runtime_error("Failed to derive the key file's sealing key");
+        }
+    }
+
+    void KeyFile::writeExclusive(const std::string &path, const unsigned char *data, size_t length) {
+        // The file is created with its final permissions, so the key is never readable by others.
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (fd == -1) {
+            throw std::runtime_error(errno == EEXIST
+                                         ? "Refusing to overwrite " + path
+                                         : "Failed to create key file: " + path);
+        }
+        while (length > 0) {
+            const ssize_t written = write(fd, data, length);
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                close(fd);
+                unlink(path.c_str());
+                throw std::runtime_error("Failed to write key file: " + path);
+            }
+            data += written;
+            length -= written;
+        }
+        // The descriptor is closed whether or not the sync succeeded.
+        const bool synced = fsync(fd) == 0;
+        if (close(fd) == -1 || !synced) {
+            unlink(path.c_str());
+            throw std::runtime_error("Failed to write key file: " + path);
+        }
+    }
+} // namespace utils::crypto
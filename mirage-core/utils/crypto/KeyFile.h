@@ -0,0 +1,154 @@
+#ifndef KEYFILE_H
+#define KEYFILE_H
+
+#include <sodium.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#define KEY_FILE_MAGIC "MIRAGEKY"
+#define KEY_FILE_MAGIC_SIZE 8
+#define KEY_FILE_VERSION 1
+#define KEY_FILE_KEY_SIZE crypto_secretstream_xchacha20poly1305_KEYBYTES
+#define KEY_FILE_HEADER_SIZE 40
+#define SEALED_KEY_FILE_SIZE (KEY_FILE_HEADER_SIZE + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + \
+                              KEY_FILE_KEY_SIZE + crypto_aead_xchacha20poly1305_ietf_ABYTES)
+#define KEY_FILE_MAX_MEMLIMIT crypto_pwhash_MEMLIMIT_SENSITIVE
+
+namespace utils::crypto {
+ /**
+  * @class LockedKey
+  * @brief A master key held in guarded, locked memory for as long as it is in use.
+  *
+  * The key lives in a sodium_malloc() allocation, so it is never swapped out, is surrounded by guard pages
+  * and is read-only once loaded. Engines copy it on construction; keeping one LockedKey for a whole session
+  * means the key file is read, and a sealed one unlocked, only once however many files are processed.
+  */
+ class LockedKey {
+ public:
+  /**
+   * @brief Allocates a zeroed key.
+   */
+  LockedKey();
+
+  /**
+   * @brief Destroys the LockedKey object, erasing and releasing the key.
+   */
+  ~LockedKey();
+
+  LockedKey(LockedKey &&other) noexcept;
+
+  LockedKey &operator=(LockedKey &&other) noexcept;
+
+  LockedKey(const LockedKey &) = delete;
+
+  LockedKey &operator=(const LockedKey &) = delete;
+
+  /**
+   * @brief Gets the key bytes.
+   *
+   * @return A pointer to the KEY_FILE_KEY_SIZE key bytes.
+   */
+  [[nodiscard]] const unsigned char *data() const { return bytes; }
+
+ private:
+  friend class KeyFile;
+
+  unsigned char *bytes; /**< The key, in a sodium_malloc() allocation; nullptr once moved from. */
+ };
+
+ /**
+  * @struct KdfLimits
+  * @brief The Argon2id cost a passphrase is stretched with.
+  */
+ struct KdfLimits {
+  unsigned long long opslimit = crypto_pwhash_OPSLIMIT_MODERATE; /**< Number of passes over the memory. */
+  size_t memlimit = crypto_pwhash_MEMLIMIT_MODERATE; /**< Memory used, in bytes; at most KEY_FILE_MAX_MEMLIMIT. */
+ };
+
+ /**
+  * @class KeyFile
+  * @brief This class reads and writes the files master keys are stored in.
+  *
+  * A raw key file holds the KEY_FILE_KEY_SIZE key bytes and nothing else. A sealed key file holds the key
+  * encrypted with XChaCha20-Poly1305 under a key stretched from a passphrase with Argon2id, so it can be
+  * stored next to the data it protects. Layout (little-endian): magic "MIRAGEKY" (8), version (1),
+  * reserved (3), opslimit (4), memlimit (8), salt (crypto_pwhash_SALTBYTES), nonce, sealed key, MAC. The
+  * first KEY_FILE_HEADER_SIZE bytes are authenticated as associated data, so the cost cannot be lowered
+  * without the passphrase.
+  *
+  * Unlocking a sealed file costs the Argon2id computation, typically hundreds of milliseconds, while the
+  * per-file keys are then derived from the master key with one BLAKE2b call each. Work split over many
+  * processes should therefore unlock once per session, either with a long-running process or by exporting
+  * the key with writeRaw() to private, memory-backed storage that the jobs then load at no cost.
+  */
+ class KeyFile {
+ public:
+  /**
+   * @brief Loads a master key from a raw or sealed key file.
+   *
+   * Throws std::invalid_argument if a sealed file is given no passphrase or a raw file is given one, and
+   * std::runtime_error if the file is malformed or the passphrase is wrong.
+   *
+   * @param path The path to the key file.
+   * @param passphrase The passphrase of a sealed file; empty for a raw one.
+   * @return The key.
+   */
+  static LockedKey load(const std::string &path, std::string_view passphrase = {});
+
+  /**
+   * @brief Tells whether a key file is sealed with a passphrase.
+   *
+   * @param path The path to the key file.
+   * @return True if the file starts with the sealed key file magic.
+   */
+  static bool isSealed(const std::string &path);
+
+  /**
+   * @brief Writes a raw key file, readable by its owner only.
+   *
+   * Throws if the file exists already.
+   *
+   * @param path The path to the key file.
+   * @param key The KEY_FILE_KEY_SIZE-byte key.
+   */
+  static void writeRaw(const std::string &path, const unsigned char *key);
+
+  /**
+   * @brief Writes a key file sealed with a passphrase, readable by its owner only.
+   *
+   * Throws if the file exists already, the passphrase is empty or the limits are out of range.
+   *
+   * @param path The path to the key file.
+   * @param key The KEY_FILE_KEY_SIZE-byte key.
+   * @param passphrase The passphrase.
+   * @param limits The Argon2id cost.
+   */
+  static void writeSealed(const std::string &path, const unsigned char *key, std::string_view passphrase,
+                          const KdfLimits &limits = {});
+
+ private:
+  /**
+   * @brief Stretches a passphrase into the key that seals the master key.
+   *
+   * @param sealingKey Output buffer of crypto_aead_xchacha20poly1305_ietf_KEYBYTES bytes.
+   * @param passphrase The passphrase.
+   * @param salt The crypto_pwhash_SALTBYTES-byte salt.
+   * @param limits The Argon2id cost.
+   */
+  static void stretch(unsigned char *sealingKey, std::string_view passphrase, const unsigned char *salt,
+                      const KdfLimits &limits);
+
+  /**
+   * @brief Creates a file readable by its owner only and writes it completely.
+   *
+   * @param path The path to the file, which must not exist.
+   * @param data The contents.
+   * @param length The length of the contents.
+   */
+  static void writeExclusive(const std::string &path, const unsigned char *data, size_t length);
+ };
+} // namespace utils::crypto
+
+#endif // KEYFILE_H
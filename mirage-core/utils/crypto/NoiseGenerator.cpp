@@ -0,0 +1,46 @@
+#include "NoiseGenerator.h"
+#include <algorithm>
+#include <cstring>
+
+namespace utils::crypto {
+    NoiseGenerator::NoiseGenerator(const unsigned char *seed, const uint64_t streamId) {
+        std::memcpy(key, seed, sizeof(key));
+        for (size_t i = 0; i < 8; ++i) {
+            nonce[i] = static_cast<unsigned char>(streamId >> (8 * i));
+        }
+    }
+
+    NoiseGenerator::~NoiseGenerator() {
+        sodium_memzero(key, sizeof(key));
+        sodium_memzero(batch, sizeof(batch));
+    }
+
+    void NoiseGenerator::fill(unsigned char *noise, size_t length) {
+        if (length >= NOISE_BATCH_SIZE) {
+            expand(noise, length);
+            return;
+        }
+
+        while (length > 0) {
+            if (batchOffset == NOISE_BATCH_SIZE) {
+                expand(batch, NOISE_BATCH_SIZE);
+                batchOffset = 0;
+            }
+            const size_t take = std::min(length, NOISE_BATCH_SIZE - batchOffset);
+            std::memcpy(noise, batch + batchOffset, take);
+            batchOffset += take;
+            noise += take;
+            length -= take;
+        }
+    }
+
+    void NoiseGenerator::createSeed(unsigned char *seed) {
+        randombytes_buf(seed, NOISE_SEED_SIZE);
+    }
+
+    void NoiseGenerator::expand(unsigned char *out, const size_t length) {
+        crypto_stream_chacha20_ietf(out, length, nonce, key);
+        // The last four nonce bytes count batches, so no keystream block is ever produced twice.
+        sodium_increment(nonce + 8, sizeof(nonce) - 8);
+    }
+} // namespace utils::crypto
@@ -0,0 +1,74 @@
+#ifndef NOISEGENERATOR_H
+#define NOISEGENERATOR_H
+
+#include <sodium.h>
+#include <cstddef>
+#include <cstdint>
+
+#define NOISE_SEED_SIZE crypto_stream_chacha20_ietf_KEYBYTES
+#define NOISE_BATCH_SIZE (16 * 1024)
+
+namespace utils::crypto {
+ /**
+  * @class NoiseGenerator
+  * @brief A fast source of mask noise expanded from a single random seed.
+  *
+  * The seed is drawn from the OS RNG once per file; every generator then produces an independent ChaCha20
+  * keystream selected by its stream identifier, so segments processed on different threads never share
+  * noise. Requests of at least NOISE_BATCH_SIZE bytes are written straight to the destination, smaller
+  * ones are served from a keystream batch, and libsodium picks the vectorized ChaCha20 implementation for
+  * the host.
+  */
+ class NoiseGenerator {
+ public:
+  /**
+   * @brief Constructs a new NoiseGenerator object.
+   *
+   * @param seed The NOISE_SEED_SIZE-byte per-file seed, see createSeed().
+   * @param streamId Selects an independent keystream for the seed, e.g. a segment index.
+   */
+  NoiseGenerator(const unsigned char *seed, uint64_t streamId);
+
+  /**
+   * @brief Destroys the NoiseGenerator object.
+   *
+   * Securely erases the seed and the buffered keystream.
+   */
+  ~NoiseGenerator();
+
+  NoiseGenerator(const NoiseGenerator &) = delete;
+
+  NoiseGenerator &operator=(const NoiseGenerator &) = delete;
+
+  /**
+   * @brief Fills a buffer with noise.
+   *
+   * @param noise The buffer to fill.
+   * @param length The length of the buffer.
+   */
+  void fill(unsigned char *noise, size_t length);
+
+  /**
+   * @brief Draws a fresh seed from the OS RNG.
+   *
+   * @param seed Output buffer of NOISE_SEED_SIZE bytes.
+   */
+  static void createSeed(unsigned char *seed);
+
+ private:
+  unsigned char key[NOISE_SEED_SIZE]{}; /**< The ChaCha20 key, copied from the seed. */
+  unsigned char nonce[crypto_stream_chacha20_ietf_NONCEBYTES]{}; /**< Stream identifier and batch counter. */
+  unsigned char batch[NOISE_BATCH_SIZE]{}; /**< Buffered keystream for small requests. */
+  size_t batchOffset = NOISE_BATCH_SIZE; /**< Position of the first unused byte in batch. */
+
+  /**
+   * @brief Writes the keystream of the current nonce and advances the batch counter.
+   *
+   * @param out The destination buffer.
+   * @param length The number of keystream bytes.
+   */
+  void expand(unsigned char *out, size_t length);
+ };
+} // namespace utils::crypto
+
+#endif // NOISEGENERATOR_H
@@ -0,0 +1,213 @@
+#include "XorTransform.h"
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <sodium.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define XOR_TRANSFORM_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define XOR_TRANSFORM_NEON 1
+#endif
+
+namespace utils::crypto {
+    namespace {
+        using KernelFunction = void (*)(const unsigned char *, unsigned char *, size_t, const unsigned char *);
+
+        // Finishes a buffer from a position that is a multiple of XOR_KEY_SIZE.
+        void xorTail(const unsigned char *input, unsigned char *output, size_t offset, const size_t length,
+                     const unsigned char *key) {
+            for (; offset < length; ++offset) {
+                output[offset] = input[offset] ^ key[offset % XOR_KEY_SIZE];
+            }
+        }
+
+        void xorPortable(const unsigned char *input, unsigned char *output, const size_t length,
+                         const unsigned char *key) {
+            uint64_t keyWords[2];
+            std::memcpy(keyWords, key, sizeof(keyWords));
+            size_t offset = 0;
+            for (; offset + XOR_KEY_SIZE <= length; offset += XOR_KEY_SIZE) {
+                uint64_t words[2];
+                std::memcpy(words, input + offset, sizeof(words));
+                words[0] ^= keyWords[0];
+                words[1] ^= keyWords[1];
+                std::memcpy(output + offset, words, sizeof(words));
+            }
+            xorTail(input, output, offset, length, key);
+        }
+
+#ifdef XOR_TRANSFORM_X86
+        void xorSse2(const unsigned char *input, unsigned char *output, const size_t length, const unsigned char *key) {
+            const __m128i keyVector = _mm_load_si128(reinterpret_cast<const __m128i *>(key));
+            size_t offset = 0;
+            for (; offset + 64 <= length; offset += 64) {
+                for (size_t lane = 0; lane < 64; lane += 16) {
+                    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + offset + lane));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + offset + lane),
+                                     _mm_xor_si128(data, keyVector));
+                }
+            }
+            for (; offset + 16 <= length; offset += 16) {
+                const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + offset));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + offset), _mm_xor_si128(data, keyVector));
+            }
+            xorTail(input, output, offset, length, key);
+        }
+
+        __attribute__((target("avx2")))
+        void xorAvx2(const unsigned char *input, unsigned char *output, const size_t length, const unsigned char *key) {
+            const __m256i keyVector = _mm256_load_si256(reinterpret_cast<const __m256i *>(key));
+            size_t offset = 0;
+            for (; offset + 128 <= length; offset += 128) {
+                for (size_t lane = 0; lane < 128; lane += 32) {
+                    const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + offset + lane));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + offset + lane),
+                                        _mm256_xor_si256(data, keyVector));
+                }
+            }
+            for (; offset + 32 <= length; offset += 32) {
+                const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + offset));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + offset), _mm256_xor_si256(data, keyVector));
+            }
+            xorTail(input, output, offset, length, key);
+        }
+
+        __attribute__((target("avx512f,avx512bw")))
+        void xorAvx512(const unsigned char *input, unsigned char *output, const size_t length,
+                       const unsigned char *key) {
+            const __m512i keyVector = _mm512_load_si512(key);
+            size_t offset = 0;
+            for (; offset + 256 <= length; offset += 256) {
+                for (size_t lane = 0; lane < 256; lane += 64) {
+                    const __m512i data = _mm512_loadu_si512(input + offset + lane);
+                    _mm512_storeu_si512(output + offset + lane, _mm512_xor_si512(data, keyVector));
+                }
+            }
+            for (; offset + 64 <= length; offset += 64) {
+                _mm512_storeu_si512(output + offset, _mm512_xor_si512(_mm512_loadu_si512(input + offset), keyVector));
+            }
+            // The remainder is below one vector: a masked load and store covers it without a scalar loop.
+            if (offset < length) {
+                const __mmask64 mask = _cvtu64_mask64((~uint64_t{0}) >> (64 - (length - offset)));
+                const __m512i data = _mm512_maskz_loadu_epi8(mask, input + offset);
+                _mm512_mask_storeu_epi8(output + offset, mask, _mm512_xor_si512(data, keyVector));
+            }
+        }
+#endif
+
+#ifdef XOR_TRANSFORM_NEON
+        void xorNeon(const unsigned char *input, unsigned char *output, const size_t length, const unsigned char *key) {
+            const uint8x16_t keyVector = vld1q_u8(key);
+            size_t offset = 0;
+            for (; offset + 64 <= length; offset += 64) {
+                for (size_t lane = 0; lane < 64; lane += 16) {
+                    vst1q_u8(output + offset + lane, veorq_u8(vld1q_u8(input + offset + lane), keyVector));
+                }
+            }
+            for (; offset + 16 <= length; offset += 16) {
+                vst1q_u8(output + offset, veorq_u8(vld1q_u8(input + offset), keyVector));
+            }
+            xorTail(input, output, offset, length, key);
+        }
+#endif
+
+        KernelFunction kernelFunction(const XorKernel kernel) {
+            switch (kernel) {
+#ifdef XOR_TRANSFORM_X86
+                case XorKernel::Sse2:
+                    return xorSse2;
+                case XorKernel::Avx2:
+                    return xorAvx2;
+                case XorKernel::Avx512:
+                    return xorAvx512;
+#endif
+#ifdef XOR_TRANSFORM_NEON
+                case XorKernel::Neon:
+                    return xorNeon;
+#endif
+                default:
+                    return xorPortable;
+            }
+        }
+
+        XorKernel detectKernel() {
+            for (const XorKernel kernel: {XorKernel::Avx512, XorKernel::Avx2, XorKernel::Sse2, XorKernel::Neon}) {
+                if (XorTransform::isSupported(kernel)) {
+                    return kernel;
+                }
+            }
+            return XorKernel::Portable;
+        }
+    }
+
+    XorTransform::XorTransform(const unsigned char *key) {
+        for (size_t offset = 0; offset < sizeof(this->key); offset += XOR_KEY_SIZE) {
+            std::memcpy(this->key + offset, key, XOR_KEY_SIZE);
+        }
+    }
+
+    XorTransform::~XorTransform() {
+        sodium_memzero(key, sizeof(key));
+    }
+
+    void XorTransform::apply(const unsigned char *input, unsigned char *output, const size_t length) const {
+        static const KernelFunction kernel = kernelFunction(selectedKernel());
+        kernel(input, output, length, key);
+    }
+
+    void XorTransform::applyWith(const XorKernel kernel, const unsigned char *input, unsigned char *output,
+                                 const size_t length) const {
+        kernelFunction(kernel)(input, output, length, key);
+    }
+
+    void XorTransform::applyScalar(const unsigned char *input, unsigned char *output, const size_t length) const {
+        for (size_t i = 0; i < length; ++i) {
+            output[i] = input[i] ^ key[i % XOR_KEY_SIZE];
+        }
+    }
+
+    bool XorTransform::isSupported(const XorKernel kernel) {
+        switch (kernel) {
+            case XorKernel::Portable:
+                return true;
+#ifdef XOR_TRANSFORM_X86
+            case XorKernel::Sse2:
+                return true;
+            case XorKernel::Avx2:
+                return __builtin_cpu_supports("avx2");
+            case XorKernel::Avx512:
+                return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+#ifdef XOR_TRANSFORM_NEON
+            case XorKernel::Neon:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    XorKernel XorTransform::selectedKernel() {
+        static const XorKernel kernel = detectKernel();
+        return kernel;
+    }
+
+    const char *XorTransform::kernelName(const XorKernel kernel) {
+        switch (kernel) {
+            case XorKernel::Portable:
+                return "portable";
+            case XorKernel::Sse2:
+                return "sse2";
+            case XorKernel::Avx2:
+                return "avx2";
+            case XorKernel::Avx512:
+                return "avx512";
+            case XorKernel::Neon:
+                return "neon";
+        }
+        return "unknown";
+    }
+} // namespace utils::crypto
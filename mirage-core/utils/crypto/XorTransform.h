@@ -0,0 +1,95 @@
+#ifndef XORTRANSFORM_H
+#define XORTRANSFORM_H
+
+#include <cstddef>
+
+#define XOR_KEY_SIZE 16
+
+namespace utils::crypto {
+ /**
+  * @enum XorKernel
+  * @brief The implementations of XorTransform::apply().
+  */
+ enum class XorKernel {
+  Portable, /**< 64-bit words; compiled for every target. */
+  Sse2, /**< 16-byte vectors; x86-64 baseline. */
+  Avx2, /**< 32-byte vectors. */
+  Avx512, /**< 64-byte vectors. */
+  Neon /**< 16-byte vectors; AArch64 baseline. */
+ };
+
+ /**
+  * @class XorTransform
+  * @brief XORs buffers with a repeating XOR_KEY_SIZE-byte key.
+  *
+  * The key is broadcast to the widest vector the host supports; the kernel is picked once per process from
+  * the CPU features reported at runtime, so a binary built for the baseline still uses AVX2 or AVX-512 where
+  * available. Every buffer starts at key offset zero, and input and output may be the same buffer.
+  */
+ class XorTransform {
+ public:
+  /**
+   * @brief Constructs a new XorTransform object.
+   *
+   * @param key The XOR_KEY_SIZE-byte key.
+   */
+  explicit XorTransform(const unsigned char *key);
+
+  /**
+   * @brief Destroys the XorTransform object, erasing the broadcast key.
+   */
+  ~XorTransform();
+
+  XorTransform(const XorTransform &) = delete;
+
+  XorTransform &operator=(const XorTransform &) = delete;
+
+  /**
+   * @brief XORs a buffer with the key using the fastest supported kernel.
+   *
+   * @param input The source buffer.
+   * @param output The destination buffer; may equal input.
+   * @param length The length of the buffers.
+   */
+  void apply(const unsigned char *input, unsigned char *output, size_t length) const;
+
+  /**
+   * @brief XORs a buffer with the key using a given kernel.
+   *
+   * @param kernel A kernel for which isSupported() holds.
+   * @param input The source buffer.
+   * @param output The destination buffer; may equal input.
+   * @param length The length of the buffers.
+   */
+  void applyWith(XorKernel kernel, const unsigned char *input, unsigned char *output, size_t length) const;
+
+  /**
+   * @brief XORs a buffer with the key one byte at a time; the reference the kernels are checked against.
+   *
+   * @param input The source buffer.
+   * @param output The destination buffer; may equal input.
+   * @param length The length of the buffers.
+   */
+  void applyScalar(const unsigned char *input, unsigned char *output, size_t length) const;
+
+  /**
+   * @brief Tells whether a kernel is compiled in and supported by the CPU.
+   */
+  [[nodiscard]] static bool isSupported(XorKernel kernel);
+
+  /**
+   * @brief Gets the kernel apply() uses on this host.
+   */
+  [[nodiscard]] static XorKernel selectedKernel();
+
+  /**
+   * @brief Gets the name of a kernel.
+   */
+  [[nodiscard]] static const char *kernelName(XorKernel kernel);
+
+ private:
+  alignas(64) unsigned char key[64]{}; /**< The key repeated to the width of the widest vector. */
+ };
+} // namespace utils::crypto
+
+#endif // XORTRANSFORM_H
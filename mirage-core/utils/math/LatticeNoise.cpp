@@ -1,24 +1,171 @@
 #include "LatticeNoise.h"
-#include <random>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define LATTICE_NOISE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define LATTICE_NOISE_NEON 1
+#endif
 
 namespace utils::math {
-    void LatticeNoise::addLatticeNoise(std::vector<unsigned char> &data, size_t length) {
-        std::default_random_engine generator(std::random_device{}());
-        std::uniform_int_distribution distribution(0, MODULUS - 1);
+    namespace {
+        using KernelFunction = void (*)(const uint8_t *, const uint8_t *, uint8_t *, size_t);
+
+        constexpr uint64_t LOW_BITS = 0x7f7f7f7f7f7f7f7full;
+        constexpr uint64_t HIGH_BITS = 0x8080808080808080ull;
+
+        // Eight lanes per 64-bit word: the low seven bits are added without carrying into the next lane.
+        template<bool Remove>
+        void applyPortable(const uint8_t *input, const uint8_t *noise, uint8_t *output, const size_t length) {
+            size_t offset = 0;
+            for (; offset + 8 <= length; offset += 8) {
+                uint64_t data, pad;
+                std::memcpy(&data, input + offset, sizeof(data));
+                std::memcpy(&pad, noise + offset, sizeof(pad));
+                const uint64_t result = Remove
+                                            ? ((data | HIGH_BITS) - (pad & LOW_BITS)) ^ ((data ^ ~pad) & HIGH_BITS)
+                                            : ((data & LOW_BITS) + (pad & LOW_BITS)) ^ ((data ^ pad) & HIGH_BITS);
+                std::memcpy(output + offset, &result, sizeof(result));
+            }
+            for (; offset < length; ++offset) {
+                output[offset] = static_cast<uint8_t>(Remove ? input[offset] - noise[offset]
+                                                             : input[offset] + noise[offset]);
+            }
+        }
+
+#ifdef LATTICE_NOISE_X86
+        template<bool Remove>
+        void applySse2(const uint8_t *input, const uint8_t *noise, uint8_t *output, const size_t length) {
+            size_t offset = 0;
+            for (; offset + 16 <= length; offset += 16) {
+                const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + offset));
+                const __m128i pad = _mm_loadu_si128(reinterpret_cast<const __m128i *>(noise + offset));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + offset),
+                                 Remove ? _mm_sub_epi8(data, pad) : _mm_add_epi8(data, pad));
+            }
+            applyPortable<Remove>(input + offset, noise + offset, output + offset, length - offset);
+        }
+
+        template<bool Remove>
+        __attribute__((target("avx2")))
+        void applyAvx2(const uint8_t *input, const uint8_t *noise, uint8_t *output, const size_t length) {
+            size_t offset = 0;
+            for (; offset + 32 <= length; offset += 32) {
+                const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + offset));
+                const __m256i pad = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(noise + offset));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + offset),
+                                    Remove ? _mm256_sub_epi8(data, pad) : _mm256_add_epi8(data, pad));
+            }
+            applyPortable<Remove>(input + offset, noise + offset, output + offset, length - offset);
+        }
+#endif
+
+#ifdef LATTICE_NOISE_NEON
+        template<bool Remove>
+        void applyNeon(const uint8_t *input, const uint8_t *noise, uint8_t *output, const size_t length) {
+            size_t offset = 0;
+            for (; offset + 16 <= length; offset += 16) {
+                const uint8x16_t data = vld1q_u8(input + offset);
+                const uint8x16_t pad = vld1q_u8(noise + offset);
+                vst1q_u8(output + offset, Remove ? vsubq_u8(data, pad) : vaddq_u8(data, pad));
+            }
+            applyPortable<Remove>(input + offset, noise + offset, output + offset, length - offset);
+        }
+#endif
+
+        enum class Kernel { Portable, Sse2, Avx2, Neon };
+
+        Kernel detectKernel() {
+#ifdef LATTICE_NOISE_X86
+            return __builtin_cpu_supports("avx2") ? Kernel::Avx2 : Kernel::Sse2;
+#elif defined(LATTICE_NOISE_NEON)
+            return Kernel::Neon;
+#else
+            return Kernel::Portable;
+#endif
+        }
+
+        Kernel selectedKernel() {
+            static const Kernel kernel = detectKernel();
+            return kernel;
+        }
 
-        for (size_t i = 0; i < length; ++i) {
-            const int noise = distribution(generator);
-            data[i] = static_cast<unsigned char>((static_cast<int>(data[i]) + noise) % MODULUS);
+        template<bool Remove>
+        KernelFunction kernelFunction() {
+            switch (selectedKernel()) {
+#ifdef LATTICE_NOISE_X86
+                case Kernel::Sse2:
+                    return applySse2<Remove>;
+                case Kernel::Avx2:
+                    return applyAvx2<Remove>;
+#endif
+#ifdef LATTICE_NOISE_NEON
+                case Kernel::Neon:
+                    return applyNeon<Remove>;
+#endif
+                default:
+                    return applyPortable<Remove>;
+            }
         }
     }
 
-    void LatticeNoise::removeLatticeNoise(std::vector<unsigned char> &data, size_t length) {
-        std::default_random_engine generator(std::random_device{}());
-        std::uniform_int_distribution distribution(0, MODULUS - 1);
+    LatticeNoise::LatticeNoise(const unsigned char *key) {
+        std::memcpy(this->key, key, sizeof(this->key));
+    }
+
+    LatticeNoise::~LatticeNoise() {
+        sodium_memzero(key, sizeof(key));
+    }
+
+    void LatticeNoise::addLatticeNoise(const std::span<const uint8_t> input, const std::span<uint8_t> output,
+                                       const uint64_t streamId) const {
+        transform<false>(input, output, streamId);
+    }
+
+    void LatticeNoise::removeLatticeNoise(const std::span<const uint8_t> input, const std::span<uint8_t> output,
+                                          const uint64_t streamId) const {
+        transform<true>(input, output, streamId);
+    }
+
+    const char *LatticeNoise::kernelName() {
+        switch (selectedKernel()) {
+            case Kernel::Sse2:
+                return "sse2";
+            case Kernel::Avx2:
+                return "avx2";
+            case Kernel::Neon:
+                return "neon";
+            default:
+                return "portable";
+        }
+    }
+
+    template<bool Remove>
+    void LatticeNoise::transform(const std::span<const uint8_t> input, const std::span<uint8_t> output,
+                                 const uint64_t streamId) const {
+        if (output.size() != input.size()) {
+            throw std::invalid_argument("Lattice noise output must match the input size");
+        }
+        static const KernelFunction kernel = kernelFunction<Remove>();
+
+        unsigned char nonce[crypto_stream_chacha20_ietf_NONCEBYTES]{};
+        for (size_t i = 0; i < 8; ++i) {
+            nonce[i] = static_cast<unsigned char>(streamId >> (8 * i));
+        }
 
-        for (size_t i = 0; i < length; ++i) {
-            const int noise = distribution(generator);
-            data[i] = static_cast<unsigned char>((static_cast<int>(data[i]) - noise + MODULUS) % MODULUS);
+        // Every batch starts a whole number of 64-byte ChaCha20 blocks into the stream.
+        alignas(64) uint8_t noise[LATTICE_NOISE_BATCH_SIZE];
+        for (size_t offset = 0; offset < input.size(); offset += LATTICE_NOISE_BATCH_SIZE) {
+            const size_t length = std::min<size_t>(LATTICE_NOISE_BATCH_SIZE, input.size() - offset);
+            std::memset(noise, 0, length);
+            crypto_stream_chacha20_ietf_xor_ic(noise, noise, length, nonce,
+                                               static_cast<uint32_t>(offset / 64), key);
+            kernel(input.data() + offset, noise, output.data() + offset, length);
         }
+        sodium_memzero(noise, sizeof(noise));
     }
-}
+} // namespace utils::math
@@ -1,32 +1,73 @@
 #ifndef LATTICE_NOISE_H
 #define LATTICE_NOISE_H
 
-#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <sodium.h>
 
-#define MODULUS 256
+#define LATTICE_NOISE_KEY_SIZE crypto_stream_chacha20_ietf_KEYBYTES
+#define LATTICE_NOISE_BATCH_SIZE 4096
 
 namespace utils::math {
+    /**
+     * @class LatticeNoise
+     * @brief A reversible keyed transform that adds noise to every byte modulo 256.
+     *
+     * The noise is a ChaCha20 keystream selected by the key and a stream identifier, so removing it only needs
+     * the same two values. The keystream is produced in batches of LATTICE_NOISE_BATCH_SIZE bytes and added or
+     * subtracted with byte-wise vector arithmetic; the kernel is picked once per process from the CPU features
+     * reported at runtime.
+     */
     class LatticeNoise {
     public:
         /**
-         * @brief Adds lattice noise to the provided data.
+         * @brief Constructs a new LatticeNoise object.
          *
-         * This method adds lattice noise to the provided data by XORing it with random bytes.
+         * @param key The LATTICE_NOISE_KEY_SIZE-byte key.
+         */
+        explicit LatticeNoise(const unsigned char *key);
+
+        /**
+         * @brief Destroys the LatticeNoise object, erasing the key.
+         */
+        ~LatticeNoise();
+
+        LatticeNoise(const LatticeNoise &) = delete;
+
+        LatticeNoise &operator=(const LatticeNoise &) = delete;
+
+        /**
+         * @brief Adds lattice noise to the provided data.
          *
-         * @param data The data to which lattice noise will be added.
-         * @param length The length of the data.
+         * @param input The source bytes.
+         * @param output The destination, of the size of input; may be the same buffer.
+         * @param streamId Selects an independent noise stream for the key, e.g. a chunk index.
          */
-        static void addLatticeNoise(std::vector<unsigned char> &data, size_t length);
+        void addLatticeNoise(std::span<const uint8_t> input, std::span<uint8_t> output, uint64_t streamId) const;
 
         /**
          * @brief Removes lattice noise from the provided data.
          *
-         * This method removes lattice noise from the provided data by reversing the XOR operation.
-         *
-         * @param data The data from which lattice noise will be removed.
-         * @param length The length of the data.
+         * @param input The source bytes.
+         * @param output The destination, of the size of input; may be the same buffer.
+         * @param streamId The stream identifier the noise was added with.
+         */
+        void removeLatticeNoise(std::span<const uint8_t> input, std::span<uint8_t> output, uint64_t streamId) const;
+
+        /**
+         * @brief Gets the name of the kernel used on this host.
+         */
+        [[nodiscard]] static const char *kernelName();
+
+    private:
+        unsigned char key[LATTICE_NOISE_KEY_SIZE]{}; /**< The ChaCha20 key. */
+
+        /**
+         * @brief Adds or subtracts the noise stream batch by batch.
          */
-        static void removeLatticeNoise(std::vector<unsigned char> &data, size_t length);
+        template<bool Remove>
+        void transform(std::span<const uint8_t> input, std::span<uint8_t> output, uint64_t streamId) const;
     };
 } // namespace utils::math
 
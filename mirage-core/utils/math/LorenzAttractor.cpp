@@ -1,32 +1,70 @@
 #include "LorenzAttractor.h"
-#include <cmath>
-
-#include "../../engines/encryption/PolymorphicEncryptionEngine.h"
+#include <algorithm>
+#include <stdexcept>
 
 namespace utils::math {
-    void LorenzAttractor::step(double &x, double &y, double &z, double dt) {
-        constexpr double sigma = 10.0;
-        constexpr double rho = 28.0;
-        constexpr double beta = 8.0 / 3.0;
-
-        const double dx = sigma * (y - x);
-        const double dy = x * (rho - z) - y;
-        const double dz = x * y - beta * z;
-
-        x += dx * dt;
-        y += dy * dt;
-        z += dz * dt;
+    namespace {
+        constexpr LorenzState ENTROPY_START{LORENZ_ENTROPY_START_X, LORENZ_ENTROPY_START_Y, LORENZ_ENTROPY_START_Z};
+
+        constexpr std::array<uint8_t, LORENZ_ENTROPY_SIZE> ENTROPY_TABLE =
+                LorenzAttractor::trajectory<LORENZ_ENTROPY_SIZE>(ENTROPY_START);
+
+        /**
+         * @struct LorenzLanes
+         * @brief LORENZ_BATCH_LANES points in structure-of-arrays form, so every coordinate loop vectorizes.
+         */
+        struct LorenzLanes {
+            alignas(64) std::array<double, LORENZ_BATCH_LANES> x{}; /**< The x coordinates. */
+            alignas(64) std::array<double, LORENZ_BATCH_LANES> y{}; /**< The y coordinates. */
+            alignas(64) std::array<double, LORENZ_BATCH_LANES> z{}; /**< The z coordinates. */
+        };
+
+        template<LorenzMethod Method>
+        void integrateLanes(LorenzLanes &lanes, const size_t active, const std::span<uint8_t> output,
+                            const size_t stride, const size_t steps, const double dt) {
+            std::array<uint8_t, LORENZ_BATCH_LANES> samples{};
+            for (size_t s = 0; s < steps; ++s) {
+                for (size_t i = 0; i < LORENZ_BATCH_LANES; ++i) {
+                    LorenzState state{lanes.x[i], lanes.y[i], lanes.z[i]};
+                    LorenzAttractor::step(state, Method, dt);
+                    lanes.x[i] = state.x;
+                    lanes.y[i] = state.y;
+                    lanes.z[i] = state.z;
+                    samples[i] = LorenzAttractor::sample(state);
+                }
+                std::copy_n(samples.begin(), active, output.begin() + s * stride);
+            }
+        }
     }
 
-    void LorenzAttractor::generateEntropy(std::array<uint8_t, 32> &buffer, size_t size) {
-        double x = PARANOID_MODE ? 1.01 : 1.0;
-        double y = PARANOID_MODE ? 1.02 : 1.0;
-        double z = PARANOID_MODE ? 1.03 : 1.0;
+    void LorenzAttractor::generateEntropy(std::array<uint8_t, LORENZ_ENTROPY_SIZE> &buffer, const size_t size) {
+        std::copy_n(ENTROPY_TABLE.begin(), std::min<size_t>(size, LORENZ_ENTROPY_SIZE), buffer.begin());
+    }
+
+    void LorenzAttractor::integrate(const std::span<const LorenzState> starts, const std::span<uint8_t> output,
+                                    const LorenzMethod method, const double dt) {
+        if (starts.empty() || output.size() % starts.size() != 0) {
+            throw std::invalid_argument("Output size must be a multiple of the trajectory count");
+        }
+
+        const size_t steps = output.size() / starts.size();
+        for (size_t first = 0; first < starts.size(); first += LORENZ_BATCH_LANES) {
+            const size_t active = std::min<size_t>(LORENZ_BATCH_LANES, starts.size() - first);
+
+            // Unused lanes start at the origin, a fixed point of the system.
+            LorenzLanes lanes;
+            for (size_t i = 0; i < active; ++i) {
+                lanes.x[i] = starts[first + i].x;
+                lanes.y[i] = starts[first + i].y;
+                lanes.z[i] = starts[first + i].z;
+            }
 
-        for (size_t i = 0; i < size; ++i) {
-            double dt = 0.01;
-            step(x, y, z, dt);
-            buffer[i] = static_cast<uint8_t>(std::fmod(std::abs(x + y + z), 256));
+            const std::span<uint8_t> block = output.subspan(first);
+            if (method == LorenzMethod::Euler) {
+                integrateLanes<LorenzMethod::Euler>(lanes, active, block, starts.size(), steps, dt);
+            } else {
+                integrateLanes<LorenzMethod::RungeKutta4>(lanes, active, block, starts.size(), steps, dt);
+            }
         }
     }
 } // namespace utils::math
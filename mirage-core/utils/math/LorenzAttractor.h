@@ -2,29 +2,142 @@
 #define LORENZATTRACTOR_H
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#define LORENZ_TIME_STEP 0.01
+#define LORENZ_ENTROPY_SIZE 32
+#define LORENZ_BATCH_LANES 8
+#define LORENZ_ENTROPY_START_X 1.01
+#define LORENZ_ENTROPY_START_Y 1.02
+#define LORENZ_ENTROPY_START_Z 1.03
 
 namespace utils::math {
+    /**
+     * @struct LorenzState
+     * @brief A point of the Lorenz system.
+     */
+    struct LorenzState {
+        double x; /**< The x coordinate. */
+        double y; /**< The y coordinate. */
+        double z; /**< The z coordinate. */
+    };
+
+    /**
+     * @enum LorenzMethod
+     * @brief The integration schemes of LorenzAttractor::integrate().
+     */
+    enum class LorenzMethod {
+        Euler, /**< Explicit Euler; one evaluation of the system per step. */
+        RungeKutta4 /**< Classic fourth-order Runge-Kutta; four evaluations per step. */
+    };
+
     /**
      * @class LorenzAttractor
      * @brief A class for generating entropy using the Lorenz attractor.
      *
-     * This class simulates the Lorenz system to generate chaotic values that can be used as entropy.
+     * This class simulates the Lorenz system to generate chaotic values that can be used as entropy. Every
+     * step is constexpr, so the trajectories from the fixed start points are computed by the compiler and
+     * generateEntropy() only copies a table. Trajectories seeded at runtime go through integrate(), which
+     * advances LORENZ_BATCH_LANES of them side by side in structure-of-arrays form.
      */
     class LorenzAttractor {
     public:
         /**
          * @brief Generates entropy using the Lorenz attractor.
          *
-         * This method uses the Lorenz equations to generate a chaotic sequence of values
-         * and stores them in the provided buffer.
+         * This method copies the first values of the compile-time trajectory from the start point
+         * (LORENZ_ENTROPY_START_X, LORENZ_ENTROPY_START_Y, LORENZ_ENTROPY_START_Z) into the provided buffer.
          *
          * @param buffer The buffer to be filled with entropy values.
-         * @param size The size of the buffer.
+         * @param size The number of values to copy; at most LORENZ_ENTROPY_SIZE.
+         */
+        static void generateEntropy(std::array<uint8_t, LORENZ_ENTROPY_SIZE> &buffer, size_t size);
+
+        /**
+         * @brief Integrates trajectories from runtime start points and samples one byte per trajectory and step.
+         *
+         * The output is step-major: byte `step * starts.size() + trajectory`. Each trajectory produces the same
+         * bytes as trajectory() from the same start point.
+         *
+         * @param starts The start points.
+         * @param output The buffer to fill; its size must be a multiple of starts.size().
+         * @param method The integration scheme.
+         * @param dt The time step.
+         */
+        static void integrate(std::span<const LorenzState> starts, std::span<uint8_t> output,
+                              LorenzMethod method = LorenzMethod::Euler, double dt = LORENZ_TIME_STEP);
+
+        /**
+         * @brief Samples the first N steps of one trajectory; usable in constant expressions.
+         *
+         * @tparam N The number of steps.
+         * @param start The start point.
+         * @param method The integration scheme.
+         * @param dt The time step.
+         * @return One byte per step.
+         */
+        template<size_t N>
+        static constexpr std::array<uint8_t, N> trajectory(LorenzState start,
+                                                           const LorenzMethod method = LorenzMethod::Euler,
+                                                           const double dt = LORENZ_TIME_STEP) {
+            std::array<uint8_t, N> values{};
+            for (uint8_t &value: values) {
+                step(start, method, dt);
+                value = sample(start);
+            }
+            return values;
+        }
+
+        /**
+         * @brief Evaluates the Lorenz equations at a point.
+         *
+         * @return The derivative at the point.
+         */
+        static constexpr LorenzState derivative(const LorenzState &state) {
+            constexpr double sigma = 10.0;
+            constexpr double rho = 28.0;
+            constexpr double beta = 8.0 / 3.0;
+
+            return {sigma * (state.y - state.x), state.x * (rho - state.z) - state.y,
+                    state.x * state.y - beta * state.z};
+        }
+
+        /**
+         * @brief Advances a point by one step.
+         */
+        static constexpr void step(LorenzState &state, const LorenzMethod method, const double dt) {
+            if (method == LorenzMethod::Euler) {
+                const LorenzState d = derivative(state);
+                state = {state.x + d.x * dt, state.y + d.y * dt, state.z + d.z * dt};
+                return;
+            }
+            const LorenzState k1 = derivative(state);
+            const LorenzState k2 = derivative(offset(state, k1, dt / 2));
+            const LorenzState k3 = derivative(offset(state, k2, dt / 2));
+            const LorenzState k4 = derivative(offset(state, k3, dt));
+            state = {
+                state.x + dt / 6 * (k1.x + 2 * k2.x + 2 * k3.x + k4.x),
+                state.y + dt / 6 * (k1.y + 2 * k2.y + 2 * k3.y + k4.y),
+                state.z + dt / 6 * (k1.z + 2 * k2.z + 2 * k3.z + k4.z)
+            };
+        }
+
+        /**
+         * @brief Reduces a point to a byte: the integer part of |x + y + z|, modulo 256.
+         *
+         * Equivalent to truncating std::fmod(std::abs(x + y + z), 256) for every point on the attractor.
          */
-        static void generateEntropy(std::array<uint8_t, 32> &buffer, size_t size);
+        static constexpr uint8_t sample(const LorenzState &state) {
+            const double sum = state.x + state.y + state.z;
+            return static_cast<uint8_t>(static_cast<uint64_t>(sum < 0 ? -sum : sum) % 256);
+        }
 
     private:
-        static void step(double &x, double &y, double &z, double dt);
+        static constexpr LorenzState offset(const LorenzState &state, const LorenzState &slope, const double h) {
+            return {state.x + slope.x * h, state.y + slope.y * h, state.z + slope.z * h};
+        }
     };
 } // namespace utils::math
 
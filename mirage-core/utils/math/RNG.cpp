@@ -1,75 +1,97 @@
 #include "RNG.h"
 #include "LorenzAttractor.h"
 #include <algorithm>
-#include <random>
+#include <functional>
 #include <sodium.h>
 #include <stdexcept>
-#include <vector>
 
 namespace utils::math {
+    namespace {
+        /**
+         * @struct RandomPool
+         * @brief Random bytes buffered for one thread, erased when the thread exits.
+         */
+        struct RandomPool {
+            std::array<uint8_t, RNG_POOL_SIZE> bytes{}; /**< The buffered bytes. */
+            size_t offset = RNG_POOL_SIZE; /**< Position of the first unused byte. */
+
+            ~RandomPool() { sodium_memzero(bytes.data(), bytes.size()); }
+        };
+
+        thread_local RandomPool pool;
+    }
+
     RNG::RNG() {
         if (sodium_init() < 0) {
             throw std::runtime_error("libsodium initialization failed");
         }
-
-        std::array<uint32_t, std::mt19937::state_size> seed_data{};
-        randombytes_buf(seed_data.data(), seed_data.size() * sizeof(uint32_t));
-
-        std::seed_seq seq(seed_data.begin(), seed_data.end());
-        rng_.seed(seq);
     }
 
-    std::array<uint8_t, 32> RNG::generateSeed() {
-        std::array<uint8_t, 32> seed{};
+    std::array<uint8_t, randombytes_SEEDBYTES> RNG::generateSeed() {
+        std::array<uint8_t, randombytes_SEEDBYTES> seed{};
 
         // Get OS entropy
-        uint8_t osSeed[32];
-        randombytes_buf(osSeed, 32);
+        uint8_t osSeed[randombytes_SEEDBYTES];
+        randombytes_buf(osSeed, sizeof(osSeed));
 
         // Get Lorenz attractor entropy
-        std::array<uint8_t, 32> lorenzEntropy{};
-        LorenzAttractor::generateEntropy(lorenzEntropy, 32);
+        static_assert(LORENZ_ENTROPY_SIZE >= randombytes_SEEDBYTES, "Lorenz entropy must cover the seed");
+        std::array<uint8_t, LORENZ_ENTROPY_SIZE> lorenzEntropy{};
+        LorenzAttractor::generateEntropy(lorenzEntropy, lorenzEntropy.size());
 
         // Mix OS entropy with Lorenz attractor entropy
-        std::transform(osSeed, osSeed + 32, lorenzEntropy.begin(), seed.begin(), std::bit_xor());
+        std::transform(osSeed, osSeed + sizeof(osSeed), lorenzEntropy.begin(), seed.begin(), std::bit_xor());
+        sodium_memzero(osSeed, sizeof(osSeed));
 
         return seed;
     }
 
-    template<typename T>
-    void RNG::fillBufferWithRandomBytes(T &buffer, const size_t size) {
-        std::uniform_int_distribution<int> dist(0, 255);
-        for (size_t i = 0; i < size; ++i) {
-            buffer[i] = static_cast<typename T::value_type>(dist(rng_));
+    void RNG::fill(const std::span<uint8_t> buffer) {
+        std::array<uint8_t, randombytes_SEEDBYTES> seed = generateSeed();
+        randombytes_buf_deterministic(buffer.data(), buffer.size(), seed.data());
+        sodium_memzero(seed.data(), seed.size());
+    }
+
+    void RNG::fillPooled(std::span<uint8_t> buffer) {
+        if (buffer.size() > RNG_POOL_SIZE) {
+            fill(buffer);
+            return;
+        }
+
+        while (!buffer.empty()) {
+            if (pool.offset == RNG_POOL_SIZE) {
+                fill(pool.bytes);
+                pool.offset = 0;
+            }
+            const size_t take = std::min(buffer.size(), RNG_POOL_SIZE - pool.offset);
+            std::copy_n(pool.bytes.begin() + pool.offset, take, buffer.begin());
+            sodium_memzero(pool.bytes.data() + pool.offset, take);
+            pool.offset += take;
+            buffer = buffer.subspan(take);
         }
     }
 
     template<typename T>
-    T RNG::random(const size_t count) {
+    T RNG::random() {
         static_assert(std::is_integral_v<T>, "T must be an integral type");
 
-        std::vector<uint8_t> buffer(sizeof(T) * count);
-
-        std::array<uint8_t, 32> seed = generateSeed();
-
-        std::seed_seq seq(seed.begin(), seed.end());
-        rng_.seed(seq);
-
-        fillBufferWithRandomBytes(buffer, sizeof(T) * count);
+        std::array<uint8_t, sizeof(T)> buffer{};
+        fillPooled(buffer);
 
         T result = 0;
         for (size_t i = 0; i < sizeof(T); ++i) {
             result = result << 8 | buffer[i];
         }
+        sodium_memzero(buffer.data(), buffer.size());
 
         return result;
     }
 
-    template uint8_t RNG::random<uint8_t>(size_t count);
+    template uint8_t RNG::random<uint8_t>();
 
-    template uint16_t RNG::random<uint16_t>(size_t count);
+    template uint16_t RNG::random<uint16_t>();
 
-    template uint32_t RNG::random<uint32_t>(size_t count);
+    template uint32_t RNG::random<uint32_t>();
 
-    template uint64_t RNG::random<uint64_t>(size_t count);
+    template uint64_t RNG::random<uint64_t>();
 } // namespace utils::math
@@ -2,68 +2,70 @@
 #define RNG_H
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
-#include <random>
+#include <span>
 #include <sodium.h>
 
+#define RNG_POOL_SIZE 4096
+
 namespace utils::math {
  /**
   * @class RNG
   * @brief A class for generating random numbers with enhanced entropy.
   *
-  * This class utilizes both the standard random number generation and additional entropy
-  * from libsodium to provide high-quality random numbers. It also uses libsodium
-  * for secure random number generation and memory handling.
+  * This class mixes operating system entropy from libsodium with entropy from the Lorenz attractor into a
+  * seed, and expands the seed with libsodium's ChaCha20-based deterministic generator. A whole request is
+  * served from a single mix, so a 32-byte key costs one seed instead of one per byte. Small draws are
+  * served from a per-thread pool that is refilled with one mix every RNG_POOL_SIZE bytes; served bytes are
+  * erased from the pool.
   */
  class RNG {
  public:
   /**
-   * @brief Constructs a new RNG object and seeds the random number generator.
+   * @brief Constructs a new RNG object.
    *
-   * Initializes libsodium and seeds the std::mt19937 random number generator using a combination
-   * of std::random_device and std::seed_seq.
+   * Initializes libsodium. The generator keeps no state of its own, so construction is cheap.
    */
   RNG();
 
   /**
-   * @brief Generates random numbers of the specified integral type.
-   *
-   * This method generates random numbers of the specified integral type. The count parameter
-   * specifies the number of random numbers to generate. The method uses a combination of
-   * generated seed, libsodium entropy, and std::mt19937 to fill a buffer with random bytes.
+   * @brief Fills a buffer with random bytes from one fresh entropy mix.
    *
-   * @tparam T The integral type of the random number to generate.
-   * @param count The number of random numbers to generate (default is 1).
-   * @return A random number of the specified integral type.
+   * @param buffer The buffer to fill.
    */
-  template<typename T>
-  T random(size_t count = 1);
+  void fill(std::span<uint8_t> buffer);
 
- private:
   /**
-   * @brief Generates a seed for the random number generator.
+   * @brief Fills a buffer with random bytes from the calling thread's pool.
    *
-   * This method generates a 32-byte seed by combining operating system entropy and
-   * additional entropy from std::mt19937.
+   * Requests larger than RNG_POOL_SIZE bypass the pool and use fill().
    *
-   * @return A 32-byte array containing the generated seed.
+   * @param buffer The buffer to fill.
    */
-  std::array<uint8_t, 32> generateSeed();
+  void fillPooled(std::span<uint8_t> buffer);
 
   /**
-   * @brief Fills a buffer with random bytes.
+   * @brief Generates a random number of the specified integral type.
    *
-   * This method fills the provided buffer with random bytes using a uniform distribution.
-   * The buffer is filled with random values generated by std::mt19937.
+   * The number is drawn from the calling thread's pool.
    *
-   * @tparam T The type of the buffer to fill with random bytes.
-   * @param buffer The buffer to be filled with random bytes.
-   * @param size The size of the buffer.
+   * @tparam T The integral type of the random number to generate.
+   * @return A random number of the specified integral type.
    */
   template<typename T>
-  void fillBufferWithRandomBytes(T &buffer, size_t size);
+  T random();
 
-  std::mt19937 rng_; /**< Mersenne Twister random number generator. */
+ private:
+  /**
+   * @brief Generates a seed for the random number generator.
+   *
+   * This method generates a 32-byte seed by combining operating system entropy and
+   * additional entropy from the Lorenz attractor.
+   *
+   * @return A randombytes_SEEDBYTES-byte array containing the generated seed.
+   */
+  std::array<uint8_t, randombytes_SEEDBYTES> generateSeed();
  };
 } // namespace utils::math
 
@@ -0,0 +1,138 @@
+#include "SecureBufferPool.h"
+#include <bit>
+#include <new>
+#include <sodium.h>
+#include <sys/mman.h>
+
+namespace utils::memory {
+    namespace {
+        size_t classSizeOf(const size_t sizeClass) {
+            return static_cast<size_t>(BUFFER_POOL_MIN_CLASS_SIZE) << sizeClass;
+        }
+    }
+
+    SecureBuffer::SecureBuffer(SecureBufferPool *pool, unsigned char *bytes, const size_t length,
+                               const size_t sizeClass, const bool locked)
+        : pool(pool), bytes(bytes), length(length), sizeClass(sizeClass), locked(locked) {
+    }
+
+    SecureBuffer::~SecureBuffer() {
+        release();
+    }
+
+    SecureBuffer::SecureBuffer(SecureBuffer &&other) noexcept
+        : pool(other.pool), bytes(other.bytes), length(other.length), sizeClass(other.sizeClass),
+          locked(other.locked) {
+        other.pool = nullptr;
+        other.bytes = nullptr;
+        other.length = 0;
+    }
+
+    SecureBuffer &SecureBuffer::operator=(SecureBuffer &&other) noexcept {
+        if (this != &other) {
+            release();
+            pool = other.pool;
+            bytes = other.bytes;
+            length = other.length;
+            sizeClass = other.sizeClass;
+            locked = other.locked;
+            other.pool = nullptr;
+            other.bytes = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    void SecureBuffer::release() {
+        if (pool != nullptr && bytes != nullptr) {
+            pool->release(*this);
+        }
+        pool = nullptr;
+        bytes = nullptr;
+        length = 0;
+    }
+
+    SecureBufferPool::SecureBufferPool(const size_t idleLimit, const bool hugePages)
+        : idleLimit(idleLimit), hugePages(hugePages) {
+    }
+
+    SecureBufferPool::~SecureBufferPool() {
+        for (size_t sizeClass = 0; sizeClass < BUFFER_POOL_CLASS_COUNT; ++sizeClass) {
+            for (const Block &block: idle[sizeClass]) {
+                unmap(block, classSizeOf(sizeClass));
+            }
+        }
+    }
+
+    SecureBuffer SecureBufferPool::acquire(const size_t size) {
+        if (size == 0) {
+            return {};
+        }
+        const size_t sizeClass = size <= BUFFER_POOL_MIN_CLASS_SIZE
+                                     ? 0
+                                     : std::bit_width((size - 1) / BUFFER_POOL_MIN_CLASS_SIZE);
+        if (sizeClass >= BUFFER_POOL_CLASS_COUNT) {
+            throw std::bad_alloc();
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            if (!idle[sizeClass].empty()) {
+                const Block block = idle[sizeClass].back();
+                idle[sizeClass].pop_back();
+                idleBytes -= classSizeOf(sizeClass);
+                return {this, block.bytes, size, sizeClass, block.locked};
+            }
+        }
+
+        // Mapping and locking fault in every page, so it happens outside the lock.
+        const Block block = map(classSizeOf(sizeClass));
+        if (block.locked) {
+            std::lock_guard lock(mutex);
+            locked += classSizeOf(sizeClass);
+        }
+        return {this, block.bytes, size, sizeClass, block.locked};
+    }
+
+    size_t SecureBufferPool::lockedBytes() const {
+        std::lock_guard lock(mutex);
+        return locked;
+    }
+
+    SecureBufferPool::Block SecureBufferPool::map(const size_t classSize) const {
+        void *mapping = mmap(nullptr, classSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugePages && classSize >= BUFFER_POOL_HUGE_PAGE_SIZE) {
+            madvise(mapping, classSize, MADV_HUGEPAGE);
+        }
+#endif
+        return {static_cast<unsigned char *>(mapping), sodium_mlock(mapping, classSize) == 0};
+    }
+
+    void SecureBufferPool::release(const SecureBuffer &buffer) {
+        sodium_memzero(buffer.bytes, buffer.length);
+        const size_t classSize = classSizeOf(buffer.sizeClass);
+        {
+            std::lock_guard lock(mutex);
+            if (idleBytes + classSize <= idleLimit) {
+                idle[buffer.sizeClass].push_back({buffer.bytes, buffer.locked});
+                idleBytes += classSize;
+                return;
+            }
+            if (buffer.locked) {
+                locked -= classSize;
+            }
+        }
+        unmap({buffer.bytes, buffer.locked}, classSize);
+    }
+
+    void SecureBufferPool::unmap(const Block &block, const size_t classSize) {
+        if (block.locked) {
+            sodium_munlock(block.bytes, classSize);
+        }
+        munmap(block.bytes, classSize);
+    }
+} // namespace utils::memory
@@ -0,0 +1,153 @@
+#ifndef SECUREBUFFERPOOL_H
+#define SECUREBUFFERPOOL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#define BUFFER_POOL_MIN_CLASS_SIZE (4 * 1024)
+#define BUFFER_POOL_CLASS_COUNT 20
+#define BUFFER_POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define DEFAULT_BUFFER_POOL_LIMIT (64 * 1024 * 1024)
+
+namespace utils::memory {
+ class SecureBufferPool;
+
+ /**
+  * @class SecureBuffer
+  * @brief A buffer leased from a SecureBufferPool, zeroed and returned to it on destruction.
+  */
+ class SecureBuffer {
+ public:
+  SecureBuffer() = default;
+
+  ~SecureBuffer();
+
+  SecureBuffer(SecureBuffer &&other) noexcept;
+
+  SecureBuffer &operator=(SecureBuffer &&other) noexcept;
+
+  SecureBuffer(const SecureBuffer &) = delete;
+
+  SecureBuffer &operator=(const SecureBuffer &) = delete;
+
+  [[nodiscard]] unsigned char *data() const { return bytes; }
+
+  [[nodiscard]] size_t size() const { return length; }
+
+  [[nodiscard]] std::span<unsigned char> span() const { return {bytes, length}; }
+
+  [[nodiscard]] unsigned char &operator[](const size_t index) const { return bytes[index]; }
+
+ private:
+  friend class SecureBufferPool;
+
+  SecureBufferPool *pool = nullptr; /**< The pool the block returns to. */
+  unsigned char *bytes = nullptr; /**< The page-aligned block. */
+  size_t length = 0; /**< The size requested, which is zeroed on release. */
+  size_t sizeClass = 0; /**< The size class of the block. */
+  bool locked = false; /**< Whether the block is locked in memory. */
+
+  SecureBuffer(SecureBufferPool *pool, unsigned char *bytes, size_t length, size_t sizeClass, bool locked);
+
+  void release();
+ };
+
+ /**
+  * @class SecureBufferPool
+  * @brief Page-aligned, memory-locked buffers that are reused across calls and threads.
+  *
+  * Blocks come in power-of-two size classes from BUFFER_POOL_MIN_CLASS_SIZE bytes. They are mapped
+  * anonymously, so they are page-aligned, and locked with sodium_mlock(), which also keeps them out of core
+  * dumps. Blocks of BUFFER_POOL_HUGE_PAGE_SIZE bytes and more can be backed by transparent huge pages. A
+  * released block is zeroed and kept for the next lease until the idle blocks reach the pool's limit; the
+  * rest are unmapped. Locking is best effort: when RLIMIT_MEMLOCK is exhausted a block stays unlocked, which
+  * lockedBytes() shows.
+  */
+ class SecureBufferPool {
+ public:
+  /**
+   * @brief Constructs a new SecureBufferPool object.
+   *
+   * @param idleLimit The largest number of bytes kept in idle blocks.
+   * @param hugePages Whether large blocks ask for transparent huge pages.
+   */
+  explicit SecureBufferPool(size_t idleLimit = DEFAULT_BUFFER_POOL_LIMIT, bool hugePages = false);
+
+  /**
+   * @brief Destroys the SecureBufferPool object, erasing and unmapping the idle blocks.
+   *
+   * Every leased buffer must have been released.
+   */
+  ~SecureBufferPool();
+
+  SecureBufferPool(const SecureBufferPool &) = delete;
+
+  SecureBufferPool &operator=(const SecureBufferPool &) = delete;
+
+  /**
+   * @brief Leases a buffer of at least a given size.
+   *
+   * The contents are zero. Throws std::bad_alloc if no memory can be mapped or the size exceeds the largest
+   * size class.
+   *
+   * @param size The size of the buffer in bytes.
+   * @return The buffer; empty if size is zero.
+   */
+  [[nodiscard]] SecureBuffer acquire(size_t size);
+
+  /**
+   * @brief Gets the number of bytes currently mapped and locked.
+   *
+   * @return The locked bytes of leased and idle blocks.
+   */
+  [[nodiscard]] size_t lockedBytes() const;
+
+ private:
+  friend class SecureBuffer;
+
+  /**
+   * @struct Block
+   * @brief An idle mapped block.
+   */
+  struct Block {
+   unsigned char *bytes; /**< The mapping. */
+   bool locked; /**< Whether sodium_mlock() succeeded. */
+  };
+
+  size_t idleLimit; /**< The largest number of bytes kept in idle blocks. */
+  bool hugePages; /**< Whether large blocks ask for transparent huge pages. */
+  mutable std::mutex mutex; /**< Guards the free lists and the byte counts. */
+  std::array<std::vector<Block>, BUFFER_POOL_CLASS_COUNT> idle; /**< Idle blocks per size class. */
+  size_t idleBytes = 0; /**< Bytes in idle blocks. */
+  size_t locked = 0; /**< Bytes in locked blocks, leased or idle. */
+
+  /**
+   * @brief Maps and locks a new block.
+   *
+   * @param classSize The size of the block.
+   * @return The block.
+   */
+  [[nodiscard]] Block map(size_t classSize) const;
+
+  /**
+   * @brief Returns a leased block, zeroing the part that was handed out.
+   *
+   * @param buffer The lease.
+   */
+  void release(const SecureBuffer &buffer);
+
+  /**
+   * @brief Unlocks and unmaps a block.
+   *
+   * @param block The block.
+   * @param classSize The size of the block.
+   */
+  static void unmap(const Block &block, size_t classSize);
+ };
+} // namespace utils::memory
+
+#endif // SECUREBUFFERPOOL_H
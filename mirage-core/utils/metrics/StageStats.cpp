@@ -0,0 +1,113 @@
+#include "StageStats.h"
+#include <sstream>
+
+namespace utils::metrics {
+    const char *stageName(const Stage stage) {
+        switch (stage) {
+            case Stage::Read:
+                return "read";
+            case Stage::Crypto:
+                return "crypto";
+            case Stage::Noise:
+                return "noise";
+            case Stage::Layers:
+                return "layers";
+            case Stage::Rekey:
+                return "rekey";
+            case Stage::Compress:
+                return "compress";
+            case Stage::Digest:
+                return "digest";
+            case Stage::Write:
+                return "write";
+            default:
+                return "unknown";
+        }
+    }
+
+    void OperationStats::merge(const OperationStats &other) {
+        bytesIn += other.bytesIn;
+        bytesOut += other.bytesOut;
+        segments += other.segments;
+        chunks += other.chunks;
+        rekeys += other.rekeys;
+        for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+            stages[stage].calls += other.stages[stage].calls;
+            stages[stage].nanoseconds += other.stages[stage].nanoseconds;
+        }
+        elapsedNanoseconds += other.elapsedNanoseconds;
+    }
+
+    bool OperationStats::empty() const {
+        if (bytesIn != 0 || bytesOut != 0 || segments != 0 || chunks != 0 || rekeys != 0) {
+            return false;
+        }
+        for (const StageTime &stage: stages) {
+            if (stage.calls != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string OperationStats::toJson() const {
+        std::ostringstream json;
+        json << "{\"bytes_in\":" << bytesIn << ",\"bytes_out\":" << bytesOut << ",\"segments\":" << segments
+                << ",\"chunks\":" << chunks << ",\"rekeys\":" << rekeys << ",\"elapsed_ns\":" << elapsedNanoseconds
+                << ",\"stages\":{";
+        for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+            json << (stage == 0 ? "" : ",") << '"' << stageName(static_cast<Stage>(stage)) << "\":{\"calls\":"
+                    << stages[stage].calls << ",\"ns\":" << stages[stage].nanoseconds << '}';
+        }
+        json << "}}";
+        return json.str();
+    }
+
+    StatsRecorder::StatsRecorder(const bool enabled, ProgressCallback progress)
+        : enabled(enabled), progress(std::move(progress)), start(std::chrono::steady_clock::now()) {
+    }
+
+    void StatsRecorder::merge(const OperationStats &local) {
+        std::lock_guard lock(mutex);
+        totals.merge(local);
+        if (progress) {
+            progress(totals);
+        }
+    }
+
+    OperationStats StatsRecorder::finish() {
+        if (detail::activeRecorder == this) {
+            flushStats();
+        }
+        std::lock_guard lock(mutex);
+        totals.elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return totals;
+    }
+
+    StatsRecorder *StatsRecorder::current() {
+        return detail::activeRecorder;
+    }
+
+    StatsScope::StatsScope(StatsRecorder *recorder)
+        : recorder(recorder != nullptr && recorder->isEnabled() ? recorder : nullptr),
+          previousRecorder(detail::activeRecorder), previousStats(detail::activeStats) {
+        detail::activeRecorder = this->recorder;
+        detail::activeStats = this->recorder != nullptr ? &local : nullptr;
+    }
+
+    StatsScope::~StatsScope() {
+        if (recorder != nullptr && !local.empty()) {
+            recorder->merge(local);
+        }
+        detail::activeRecorder = previousRecorder;
+        detail::activeStats = previousStats;
+    }
+
+    void flushStats() {
+        if (detail::activeRecorder != nullptr && detail::activeStats != nullptr && !detail::activeStats->empty()) {
+            detail::activeRecorder->merge(*detail::activeStats);
+            *detail::activeStats = OperationStats{};
+        }
+    }
+} // namespace utils::metrics
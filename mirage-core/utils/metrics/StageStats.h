@@ -0,0 +1,258 @@
+#ifndef STAGESTATS_H
+#define STAGESTATS_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#ifndef INSTRUMENTATION_ENABLED
+#define INSTRUMENTATION_ENABLED 1
+#endif
+#define STATS_FLUSH_INTERVAL 64
+
+namespace utils::metrics {
+ /**
+  * @enum Stage
+  * @brief The hot-path stages that are timed separately.
+  */
+ enum class Stage : size_t {
+  Read, /**< Positional and stream reads; page faults on a file mapping are counted in the stage touching it. */
+  Crypto, /**< Stream cipher push and pull. */
+  Noise, /**< Mask noise generation. */
+  Layers, /**< The XOR layer and the lattice noise stage. */
+  Rekey, /**< Stream cipher rekeys. */
+  Compress, /**< Chunk compression and decompression. */
+  Digest, /**< Segment digests of updatable containers. */
+  Write, /**< Positional and stream writes, and reserving the output file. */
+  Count
+ };
+
+ constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::Count);
+
+ /**
+  * @brief Gets the name of a stage as it appears in reports.
+  *
+  * @param stage The stage.
+  * @return The lower-case name.
+  */
+ const char *stageName(Stage stage);
+
+ /**
+  * @struct StageTime
+  * @brief The number of timed calls of a stage and the time spent in them.
+  */
+ struct StageTime {
+  uint64_t calls = 0; /**< Number of timed calls. */
+  uint64_t nanoseconds = 0; /**< Total time of the calls, summed over all threads. */
+ };
+
+ /**
+  * @struct OperationStats
+  * @brief Counters and stage times of one engine call.
+  *
+  * Byte counts cover the segments read and written, without the container header and trailer. Stage times
+  * are summed over all threads, so with N workers they can add up to N times the elapsed time.
+  */
+ struct OperationStats {
+  uint64_t bytesIn = 0; /**< Segment bytes consumed. */
+  uint64_t bytesOut = 0; /**< Segment bytes produced. */
+  uint64_t segments = 0; /**< Segments encrypted or decrypted. */
+  uint64_t chunks = 0; /**< Records sealed or opened. */
+  uint64_t rekeys = 0; /**< Stream rekeys. */
+  std::array<StageTime, STAGE_COUNT> stages{}; /**< Time per stage, indexed by Stage. */
+  uint64_t elapsedNanoseconds = 0; /**< Wall-clock time of the call; zero in progress reports. */
+
+  [[nodiscard]] StageTime &operator[](Stage stage) { return stages[static_cast<size_t>(stage)]; }
+
+  [[nodiscard]] const StageTime &operator[](Stage stage) const { return stages[static_cast<size_t>(stage)]; }
+
+  /**
+   * @brief Adds the counters and stage times of another set of stats.
+   *
+   * @param other The stats to add.
+   */
+  void merge(const OperationStats &other);
+
+  /**
+   * @brief Checks whether nothing was counted.
+   *
+   * @return True if every counter and stage time is zero.
+   */
+  [[nodiscard]] bool empty() const;
+
+  /**
+   * @brief Formats the stats as a single-line JSON object for logs.
+   *
+   * @return The JSON text.
+   */
+  [[nodiscard]] std::string toJson() const;
+ };
+
+ /**
+  * @brief Receives the running totals of an operation, serialized, after every finished segment.
+  */
+ using ProgressCallback = std::function<void(const OperationStats &)>;
+
+ /**
+  * @class StatsRecorder
+  * @brief Collects the stats of one operation from every thread working on it.
+  *
+  * Threads count into private OperationStats installed by a StatsScope and merge them in batches, so the
+  * hot path never takes a lock. A disabled recorder installs nothing, and every probe reduces to a check of
+  * a thread-local pointer.
+  */
+ class StatsRecorder {
+ public:
+  /**
+   * @brief Constructs a new StatsRecorder object and starts the wall clock.
+   *
+   * @param enabled Whether stats are collected.
+   * @param progress Called with the running totals after every merge, or empty.
+   */
+  StatsRecorder(bool enabled, ProgressCallback progress);
+
+  StatsRecorder(const StatsRecorder &) = delete;
+
+  StatsRecorder &operator=(const StatsRecorder &) = delete;
+
+  /**
+   * @brief Gets whether stats are collected.
+   *
+   * @return True if the recorder was enabled.
+   */
+  [[nodiscard]] bool isEnabled() const { return enabled; }
+
+  /**
+   * @brief Adds a thread's counters to the totals and reports progress.
+   *
+   * @param local The counters to add.
+   */
+  void merge(const OperationStats &local);
+
+  /**
+   * @brief Stops the wall clock and returns the totals.
+   *
+   * Counters still held by the calling thread's scope of this recorder are merged first, so an operation can
+   * return the stats while its scope is alive.
+   *
+   * @return The stats of the operation.
+   */
+  [[nodiscard]] OperationStats finish();
+
+  /**
+   * @brief Gets the recorder of the StatsScope active on the calling thread.
+   *
+   * @return The recorder, or nullptr outside any enabled scope.
+   */
+  [[nodiscard]] static StatsRecorder *current();
+
+ private:
+  bool enabled; /**< Whether stats are collected. */
+  ProgressCallback progress; /**< Progress callback, or empty. */
+  std::mutex mutex; /**< Guards totals and serializes progress calls. */
+  OperationStats totals; /**< Counters merged so far. */
+  std::chrono::steady_clock::time_point start; /**< When the operation started. */
+ };
+
+ /**
+  * @class StatsScope
+  * @brief Routes the probes of the calling thread to a recorder while it is alive.
+  *
+  * Scopes nest: the previous scope of the thread is restored on destruction, after the counters collected
+  * in this one were merged into its recorder.
+  */
+ class StatsScope {
+ public:
+  /**
+   * @brief Constructs a new StatsScope object.
+   *
+   * @param recorder The recorder to feed; nullptr or a disabled recorder turns the probes off.
+   */
+  explicit StatsScope(StatsRecorder *recorder);
+
+  /**
+   * @brief Destroys the StatsScope object, merging its counters and restoring the previous scope.
+   */
+  ~StatsScope();
+
+  StatsScope(const StatsScope &) = delete;
+
+  StatsScope &operator=(const StatsScope &) = delete;
+
+ private:
+  StatsRecorder *recorder; /**< The recorder fed, or nullptr. */
+  StatsRecorder *previousRecorder; /**< The recorder of the enclosing scope. */
+  OperationStats *previousStats; /**< The counters of the enclosing scope. */
+  OperationStats local; /**< The counters of this scope. */
+ };
+
+ namespace detail {
+  inline thread_local OperationStats *activeStats = nullptr; /**< Counters of the thread's scope, or nullptr. */
+  inline thread_local StatsRecorder *activeRecorder = nullptr; /**< Recorder of the thread's scope, or nullptr. */
+ }
+
+ /**
+  * @brief Merges the counters of the calling thread's scope into its recorder now.
+  *
+  * Long-running loops call it at segment boundaries so progress reports stay current.
+  */
+ void flushStats();
+
+ /**
+  * @brief Adds to a counter of the calling thread's scope, if any.
+  *
+  * @param counter The counter.
+  * @param amount The amount to add.
+  */
+ inline void countStat(uint64_t OperationStats::*counter, const uint64_t amount) {
+  if (detail::activeStats != nullptr) {
+   detail::activeStats->*counter += amount;
+  }
+ }
+
+ /**
+  * @class StageTimer
+  * @brief Adds the lifetime of a block to a stage of the calling thread's scope, if any.
+  */
+ class StageTimer {
+ public:
+  explicit StageTimer(const Stage stage) : stats(detail::activeStats), stage(stage) {
+   if (stats != nullptr) {
+    start = std::chrono::steady_clock::now();
+   }
+  }
+
+  ~StageTimer() {
+   if (stats != nullptr) {
+    StageTime &time = (*stats)[stage];
+    ++time.calls;
+    time.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+     std::chrono::steady_clock::now() - start).count();
+   }
+  }
+
+  StageTimer(const StageTimer &) = delete;
+
+  StageTimer &operator=(const StageTimer &) = delete;
+
+ private:
+  OperationStats *stats; /**< The counters timed into, or nullptr. */
+  Stage stage; /**< The stage timed. */
+  std::chrono::steady_clock::time_point start; /**< When the block was entered. */
+ };
+} // namespace utils::metrics
+
+// Probes for the hot path; building with INSTRUMENTATION_ENABLED=0 removes them entirely.
+#if INSTRUMENTATION_ENABLED
+#define TIME_STAGE(stage) const utils::metrics::StageTimer stageTimer(utils::metrics::Stage::stage)
+#define COUNT_STAT(counter, amount) utils::metrics::countStat(&utils::metrics::OperationStats::counter, (amount))
+#else
+#define TIME_STAGE(stage) ((void) 0)
+#define COUNT_STAT(counter, amount) ((void) 0)
+#endif
+
+#endif // STAGESTATS_H